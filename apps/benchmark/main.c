@@ -0,0 +1,335 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#define PRINTF              printf
+
+/*
+* Offline benchmark of the mango state machine.
+*
+* No network is involved: every scenario runs on top of the in-memory
+* loopback transport which replays canned server responses. The numbers
+* reflect the cost of mango itself (request building, state machine,
+* data processors) and are deterministic enough to be used as a
+* performance baseline.
+*
+* Build & run with "make benchmark"
+*/
+
+#define SERVER_HOSTNAME     "localhost"
+
+#define HTTP_ITERATIONS     (20000)
+#define HTTP_BODY_SZ        (4096)
+#define HTTP_CHUNK_SZ       (128)
+#define HTTP_FRAGMENT_SZ    (61)    /* Odd size, splits chunk headers */
+
+#define WS_ITERATIONS       (100)
+#define WS_FRAMES           (1000)
+#define WS_FRAME_SZ         (32)
+
+typedef struct{
+    char*                   name;
+    mangoLoopbackStep_t     steps[2];
+    uint16_t                stepsCnt;
+    uint16_t                fragmentSz;
+    uint32_t                iterations;
+    uint32_t                opsPerIteration;
+    mangoErr_t              (*run)(mangoHttpClient_t* httpClient);
+}benchmarkScenario_t;
+
+static uint8_t  bodyBuffer[HTTP_BODY_SZ];
+static uint32_t wsFramesReceived;
+
+
+static uint64_t timeNowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stepSet(mangoLoopbackStep_t* step, char* headers, uint8_t* body, uint32_t bodylen){
+    uint32_t headerslen = strlen(headers);
+
+    step->data = malloc(headerslen + bodylen);
+    memcpy(step->data, headers, headerslen);
+    if(bodylen){
+        memcpy(&step->data[headerslen], body, bodylen);
+    }
+    step->datalen = headerslen + bodylen;
+}
+
+
+mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
+    (void) userArgs;
+
+    if(mangoArgs->argType == MANGO_ARG_TYPE_WEBSOCKET_DATA_RECEIVED){
+        wsFramesReceived++;
+    }
+
+    return MANGO_OK;
+}
+
+
+/* -----------------------------------------------------------------------------------------------------------------
+| SCENARIOS
+----------------------------------------------------------------------------------------------------------------- */
+
+static mangoErr_t runGet(mangoHttpClient_t* httpClient){
+    mangoErr_t err;
+
+    err = mango_httpRequestNew(httpClient, "/resource",  MANGO_HTTP_METHOD_GET);
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    err = mango_httpHeaderSet(httpClient, MANGO_HDR__HOST, SERVER_HOSTNAME);
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    return mango_httpRequestProcess(httpClient, mangoApp_handler, NULL);
+}
+
+static mangoErr_t runPost(mangoHttpClient_t* httpClient, uint8_t expect){
+    char fileSz[11];
+    mangoErr_t err;
+    uint32_t sent;
+
+    err = mango_httpRequestNew(httpClient, "/upload",  MANGO_HTTP_METHOD_POST);
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    err = mango_httpHeaderSet(httpClient, MANGO_HDR__HOST, SERVER_HOSTNAME);
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    mangoHelper_dec2decstr(HTTP_BODY_SZ, fileSz);
+    err = mango_httpHeaderSet(httpClient, MANGO_HDR__CONTENT_LENGTH, fileSz);
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    if(expect){
+        err = mango_httpHeaderSet(httpClient, MANGO_HDR__EXPECT, "100-Continue");
+        if(err != MANGO_OK){ return MANGO_ERR; }
+    }
+
+    err = mango_httpRequestProcess(httpClient, mangoApp_handler, NULL);
+    if(err != MANGO_ERR_HTTP_100){ return err; }
+
+    for(sent = 0; sent < HTTP_BODY_SZ; sent += 1024){
+        err = mango_httpDataSend(httpClient, &bodyBuffer[sent], 1024);
+        if(err != MANGO_OK){ return MANGO_ERR; }
+    }
+
+    return mango_httpDataSend(httpClient, NULL, 0);
+}
+
+static mangoErr_t runPostRaw(mangoHttpClient_t* httpClient){
+    return runPost(httpClient, 0);
+}
+
+static mangoErr_t runPostExpect(mangoHttpClient_t* httpClient){
+    return runPost(httpClient, 1);
+}
+
+static mangoErr_t runWebsocket(mangoHttpClient_t* httpClient){
+    uint8_t msg[WS_FRAME_SZ];
+    mangoErr_t err;
+    uint32_t i;
+
+    err = mango_httpRequestNew(httpClient, "/",  MANGO_HTTP_METHOD_GET);
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    err = mango_httpHeaderSet(httpClient, MANGO_HDR__HOST, SERVER_HOSTNAME);
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    err = mango_httpHeaderSet(httpClient, MANGO_HDR__UPGRADE, "websocket");
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    err = mango_httpHeaderSet(httpClient, MANGO_HDR__CONNECTION, "Upgrade");
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    err = mango_httpHeaderSet(httpClient, MANGO_HDR__WEB_SOCKET_KEY, "dGhlIHNhbXBsZSBub25jZQ==");
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    err = mango_httpHeaderSet(httpClient, MANGO_HDR__WEB_SOCKET_VERSION, "13");
+    if(err != MANGO_OK){ return MANGO_ERR; }
+
+    err = mango_httpRequestProcess(httpClient, mangoApp_handler, NULL);
+    if(err != MANGO_ERR_HTTP_101){ return MANGO_ERR; }
+
+    memset(msg, 'x', sizeof(msg));
+    for(i = 0; i < WS_FRAMES; i++){
+        err = mango_wsFrameSend(httpClient, msg, sizeof(msg), MANGO_WS_FRAME_TYPE_TEXT);
+        if(err != MANGO_OK){ return MANGO_ERR; }
+    }
+
+    /* The canned echo frames were released by the first frame we sent */
+    wsFramesReceived = 0;
+    while(wsFramesReceived < WS_FRAMES){
+        err = mango_wsPoll(httpClient, 1);
+        if(err != MANGO_OK){ return MANGO_ERR; }
+    }
+
+    return MANGO_OK;
+}
+
+
+/* -----------------------------------------------------------------------------------------------------------------
+| HARNESS
+----------------------------------------------------------------------------------------------------------------- */
+
+static void scenariosCreate(benchmarkScenario_t* scenarios){
+    static char chunked[(HTTP_BODY_SZ / HTTP_CHUNK_SZ) * (HTTP_CHUNK_SZ + 8) + 128];
+    static uint8_t wsFrames[WS_FRAMES * (WS_FRAME_SZ + 2)];
+    char* ptr;
+    uint32_t i;
+
+    memset(bodyBuffer, 'x', sizeof(bodyBuffer));
+
+    /* GET, Content-Length */
+    scenarios[0].name = "GET";
+    stepSet(&scenarios[0].steps[0], "HTTP/1.1 200 OK\r\nContent-Length: 4096\r\n\r\n", bodyBuffer, HTTP_BODY_SZ);
+    scenarios[0].stepsCnt = 1;
+    scenarios[0].iterations = HTTP_ITERATIONS;
+    scenarios[0].run = runGet;
+
+    /* GET, chunked, fragmented */
+    ptr = chunked;
+    ptr += sprintf(ptr, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+    for(i = 0; i < HTTP_BODY_SZ / HTTP_CHUNK_SZ; i++){
+        ptr += sprintf(ptr, "%x\r\n", HTTP_CHUNK_SZ);
+        memset(ptr, 'x', HTTP_CHUNK_SZ);
+        ptr += HTTP_CHUNK_SZ;
+        ptr += sprintf(ptr, "\r\n");
+    }
+    ptr += sprintf(ptr, "0\r\n\r\n");
+    scenarios[1].name = "GET chunked";
+    stepSet(&scenarios[1].steps[0], "", (uint8_t*) chunked, ptr - chunked);
+    scenarios[1].stepsCnt = 1;
+    scenarios[1].fragmentSz = HTTP_FRAGMENT_SZ;
+    scenarios[1].iterations = HTTP_ITERATIONS;
+    scenarios[1].run = runGet;
+
+    /* POST, Content-Length */
+    scenarios[2].name = "POST";
+    stepSet(&scenarios[2].steps[0], "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n", NULL, 0);
+    scenarios[2].stepsCnt = 1;
+    scenarios[2].iterations = HTTP_ITERATIONS;
+    scenarios[2].run = runPostRaw;
+
+    /* POST, Expect: 100-continue */
+    scenarios[3].name = "POST expect-100";
+    stepSet(&scenarios[3].steps[0], "HTTP/1.1 100 Continue\r\n\r\n", NULL, 0);
+    stepSet(&scenarios[3].steps[1], "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n", NULL, 0);
+    scenarios[3].stepsCnt = 2;
+    scenarios[3].iterations = HTTP_ITERATIONS;
+    scenarios[3].run = runPostExpect;
+
+    /* Websocket upgrade and echo */
+    for(i = 0; i < WS_FRAMES; i++){
+        wsFrames[i * (WS_FRAME_SZ + 2) + 0] = 0x80 | MANGO_WS_FRAME_TYPE_TEXT;
+        wsFrames[i * (WS_FRAME_SZ + 2) + 1] = WS_FRAME_SZ;
+        memset(&wsFrames[i * (WS_FRAME_SZ + 2) + 2], 'x', WS_FRAME_SZ);
+    }
+    scenarios[4].name = "Websocket frame";
+    stepSet(&scenarios[4].steps[0], "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                    "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n\r\n", NULL, 0);
+    stepSet(&scenarios[4].steps[1], "", wsFrames, sizeof(wsFrames));
+    scenarios[4].stepsCnt = 2;
+    scenarios[4].iterations = WS_ITERATIONS;
+    scenarios[4].opsPerIteration = WS_FRAMES;
+    scenarios[4].run = runWebsocket;
+}
+
+static int scenarioRun(benchmarkScenario_t* scenario){
+    mangoHttpClient_t* httpClient;
+    mangoLoopback_t loopback;
+    uint8_t upgrade;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t ops;
+    uint32_t i;
+    mangoErr_t err;
+
+    upgrade = (scenario->run == runWebsocket);
+
+    mango_loopbackInit(&loopback, scenario->steps, scenario->stepsCnt, scenario->fragmentSz, 0, 0);
+    httpClient = mango_loopbackConnect(&loopback);
+    if(!httpClient){ return -1; }
+
+    start = timeNowNs();
+    for(i = 0; i < scenario->iterations; i++){
+        if(upgrade && i){
+            /* A websocket connection can't be reused for a new handshake */
+            mango_disconnect(httpClient);
+            mango_loopbackInit(&loopback, scenario->steps, scenario->stepsCnt, scenario->fragmentSz, 0, 0);
+            httpClient = mango_loopbackConnect(&loopback);
+            if(!httpClient){ return -1; }
+        }
+
+        err = scenario->run(httpClient);
+        if(err != MANGO_OK && err != MANGO_ERR_HTTP_200){
+            PRINTF("%s: iteration %u FAILED [%d]\r\n", scenario->name, i, err);
+            mango_disconnect(httpClient);
+            return -1;
+        }
+    }
+    elapsed = timeNowNs() - start;
+
+    mango_disconnect(httpClient);
+
+    ops = (uint64_t) scenario->iterations * (scenario->opsPerIteration ? scenario->opsPerIteration : 1);
+
+    /* The loopback counters are reset per websocket connection, extrapolate */
+    if(upgrade){
+        loopback.rxBytes *= scenario->iterations;
+        loopback.txBytes *= scenario->iterations;
+    }
+
+    PRINTF("%-18s %10llu ops %10llu ns/op %10.2f MB/s\r\n",
+        scenario->name,
+        (unsigned long long) ops,
+        (unsigned long long) (elapsed / ops),
+        ((double) loopback.rxBytes + loopback.txBytes) / ((double) elapsed / 1e9) / (1024.0 * 1024.0));
+
+    return 0;
+}
+
+
+int main(){
+    static benchmarkScenario_t scenarios[5];
+    uint32_t i;
+    int failed;
+
+    memset(scenarios, 0, sizeof(scenarios));
+    scenariosCreate(scenarios);
+
+    PRINTF("%-18s %14s %16s %15s\r\n", "Scenario", "Operations", "Latency", "Throughput");
+
+    failed = 0;
+    for(i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++){
+        if(scenarioRun(&scenarios[i]) < 0){
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
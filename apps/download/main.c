@@ -0,0 +1,93 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#define PRINTF              printf
+
+/*
+* Segmented download, meant to be used against the "testserver" application.
+*
+* <URI> is downloaded to <file> over <connections> parallel connections
+* with mango_download(). The download is resumable: if it is interrupted,
+* running the same command again continues from the checkpoint kept in
+* "<file>.mango". The file size, the elapsed time and the MB/s are reported.
+*
+* Usage: ./a.out [URI] [file] [connections] [port]
+*        ./a.out /file/104857600 /tmp/download.bin 4 8080
+*/
+
+#define SERVER_IP           "127.0.0.1"
+#define SERVER_PORT         8080
+
+static uint64_t timeNowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+int main(int argc, char** argv){
+    mangoDownload_t dl;
+    mangoErr_t err;
+    uint64_t start;
+    double elapsed;
+
+    memset(&dl, 0, sizeof(dl));
+    dl.serverIP     = SERVER_IP;
+    dl.serverPort   = SERVER_PORT;
+    dl.URI          = "/file/16777216";
+    dl.path         = "download.bin";
+    dl.resume       = 1;
+
+    if(argc > 1){ dl.URI            = argv[1]; }
+    if(argc > 2){ dl.path           = argv[2]; }
+    if(argc > 3){ dl.connections    = atoi(argv[3]); }
+    if(argc > 4){ dl.serverPort     = atoi(argv[4]); }
+
+    PRINTF("GET http://%s:%u%s -> %s\r\n", dl.serverIP, dl.serverPort, dl.URI, dl.path);
+
+    start = timeNowNs();
+
+    err = mango_download(&dl);
+
+    elapsed = (double) (timeNowNs() - start) / 1e9;
+
+    if(err != MANGO_OK){
+        PRINTF("Download failed [%d], %llu bytes received, run again to resume\r\n", err, (unsigned long long) dl.bytes);
+        return MANGO_ERR;
+    }
+
+    PRINTF("%llu bytes (%llu resumed), %u connections, %u segments retried, %.3f s, %.2f MB/s\r\n",
+        (unsigned long long) dl.bytes,
+        (unsigned long long) dl.bytesResumed,
+        dl.connections,
+        dl.segmentsRetried,
+        elapsed,
+        dl.bytes / elapsed / (1024.0 * 1024.0));
+
+    return 0;
+}
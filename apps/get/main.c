@@ -131,7 +131,7 @@ mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
 			PRINTF("-----------------------------------------------------------------\r\n");
 			PRINTF("WEBSOCKET DATA RECEIVED: [%u bytes, Frame ID %u]\r\n", mangoArgs->buflen, mangoArgs->frameID);
 			PRINTF("-----------------------------------------------------------------\r\n");
-			PRINTF("%s\r\n", mangoArgs->buf);
+			PRINTF("%.*s\r\n", (int) mangoArgs->buflen, mangoArgs->buf);
 			PRINTF("-----------------------------------------------------------------\r\n");
 			
 			break;
@@ -159,6 +159,31 @@ mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
 			PRINTF("-----------------------------------------------------------------\r\n");
             break;
         }
+        case MANGO_ARG_TYPE_HTTP_STATS:
+        {
+            /*
+            * Request completed (or failed), print where the time was spent
+            */
+            mangoStats_t* stats = mangoArgs->stats;
+            
+            PRINTF("\r\n");
+			PRINTF("-----------------------------------------------------------------\r\n");
+			PRINTF("HTTP STATS: [Tx %llu bytes, Rx %llu bytes, %u ms]\r\n", (unsigned long long) stats->txBytes, (unsigned long long) stats->rxBytes, stats->time);
+			PRINTF("-----------------------------------------------------------------\r\n");
+            PRINTF("Connect:  %u us\r\n", stats->connectEnd - stats->connectStart);
+            if(stats->firstByte){
+                PRINTF("Server:   %u us\r\n", stats->firstByte - stats->headersSent);
+            }
+            if(stats->bodyComplete){
+                PRINTF("Transfer: %u us\r\n", stats->bodyComplete - stats->firstByte);
+            }
+			PRINTF("-----------------------------------------------------------------\r\n");
+            break;
+        }
+        default:
+        {
+            break;
+        }
 	};
 	
     return MANGO_OK;
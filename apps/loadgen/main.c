@@ -0,0 +1,419 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#define PRINTF              printf
+
+/*
+* Load generator, meant to be used against the "testserver" application.
+*
+* <clients> threads are started, every thread owns a mango client and
+* executes GET requests for <path> over a persistent connection (it
+* reconnects when the server closes it) until <duration> seconds have
+* passed. Requests/s, p50/p99 latency and the received MB/s are reported.
+*
+* With [cache] the clients share a response cache, "mem" for a memory cache
+* or a directory for a disk cache, and the cache counters are reported too.
+* Use the "/file/<size>/<maxAge>" resource so responses are served fresh,
+* revalidated and replaced concurrently.
+*
+* Redirects are followed (up to REDIRECT_MAX_HOPS), so "/redirect/..." paths
+* can be loaded too. With the path "redirects" the redirect scenarios are run
+* once instead: relative and absolute Locations, a 301 that closes the
+* connection, and a redirect to another origin [the Authorization header
+* must not be forwarded].
+*
+* Usage: ./a.out [clients] [duration] [path] [port] [cache]
+*        ./a.out 8 10 /fixed/4096 8080
+*        ./a.out 8 10 /file/4096/1 8080 /tmp/mangocache
+*        ./a.out 1 1 redirects 8080
+*/
+
+#define SERVER_IP           "127.0.0.1"
+#define SERVER_PORT         8080
+
+/*
+* Latency samples kept per client, older ones are overwritten
+*/
+#define SAMPLES_MAX         (64 * 1024)
+
+/*
+* Failed connects are retried after a delay that doubles from
+* CONNECT_BACKOFF_MIN_MS up to CONNECT_BACKOFF_MAX_MS
+*/
+#define CONNECT_BACKOFF_MIN_MS  (10)
+#define CONNECT_BACKOFF_MAX_MS  (1000)
+
+/*
+* Size of the shared response cache
+*/
+#define CACHE_MAX_BYTES         (4 * 1024 * 1024)
+
+/*
+* Redirects followed per request
+*/
+#define REDIRECT_MAX_HOPS       (5)
+
+/*
+* Sent with the redirect scenarios, "Aladdin:open sesame"
+*/
+#define REDIRECT_CREDENTIALS    "Basic QWxhZGRpbjpvcGVuIHNlc2FtZQ=="
+
+typedef struct{
+    pthread_t   thread;
+    uint64_t*   samples;
+    uint32_t    samplesCnt;
+    uint32_t    requests;
+    uint32_t    errors;
+    uint64_t    bytes;
+}loadgenClient_t;
+
+static uint32_t clientsCnt  = 4;
+static uint32_t duration    = 5;
+static char*    path        = "/fixed/1024";
+static uint16_t port        = SERVER_PORT;
+static mangoCache_t* cache  = NULL;
+
+static uint64_t timeNowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compareU64(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+
+mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
+    loadgenClient_t* client = (loadgenClient_t*) userArgs;
+
+    if(mangoArgs->argType == MANGO_ARG_TYPE_HTTP_DATA_RECEIVED){
+        client->bytes += mangoArgs->buflen;
+    }
+
+    return MANGO_OK;
+}
+
+/*
+* What the redirect scenarios observe, the last request sent and the body of
+* the final response
+*/
+typedef struct{
+    uint32_t    requests;
+    uint8_t     authSent;
+    uint64_t    bytes;
+}redirectResult_t;
+
+static mangoErr_t redirectHandler(mangoArg_t* mangoArgs, void* userArgs){
+    redirectResult_t* result = (redirectResult_t*) userArgs;
+    char value[64];
+
+    if(mangoArgs->argType == MANGO_ARG_TYPE_HTTP_REQUEST_READY){
+        result->requests++;
+        result->authSent = mango_httpHeaderGet((char*) mangoArgs->buf, MANGO_HDR__AUTHORIZATION, value, sizeof(value)) == MANGO_OK;
+    }else if(mangoArgs->argType == MANGO_ARG_TYPE_HTTP_DATA_RECEIVED){
+        result->bytes += mangoArgs->buflen;
+    }
+
+    return MANGO_OK;
+}
+
+/*
+* Sends a GET for "resource" with the "host" Host header and credentials, and
+* checks that "hops" redirects were followed to "location", that the final
+* response has "bodylen" bytes and whether the credentials reached it.
+*/
+static int redirectScenario(char* name, char* resource, char* host, uint8_t hops, char* location, uint64_t bodylen, uint8_t authForwarded){
+    mangoHttpClient_t* httpClient;
+    redirectResult_t result;
+    const char* followed;
+    mangoErr_t err;
+    int ok;
+
+    httpClient = mango_connect(SERVER_IP, port);
+    if(!httpClient){
+        PRINTF("%-14s FAILED [connect]\r\n", name);
+        return 0;
+    }
+
+    memset(&result, 0, sizeof(result));
+
+    err = mango_httpRedirectSet(httpClient, REDIRECT_MAX_HOPS);
+    if(err == MANGO_OK){
+        err = mango_httpRequestNew(httpClient, resource, MANGO_HTTP_METHOD_GET);
+    }
+    if(err == MANGO_OK){
+        err = mango_httpHeaderSet(httpClient, MANGO_HDR__HOST, host);
+    }
+    if(err == MANGO_OK){
+        err = mango_httpHeaderSet(httpClient, MANGO_HDR__AUTHORIZATION, REDIRECT_CREDENTIALS);
+    }
+    if(err == MANGO_OK){
+        err = mango_httpRequestProcess(httpClient, redirectHandler, &result);
+    }
+
+    followed = mango_httpRedirectLocation(httpClient);
+
+    ok = err == MANGO_ERR_HTTP_200 &&
+         mango_httpRedirectCount(httpClient) == hops &&
+         result.requests == hops + 1u &&
+         followed && strcmp(followed, location) == 0 &&
+         result.bytes == bodylen &&
+         result.authSent == authForwarded;
+
+    PRINTF("%-14s %s [status %d, %u redirects to %s, %llu bytes, credentials %s]\r\n",
+        name,
+        ok ? "OK" : "FAILED",
+        err,
+        mango_httpRedirectCount(httpClient),
+        followed ? followed : "-",
+        (unsigned long long) result.bytes,
+        result.authSent ? "forwarded" : "dropped");
+
+    mango_disconnect(httpClient);
+
+    return ok;
+}
+
+static int redirectScenarios(void){
+    char resource[128];
+    char location[128];
+    char host[32];
+    int ok;
+
+    ok = 1;
+
+    /* Relative Locations over the same connection, then an absolute path */
+    snprintf(host, sizeof(host), "%s:%u", SERVER_IP, port);
+    ok &= redirectScenario("relative", "/redirect/302/fixed/16?n=3", host, 4, "/fixed/16", 16, 1);
+
+    /* An absolute Location of the same origin keeps the credentials */
+    snprintf(host, sizeof(host), "localhost:%u", port);
+    snprintf(resource, sizeof(resource), "/redirect/307/abs/%u/fixed/32", port);
+    snprintf(location, sizeof(location), "http://localhost:%u/fixed/32", port);
+    ok &= redirectScenario("absolute", resource, host, 1, location, 32, 1);
+
+    /* The server closes the connection after every redirect */
+    snprintf(host, sizeof(host), "%s:%u", SERVER_IP, port);
+    ok &= redirectScenario("301-close", "/redirect/301c/fixed/8?n=1", host, 2, "/fixed/8", 8, 1);
+
+    /* "localhost" is another origin than "127.0.0.1", the credentials are dropped */
+    ok &= redirectScenario("cross-origin", resource, host, 1, location, 32, 0);
+
+    return ok;
+}
+
+static void* clientThread(void* args){
+    loadgenClient_t* client = (loadgenClient_t*) args;
+    mangoHttpClient_t* httpClient;
+    mangoErr_t err;
+    uint64_t deadline;
+    uint64_t start;
+    uint64_t now;
+    uint32_t backoff;
+    struct timespec ts;
+
+    deadline = timeNowNs() + (uint64_t) duration * 1000000000ULL;
+    httpClient = NULL;
+    backoff = CONNECT_BACKOFF_MIN_MS;
+
+    while(timeNowNs() < deadline){
+        if(!httpClient){
+            httpClient = mango_connect(SERVER_IP, port);
+            if(!httpClient){
+                /* The server is down or overloaded, do not spin */
+                client->errors++;
+                
+                now = timeNowNs();
+                if(now + (uint64_t) backoff * 1000000ULL > deadline){
+                    break;
+                }
+                
+                ts.tv_sec  = backoff / 1000;
+                ts.tv_nsec = (backoff % 1000) * 1000000L;
+                nanosleep(&ts, NULL);
+                
+                backoff = backoff * 2 > CONNECT_BACKOFF_MAX_MS ? CONNECT_BACKOFF_MAX_MS : backoff * 2;
+                continue;
+            }
+            
+            backoff = CONNECT_BACKOFF_MIN_MS;
+            mango_httpRedirectSet(httpClient, REDIRECT_MAX_HOPS);
+        }
+
+        start = timeNowNs();
+
+        err = mango_httpRequestNew(httpClient, path, MANGO_HTTP_METHOD_GET);
+        if(err == MANGO_OK){
+            err = mango_httpHeaderSet(httpClient, MANGO_HDR__HOST, SERVER_IP);
+        }
+        if(err == MANGO_OK){
+            if(cache){
+                err = mango_httpRequestProcessCached(httpClient, cache, mangoApp_handler, client);
+            }else{
+                err = mango_httpRequestProcess(httpClient, mangoApp_handler, client);
+            }
+        }
+
+        if(err != MANGO_ERR_HTTP_200){
+            /* The connection state is unknown, start over */
+            client->errors++;
+            mango_disconnect(httpClient);
+            httpClient = NULL;
+            continue;
+        }
+
+        client->samples[client->samplesCnt % SAMPLES_MAX] = timeNowNs() - start;
+        client->samplesCnt++;
+        client->requests++;
+
+        if(!mango_httpConnectionReusable(httpClient)){
+            /* The server closes the connection after this response */
+            mango_disconnect(httpClient);
+            httpClient = NULL;
+        }
+    }
+
+    if(httpClient){
+        mango_disconnect(httpClient);
+    }
+
+    return NULL;
+}
+
+
+int main(int argc, char** argv){
+    loadgenClient_t* clients;
+    uint64_t* samples;
+    uint64_t samplesCnt;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t start;
+    mangoCacheStats_t cacheStats;
+    double elapsed;
+    uint32_t cnt;
+    uint32_t i;
+
+    if(argc > 1){ clientsCnt = atoi(argv[1]); }
+    if(argc > 2){ duration   = atoi(argv[2]); }
+    if(argc > 3){ path       = argv[3]; }
+    if(argc > 4){ port       = atoi(argv[4]); }
+
+    if(!clientsCnt || !duration){
+        PRINTF("Usage: %s [clients] [duration] [path] [port] [cache]\r\n", argv[0]);
+        return MANGO_ERR;
+    }
+
+    if(strcmp(path, "redirects") == 0){
+        return redirectScenarios() ? 0 : MANGO_ERR;
+    }
+
+    if(argc > 5){
+        cache = mango_cacheCreate(CACHE_MAX_BYTES, strcmp(argv[5], "mem") == 0 ? NULL : argv[5]);
+        if(!cache){
+            PRINTF("Could not create the cache!\r\n");
+            return MANGO_ERR;
+        }
+    }
+
+    clients = calloc(clientsCnt, sizeof(loadgenClient_t));
+    samples = malloc((uint64_t) clientsCnt * SAMPLES_MAX * sizeof(uint64_t));
+    if(!clients || !samples){
+        PRINTF("Out of memory!\r\n");
+        return MANGO_ERR;
+    }
+
+    PRINTF("%u clients, %u seconds, GET http://%s:%u%s\r\n", clientsCnt, duration, SERVER_IP, port, path);
+
+    start = timeNowNs();
+
+    for(i = 0; i < clientsCnt; i++){
+        clients[i].samples = &samples[(uint64_t) i * SAMPLES_MAX];
+        if(pthread_create(&clients[i].thread, NULL, clientThread, &clients[i]) != 0){
+            PRINTF("Could not start client %u!\r\n", i);
+            return MANGO_ERR;
+        }
+    }
+
+    for(i = 0; i < clientsCnt; i++){
+        pthread_join(clients[i].thread, NULL);
+    }
+
+    elapsed = (double) (timeNowNs() - start) / 1e9;
+
+    /* Merge the latency samples of all clients */
+    samplesCnt = 0;
+    requests = 0;
+    errors = 0;
+    bytes = 0;
+    for(i = 0; i < clientsCnt; i++){
+        cnt = clients[i].samplesCnt > SAMPLES_MAX ? SAMPLES_MAX : clients[i].samplesCnt;
+        memmove(&samples[samplesCnt], clients[i].samples, cnt * sizeof(uint64_t));
+        samplesCnt += cnt;
+        requests += clients[i].requests;
+        errors += clients[i].errors;
+        bytes += clients[i].bytes;
+    }
+
+    if(!samplesCnt){
+        PRINTF("No request completed, errors: %llu\r\n", (unsigned long long) errors);
+        return MANGO_ERR;
+    }
+
+    qsort(samples, samplesCnt, sizeof(uint64_t), compareU64);
+
+    PRINTF("requests: %llu, errors: %llu, %.0f req/s, p50: %.1f us, p99: %.1f us, %.2f MB/s\r\n",
+        (unsigned long long) requests,
+        (unsigned long long) errors,
+        requests / elapsed,
+        samples[samplesCnt / 2] / 1000.0,
+        samples[(samplesCnt * 99) / 100] / 1000.0,
+        bytes / elapsed / (1024.0 * 1024.0));
+
+    if(cache){
+        mango_cacheStatsGet(cache, &cacheStats);
+        PRINTF("cache hits: %u, revalidated: %u, misses: %u, stored: %u, evicted: %u, entries: %u, bytes: %u\r\n",
+            cacheStats.hits,
+            cacheStats.revalidated,
+            cacheStats.misses,
+            cacheStats.stored,
+            cacheStats.evicted,
+            cacheStats.entries,
+            cacheStats.bytes);
+        mango_cacheDestroy(cache);
+    }
+
+    free(samples);
+    free(clients);
+
+    return 0;
+}
@@ -128,7 +128,7 @@ mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
 			PRINTF("-----------------------------------------------------------------\r\n");
 			PRINTF("WEBSOCKET DATA RECEIVED: [%u bytes, Frame ID %u]\r\n", mangoArgs->buflen, mangoArgs->frameID);
 			PRINTF("-----------------------------------------------------------------\r\n");
-			PRINTF("%s\r\n", mangoArgs->buf);
+			PRINTF("%.*s\r\n", (int) mangoArgs->buflen, mangoArgs->buf);
 			PRINTF("-----------------------------------------------------------------\r\n");
 			
 			break;
@@ -156,6 +156,10 @@ mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
 			PRINTF("-----------------------------------------------------------------\r\n");
             break;
         }
+        default:
+        {
+            break;
+        }
 	};
 	
     return MANGO_OK;
@@ -0,0 +1,645 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define PRINTF              printf
+
+/*
+* Local HTTP/Websocket server, the counterpart of the "loadgen" application.
+*
+* Every connection is served by its own thread, persistent connections are
+* supported. Request bodies (Content-Length or chunked) are read and dropped,
+* "Expect: 100-continue" is honoured. The following resources are available:
+*
+*   /fixed/<size>                   <size> bytes with Content-Length
+*   /chunked/<size>[/<chunkSz>]     <size> bytes with chunked transfer-coding
+*   /drip/<size>/<delay>            <size> bytes with Content-Length, 16 bytes every <delay> ms
+*   /file/<size>[/<maxAge>]         <size> bytes whose value depends on their offset, HEAD and
+*                                   single byte ranges ("a-b", "a-", "-n") are supported, the
+*                                   ETag is "<size>" and If-Range/If-None-Match are honoured.
+*                                   <maxAge> adds "Cache-Control: max-age=<maxAge>"
+*   /redirect/<code>[c]/<path>[?n=<n>]
+*                                   <n> <code> redirects to itself (relative Locations), then
+*                                   one to "/<path>". With "c" the connection is closed after
+*                                   every redirect. A <path> "abs/<port>/<rest>" is redirected to
+*                                   "http://localhost:<port>/<rest>"
+*   /echo[/nocontinue]              "<method> <body length>", for any method. With "nocontinue"
+*                                   "Expect: 100-continue" is ignored, as old servers do
+*   /reject/<code>                  <code> final status sent before the request body. A chunked
+*                                   body is dropped afterwards, otherwise the connection is closed
+*   /icy                            Shoutcast (ICY 200) stream, until the client disconnects
+*   /ws                             Websocket echo (text/binary frames are echoed, pings answered,
+*                                   the first offered subprotocol is selected)
+*
+* Usage: ./a.out [port]   (build with "make MANGO_APP=testserver")
+*/
+
+#define SERVER_IP           "127.0.0.1"
+#define SERVER_PORT         8080
+
+#define REQUEST_SZ          (4096)
+#define BLOCK_SZ            (16 * 1024)
+
+#define WS_GUID             "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static uint8_t fillBuffer[BLOCK_SZ];
+
+
+static int socketWrite(int fd, const void* data, uint32_t datalen){
+    const uint8_t* ptr = (const uint8_t*) data;
+    int retval;
+
+    while(datalen){
+        retval = send(fd, ptr, datalen, MSG_NOSIGNAL);
+        if(retval <= 0){ return -1; }
+        ptr += retval;
+        datalen -= retval;
+    }
+
+    return 0;
+}
+
+static int socketReadExact(int fd, uint8_t* data, uint32_t datalen){
+    int retval;
+
+    while(datalen){
+        retval = recv(fd, data, datalen, 0);
+        if(retval <= 0){ return -1; }
+        data += retval;
+        datalen -= retval;
+    }
+
+    return 0;
+}
+
+static int headerValueGet(char* request, char* headerName, char* headerValue, uint16_t headerValueLen){
+    return mangoHelper_httpHeaderGet(request, headerName, headerValue, headerValueLen) > 0 ? 0 : -1;
+}
+
+static int bodyWrite(int fd, uint32_t size){
+    uint32_t sz;
+
+    while(size){
+        sz = size > BLOCK_SZ ? BLOCK_SZ : size;
+        if(socketWrite(fd, fillBuffer, sz) < 0){ return -1; }
+        size -= sz;
+    }
+
+    return 0;
+}
+
+
+/* -----------------------------------------------------------------------------------------------------------------
+| RESOURCES
+----------------------------------------------------------------------------------------------------------------- */
+
+static int serveFixed(int fd, uint32_t size, uint32_t delay){
+    char headers[128];
+    uint32_t sz;
+
+    sprintf(headers, "HTTP/1.1 200 OK\r\nContent-Length: %u\r\n\r\n", size);
+    if(socketWrite(fd, headers, strlen(headers)) < 0){ return -1; }
+
+    if(!delay){
+        return bodyWrite(fd, size);
+    }
+
+    while(size){
+        usleep(delay * 1000);
+        sz = size > 16 ? 16 : size;
+        if(socketWrite(fd, fillBuffer, sz) < 0){ return -1; }
+        size -= sz;
+    }
+
+    return 0;
+}
+
+static int serveChunked(int fd, uint32_t size, uint32_t chunkSz){
+    char* headers = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+    char chunkHeader[16];
+    uint32_t sz;
+
+    if(!chunkSz){ chunkSz = 1024; }
+    if(chunkSz > BLOCK_SZ){ chunkSz = BLOCK_SZ; }
+
+    if(socketWrite(fd, headers, strlen(headers)) < 0){ return -1; }
+
+    while(size){
+        sz = size > chunkSz ? chunkSz : size;
+        sprintf(chunkHeader, "%x\r\n", sz);
+        if(socketWrite(fd, chunkHeader, strlen(chunkHeader)) < 0){ return -1; }
+        if(socketWrite(fd, fillBuffer, sz) < 0){ return -1; }
+        if(socketWrite(fd, "\r\n", 2) < 0){ return -1; }
+        size -= sz;
+    }
+
+    return socketWrite(fd, "0\r\n\r\n", 5);
+}
+
+static int serveFile(int fd, char* request, uint32_t size, uint32_t maxAge){
+    uint8_t block[BLOCK_SZ];
+    char headers[256];
+    char cacheControl[48];
+    char range[64];
+    char etag[16];
+    uint32_t first;
+    uint32_t last;
+    uint32_t sz;
+    uint32_t i;
+
+    first = 0;
+    last = size - 1;
+
+    sprintf(etag, "\"%u\"", size);
+
+    cacheControl[0] = '\0';
+    if(maxAge){
+        sprintf(cacheControl, "Cache-Control: max-age=%u\r\n", maxAge);
+    }
+
+    if(headerValueGet(request, MANGO_HDR__IF_NONE_MATCH, range, sizeof(range)) == 0 && strcmp(range, etag) == 0){
+        sprintf(headers, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%s\r\n", etag, cacheControl);
+        return socketWrite(fd, headers, strlen(headers));
+    }
+
+    /* A range is only served while the validator matches */
+    if(headerValueGet(request, MANGO_HDR__RANGE, range, sizeof(range)) == 0 && size &&
+       (headerValueGet(request, MANGO_HDR__IF_RANGE, headers, sizeof(headers)) < 0 || strcmp(headers, etag) == 0)){
+        if(sscanf(range, "bytes=%u-%u", &first, &last) == 2){
+            if(last >= size){ last = size - 1; }
+        }else if(sscanf(range, "bytes=%u-", &first) == 1){
+            last = size - 1;
+        }else if(sscanf(range, "bytes=-%u", &sz) == 1 && sz){
+            first = sz > size ? 0 : size - sz;
+            last = size - 1;
+        }else{
+            first = size;
+        }
+
+        if(first > last || first >= size){
+            sprintf(headers, "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%u\r\nContent-Length: 0\r\n\r\n", size);
+            return socketWrite(fd, headers, strlen(headers));
+        }
+
+        sprintf(headers, "HTTP/1.1 206 Partial Content\r\nAccept-Ranges: bytes\r\nETag: %s\r\nContent-Range: bytes %u-%u/%u\r\nContent-Length: %u\r\n\r\n",
+            etag, first, last, size, last - first + 1);
+        size = last - first + 1;
+    }else{
+        sprintf(headers, "HTTP/1.1 200 OK\r\nAccept-Ranges: bytes\r\nETag: %s\r\n%sContent-Length: %u\r\n\r\n", etag, cacheControl, size);
+    }
+
+    if(socketWrite(fd, headers, strlen(headers)) < 0){ return -1; }
+
+    if(strncmp(request, "HEAD ", 5) == 0){
+        return 0;
+    }
+
+    while(size){
+        sz = size > BLOCK_SZ ? BLOCK_SZ : size;
+        for(i = 0; i < sz; i++){
+            block[i] = (uint8_t)((first + i) ^ ((first + i) >> 8) ^ ((first + i) >> 16));
+        }
+        if(socketWrite(fd, block, sz) < 0){ return -1; }
+        first += sz;
+        size -= sz;
+    }
+
+    return 0;
+}
+
+static int serveRedirect(int fd, char* path){
+    char location[320];
+    char headers[512];
+    char target[256];
+    uint32_t code;
+    uint32_t hops;
+    uint32_t port;
+    char* query;
+    char* name;
+    int offset;
+
+    offset = 0;
+    if(sscanf(path, "%u%n", &code, &offset) != 1){ return -1; }
+    path += offset;
+    if(*path == 'c'){ path++; }
+    if(*path != '/'){ return -1; }
+
+    snprintf(target, sizeof(target), "%.*s", (int) strcspn(path + 1, " "), path + 1);
+
+    hops = 0;
+    query = strchr(target, '?');
+    if(query){
+        sscanf(query, "?n=%u", &hops);
+        *query = '\0';
+    }
+
+    if(hops){
+        /* Relative to the current directory: "<last segment>?n=<hops - 1>" */
+        name = strrchr(target, '/');
+        snprintf(location, sizeof(location), "%s?n=%u", name ? name + 1 : target, hops - 1);
+    }else if(sscanf(target, "abs/%u/%n", &port, &offset) == 1){
+        snprintf(location, sizeof(location), "http://localhost:%u/%s", port, target + offset);
+    }else{
+        snprintf(location, sizeof(location), "/%s", target);
+    }
+
+    snprintf(headers, sizeof(headers), "HTTP/1.1 %u Redirect\r\nLocation: %s\r\n%sContent-Length: 5\r\n\r\nmoved",
+        code, location, path[-1] == 'c' ? "Connection: close\r\n" : "");
+
+    if(socketWrite(fd, headers, strlen(headers)) < 0){ return -1; }
+
+    /* Closed after the response */
+    return path[-1] == 'c' ? 1 : 0;
+}
+
+static int serveEcho(int fd, char* request, uint32_t bodylen){
+    char response[128];
+    char body[64];
+    int len;
+
+    len = snprintf(body, sizeof(body), "%.*s %u", (int) strcspn(request, " "), request, bodylen);
+    if(len >= (int) sizeof(body)){ len = sizeof(body) - 1; }
+
+    len = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s", len, body);
+
+    return socketWrite(fd, response, len) < 0 ? -1 : 0;
+}
+
+/*
+* A final status instead of "100 Continue". The client skips the body: a chunked
+* one is terminated and can be dropped, a Content-Length one may be partially
+* sent or not at all, so the connection is closed.
+*/
+static int serveReject(int fd, char* request, uint32_t code){
+    char response[96];
+    char headerValue[32];
+    uint8_t chunked;
+    int len;
+
+    chunked = headerValueGet(request, MANGO_HDR__TRANSFER_ENCODING, headerValue, sizeof(headerValue)) == 0;
+
+    len = snprintf(response, sizeof(response), "HTTP/1.1 %u Rejected\r\nContent-Length: 0\r\n%s\r\n", code, chunked ? "" : "Connection: close\r\n");
+
+    if(socketWrite(fd, response, len) < 0){ return -1; }
+
+    return chunked ? 0 : -1;
+}
+
+static int serveIcy(int fd){
+    char* headers = "ICY 200 OK\r\nicy-name: mango test stream\r\nicy-metaint: 0\r\n\r\n";
+
+    if(socketWrite(fd, headers, strlen(headers)) < 0){ return -1; }
+
+    /* Stream until the client goes away */
+    while(socketWrite(fd, fillBuffer, 4096) == 0){
+        usleep(50 * 1000);
+    }
+
+    return -1;
+}
+
+static int serveWebsocket(int fd, char* request){
+    char key[64];
+    char accept[64];
+    char protocol[64];
+    char response[320];
+    uint8_t digest[20];
+    uint8_t header[14];
+    uint8_t mask[4];
+    uint8_t* payload;
+    uint64_t payloadlen;
+    uint32_t headerlen;
+    uint64_t i;
+    uint8_t opcode;
+
+    if(headerValueGet(request, MANGO_HDR__WEB_SOCKET_KEY, key, sizeof(key) - sizeof(WS_GUID)) < 0){
+        return -1;
+    }
+
+    strcat(key, WS_GUID);
+    mangoCrypto_sha1(key, strlen(key), digest);
+    mangoCrypto_base64Encode(digest, sizeof(digest), accept, sizeof(accept));
+
+    /* The first offered subprotocol (if any) is selected */
+    protocol[0] = '\0';
+    if(headerValueGet(request, MANGO_HDR__WEB_SOCKET_PROTOCOL, protocol, sizeof(protocol)) == 0){
+        protocol[strcspn(protocol, ", ")] = '\0';
+    }
+
+    sprintf(response, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n%s%s%s\r\n",
+        accept,
+        protocol[0] ? MANGO_HDR__WEB_SOCKET_PROTOCOL ": " : "",
+        protocol,
+        protocol[0] ? "\r\n" : "");
+    if(socketWrite(fd, response, strlen(response)) < 0){ return -1; }
+
+    while(1){
+        if(socketReadExact(fd, header, 2) < 0){ return -1; }
+
+        opcode = header[0] & 0x0F;
+        payloadlen = header[1] & 0x7F;
+        if(payloadlen == 126){
+            if(socketReadExact(fd, &header[2], 2) < 0){ return -1; }
+            payloadlen = ((uint64_t) header[2] << 8) | header[3];
+        }else if(payloadlen == 127){
+            if(socketReadExact(fd, &header[2], 8) < 0){ return -1; }
+            payloadlen = 0;
+            for(i = 0; i < 8; i++){ payloadlen = (payloadlen << 8) | header[2 + i]; }
+        }
+
+        if(!(header[1] & 0x80)){
+            /* Client frames must be masked */
+            return -1;
+        }
+        if(socketReadExact(fd, mask, 4) < 0){ return -1; }
+
+        payload = malloc(payloadlen + 1);
+        if(!payload){ return -1; }
+        if(socketReadExact(fd, payload, payloadlen) < 0){ free(payload); return -1; }
+        for(i = 0; i < payloadlen; i++){ payload[i] ^= mask[i % 4]; }
+
+        if(opcode == MANGO_WS_FRAME_TYPE_PING){
+            opcode = MANGO_WS_FRAME_TYPE_PONG;
+        }else if(opcode == MANGO_WS_FRAME_TYPE_PONG){
+            free(payload);
+            continue;
+        }
+
+        /* Echo back, unmasked */
+        headerlen = 0;
+        header[headerlen++] = (header[0] & 0x80) | opcode;
+        if(payloadlen < 126){
+            header[headerlen++] = payloadlen;
+        }else if(payloadlen <= 0xffff){
+            header[headerlen++] = 126;
+            header[headerlen++] = payloadlen >> 8;
+            header[headerlen++] = payloadlen;
+        }else{
+            header[headerlen++] = 127;
+            for(i = 0; i < 8; i++){ header[headerlen++] = payloadlen >> (56 - i * 8); }
+        }
+
+        if(socketWrite(fd, header, headerlen) < 0 || socketWrite(fd, payload, payloadlen) < 0){
+            free(payload);
+            return -1;
+        }
+        free(payload);
+
+        if(opcode == MANGO_WS_FRAME_TYPE_CLOSE){
+            return -1;
+        }
+    }
+}
+
+
+/* -----------------------------------------------------------------------------------------------------------------
+| CONNECTION HANDLING
+----------------------------------------------------------------------------------------------------------------- */
+
+/*
+* Reads and drops the request body, "bodylen" is set to its (decoded) length.
+* "100 Continue" is sent first if the client expects it and "expect" is set.
+*/
+static int requestBodyDrop(int fd, char* request, uint8_t* extra, uint32_t* extralen, uint32_t* bodylen, uint8_t expect){
+    char headerValue[32];
+    uint8_t buf[BLOCK_SZ];
+    uint32_t contentLength;
+    uint32_t sz;
+    int retval;
+
+    *bodylen = 0;
+
+    if(expect && headerValueGet(request, MANGO_HDR__EXPECT, headerValue, sizeof(headerValue)) == 0){
+        if(socketWrite(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25) < 0){ return -1; }
+    }
+
+    if(headerValueGet(request, MANGO_HDR__CONTENT_LENGTH, headerValue, sizeof(headerValue)) == 0){
+        if(mangoHelper_decstr2dec(headerValue, &contentLength)){ return -1; }
+        *bodylen = contentLength;
+
+        sz = *extralen > contentLength ? contentLength : *extralen;
+        memmove(extra, &extra[sz], *extralen - sz);
+        *extralen -= sz;
+        contentLength -= sz;
+
+        while(contentLength){
+            retval = recv(fd, buf, contentLength > sizeof(buf) ? sizeof(buf) : contentLength, 0);
+            if(retval <= 0){ return -1; }
+            contentLength -= retval;
+        }
+    }else if(headerValueGet(request, MANGO_HDR__TRANSFER_ENCODING, headerValue, sizeof(headerValue)) == 0){
+        /* 
+        * Chunked body: 0 = size line, 1 = size extension, 2 = data, 3 = CRLF after data,
+        * 4 = trailer line start, 5 = trailer line
+        */
+        uint32_t chunkSz = 0;
+        uint8_t state = 0;
+        uint8_t c;
+
+        while(1){
+            while(*extralen){
+                c = extra[0];
+                memmove(extra, &extra[1], --(*extralen));
+
+                switch(state){
+                    case 0:
+                        if(c >= '0' && c <= '9'){ chunkSz = (chunkSz << 4) | (c - '0'); }
+                        else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f'){ chunkSz = (chunkSz << 4) | ((c | 0x20) - 'a' + 10); }
+                        else if(c == '\n'){ state = chunkSz ? 2 : 4; }
+                        else{ state = 1; }
+                        break;
+                    case 1:
+                        if(c == '\n'){ state = chunkSz ? 2 : 4; }
+                        break;
+                    case 2:
+                        (*bodylen)++;
+                        if(--chunkSz == 0){ state = 3; }
+                        break;
+                    case 3:
+                        if(c == '\n'){ state = 0; }
+                        break;
+                    case 4:
+                        if(c == '\n'){ return 0; }
+                        if(c != '\r'){ state = 5; }
+                        break;
+                    case 5:
+                        if(c == '\n'){ state = 4; }
+                        break;
+                }
+            }
+            retval = recv(fd, extra, REQUEST_SZ / 2 - 1, 0);
+            if(retval <= 0){ return -1; }
+            *extralen = retval;
+        }
+    }
+
+    return 0;
+}
+
+static void* connectionThread(void* args){
+    int fd = (int)(intptr_t) args;
+    char request[REQUEST_SZ];
+    char headerValue[32];
+    uint32_t requestlen;
+    uint32_t extralen;
+    uint32_t bodylen;
+    uint32_t size;
+    uint32_t param;
+    uint8_t expect;
+    char* path;
+    char* end;
+    int retval;
+    int optval = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+    requestlen = 0;
+    while(1){
+        /* Read the request headers */
+        end = NULL;
+        while(!end){
+            if(requestlen == sizeof(request) - 1){ goto exit; }
+            retval = recv(fd, &request[requestlen], sizeof(request) - 1 - requestlen, 0);
+            if(retval <= 0){ goto exit; }
+            requestlen += retval;
+            request[requestlen] = '\0';
+            end = strstr(request, "\r\n\r\n");
+        }
+
+        /* Bytes following the headers belong to the body or the next request */
+        end += 4;
+        extralen = requestlen - (end - request);
+        memmove(request + REQUEST_SZ / 2, end, extralen);
+        *end = '\0';
+
+        path = strchr(request, ' ');
+        if(!path){ goto exit; }
+        path++;
+
+        /* The rejection is sent before the body */
+        if(strncmp(path, "/reject/", 8) == 0){
+            sscanf(path + 8, "%u", &param);
+            if(serveReject(fd, request, param) != 0){ goto exit; }
+        }
+
+        expect = strncmp(path, "/reject/", 8) != 0 && strncmp(path, "/echo/nocontinue", 16) != 0;
+        if(requestBodyDrop(fd, request, (uint8_t*) request + REQUEST_SZ / 2, &extralen, &bodylen, expect) < 0){ goto exit; }
+
+        size = 0;
+        param = 0;
+        if(strncmp(path, "/fixed/", 7) == 0){
+            sscanf(path + 7, "%u", &size);
+            retval = serveFixed(fd, size, 0);
+        }else if(strncmp(path, "/chunked/", 9) == 0){
+            sscanf(path + 9, "%u/%u", &size, &param);
+            retval = serveChunked(fd, size, param);
+        }else if(strncmp(path, "/drip/", 6) == 0){
+            sscanf(path + 6, "%u/%u", &size, &param);
+            retval = serveFixed(fd, size, param);
+        }else if(strncmp(path, "/file/", 6) == 0){
+            sscanf(path + 6, "%u/%u", &size, &param);
+            retval = serveFile(fd, request, size, param);
+        }else if(strncmp(path, "/redirect/", 10) == 0){
+            retval = serveRedirect(fd, path + 10);
+        }else if(strncmp(path, "/echo", 5) == 0){
+            retval = serveEcho(fd, request, bodylen);
+        }else if(strncmp(path, "/reject/", 8) == 0){
+            retval = 0;
+        }else if(strncmp(path, "/icy", 4) == 0){
+            retval = serveIcy(fd);
+        }else if(strncmp(path, "/ws", 3) == 0){
+            retval = serveWebsocket(fd, request);
+        }else{
+            char* response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+            retval = socketWrite(fd, response, strlen(response));
+        }
+
+        if(retval != 0){ goto exit; }
+
+        if(headerValueGet(request, MANGO_HDR__CONNECTION, headerValue, sizeof(headerValue)) == 0 && strcasecmp(headerValue, "close") == 0){
+            goto exit;
+        }
+
+        /* Pipelined data, if any */
+        memmove(request, request + REQUEST_SZ / 2, extralen);
+        requestlen = extralen;
+        request[requestlen] = '\0';
+    }
+
+exit:
+    close(fd);
+    return NULL;
+}
+
+
+int main(int argc, char** argv){
+    struct sockaddr_in addr;
+    pthread_t thread;
+    uint16_t port;
+    int serverfd;
+    int clientfd;
+    int optval = 1;
+
+    port = argc > 1 ? atoi(argv[1]) : SERVER_PORT;
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(fillBuffer, 'x', sizeof(fillBuffer));
+
+    serverfd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(serverfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = inet_addr(SERVER_IP);
+
+    if(bind(serverfd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(serverfd, 1024) < 0){
+        PRINTF("Could not listen on %s:%u\r\n", SERVER_IP, port);
+        return MANGO_ERR;
+    }
+
+    PRINTF("Listening on %s:%u\r\n", SERVER_IP, port);
+
+    while(1){
+        clientfd = accept(serverfd, NULL, NULL);
+        if(clientfd < 0){ continue; }
+
+        if(pthread_create(&thread, NULL, connectionThread, (void*)(intptr_t) clientfd) != 0){
+            close(clientfd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+#include <openssl/pem.h>
+
+#define PRINTF              printf
+
+/*
+* This example measures the cost of the TLS handshake, with and without
+* session resumption.
+*
+* A TLS server is started on the loopback interface using a certificate
+* which is generated on the fly. mango connects to it and executes a
+* small HTTP GET request per connection. The first run flushes the session
+* cache before every connection (full handshakes), the second one lets
+* mango resume the cached session.
+*
+* Build & run with "make tlsbench && ./a.out"
+*/
+
+#define SERVER_IP           "127.0.0.1"
+#define SERVER_HOSTNAME     "localhost"
+#define SERVER_PORT         8443
+#define CERT_FILE           "/tmp/mango_tlsbench_cert.pem"
+
+/*
+* Number of connections for every run
+*/
+#define CONNECTIONS         (200)
+
+
+static SSL_CTX* serverCtx;
+static int serverSocketfd;
+
+
+static uint64_t timeNowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compareU64(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+
+/*
+* Generates a self signed P-256 certificate for "localhost", stores
+* it to CERT_FILE (so mango can trust it) and creates the server context.
+*/
+static int serverCertificateCreate(void){
+    EVP_PKEY* pkey;
+    X509* x509;
+    X509_NAME* name;
+    X509_EXTENSION* ext;
+    X509V3_CTX v3ctx;
+    FILE* fp;
+
+    pkey = EVP_EC_gen("P-256");
+    if(!pkey){ return -1; }
+
+    x509 = X509_new();
+    X509_set_version(x509, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 24 * 3600);
+    X509_set_pubkey(x509, pkey);
+
+    name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (unsigned char*) SERVER_HOSTNAME, -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+
+    X509V3_set_ctx(&v3ctx, x509, x509, NULL, NULL, 0);
+    ext = X509V3_EXT_conf_nid(NULL, &v3ctx, NID_subject_alt_name, "DNS:" SERVER_HOSTNAME);
+    X509_add_ext(x509, ext, -1);
+    X509_EXTENSION_free(ext);
+    ext = X509V3_EXT_conf_nid(NULL, &v3ctx, NID_basic_constraints, "critical,CA:TRUE");
+    X509_add_ext(x509, ext, -1);
+    X509_EXTENSION_free(ext);
+
+    if(!X509_sign(x509, pkey, EVP_sha256())){ return -1; }
+
+    fp = fopen(CERT_FILE, "w");
+    if(!fp){ return -1; }
+    PEM_write_X509(fp, x509);
+    fclose(fp);
+
+    serverCtx = SSL_CTX_new(TLS_server_method());
+    if(!serverCtx){ return -1; }
+
+    SSL_CTX_use_certificate(serverCtx, x509);
+    SSL_CTX_use_PrivateKey(serverCtx, pkey);
+    SSL_CTX_set_session_id_context(serverCtx, (unsigned char*) "mango", 5);
+
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+
+    return 0;
+}
+
+/*
+* Accepts connections forever. Every connection gets a single HTTP
+* response and is then closed.
+*/
+static void* serverThread(void* args){
+    const char* response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nOK";
+    char request[512];
+    int clientfd;
+    SSL* ssl;
+    int retval;
+
+    (void) args;
+
+    while(1){
+        clientfd = accept(serverSocketfd, NULL, NULL);
+        if(clientfd < 0){ continue; }
+
+        ssl = SSL_new(serverCtx);
+        SSL_set_fd(ssl, clientfd);
+
+        if(SSL_accept(ssl) == 1){
+            /* Read until the end of the request headers */
+            retval = 0;
+            while(retval < (int) sizeof(request) - 1){
+                int r = SSL_read(ssl, &request[retval], sizeof(request) - 1 - retval);
+                if(r <= 0){ break; }
+                retval += r;
+                request[retval] = '\0';
+                if(strstr(request, "\r\n\r\n")){ break; }
+            }
+            SSL_write(ssl, response, strlen(response));
+            SSL_shutdown(ssl);
+        }
+
+        SSL_free(ssl);
+        close(clientfd);
+    }
+
+    return NULL;
+}
+
+static int serverStart(void){
+    struct sockaddr_in addr;
+    pthread_t thread;
+    int optval = 1;
+
+    if(serverCertificateCreate() < 0){
+        return -1;
+    }
+
+    serverSocketfd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(serverSocketfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(SERVER_PORT);
+    addr.sin_addr.s_addr = inet_addr(SERVER_IP);
+
+    if(bind(serverSocketfd, (struct sockaddr*) &addr, sizeof(addr)) < 0){ return -1; }
+    if(listen(serverSocketfd, 64) < 0){ return -1; }
+
+    return pthread_create(&thread, NULL, serverThread, NULL);
+}
+
+
+mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
+    /* Nothing to do, we are only interested in timings */
+    (void) mangoArgs;
+    (void) userArgs;
+
+    return MANGO_OK;
+}
+
+/*
+* Opens CONNECTIONS TLS connections and records the duration of every
+* handshake (mango_tlsConnect()) in microseconds.
+*/
+static int benchmarkRun(uint8_t resume, uint64_t* samples, uint32_t* resumedCnt){
+    mangoHttpClient_t* httpClient;
+    mangoErr_t err;
+    uint64_t start;
+    uint32_t i;
+
+    *resumedCnt = 0;
+
+    for(i = 0; i < CONNECTIONS; i++){
+        if(!resume){
+            mango_tlsSessionCacheFlush();
+        }
+
+        start = timeNowNs();
+        httpClient = mango_tlsConnect(SERVER_IP, SERVER_PORT, SERVER_HOSTNAME);
+        samples[i] = (timeNowNs() - start) / 1000;
+        if(!httpClient){
+            PRINTF("mango_tlsConnect() FAILED!\r\n");
+            return -1;
+        }
+
+        if(mango_tlsSessionResumed(httpClient)){
+            (*resumedCnt)++;
+        }
+
+        /*
+        * A request/response is needed anyway: with TLSv1.3 the session
+        * tickets are sent by the server after the handshake.
+        */
+        err = mango_httpRequestNew(httpClient, "/",  MANGO_HTTP_METHOD_GET);
+        if(err == MANGO_OK){
+            err = mango_httpHeaderSet(httpClient, MANGO_HDR__HOST, SERVER_HOSTNAME);
+        }
+        if(err == MANGO_OK){
+            err = mango_httpRequestProcess(httpClient, mangoApp_handler, NULL);
+        }
+
+        mango_disconnect(httpClient);
+
+        if(err != MANGO_ERR_HTTP_200){
+            PRINTF("HTTP request FAILED [%d]!\r\n", err);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void benchmarkReport(char* name, uint64_t* samples, uint32_t resumedCnt){
+    uint64_t sum;
+    uint32_t i;
+
+    sum = 0;
+    for(i = 0; i < CONNECTIONS; i++){
+        sum += samples[i];
+    }
+
+    qsort(samples, CONNECTIONS, sizeof(uint64_t), compareU64);
+
+    PRINTF("%-8s handshakes: %u, resumed: %u, avg: %llu us, p50: %llu us, p99: %llu us\r\n",
+        name, CONNECTIONS, resumedCnt,
+        (unsigned long long) (sum / CONNECTIONS),
+        (unsigned long long) samples[CONNECTIONS / 2],
+        (unsigned long long) samples[(CONNECTIONS * 99) / 100]);
+}
+
+
+int main(){
+    static uint64_t samplesFull[CONNECTIONS];
+    static uint64_t samplesResumed[CONNECTIONS];
+    uint32_t resumedFull;
+    uint32_t resumedResumed;
+
+    if(serverStart() < 0){
+        PRINTF("TLS server could not be started!\r\n");
+        return MANGO_ERR;
+    }
+
+    if(mango_tlsInit(CERT_FILE) != MANGO_OK){
+        PRINTF("mango_tlsInit() FAILED!\r\n");
+        return MANGO_ERR;
+    }
+
+    if(benchmarkRun(0, samplesFull, &resumedFull) < 0){ return MANGO_ERR; }
+    if(benchmarkRun(1, samplesResumed, &resumedResumed) < 0){ return MANGO_ERR; }
+
+    benchmarkReport("Full", samplesFull, resumedFull);
+    benchmarkReport("Resumed", samplesResumed, resumedResumed);
+
+    return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define PRINTF              printf
+
+/*
+* multipart/form-data upload, meant to be used against the "testserver" application.
+*
+* The files given on the command line are uploaded in a single POST with
+* mango_httpMultipartSet(), every file is a "file<N>" part. A "-" reads the
+* standard input, which makes the body chunked. testserver's /echo answers
+* with the method and the body length.
+*
+* With "-nb" <clients> bodies of <size> bytes are uploaded to /echo at the
+* same time from one thread instead, every other one chunked. Each connection
+* is given data with mango_httpDataSendNB() when poll() reports it writable,
+* and the length echoed by the server is checked.
+*
+* Usage: ./a.out [URI] [file]...
+*        ./a.out /echo /var/log/syslog /etc/hosts
+*        ./a.out -nb [clients] [size]
+*        ./a.out -nb 8 67108864
+*/
+
+#define SERVER_IP           "127.0.0.1"
+#define SERVER_PORT         8080
+#define FILES_MAX           8
+
+/*
+* Non-blocking uploads: most connections and the data offered per call
+*/
+#define NB_CLIENTS_MAX      64
+#define NB_PIECE_SZ         (256 * 1024)
+
+typedef struct{
+    mangoHttpClient_t*  httpClient;
+    uint32_t            offset;     /* Body bytes sent */
+    uint32_t            echoed;     /* Body length reported by /echo */
+    uint32_t            calls;      /* mango_httpDataSendNB() calls */
+    uint32_t            partial;    /* Calls that sent less than offered */
+    uint8_t             chunked;
+    uint8_t             done;
+}uploadNB_t;
+
+static mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
+    switch(mangoArgs->argType){
+        case MANGO_ARG_TYPE_HTTP_RESP_RECEIVED:
+            PRINTF("%s", (char*) mangoArgs->buf);
+            break;
+        case MANGO_ARG_TYPE_HTTP_DATA_RECEIVED:
+            PRINTF("%.*s\r\n", (int) mangoArgs->buflen, (char*) mangoArgs->buf);
+            break;
+        default:
+            break;
+    }
+    return MANGO_OK;
+}
+
+static mangoErr_t uploadNB_handler(mangoArg_t* mangoArgs, void* userArgs){
+    uploadNB_t* upload = (uploadNB_t*) userArgs;
+    char* len;
+
+    if(mangoArgs->argType == MANGO_ARG_TYPE_HTTP_DATA_RECEIVED){
+        /* "POST <body length>" */
+        len = memchr(mangoArgs->buf, ' ', mangoArgs->buflen);
+        if(len){
+            upload->echoed = strtoul(len + 1, NULL, 10);
+        }
+    }
+    return MANGO_OK;
+}
+
+static int uploadNB(uint32_t clientsCnt, uint32_t size){
+    static uploadNB_t uploads[NB_CLIENTS_MAX];
+    struct pollfd fds[NB_CLIENTS_MAX];
+    uploadNB_t* active[NB_CLIENTS_MAX];
+    char contentLength[16];
+    uint8_t* piece;
+    uint32_t offer;
+    uint32_t sent;
+    uint32_t cnt;
+    uint32_t ok;
+    uint32_t i;
+    mangoErr_t err;
+
+    piece = malloc(NB_PIECE_SZ);
+    if(!piece){
+        return MANGO_ERR;
+    }
+    for(i = 0; i < NB_PIECE_SZ; i++){
+        piece[i] = 'a' + i % 26;
+    }
+
+    snprintf(contentLength, sizeof(contentLength), "%u", size);
+
+    for(i = 0; i < clientsCnt; i++){
+        uploads[i].chunked = i % 2;
+        uploads[i].httpClient = mango_connect(SERVER_IP, SERVER_PORT);
+        if(!uploads[i].httpClient){
+            PRINTF("Connection %u failed\r\n", i);
+            return MANGO_ERR;
+        }
+
+        err = mango_httpRequestNew(uploads[i].httpClient, "/echo", MANGO_HTTP_METHOD_POST);
+        if(err == MANGO_OK){ err = mango_httpHeaderSet(uploads[i].httpClient, MANGO_HDR__HOST, SERVER_IP); }
+        if(err == MANGO_OK && uploads[i].chunked){
+            err = mango_httpHeaderSet(uploads[i].httpClient, MANGO_HDR__TRANSFER_ENCODING, "chunked");
+        }else if(err == MANGO_OK){
+            err = mango_httpHeaderSet(uploads[i].httpClient, MANGO_HDR__CONTENT_LENGTH, contentLength);
+        }
+        if(err == MANGO_OK){
+            err = mango_httpRequestProcess(uploads[i].httpClient, uploadNB_handler, &uploads[i]);
+        }
+        if(err != MANGO_ERR_HTTP_100){
+            PRINTF("Request %u failed [%d]\r\n", i, err);
+            return MANGO_ERR;
+        }
+    }
+
+    while(1){
+        /* Wait until one of the unfinished uploads can take data */
+        cnt = 0;
+        for(i = 0; i < clientsCnt; i++){
+            if(!uploads[i].done){
+                active[cnt] = &uploads[i];
+                fds[cnt].fd = mango_socketGet(uploads[i].httpClient);
+                fds[cnt].events = POLLOUT;
+                fds[cnt].revents = 0;
+                cnt++;
+            }
+        }
+
+        if(!cnt){
+            break;
+        }
+
+        if(poll(fds, cnt, 1000) < 0){
+            return MANGO_ERR;
+        }
+
+        for(i = 0; i < cnt; i++){
+            if(!fds[i].revents){
+                continue;
+            }
+
+            err = MANGO_OK;
+            offer = size - active[i]->offset > NB_PIECE_SZ ? NB_PIECE_SZ : size - active[i]->offset;
+            if(offer){
+                err = mango_httpDataSendNB(active[i]->httpClient, piece, offer, &sent);
+                active[i]->calls++;
+                active[i]->partial += sent < offer;
+                active[i]->offset += sent;
+            }
+
+            if(err == MANGO_OK && active[i]->offset == size){
+                /* End the body and receive the echo [blocks] */
+                err = mango_httpDataSend(active[i]->httpClient, NULL, 0);
+                active[i]->done = 1;
+            }
+
+            if(err != MANGO_OK && err != MANGO_ERR_HTTP_200){
+                PRINTF("Upload %u failed [%d]\r\n", (uint32_t) (active[i] - uploads), err);
+                active[i]->done = 1;
+            }
+        }
+    }
+
+    ok = 0;
+    for(i = 0; i < clientsCnt; i++){
+        PRINTF("Upload %u [%s]: %u bytes echoed, %u calls, %u partial\r\n",
+            i, uploads[i].chunked ? "chunked" : "Content-Length", uploads[i].echoed, uploads[i].calls, uploads[i].partial);
+        ok += uploads[i].echoed == size;
+        mango_disconnect(uploads[i].httpClient);
+    }
+
+    free(piece);
+
+    PRINTF("%u of %u uploads complete\r\n", ok, clientsCnt);
+
+    return ok == clientsCnt ? 0 : MANGO_ERR;
+}
+
+int main(int argc, char** argv){
+    mangoHttpClient_t* httpClient;
+    mangoMultipartPart_t parts[FILES_MAX + 1];
+    char names[FILES_MAX][8];
+    char* URI;
+    mangoErr_t err;
+    uint16_t partsCnt;
+    int i;
+
+    if(argc > 1 && strcmp(argv[1], "-nb") == 0){
+        uint32_t clientsCnt = argc > 2 ? atoi(argv[2]) : 4;
+        uint32_t size = argc > 3 ? strtoul(argv[3], NULL, 10) : 16 * 1024 * 1024;
+
+        if(!clientsCnt || clientsCnt > NB_CLIENTS_MAX || !size){
+            PRINTF("Usage: %s -nb [clients] [size]\r\n", argv[0]);
+            return MANGO_ERR;
+        }
+        return uploadNB(clientsCnt, size);
+    }
+
+    URI = argc > 1 ? argv[1] : "/echo";
+
+    memset(parts, 0, sizeof(parts));
+    parts[0].name   = "device";
+    parts[0].buf    = (uint8_t*) "mango";
+    parts[0].len    = 5;
+    partsCnt = 1;
+
+    for(i = 2; i < argc && partsCnt <= FILES_MAX; i++){
+        snprintf(names[partsCnt - 1], sizeof(names[0]), "file%u", partsCnt);
+        parts[partsCnt].name        = names[partsCnt - 1];
+        parts[partsCnt].filename    = argv[i];
+        parts[partsCnt].contentType = "application/octet-stream";
+        parts[partsCnt].fd          = strcmp(argv[i], "-") == 0 ? STDIN_FILENO : open(argv[i], O_RDONLY);
+        if(parts[partsCnt].fd < 0){
+            PRINTF("Cannot open %s\r\n", argv[i]);
+            return MANGO_ERR;
+        }
+        partsCnt++;
+    }
+
+    httpClient = mango_connect(SERVER_IP, SERVER_PORT);
+    if(!httpClient){
+        PRINTF("Connection failed\r\n");
+        return MANGO_ERR;
+    }
+
+    err = mango_httpRequestNew(httpClient, URI, MANGO_HTTP_METHOD_POST);
+    if(err == MANGO_OK){ err = mango_httpHeaderSet(httpClient, MANGO_HDR__HOST, SERVER_IP); }
+    if(err == MANGO_OK){ err = mango_httpMultipartSet(httpClient, parts, partsCnt); }
+    if(err != MANGO_OK){
+        PRINTF("Request creation failed [%d]\r\n", err);
+        mango_disconnect(httpClient);
+        return MANGO_ERR;
+    }
+
+    err = mango_httpRequestProcess(httpClient, mangoApp_handler, NULL);
+    if(err == MANGO_ERR_HTTP_100){
+        /* The parts are the whole body, just end it */
+        err = mango_httpDataSend(httpClient, NULL, 0);
+    }
+
+    PRINTF("Upload finished [%d]\r\n", err);
+
+    mango_disconnect(httpClient);
+
+    return err == MANGO_ERR_HTTP_200 ? 0 : MANGO_ERR;
+}
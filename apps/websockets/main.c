@@ -105,7 +105,7 @@ mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
 			PRINTF("-----------------------------------------------------------------\r\n");
 			PRINTF("WEBSOCKET DATA RECEIVED: [%u bytes, Frame ID %u]\r\n", mangoArgs->buflen, mangoArgs->frameID);
 			PRINTF("-----------------------------------------------------------------\r\n");
-			PRINTF("%s\r\n", mangoArgs->buf);
+			PRINTF("%.*s\r\n", (int) mangoArgs->buflen, mangoArgs->buf);
 			PRINTF("-----------------------------------------------------------------\r\n");
 			
 			break;
@@ -118,7 +118,7 @@ mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
             */
             PRINTF("\r\n");
 			PRINTF("-----------------------------------------------------------------\r\n");
-			PRINTF("WEBSOCKET CLOSE FRAME RECEIVED!\r\n");
+			PRINTF("WEBSOCKET CLOSE FRAME RECEIVED! [code %u] %.*s\r\n", mangoArgs->closeCode, (int) mangoArgs->buflen, mangoArgs->buf);
 			PRINTF("-----------------------------------------------------------------\r\n");
             break;
         }
@@ -129,10 +129,22 @@ mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
             */
             PRINTF("\r\n");
 			PRINTF("-----------------------------------------------------------------\r\n");
-			PRINTF("WEBSOCKET PING FRAME RECEIVED!\r\n");
+			PRINTF("WEBSOCKET PING FRAME RECEIVED! [%u bytes]\r\n", mangoArgs->buflen);
 			PRINTF("-----------------------------------------------------------------\r\n");
             break;
         }
+        case MANGO_ARG_TYPE_WEBSOCKET_PONG:
+        {
+			/*
+            * Server answered one of our keepalive pings
+            */
+            PRINTF("WEBSOCKET PONG RECEIVED!\r\n");
+            break;
+        }
+        default:
+        {
+            break;
+        }
 	};
 	
     return MANGO_OK;
@@ -143,94 +155,68 @@ mangoErr_t testWebsocket(mangoHttpClient_t* httpClient){
     mangoErr_t err;
     char* msg;
  
-    /*
-	* Specify HTTP request's basic headers
-	*/
-	err = mango_httpRequestNew(httpClient, "/",  MANGO_HTTP_METHOD_GET);
-	if(err != MANGO_OK){ return MANGO_ERR; }
-	
-	/*
-	* If Basic Access Authentication is needed enable this..
-	*/
-	//err = mango_httpAuthSet(httpClient, MANGO_HTTP_AUTH__BASIC, "admin", "admin");
-	if(err != MANGO_OK){ return MANGO_ERR; }
-	
-	err = mango_httpHeaderSet(httpClient, MANGO_HDR__HOST, SERVER_HOSTNAME);
-	if(err != MANGO_OK){ return MANGO_ERR; }	
-
-	err = mango_httpHeaderSet(httpClient, MANGO_HDR__ORIGIN, "http://www.websocket.org");
-	if(err != MANGO_OK){ return MANGO_ERR; }
-	
-	err = mango_httpHeaderSet(httpClient, MANGO_HDR__WEB_SOCKET_VERSION, "13");
-	if(err != MANGO_OK){ return MANGO_ERR; }
-	
-	err = mango_httpHeaderSet(httpClient, MANGO_HDR__CONNECTION, "Keep-alive, Upgrade");
-	if(err != MANGO_OK){ return MANGO_ERR; }
-	
-	err = mango_httpHeaderSet(httpClient, MANGO_HDR__WEB_SOCKET_PROTOCOL, "wamp");
-	if(err != MANGO_OK){ return MANGO_ERR; }	
-	
-	err = mango_httpHeaderSet(httpClient, MANGO_HDR__WEB_SOCKET_KEY, "v6H3B7uxxRf1NfPeeaDHiQ==");
-	if(err != MANGO_OK){ return MANGO_ERR; }
-	
-	err = mango_httpHeaderSet(httpClient, MANGO_HDR__UPGRADE, "websocket");
-	if(err != MANGO_OK){ return MANGO_ERR; }
-	
-
 	/*
-	* Send HTTP request and receive the response
+	* Upgrade the connection. mango builds the upgrade request (random
+	* Sec-WebSocket-Key, version, subprotocols) and verifies the
+	* server's Sec-WebSocket-Accept.
 	*/
-	err = mango_httpRequestProcess(httpClient, mangoApp_handler, NULL);
-	if(err >= MANGO_ERR_HTTP_100 && err <= MANGO_ERR_HTTP_599){
-		if(err != MANGO_ERR_HTTP_101){
+	err = mango_wsConnect(httpClient, "/", SERVER_HOSTNAME, NULL, mangoApp_handler, NULL);
+	if(err != MANGO_OK){
+		if(err >= MANGO_ERR_HTTP_100 && err <= MANGO_ERR_HTTP_599){
 			/*
-			* HTTP upgrade to websockets failed, possibly due to wrong headers
-            * or because the server does not support them
+			* HTTP upgrade to websockets failed, possibly because
+			* the server does not support them
 			*/
 			return err;
 		}else{
 			/*
-			* HTTP upgrade to websockets succeed. Enter an infinite loop
-			* waiting for new frames and sending new ones.
-			*/
-			while(1){
-				/*
-				* Block for the specified amount of time and Poll for received data 
-                * or control (Ping, Close) frames.
-				*/
-                PRINTF("Polling..\r\n");
-				err = mango_wsPoll(httpClient, 2000);
-				if(err != MANGO_OK){ return MANGO_ERR; } /* Connection closed by remote peer / socket disconnected / we got an invalid frame.. */
-				
-				/*
-				* Send some frames to the server. They should be echoed back to us through the 
-                * mangoApp_handler() callback.
-				*/
-                msg = "Hello from mango!";
-				err = mango_wsFrameSend(httpClient, (uint8_t*) msg, strlen(msg), MANGO_WS_FRAME_TYPE_TEXT);
-				if(err != MANGO_OK){ return MANGO_ERR; } /* Connection error, abort */
-                
-                msg = "This is a test message";
-				err = mango_wsFrameSend(httpClient, (uint8_t*) msg, strlen(msg), MANGO_WS_FRAME_TYPE_TEXT);
-				if(err != MANGO_OK){ return MANGO_ERR; } /* Connection error, abort */
-			}
-			
-			/*
-			* When we finish close the connection
+			* Fatal request error (Connection closed, invalid handshake or
+			* working buffer was small and we couldn't to process the HTPP request/response.
 			*/
-			mango_wsClose(httpClient);
-			
-			return MANGO_OK;
+			return MANGO_ERR;
 		}
-	}else{
+	}
+	
+	PRINTF("Websocket subprotocol: '%s'\r\n", mango_wsProtocolGet(httpClient));
+	
+	/*
+	* Ping the server every 10 seconds and consider it dead if
+	* nothing was received for 30 seconds
+	*/
+	mango_wsKeepaliveSet(httpClient, 10000, 30000);
+	
+	/*
+	* HTTP upgrade to websockets succeed. Enter an infinite loop
+	* waiting for new frames and sending new ones.
+	*/
+	while(1){
+		/*
+		* Block for the specified amount of time and Poll for received data 
+		* or control (Ping, Close) frames.
+		*/
+		PRINTF("Polling..\r\n");
+		err = mango_wsPoll(httpClient, 2000);
+		if(err != MANGO_OK){ return MANGO_ERR; } /* Connection closed by remote peer / socket disconnected / we got an invalid frame.. */
+		
 		/*
-		* Fatal request error (Connection closed or working buffer was small
-		* and we couldn't to process the HTPP request/response.
+		* Send some frames to the server. They should be echoed back to us through the 
+		* mangoApp_handler() callback.
 		*/
-		return MANGO_ERR;
+		msg = "Hello from mango!";
+		err = mango_wsFrameSend(httpClient, (uint8_t*) msg, strlen(msg), MANGO_WS_FRAME_TYPE_TEXT);
+		if(err != MANGO_OK){ return MANGO_ERR; } /* Connection error, abort */
+		
+		msg = "This is a test message";
+		err = mango_wsFrameSend(httpClient, (uint8_t*) msg, strlen(msg), MANGO_WS_FRAME_TYPE_TEXT);
+		if(err != MANGO_OK){ return MANGO_ERR; } /* Connection error, abort */
 	}
-
-    return MANGO_ERR;
+	
+	/*
+	* When we finish close the connection
+	*/
+	mango_wsClose(httpClient);
+	
+	return MANGO_OK;
 }
 
 
@@ -0,0 +1,202 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#define PRINTF              printf
+
+/*
+* Websocket send benchmark, meant to be used against the "testserver"
+* application (/ws echoes every frame back).
+*
+* <frames> 32 byte frames are sent over a real socket, first one
+* mango_wsFrameSend() at a time, then in batches with
+* mango_wsFrameSendBatch() and finally with coalescing enabled
+* [mango_wsCoalesceSet()]. The echoes are drained while sending. The send
+* cost per frame and the overall frames/s (until all echoes arrived) are
+* reported.
+*
+* Usage: ./a.out [frames] [port]
+*        ./a.out 200000 8080
+*/
+
+#define SERVER_IP           "127.0.0.1"
+#define SERVER_PORT         8080
+
+#define FRAME_SZ            (32)
+#define BATCH_SZ            (64)
+#define COALESCE_BUF_SZ     (16 * 1024)
+#define COALESCE_DELAY_MS   (1)
+
+/*
+* Frames sent between two drains of the echoes
+*/
+#define DRAIN_INTERVAL      (256)
+
+typedef enum{
+    MODE_SINGLE,
+    MODE_BATCH,
+    MODE_COALESCE,
+}wsbenchMode_e;
+
+static uint32_t framesCnt   = 100000;
+static uint16_t port        = SERVER_PORT;
+static uint32_t framesReceived;
+
+static uint64_t timeNowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+mangoErr_t mangoApp_handler(mangoArg_t* mangoArgs, void* userArgs){
+    (void) userArgs;
+
+    if(mangoArgs->argType == MANGO_ARG_TYPE_WEBSOCKET_DATA_RECEIVED){
+        framesReceived++;
+    }
+
+    return MANGO_OK;
+}
+
+static int benchmarkRun(char* name, wsbenchMode_e mode){
+    mangoHttpClient_t* httpClient;
+    mangoWsFrame_t frames[BATCH_SZ];
+    uint8_t msg[FRAME_SZ];
+    uint64_t sendTime;
+    uint64_t start;
+    uint64_t t;
+    uint32_t sent;
+    uint32_t cnt;
+    uint32_t i;
+    mangoErr_t err;
+
+    httpClient = mango_connect(SERVER_IP, port);
+    if(!httpClient){
+        PRINTF("%s: connect FAILED\r\n", name);
+        return -1;
+    }
+
+    err = mango_wsConnect(httpClient, "/ws", SERVER_IP, NULL, mangoApp_handler, NULL);
+    if(err != MANGO_OK){
+        PRINTF("%s: upgrade FAILED [%d]\r\n", name, err);
+        mango_disconnect(httpClient);
+        return -1;
+    }
+
+    if(mode == MODE_COALESCE){
+        mango_wsCoalesceSet(httpClient, COALESCE_BUF_SZ, COALESCE_DELAY_MS);
+    }
+
+    memset(msg, 'x', sizeof(msg));
+    for(i = 0; i < BATCH_SZ; i++){
+        frames[i].buf = msg;
+        frames[i].buflen = sizeof(msg);
+        frames[i].type = MANGO_WS_FRAME_TYPE_BINARY;
+    }
+
+    framesReceived = 0;
+    sendTime = 0;
+    start = timeNowNs();
+
+    sent = 0;
+    while(sent < framesCnt){
+        t = timeNowNs();
+
+        cnt = DRAIN_INTERVAL;
+        if(cnt > framesCnt - sent){
+            cnt = framesCnt - sent;
+        }
+
+        if(mode == MODE_BATCH){
+            for(i = 0; i < cnt && err == MANGO_OK; i += BATCH_SZ){
+                err = mango_wsFrameSendBatch(httpClient, frames, cnt - i > BATCH_SZ ? BATCH_SZ : cnt - i);
+            }
+        }else{
+            for(i = 0; i < cnt && err == MANGO_OK; i++){
+                err = mango_wsFrameSend(httpClient, msg, sizeof(msg), MANGO_WS_FRAME_TYPE_BINARY);
+            }
+        }
+        sent += cnt;
+
+        sendTime += timeNowNs() - t;
+
+        /* Don't let the echoes fill the socket buffers */
+        if(err == MANGO_OK){
+            err = mango_wsPoll(httpClient, 0);
+        }
+        if(err != MANGO_OK){
+            PRINTF("%s: FAILED [%d]\r\n", name, err);
+            mango_disconnect(httpClient);
+            return -1;
+        }
+    }
+
+    err = mango_wsFlush(httpClient);
+    while(err == MANGO_OK && framesReceived < framesCnt){
+        err = mango_wsPoll(httpClient, 100);
+    }
+    if(err != MANGO_OK){
+        PRINTF("%s: FAILED [%d]\r\n", name, err);
+        mango_disconnect(httpClient);
+        return -1;
+    }
+
+    t = timeNowNs() - start;
+
+    PRINTF("%-12s %10u frames %8llu ns/frame sent %12.0f frames/s\r\n",
+        name,
+        framesCnt,
+        (unsigned long long) (sendTime / framesCnt),
+        framesCnt / ((double) t / 1e9));
+
+    mango_disconnect(httpClient);
+
+    return 0;
+}
+
+
+int main(int argc, char** argv){
+    int failed;
+
+    if(argc > 1){ framesCnt = atoi(argv[1]); }
+    if(argc > 2){ port      = atoi(argv[2]); }
+
+    if(!framesCnt){
+        PRINTF("Usage: %s [frames] [port]\r\n", argv[0]);
+        return MANGO_ERR;
+    }
+
+    PRINTF("%u byte frames, ws://%s:%u/ws\r\n", FRAME_SZ, SERVER_IP, port);
+
+    failed = 0;
+    failed |= benchmarkRun("single", MODE_SINGLE) < 0;
+    failed |= benchmarkRun("batch", MODE_BATCH) < 0;
+    failed |= benchmarkRun("coalesce", MODE_COALESCE) < 0;
+
+    return failed;
+}
@@ -0,0 +1,119 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "../mango.h"
+
+#define SHA1_ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+static void mangoCrypto_sha1Block(uint32_t state[5], const uint8_t block[64])
+{
+	uint32_t w[80];
+	uint32_t a, b, c, d, e, f, k, temp;
+	uint8_t i;
+
+	for(i = 0; i < 16; i++){
+		w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) | ((uint32_t)block[i * 4 + 2] << 8) | ((uint32_t)block[i * 4 + 3]);
+	}
+	for(i = 16; i < 80; i++){
+		w[i] = SHA1_ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+
+	for(i = 0; i < 80; i++){
+		if(i < 20){
+			f = (b & c) | ((~b) & d);
+			k = 0x5A827999;
+		}else if(i < 40){
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}else if(i < 60){
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}else{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+
+		temp = SHA1_ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = SHA1_ROL(b, 30);
+		b = a;
+		a = temp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+/*
+ * SHA-1 digest of "dataLength" bytes. Only used for the websocket handshake
+ * (Sec-WebSocket-Accept), so the whole message is hashed in one go.
+*/
+void mangoCrypto_sha1(const void* data_buf, size_t dataLength, uint8_t digest[20])
+{
+	const uint8_t *data = (const uint8_t *)data_buf;
+	uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	uint8_t block[64];
+	uint64_t bitLength;
+	size_t x;
+	size_t remaining;
+	uint8_t i;
+
+	/* Full blocks */
+	for(x = 0; x + 64 <= dataLength; x += 64){
+		mangoCrypto_sha1Block(state, &data[x]);
+	}
+
+	/* Last block(s) with the padding and the message length */
+	remaining = dataLength - x;
+	memset(block, 0, sizeof(block));
+	memcpy(block, &data[x], remaining);
+	block[remaining] = 0x80;
+
+	if(remaining >= 56){
+		mangoCrypto_sha1Block(state, block);
+		memset(block, 0, sizeof(block));
+	}
+
+	bitLength = (uint64_t)dataLength * 8;
+	for(i = 0; i < 8; i++){
+		block[63 - i] = (uint8_t)(bitLength >> (i * 8));
+	}
+	mangoCrypto_sha1Block(state, block);
+
+	for(i = 0; i < 5; i++){
+		digest[i * 4]     = (uint8_t)(state[i] >> 24);
+		digest[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+		digest[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+		digest[i * 4 + 3] = (uint8_t)(state[i]);
+	}
+}
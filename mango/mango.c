@@ -26,7 +26,7 @@
 mangoHttpClient_t* mango_connect(char* serverIP, uint16_t serverPort){
     mangoHttpClient_t* hc;
     
-    MANGO_ENSURE(serverIP, ("?") );
+    MANGO_ENSURE_RET(serverIP, NULL, ("?") );
     
     hc = mangoPort_malloc(sizeof(mangoHttpClient_t));
     if(!hc){
@@ -35,52 +35,148 @@ mangoHttpClient_t* mango_connect(char* serverIP, uint16_t serverPort){
         memset(hc, 0, sizeof(mangoHttpClient_t));
     }
     
+    hc->stats.connectStart = mangoPort_timeNowUs();
+    
     hc->socketfd = mangoPort_connect(serverIP, serverPort, MANGO_SOCKET_CONNECT_TIMEOUT_MS);
     if(hc->socketfd < 0){
+        MANGO_METRICS( mangoMetrics_connect(0, 1) );
         mangoPort_free(hc);
         return NULL;
     }
     
+    hc->stats.connectEnd = mangoPort_timeNowUs();
+    MANGO_METRICS( mangoMetrics_connect(hc->stats.connectEnd - hc->stats.connectStart, 0) );
+    
+    strncpy(hc->serverIP, serverIP, sizeof(hc->serverIP) - 1);
+    hc->serverPort = serverPort;
+    
     mangoSM_INIT(hc);
     
     return hc;
 }
+
+mangoHttpClient_t* mango_transportConnect(mangoTransport_t* transport, void* transportArgs){
+    mangoHttpClient_t* hc;
+    
+    MANGO_ENSURE_RET(transport, NULL, ("?") );
+    
+    hc = mangoPort_malloc(sizeof(mangoHttpClient_t));
+    if(!hc){
+        return NULL;
+    }else{
+        memset(hc, 0, sizeof(mangoHttpClient_t));
+    }
+    
+    hc->socketfd        = -1;
+    hc->transport       = transport;
+    hc->transportArgs   = transportArgs;
+    
+    MANGO_METRICS( mangoMetrics_connect(0, 0) );
+    
+    mangoSM_INIT(hc);
+    
+    return hc;
+}
+
+mangoHttpClient_t* mango_loopbackConnect(mangoLoopback_t* loopback){
+    static mangoTransport_t loopbackTransport = {
+        mangoLoopback_read,
+        mangoLoopback_write,
+        mangoLoopback_disconnect,
+    };
+    
+    return mango_transportConnect(&loopbackTransport, loopback);
+}
+
+mangoErr_t mango_tlsInit(char* caFile){
+#ifdef MANGO_TLS_ENABLED
+    return mangoTLS_init(caFile);
+#else
+    (void) caFile;
+    return MANGO_ERR;
+#endif
+}
+
+mangoHttpClient_t* mango_tlsConnect(char* serverIP, uint16_t serverPort, char* serverName){
+#ifdef MANGO_TLS_ENABLED
+    mangoHttpClient_t* hc;
+    
+    hc = mango_connect(serverIP, serverPort);
+    if(!hc){
+        return NULL;
+    }
+    
+    hc->tls = mangoTLS_connect(hc->socketfd, serverName ? serverName : serverIP, serverPort, MANGO_TLS_HANDSHAKE_TIMEOUT_MS);
+    if(!hc->tls){
+        mango_disconnect(hc);
+        return NULL;
+    }
+    
+    hc->stats.connectEnd = mangoPort_timeNowUs();
+    
+    return hc;
+#else
+    (void) serverIP;
+    (void) serverPort;
+    (void) serverName;
+    return NULL;
+#endif
+}
+
+uint8_t mango_tlsSessionResumed(mangoHttpClient_t* hc){
+#ifdef MANGO_TLS_ENABLED
+    if(hc->tls){
+        return mangoTLS_sessionResumed(hc->tls);
+    }
+#endif
+    return 0;
+}
+
+void mango_tlsSessionCacheFlush(void){
+#ifdef MANGO_TLS_ENABLED
+    mangoTLS_sessionCacheFlush();
+#endif
+}
  
  
-mangoErr_t mango_httpRequestNew(mangoHttpClient_t* hc, char* URI, mangoHttpMethod_e method){
+/*
+* Request line token of every method, MANGO_HTTP_METHOD_CUSTOM has none
+*/
+static char* mango_httpMethodTokens[] = {
+	[MANGO_HTTP_METHOD_HEAD]			= "HEAD",
+	[MANGO_HTTP_METHOD_GET]				= "GET",
+	[MANGO_HTTP_METHOD_POST]			= "POST",
+	[MANGO_HTTP_METHOD_POST_CHUNKED]	= "POST",
+	[MANGO_HTTP_METHOD_PUT]				= "PUT",
+	[MANGO_HTTP_METHOD_DELETE]			= "DELETE",
+	[MANGO_HTTP_METHOD_PATCH]			= "PATCH",
+	[MANGO_HTTP_METHOD_OPTIONS]			= "OPTIONS",
+	[MANGO_HTTP_METHOD_CUSTOM]			= NULL,
+};
+
+/*
+* Writes "<method> <URI> HTTP/1.1\r\n\r\n" to the WB, the headers are
+* inserted before the last CRLF by mango_httpHeaderSet().
+*/
+static mangoErr_t mango_httpRequestLineSet(mangoHttpClient_t* hc, char* URI, char* method){
     char* token;
     uint16_t tokenlen;
 
-    hc->httpMethod = method;
+	hc->wsAccept[0] = '\0';
+	hc->ODPArgsMultipart.parts = NULL;
 	
 	hc->workingBufferIndexRight = 0;
 	hc->workingBufferIndexLeft = 0;
-	
-    switch(hc->httpMethod){
-        case MANGO_HTTP_METHOD_GET:
-            token = "GET ";
-            break;
-        case MANGO_HTTP_METHOD_HEAD:
-            token = "HEAD ";
-            break;    
-        case MANGO_HTTP_METHOD_POST:
-            token = "POST ";
-            break;
-        case MANGO_HTTP_METHOD_PUT:
-            token = "PUT ";
-            break;     
-        default:
-            goto handleError;
-            break;
-    }
     
+    token       = method;
     tokenlen    = strlen(token);
-    if(hc->workingBufferIndexRight + tokenlen > MANGO_WB_TOT_SZ(hc) ){
+    if(hc->workingBufferIndexRight + tokenlen + 1 > MANGO_WB_TOT_SZ(hc) ){
         goto handleError;
     }
     
     memcpy(&hc->workingBuffer[hc->workingBufferIndexRight], token, tokenlen);
     hc->workingBufferIndexRight += tokenlen;
+    hc->workingBuffer[hc->workingBufferIndexRight++] = ' ';
     
     token       = URI;
     tokenlen    = strlen(token);
@@ -109,6 +205,49 @@ mangoErr_t mango_httpRequestNew(mangoHttpClient_t* hc, char* URI, mangoHttpMetho
         return MANGO_ERR;
 }
 
+mangoErr_t mango_httpRequestNew(mangoHttpClient_t* hc, char* URI, mangoHttpMethod_e method){
+    mangoErr_t err;
+    
+    MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+    MANGO_ENSURE_RET(URI, MANGO_ERR, ("?") );
+    
+    if(method >= sizeof(mango_httpMethodTokens) / sizeof(mango_httpMethodTokens[0]) || !mango_httpMethodTokens[method]){
+        /* MANGO_HTTP_METHOD_CUSTOM requests are created with mango_httpRequestNewCustom() */
+        return MANGO_ERR;
+    }
+    
+    hc->httpMethod = method;
+    
+    err = mango_httpRequestLineSet(hc, URI, mango_httpMethodTokens[method]);
+    if(err == MANGO_OK && method == MANGO_HTTP_METHOD_POST_CHUNKED){
+        err = mango_httpHeaderSet(hc, MANGO_HDR__TRANSFER_ENCODING, "chunked");
+    }
+    
+    return err;
+}
+
+mangoErr_t mango_httpRequestNewCustom(mangoHttpClient_t* hc, char* URI, char* method){
+    char* c;
+    
+    MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+    MANGO_ENSURE_RET(URI, MANGO_ERR, ("?") );
+    MANGO_ENSURE_RET(method, MANGO_ERR, ("?") );
+    
+    /* The method is a token [RFC 7230, 3.2.6] */
+    if(!method[0]){
+        return MANGO_ERR;
+    }
+    for(c = method; *c; c++){
+        if(!((*c >= '0' && *c <= '9') || (*c >= 'A' && *c <= 'Z') || (*c >= 'a' && *c <= 'z')) && !strchr("!#$%&'*+-.^_`|~", *c)){
+            return MANGO_ERR;
+        }
+    }
+    
+    hc->httpMethod = MANGO_HTTP_METHOD_CUSTOM;
+    
+    return mango_httpRequestLineSet(hc, URI, method);
+}
+
 
 mangoErr_t mango_httpAuthSet(mangoHttpClient_t* hc, mangoHttpAuth_t auth, char* username, char* password){
 	char*       token;
@@ -117,8 +256,8 @@ mangoErr_t mango_httpAuthSet(mangoHttpClient_t* hc, mangoHttpAuth_t auth, char*
 	char tmpBuf[32];
 	int retval;
 	
-	MANGO_ENSURE(hc->workingBufferIndexRight > 2, ("?") );
-    MANGO_ENSURE(hc, ("?") );
+    MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+	MANGO_ENSURE_RET(hc->workingBufferIndexRight > 2, MANGO_ERR, ("?") );
     
     hc->workingBufferIndexRight -= 2;
     
@@ -190,9 +329,9 @@ mangoErr_t mango_httpHeaderSet(mangoHttpClient_t* hc, char* headerName, char* he
     uint16_t    prevRequestLen;
     uint16_t    tokenlen;
     
-    MANGO_ENSURE(hc->workingBufferIndexRight > 2, ("?") );
-    MANGO_ENSURE(hc, ("?") );
-    MANGO_ENSURE(headerName, ("?") );
+    MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+    MANGO_ENSURE_RET(hc->workingBufferIndexRight > 2, MANGO_ERR, ("?") );
+    MANGO_ENSURE_RET(headerName, MANGO_ERR, ("?") );
     
     hc->workingBufferIndexRight -= 2;
     
@@ -230,6 +369,13 @@ mangoErr_t mango_httpHeaderSet(mangoHttpClient_t* hc, char* headerName, char* he
     memcpy(&hc->workingBuffer[hc->workingBufferIndexRight], token, tokenlen);
     hc->workingBufferIndexRight += tokenlen;
     
+    if(strcasecmp(headerName, MANGO_HDR__WEB_SOCKET_KEY) == 0){
+        /* Remember the expected Sec-WebSocket-Accept of the upgrade */
+        if(mangoWS_acceptCompute(headerValue, hc->wsAccept) != MANGO_OK){
+            hc->wsAccept[0] = '\0';
+        }
+    }
+    
     return MANGO_OK;
     
     handleError:
@@ -259,11 +405,18 @@ mangoErr_t mango_httpHeaderGet(char* response, char* headerName, char* headerVal
 
 mangoErr_t mango_httpRequestProcess(mangoHttpClient_t* hc, mangoErr_t (*userFunc)(mangoArg_t* userFunc, void* userArgs), void* userArgs){
 	mangoArg_t funcArgs;
+	mangoErr_t err;
+	
+	if(!mangoSM_TRYLOCK(hc)){
+		/* Another thread is running the client */
+		return MANGO_ERR_BUSY;
+	}
 	
     hc->userFunc = userFunc;
     hc->userArgs = userArgs;
 	
 	if(!hc->userFunc){
+		mangoSM_UNLOCK(hc);
 		return MANGO_ERR_APPABORTED;
 	}
 	
@@ -274,29 +427,173 @@ mangoErr_t mango_httpRequestProcess(mangoHttpClient_t* hc, mangoErr_t (*userFunc
 	funcArgs.argType = MANGO_ARG_TYPE_HTTP_REQUEST_READY;
 	hc->userFunc(&funcArgs, hc->userArgs);
 	
-	hc->stats.rxBytes = 0;
-	hc->stats.txBytes = 0;
-	hc->stats.time = mangoPort_timeNow();
-
-	mangoErr_t err;
+	mangoStats_start(hc);
+	
+	if(hc->redirectMax){
+		mangoRedirect_start(hc);
+	}
 	
 	hc->smAPICallArgs = NULL;
 	
-	err = mangoSM_PROCESS(hc, EVENT_APICALL_httpRequestProcess);
+	err = mangoSM_RUN(hc, EVENT_APICALL_httpRequestProcess);
+	
+	if(hc->redirectFollow){
+		err = mangoRedirect_follow(hc, err);
+	}
+	
+	mangoSM_UNLOCK(hc);
+	
 	return err;
 }
 
 
+mangoErr_t mango_httpRedirectSet(mangoHttpClient_t* hc, uint8_t maxHops){
+	MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+	
+	hc->redirectMax = maxHops;
+	if(!maxHops){
+		mangoRedirect_free(hc);
+	}
+	
+	return MANGO_OK;
+}
+
+uint8_t mango_httpRedirectCount(mangoHttpClient_t* hc){
+	MANGO_ENSURE_RET(hc, 0, ("?") );
+	
+	return hc->redirectHops;
+}
+
+const char* mango_httpRedirectLocation(mangoHttpClient_t* hc){
+	MANGO_ENSURE_RET(hc, NULL, ("?") );
+	
+	return hc->redirectHops ? hc->redirectLocation : NULL;
+}
+
+uint8_t mango_httpConnectionReusable(mangoHttpClient_t* hc){
+	MANGO_ENSURE_RET(hc, 0, ("?") );
+	
+	return hc->curState == mangoSM__HTTP_CONNECTED && !hc->httpConnClose;
+}
+
+
+void mango_statsGet(mangoHttpClient_t* hc, mangoStats_t* stats){
+	MANGO_ENSURE_VOID(hc, ("?") );
+	MANGO_ENSURE_VOID(stats, ("?") );
+	
+	memcpy(stats, &hc->stats, sizeof(mangoStats_t));
+}
+
+
+uint32_t mango_ensureFailures(void){
+	return mangoDebug_ensureFailures();
+}
+
+
 mangoErr_t mango_httpDataSend(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen){
+	mangoIovec_t iov;
+	
+	iov.buf = buf;
+	iov.buflen = buflen;
+	
+	return mango_httpDataSendv(hc, &iov, 1);
+}
+
+
+mangoErr_t mango_httpDataSendNB(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen, uint32_t* sent){
 	mangoHTTPDataSendArgs_t HTTPDataSendArgs;
+	mangoIovec_t iov;
+	int32_t space;
 	mangoErr_t err;
 	
-	HTTPDataSendArgs.buf = buf;
-	HTTPDataSendArgs.buflen = buflen;
+	MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+	MANGO_ENSURE_RET(sent, MANGO_ERR, ("?") );
+	
+	*sent = 0;
+	
+	/* 
+	* Ending the body blocks. User transports take the whole buffer, TLS records
+	* cannot be written partially so only what fits in the socket buffer is passed.
+	*/
+	if(!buflen || hc->transport
+#ifdef MANGO_TLS_ENABLED
+	   || hc->tls
+#endif
+	){
+		if(buflen && hc->curState == mangoSM__HTTP_SENDING_DATA && !hc->transport){
+			space = mangoPort_writeSpace(hc->socketfd);
+			if(space == 0){
+				return MANGO_OK;
+			}
+			
+			/* Everything fits, or space < 0 [connection error, reported by the write] */
+			if(space > 0 && (uint32_t) space < buflen){
+				buflen = space;
+			}
+		}
+		
+		err = mango_httpDataSend(hc, buf, buflen);
+		if(err == MANGO_OK){
+			*sent = buflen;
+		}
+		
+		return err;
+	}
+	
+	/* A single write attempt, the ODP keeps the chunk framing state between calls */
+	iov.buf = buf;
+	iov.buflen = buflen;
+	
+	HTTPDataSendArgs.iov = &iov;
+	HTTPDataSendArgs.iovcnt = 1;
+	HTTPDataSendArgs.nonBlocking = 1;
+	HTTPDataSendArgs.sent = 0;
+	
+	err = mangoSM_PROCESS(hc, EVENT_APICALL_httpDataSend, &HTTPDataSendArgs);
+	if(err == MANGO_OK){
+		*sent = HTTPDataSendArgs.sent;
+	}
+	
+	return err;
+}
+
+
+int mango_httpWritableWait(mangoHttpClient_t* hc, uint32_t timeout){
+	MANGO_ENSURE_RET(hc, -1, ("?") );
+	
+	if(hc->transport){
+		return 1;
+	}
+	
+	return mangoPort_poll(hc->socketfd, MANGO_POLL_WRITE, timeout);
+}
+
+
+int mango_socketGet(mangoHttpClient_t* hc){
+	MANGO_ENSURE_RET(hc, -1, ("?") );
+	
+	return hc->transport ? -1 : hc->socketfd;
+}
 
-	hc->smAPICallArgs = &HTTPDataSendArgs;
 
-	err = mangoSM_PROCESS(hc, EVENT_APICALL_httpDataSend);
+mangoErr_t mango_httpDataSendv(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt){
+	mangoHTTPDataSendArgs_t HTTPDataSendArgs;
+	mangoErr_t err;
+	
+	MANGO_ENSURE_RET(iov || !iovcnt, MANGO_ERR, ("?") );
+	
+	HTTPDataSendArgs.iov = iov;
+	HTTPDataSendArgs.iovcnt = iovcnt;
+	HTTPDataSendArgs.nonBlocking = 0;
+	HTTPDataSendArgs.sent = 0;
+
+	err = mangoSM_PROCESS(hc, EVENT_APICALL_httpDataSend, &HTTPDataSendArgs);
+	
+	if(hc->redirectFollow && mangoSM_TRYLOCK(hc)){
+		/* The response to the request body is a redirect */
+		err = mangoRedirect_follow(hc, err);
+		mangoSM_UNLOCK(hc);
+	}
 	
 	return err;
 }
@@ -305,15 +602,63 @@ mangoErr_t mango_httpDataSend(mangoHttpClient_t* hc, uint8_t* buf, uint32_t bufl
 
 
 
+mangoErr_t mango_wsConnect(mangoHttpClient_t* hc, char* URI, char* host, char* protocols, mangoErr_t (*userFunc)(mangoArg_t* userFunc, void* userArgs), void* userArgs){
+	uint8_t nonce[16];
+	char key[25];
+	mangoErr_t err;
+	
+	MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+	
+	if(mangoPort_random(nonce, sizeof(nonce)) < 0){
+		return MANGO_ERR;
+	}
+	mangoCrypto_base64Encode(nonce, sizeof(nonce), key, sizeof(key));
+	
+	err = mango_httpRequestNew(hc, URI, MANGO_HTTP_METHOD_GET);
+	if(err == MANGO_OK){ err = mango_httpHeaderSet(hc, MANGO_HDR__HOST, host); }
+	if(err == MANGO_OK){ err = mango_httpHeaderSet(hc, MANGO_HDR__UPGRADE, "websocket"); }
+	if(err == MANGO_OK){ err = mango_httpHeaderSet(hc, MANGO_HDR__CONNECTION, "Upgrade"); }
+	if(err == MANGO_OK){ err = mango_httpHeaderSet(hc, MANGO_HDR__WEB_SOCKET_KEY, key); }
+	if(err == MANGO_OK){ err = mango_httpHeaderSet(hc, MANGO_HDR__WEB_SOCKET_VERSION, "13"); }
+	if(err == MANGO_OK && protocols){ err = mango_httpHeaderSet(hc, MANGO_HDR__WEB_SOCKET_PROTOCOL, protocols); }
+	if(err != MANGO_OK){
+		return MANGO_ERR_WORKBUFSMALL;
+	}
+	
+	hc->wsProtocols = protocols ? protocols : "";
+	
+	err = mango_httpRequestProcess(hc, userFunc, userArgs);
+	
+	hc->wsProtocols = NULL;
+	
+	return err == MANGO_ERR_HTTP_101 ? MANGO_OK : err;
+}
+
+
+mangoErr_t mango_wsKeepaliveSet(mangoHttpClient_t* hc, uint32_t pingInterval, uint32_t idleTimeout){
+	MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+	
+	hc->wsPingInterval = pingInterval;
+	hc->wsIdleTimeout = idleTimeout;
+	
+	return MANGO_OK;
+}
+
+
+const char* mango_wsProtocolGet(mangoHttpClient_t* hc){
+	MANGO_ENSURE_RET(hc, "", ("?") );
+	
+	return hc->wsProtocol;
+}
+
+
 mangoErr_t mango_wsPoll(mangoHttpClient_t* hc, uint32_t timeout){
 	mangoErr_t err;
 	mangoWSPollArgs_t WSPollArgs;
 	
 	WSPollArgs.timeout = timeout;
 
-	hc->smAPICallArgs = &WSPollArgs;
-
-	err = mangoSM_PROCESS(hc, EVENT_APICALL_wsPoll);
+	err = mangoSM_PROCESS(hc, EVENT_APICALL_wsPoll, &WSPollArgs);
 	
 	return err;
 }
@@ -322,36 +667,213 @@ mangoErr_t mango_wsPoll(mangoHttpClient_t* hc, uint32_t timeout){
 mangoErr_t mango_wsFrameSend(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen, mangoWsFrameType_t type){
 	mangoErr_t err;
 
-	MANGO_ENSURE( (type == MANGO_WS_FRAME_TYPE_TEXT) || (type == MANGO_WS_FRAME_TYPE_BINARY), ("?") );
+	MANGO_ENSURE_RET( (type == MANGO_WS_FRAME_TYPE_TEXT) || (type == MANGO_WS_FRAME_TYPE_BINARY), MANGO_ERR, ("?") );
 	
 	mangoWSFrameSendArgs_t WSFrameSendArgs;
 	
+#if MANGO_WS_TX_QUEUE_SZ > 0
+	if(!mangoSM_TRYLOCK(hc)){
+		/*
+		* Another thread owns the client (for example it is polling),
+		* queue a copy of the frame and let it send it.
+		*/
+		err = mangoWS_queuePush(hc, buf, buflen, type);
+		if(err != MANGO_OK){
+			return err;
+		}
+		
+		/* The owner may have released the client before the frame was queued */
+		if(mangoSM_TRYLOCK(hc)){
+			mangoWS_queueFlush(hc);
+			err = mangoWS_queueError(hc);
+			mangoSM_UNLOCK(hc);
+		}else{
+			mangoWS_queueWakeup(hc);
+		}
+		
+		return err;
+	}
+	
+	/* Frames queued earlier go first, a failure of theirs is reported instead of sending this one */
+	mangoWS_queueFlush(hc);
+	
+	err = mangoWS_queueError(hc);
+	if(err != MANGO_OK){
+		mangoSM_UNLOCK(hc);
+		return err;
+	}
+	
 	WSFrameSendArgs.buf = buf;
 	WSFrameSendArgs.buflen = buflen;
 	WSFrameSendArgs.type = type;
+	WSFrameSendArgs.batch = 0;
 	
 	hc->smAPICallArgs = &WSFrameSendArgs;
 
-	err = mangoSM_PROCESS(hc, EVENT_APICALL_wsFrameSend);
+	err = mangoSM_RUN(hc, EVENT_APICALL_wsFrameSend);
+	
+	mangoSM_UNLOCK(hc);
+#else
+	WSFrameSendArgs.buf = buf;
+	WSFrameSendArgs.buflen = buflen;
+	WSFrameSendArgs.type = type;
+	WSFrameSendArgs.batch = 0;
+	
+	err = mangoSM_PROCESS(hc, EVENT_APICALL_wsFrameSend, &WSFrameSendArgs);
+#endif
+
+	return err;
+}
+
+mangoErr_t mango_wsFrameSendBatch(mangoHttpClient_t* hc, mangoWsFrame_t* frames, uint16_t framesCnt){
+	mangoWSFrameSendArgs_t WSFrameSendArgs;
+	
+	MANGO_ENSURE_RET(frames || !framesCnt, MANGO_ERR, ("?") );
+	
+	WSFrameSendArgs.batch = 1;
+	WSFrameSendArgs.frames = frames;
+	WSFrameSendArgs.framesCnt = framesCnt;
+	
+	return mangoSM_PROCESS(hc, EVENT_APICALL_wsFrameSend, &WSFrameSendArgs);
+}
+
+
+mangoErr_t mango_wsFlush(mangoHttpClient_t* hc){
+	return mango_wsFrameSendBatch(hc, NULL, 0);
+}
+
 
+mangoErr_t mango_wsCoalesceSet(mangoHttpClient_t* hc, uint32_t bufSz, uint32_t flushDelay){
+	mangoErr_t err;
+	
+	MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+	MANGO_ENSURE_RET(!bufSz || bufSz > MANGO_WS_FRAME_HDR_MAX, MANGO_ERR, ("?") );
+	
+	if(!mangoSM_TRYLOCK(hc)){
+		return MANGO_ERR_BUSY;
+	}
+	
+	err = mangoWS_coalesceSet(hc, bufSz, flushDelay);
+	
+	mangoSM_UNLOCK(hc);
+	
 	return err;
 }
 
+mangoErr_t mango_wsViewPin(mangoHttpClient_t* hc, mangoArg_t* view){
+	uint16_t end;
+	
+	MANGO_ENSURE_RET(hc && view, MANGO_ERR, ("?") );
+	
+	if(view->argType < MANGO_ARG_TYPE_WEBSOCKET_DATA_RECEIVED){
+		return MANGO_ERR;
+	}
+	
+	end = 0;
+	if(view->buf){
+		if(view->buf < MANGO_WB_PTR(hc) || view->buf + view->buflen > MANGO_WB_PTR(hc) + MANGO_WB_TOT_SZ(hc)){
+			return MANGO_ERR;
+		}
+		end = (view->buf - MANGO_WB_PTR(hc)) + view->buflen;
+	}
+	
+	/* Called from the callback, the thread that pins owns the client */
+	if(!__atomic_load_n(&hc->wsPinCnt, __ATOMIC_ACQUIRE)){
+		hc->wsPinEnd = 0;
+	}
+	if(end > hc->wsPinEnd){
+		hc->wsPinEnd = end;
+	}
+	__atomic_add_fetch(&hc->wsPinCnt, 1, __ATOMIC_RELEASE);
+	
+	return MANGO_OK;
+}
+
+mangoErr_t mango_wsViewRelease(mangoHttpClient_t* hc, mangoArg_t* view){
+	uint16_t cnt;
+	
+	MANGO_ENSURE_RET(hc && view, MANGO_ERR, ("?") );
+	
+	if(view->argType < MANGO_ARG_TYPE_WEBSOCKET_DATA_RECEIVED){
+		/* Not a websocket view, or already released */
+		return MANGO_ERR;
+	}
+	
+	/* A pinned view lies below the pinned end, which only grows while views are pinned */
+	if(view->buf){
+		if(view->buf < MANGO_WB_PTR(hc) || view->buf + view->buflen > MANGO_WB_PTR(hc) + __atomic_load_n(&hc->wsPinEnd, __ATOMIC_RELAXED)){
+			return MANGO_ERR;
+		}
+	}
+	
+	cnt = __atomic_load_n(&hc->wsPinCnt, __ATOMIC_ACQUIRE);
+	do{
+		if(!cnt){
+			return MANGO_ERR;
+		}
+	}while(!__atomic_compare_exchange_n(&hc->wsPinCnt, &cnt, cnt - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	
+	/* A zeroed view is no websocket view, so releasing it again fails */
+	memset(view, 0, sizeof(mangoArg_t));
+	
+	return MANGO_OK;
+}
+
 mangoErr_t mango_wsClose(mangoHttpClient_t* hc){
 	mangoErr_t err;
 
-	hc->smAPICallArgs = NULL;
-
-	err = mangoSM_PROCESS(hc, EVENT_APICALL_wsClose);
+	err = mangoSM_PROCESS(hc, EVENT_APICALL_wsClose, NULL);
 
 	return err;
 }
 
 
-void mango_disconnect(mangoHttpClient_t* hc){
-	MANGO_ENSURE(hc, ("?") );
+mangoErr_t mango_disconnect(mangoHttpClient_t* hc){
+#if MANGO_WS_TX_QUEUE_SZ > 0
+	uint32_t start;
+#endif
+	
+	MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+	
+#if MANGO_WS_TX_QUEUE_SZ > 0
+	/*
+	* A producer may be flushing the queue, wait until it releases the client.
+	* A client still held after MANGO_DISCONNECT_WAIT_MS (by the calling thread
+	* itself, or by a call that never returns) is left untouched.
+	*/
+	start = mangoPort_timeNow();
+	while(!mangoSM_TRYLOCK(hc)){
+		if(mangoHelper_elapsedTime(start) >= MANGO_DISCONNECT_WAIT_MS){
+			return MANGO_ERR_BUSY;
+		}
+		mangoPort_sleep(1);
+	}
+	
+	mangoWS_queueFree(hc);
+#endif
+	
+	MANGO_METRICS( mangoMetrics_disconnect() );
+	
+	mangoWS_coalesceFree(hc);
+	mangoRedirect_free(hc);
+	
+	if(hc->transport){
+		if(hc->transport->disconnect){
+			hc->transport->disconnect(hc->transportArgs);
+		}
+		mangoPort_free(hc);
+		return MANGO_OK;
+	}
+	
+#ifdef MANGO_TLS_ENABLED
+	if(hc->tls){
+		mangoTLS_disconnect(hc->tls);
+	}
+#endif
 	
 	mangoPort_disconnect(hc->socketfd);
 	
 	mangoPort_free(hc);
+	
+	return MANGO_OK;
 }
@@ -35,12 +35,28 @@
 #define MANGO_HDR__EXPECT    			"Expect"
 #define MANGO_HDR__WEB_SOCKET_PROTOCOL 	"Sec-WebSocket-Protocol"
 #define MANGO_HDR__WEB_SOCKET_KEY 		"Sec-WebSocket-Key"
+#define MANGO_HDR__WEB_SOCKET_ACCEPT 	"Sec-WebSocket-Accept"
+#define MANGO_HDR__WEB_SOCKET_EXTENSIONS	"Sec-WebSocket-Extensions"
 #define MANGO_HDR__UPGRADE 				"Upgrade"
 #define MANGO_HDR__ORIGIN 				"Origin"
 #define MANGO_HDR__WEB_SOCKET_VERSION 	"Sec-WebSocket-Version"
 #define MANGO_HDR__CONNECTION 			"Connection"
 #define MANGO_HDR__WWW_AUTHENTICATE 	"WWW-Authenticate"
 #define MANGO_HDR__AUTHORIZATION 		"Authorization"
+#define MANGO_HDR__RANGE 				"Range"
+#define MANGO_HDR__CONTENT_RANGE 		"Content-Range"
+#define MANGO_HDR__ACCEPT_RANGES 		"Accept-Ranges"
+#define MANGO_HDR__ETAG 				"ETag"
+#define MANGO_HDR__LAST_MODIFIED 		"Last-Modified"
+#define MANGO_HDR__IF_RANGE 			"If-Range"
+#define MANGO_HDR__IF_NONE_MATCH 		"If-None-Match"
+#define MANGO_HDR__IF_MODIFIED_SINCE 	"If-Modified-Since"
+#define MANGO_HDR__CACHE_CONTROL 		"Cache-Control"
+#define MANGO_HDR__EXPIRES 				"Expires"
+#define MANGO_HDR__DATE 				"Date"
+#define MANGO_HDR__VARY 				"Vary"
+#define MANGO_HDR__LOCATION 			"Location"
+#define MANGO_HDR__CONTENT_TYPE 		"Content-Type"
 
 
 /**
@@ -50,13 +66,85 @@
  */
 mangoHttpClient_t*  mango_connect(char* serverIP, uint16_t serverPort);
 
+/**
+ * @brief  Creates a client on top of a user provided transport instead of a socket.
+ *         The transport's read/write functions must follow the semantics of
+ *         mangoPort_read() and mangoPort_write().
+ * @retval A new mangoHttpClient_t instance
+ * @retval NULL         If memory could not be allocated
+ */
+mangoHttpClient_t*  mango_transportConnect(mangoTransport_t* transport, void* transportArgs);
+
+/**
+ * @brief  Creates a client on top of the in-memory loopback transport. Every step of
+ *         the loopback script is replayed after the client writes to the transport
+ *         (for example after the HTTP request headers have been sent), split in
+ *         fragments of at most "fragmentSz" bytes delivered every "delay" miliseconds.
+ *         Useful for offline testing and benchmarking, see mango_loopbackInit().
+ * @retval A new mangoHttpClient_t instance
+ * @retval NULL         If memory could not be allocated
+ */
+mangoHttpClient_t*  mango_loopbackConnect(mangoLoopback_t* loopback);
+
+/**
+ * @brief  Initializes a loopback transport with the specified script. When the whole script
+ *         has been replayed the next client write restarts it from the first step, unless
+ *         "closeOnEnd" is set in which case the connection is reported as closed.
+ */
+void                mango_loopbackInit(mangoLoopback_t* loopback, mangoLoopbackStep_t* steps, uint16_t stepsCnt, uint16_t fragmentSz, uint32_t delay, uint8_t closeOnEnd);
+
+/**
+ * @brief  Initializes the TLS layer. Should be called once before any mango_tlsConnect() call,
+ *         else the TLS layer is initialized using the system's default trust store. If it fails, later
+ *         mango_tlsConnect() calls fail too until a mango_tlsInit() call succeeds. Thread safe.
+ * @param  caFile PEM file with the trusted CA certificates or NULL for the system's default trust store
+ * @retval MANGO_OK     if the TLS layer was initialized
+ * @retval MANGO_ERR    if the CA file could not be loaded or mango was built without TLS support
+ */
+mangoErr_t          mango_tlsInit(char* caFile);
+
+/**
+ * @brief  Connects to the specified HTTPS Server. The server certificate is verified against
+ *         "serverName" (or "serverIP" if "serverName" is NULL), which is also sent as SNI.
+ *         If a session with "serverName:serverPort" has been cached from a previous connection
+ *         it is resumed instead of doing a full handshake.
+ * @retval A new mangoHttpClient_t instance if the TLS conenction was established
+ * @retval NULL         If the conenction or the TLS handshake failed or mango was built without TLS support
+ */
+mangoHttpClient_t*  mango_tlsConnect(char* serverIP, uint16_t serverPort, char* serverName);
+
+/**
+ * @brief  Returns 1 if the TLS connection was established by resuming a cached session
+ */
+uint8_t             mango_tlsSessionResumed(mangoHttpClient_t* hc);
+
+/**
+ * @brief  Drops all the cached TLS sessions, the next connections will do a full handshake
+ */
+void                mango_tlsSessionCacheFlush(void);
+
 /**
  * @brief  Creates an new HTTP request
+ *
+ *         Whether the request has a body is decided by its headers: a "Content-Length" or a
+ *         "Transfer-Encoding" header makes mango_httpRequestProcess() return MANGO_ERR_HTTP_100
+ *         so the body can be sent with mango_httpDataSend(), for any method. POST and PUT
+ *         requests must have one of them. MANGO_HTTP_METHOD_POST_CHUNKED is a POST that
+ *         already carries "Transfer-Encoding: chunked".
+ *
  * @retval MANGO_OK    if the request created succesfully succesfully
  * @retval errorcode   If the request creation failed due to memory limitation or other factor 
  */
 mangoErr_t          mango_httpRequestNew(mangoHttpClient_t* hc, char* URI, mangoHttpMethod_e method);
 
+/**
+ * @brief  Creates an new HTTP request with any method [for example "PROPFIND" or "PURGE"],
+ *         the body is handled as in mango_httpRequestNew().
+ * @retval MANGO_OK    if the request created succesfully
+ * @retval MANGO_ERR   If "method" is not a valid token or the request does not fit in the WB
+ */
+mangoErr_t          mango_httpRequestNewCustom(mangoHttpClient_t* hc, char* URI, char* method);
+
 /**
  * @brief  Adds Basic Access Auhtentication specific headers to the new HTTP request
  */
@@ -88,11 +176,85 @@ mangoErr_t          mango_httpHeaderGet(char* response, char* headerName, char*
  * @brief   Starts the processing of the HTTP request.
  *          
  * @return  [MANGO_ERR_HTTP_100, MANGO_ERR_HTTP_599] status codes indicate that a HTTP response was received
- *          and the HTTP conenction is healthy (meaning that a new HTTP request could be issued using the same
- *          open connection). Else an errorcode indicating the failure reason is returned.
+ *          and the HTTP conenction is healthy. A new HTTP request can be issued using the same open
+ *          connection if mango_httpConnectionReusable() says so, else it fails with MANGO_ERR_CONNECTION.
+ *          Else an errorcode indicating the failure reason is returned.
  */
 mangoErr_t          mango_httpRequestProcess(mangoHttpClient_t* hc, mangoErr_t (*userFunc)(mangoArg_t* mangoArgs, void* userArgs), void* userArgs);
 
+/**
+ * @brief   Returns 1 if a new HTTP request can be issued over the connection, 0 if the client
+ *          should be disconnected (and a new connection opened). Connections are not reusable
+ *          after an error, after "Connection: close" or an HTTP/1.0 response without
+ *          "Connection: keep-alive", and after a body delimited by the connection close.
+ */
+uint8_t             mango_httpConnectionReusable(mangoHttpClient_t* hc);
+
+/**
+ * @brief   Follows up to "maxHops" 301/302/303/307/308 redirects per request [0, the default,
+ *          returns them to the application]. Followed redirects are not given to the application,
+ *          the request is sent again to the Location, over the same connection if it has the
+ *          same origin and is still open, else the client is connected to the new location
+ *          (the hostname is resolved). 303 turns the method into GET [HEAD is kept], 301/302
+ *          turn POST into GET, 307/308 keep it. The request body is not kept, so a redirect
+ *          that needs it is returned to the application, as are redirects over user transports
+ *          to another origin. Authorization and Cookie headers are dropped on another origin.
+ */
+mangoErr_t          mango_httpRedirectSet(mangoHttpClient_t* hc, uint8_t maxHops);
+
+/**
+ * @brief   Number of redirects followed by the last request
+ */
+uint8_t             mango_httpRedirectCount(mangoHttpClient_t* hc);
+
+/**
+ * @brief   Location of the last redirect followed by the last request, NULL if none
+ */
+const char*         mango_httpRedirectLocation(mangoHttpClient_t* hc);
+
+/**
+ * @brief   Copies the stats of the last (or current) HTTP request to "stats". The same stats
+ *          are also given to the application through the callback function with a
+ *          MANGO_ARG_TYPE_HTTP_STATS argument when the request completes or fails. Comparing
+ *          the timestamps [microseconds] gives the connect time (connectEnd - connectStart), the
+ *          server time (firstByte - headersSent) and the transfer time (bodyComplete - firstByte).
+ */
+void                mango_statsGet(mangoHttpClient_t* hc, mangoStats_t* stats);
+
+/**
+ * @brief   Copies the most recent state machine trace entries of the client to "entries",
+ *          oldest first. See MANGO_TRACE_RING_SZ. It may be called from any thread while
+ *          the client runs, the copy is retried until no event was recorded meanwhile.
+ * @return  The number of entries copied (0 if tracing is disabled)
+ */
+uint16_t            mango_traceGet(mangoHttpClient_t* hc, mangoTraceEntry_t* entries, uint16_t maxEntries);
+
+/**
+ * @brief   Prints the state machine trace ring of the client, oldest entry first
+ */
+void                mango_traceDump(mangoHttpClient_t* hc);
+
+/**
+ * @brief   Writes the process wide metrics of all the clients (connections, requests by status class,
+ *          bytes, timeouts, errors by error code, connect/request latency histograms) to "buf" in the
+ *          Prometheus text exposition format. See MANGO_METRICS_ENABLED.
+ * @retval  >= 0    The length of the text written to "buf" (null terminated)
+ * @retval  < 0     "buf" was too small (~16 Kb are needed) or the metrics are disabled
+ */
+int                 mango_metricsExport(char* buf, uint32_t buflen);
+
+/**
+ * @brief   Zeroes all the process wide metrics
+ */
+void                mango_metricsReset(void);
+
+/**
+ * @brief   Returns the number of internal consistency checks that failed since the
+ *          process started. Only meaningful with MANGO_ENSURE_RECOVERABLE set, else
+ *          the first failed check halts.
+ */
+uint32_t            mango_ensureFailures(void);
+
 /**
  * @brief   In case of POST/PUT HTTP requests this function sends the HTTP body of the request. When the 
  *          whole HTTP body has been sent this function should be called again with "buf" NULL and "buflen" 0 
@@ -115,20 +277,155 @@ mangoErr_t          mango_httpRequestProcess(mangoHttpClient_t* hc, mangoErr_t (
  */
 mangoErr_t 			mango_httpDataSend(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen);
 
+/**
+ * @brief   Same as mango_httpDataSend() for a body piece made of the "iovcnt" buffers of "iov", sent
+ *          in order. Over a socket they are written with one writev() per MANGO_SOCKET_IOV_MAX
+ *          buffers, in a CHUNKED request every MANGO_SOCKET_IOV_MAX - 2 buffers make one chunk. Calling it with a total length
+ *          of 0 (for example "iovcnt" 0) is the same as calling mango_httpDataSend() with "buf"
+ *          NULL and "buflen" 0.
+ */
+mangoErr_t 			mango_httpDataSendv(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt);
+
+/**
+ * @brief   Non-blocking mango_httpDataSend(): only the part of "buf" the socket can take right now
+ *          is sent, with a single write, and its length is stored to "sent" [0 if the socket buffer
+ *          is full]. The rest should be offered again when the connection is writable, see
+ *          mango_httpWritableWait() or mango_socketGet(). In a CHUNKED request a partially written
+ *          chunk is finished by the next calls, so they must continue with the unsent data. Over
+ *          TLS the socket buffer space is an estimation and user transports take the whole buffer.
+ *          Ending the body ("buf" NULL, "buflen" 0) blocks until the response is received, as
+ *          mango_httpDataSend() does.
+ *
+ * @retval MANGO_OK     Some (or no) data were sent, check "sent"
+ * @retval errorcode    As mango_httpDataSend()
+ */
+mangoErr_t 			mango_httpDataSendNB(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen, uint32_t* sent);
+
+/**
+ * @brief   Waits until the connection accepts data [mango_httpDataSendNB()] or until the "timeout"
+ *          [miliseconds] expires. Connections over user transports are always writable.
+ *
+ * @retval  > 0     The connection is writable
+ * @retval  0       Timeout expired
+ * @retval  < 0     Connection error
+ */
+int 				mango_httpWritableWait(mangoHttpClient_t* hc, uint32_t timeout);
+
+/**
+ * @brief   Returns the socket of the connection so it can be watched by the application event
+ *          loop (select(), poll(), epoll...), for example to interleave mango_httpDataSendNB()
+ *          uploads to many servers from one thread. Returns -1 for user transports. The socket
+ *          must only be polled, reading or writing it breaks the connection.
+ */
+int 				mango_socketGet(mangoHttpClient_t* hc);
+
+/**
+ * @brief   Makes the new HTTP request (a POST or PUT without "Content-Length" / "Transfer-Encoding"
+ *          headers) a multipart/form-data one made of the "partsCnt" parts of "parts". The
+ *          Content-Type header is added, and the Content-Length when the length of every part is
+ *          known [memory parts, "len" bytes of a file, regular files], else the body is CHUNKED.
+ *
+ *          mango_httpRequestProcess() returns MANGO_ERR_HTTP_100 as for any body, then the
+ *          application calls mango_httpDataSend() with "buf" NULL and "buflen" 0: all the parts are
+ *          sent and the response status is returned. File parts are sent with sendfile() over plain
+ *          sockets, "parts" and their buffers/files must stay valid until then.
+ *
+ * @retval MANGO_OK    if the headers were added
+ * @retval MANGO_ERR   if a part is invalid (no name, quotes or CR/LF in its name or filename) or
+ *                     the headers do not fit in the working buffer
+ */
+mangoErr_t 			mango_httpMultipartSet(mangoHttpClient_t* hc, mangoMultipartPart_t* parts, uint16_t partsCnt);
+
+/**
+ * @brief   Upgrades the connection to websockets. The upgrade request (Host, Upgrade, Connection,
+ *          Sec-WebSocket-Version and a random Sec-WebSocket-Key) is built and sent, and the
+ *          response is verified (Sec-WebSocket-Accept, Upgrade, no extensions and, if "protocols"
+ *          is not NULL, a subprotocol among the offered ones).
+ *
+ *          Upgrades built manually with mango_httpHeaderSet() are verified the same way, except
+ *          for the subprotocol and extensions which are left to the application.
+ *
+ * @param   protocols   Comma separated list of offered subprotocols (e.g. "chat, superchat"),
+ *                      or NULL. The selected one is returned by mango_wsProtocolGet().
+ *
+ * @retval MANGO_OK     The connection was upgraded, websocket functions can be used
+ * @retval MANGO_ERR_WSHANDSHAKE    The server replied 101 with an invalid handshake
+ * @retval errorcode    Upgrade failed. [MANGO_ERR_HTTP_100, MANGO_ERR_HTTP_599] status codes
+ *                      mean that the server did not switch protocols.
+ */
+mangoErr_t 			mango_wsConnect(mangoHttpClient_t* hc, char* URI, char* host, char* protocols, mangoErr_t (*userFunc)(mangoArg_t* userFunc, void* userArgs), void* userArgs);
+
+/**
+ * @brief   Returns the subprotocol selected by the server during the websocket upgrade,
+ *          or an empty string if none was selected.
+ */
+const char* 		mango_wsProtocolGet(mangoHttpClient_t* hc);
+
+/**
+ * @brief   Configures the websocket keepalive, which runs while the application is in mango_wsPoll().
+ *          A ping is sent every "pingInterval" miliseconds and the round trip of the answered ones
+ *          is reported in mangoStats_t.wsRtt [mango_statsGet()]. When nothing (data or pongs) was
+ *          received for "idleTimeout" miliseconds the connection is considered dead and
+ *          mango_wsPoll() fails with MANGO_ERR_WSIDLETIMEOUT. 0 disables either of them.
+ *          Defaults are MANGO_WS_PING_INTERVAL_MS and MANGO_WS_IDLE_TIMEOUT_MS.
+ *
+ * @retval MANGO_OK     Keepalive configured
+ */
+mangoErr_t 			mango_wsKeepaliveSet(mangoHttpClient_t* hc, uint32_t pingInterval, uint32_t idleTimeout);
+
 /**
  * @brief   In case of websockets, blocks for the specified amount of time (miliseconds) waiting for
- *          any received data and control (Ping, Close) frames. These frames are provided to the
- *          application through the callback function.
+ *          any received data and control (Ping, Pong, Close) frames. These frames are provided to the
+ *          application through the callback function as views of the working buffer: "buf"/"buflen"
+ *          (not null terminated), "opcode", "fin", "frameID" and, for Close, "closeCode". A view
+ *          is valid until the callback returns unless it is pinned with mango_wsViewPin().
  * @retval MANGO_OK     Websocket connection is healthy
+ * @retval MANGO_ERR_WSPINNED   Pinned views leave no room for the next frame, the connection
+ *                      is still usable once they are released [mango_wsViewRelease()]
  * @retval errorcode    Websocket connection has been closed or encoutered an error. 
                         In this case the application should call mango_disconnect().
  */
 mangoErr_t 			mango_wsPoll(mangoHttpClient_t* hc, uint32_t timeout);
 
+/**
+ * @brief   Keeps a websocket view received in the callback valid after the callback returns,
+ *          so the application does not have to copy it. Must be called from the callback.
+ *          The working buffer space of pinned views is not reused, so views should be released
+ *          [mango_wsViewRelease()] as soon as possible. Frames bigger than the remaining space
+ *          are delivered in pieces, or wait for the release if they would fit the whole buffer.
+ *
+ * @retval MANGO_OK     The view stays valid until it is released or the client is disconnected
+ * @retval MANGO_ERR    "view" is not a websocket view of this client
+ */
+mangoErr_t 			mango_wsViewPin(mangoHttpClient_t* hc, mangoArg_t* view);
+
+/**
+ * @brief   Releases a view pinned with mango_wsViewPin(). Can be called from any thread.
+ *          The space is reclaimed once all pinned views are released. "view" is the pinned
+ *          view (or a copy of it) and is zeroed on success.
+ *
+ * @retval MANGO_OK     The view was released
+ * @retval MANGO_ERR    "view" is not a pinned view of this client, or it was already released
+ */
+mangoErr_t 			mango_wsViewRelease(mangoHttpClient_t* hc, mangoArg_t* view);
+
 /**
  * @brief   In case of websockets, this function is used to send a new data frame to the remote server
  *
- * @retval MANGO_OK     Frame transmition succeed
+ *          A client is driven by one thread at a time; every other API call made while it is in
+ *          use by another thread fails with MANGO_ERR_BUSY. mango_wsFrameSend() is the exception:
+ *          it may be called from any thread, for example while another thread is blocked in
+ *          mango_wsPoll(). The frame is then copied to the client's outbound queue
+ *          [MANGO_WS_TX_QUEUE_SZ] and sent by the thread owning the client, in order; a thread
+ *          blocked in mango_wsPoll() is woken up to send it right away. MANGO_OK
+ *          only means that the frame was queued. If a queued frame fails when it is sent
+ *          by another call than mango_wsPoll(), the error is returned by the next
+ *          mango_wsPoll() / mango_wsFrameSend() call of the thread owning the client
+ *          (which then does not send its own frame). mango_disconnect() must not be called
+ *          while other threads may still call mango_wsFrameSend().
+ *
+ * @retval MANGO_OK     Frame transmition succeed (or frame queued)
+ * @retval MANGO_ERR_QUEUEFULL  The client is in use and its outbound queue is full
  * @retval errorcode    Frame transmition failed, connection might be closed.
  *                      In this case the application should call mango_disconnect().
  */
@@ -144,11 +441,108 @@ mangoErr_t 			mango_wsFrameSend(mangoHttpClient_t* hc, uint8_t* buf, uint32_t bu
  */
 mangoErr_t 			mango_wsClose(mangoHttpClient_t* hc);
 
+/**
+ * @brief   In case of websockets, sends "framesCnt" data frames with a single write. Frames
+ *          coalesced earlier [mango_wsCoalesceSet()] are written first.
+ *
+ * @retval MANGO_OK     Frames transmition succeed
+ * @retval errorcode    Frames transmition failed, connection might be closed.
+ *                      In this case the application should call mango_disconnect().
+ */
+mangoErr_t 			mango_wsFrameSendBatch(mangoHttpClient_t* hc, mangoWsFrame_t* frames, uint16_t framesCnt);
+
+/**
+ * @brief   Enables (bufSz > 0) or disables (bufSz 0) the coalescing of data frames. While enabled
+ *          mango_wsFrameSend() builds the frames into a "bufSz" bytes buffer, which is written when
+ *          full, when a control frame is sent, on mango_wsFlush() and at the latest "flushDelay"
+ *          miliseconds after its first frame. The deadline is checked on every send and while
+ *          the application is in mango_wsPoll(); frames may stay buffered if neither happens.
+ *          Frames bigger than the buffer are sent right away.
+ *
+ * @retval MANGO_OK     Coalescing configured (anything buffered was flushed)
+ */
+mangoErr_t 			mango_wsCoalesceSet(mangoHttpClient_t* hc, uint32_t bufSz, uint32_t flushDelay);
+
+/**
+ * @brief   In case of websockets, writes any coalesced frames
+ *
+ * @retval MANGO_OK     Frames transmition succeed (or nothing to send)
+ * @retval errorcode    Frames transmition failed, the application should call mango_disconnect().
+ */
+mangoErr_t 			mango_wsFlush(mangoHttpClient_t* hc);
+
 
 /**
  * @brief   Closes any active HTTP connection and releases any memory resources
+ *
+ *          Every other thread must be done with the client first, in particular the producers
+ *          calling mango_wsFrameSend() must be stopped. A frame they are still flushing is
+ *          waited for up to MANGO_DISCONNECT_WAIT_MS. It must not be called from a mango callback,
+ *          or by a thread that is still inside another call of the same client.
+ *
+ * @retval MANGO_OK         The client was released
+ * @retval MANGO_ERR_BUSY   The client is still in use after MANGO_DISCONNECT_WAIT_MS, nothing was released
+ */
+mangoErr_t          mango_disconnect(mangoHttpClient_t* hc);
+
+/**
+ * @brief   Downloads "dl->URI" to the file "dl->path". Unless "dl->fileSz" is given, a HEAD
+ *          request finds the size. If the server accepts byte ranges the file is split in
+ *          "segmentSz" segments, which are fetched with Range requests over "connections"
+ *          parallel connections (each one reused for many segments) and written at their
+ *          offsets. A segment that fails is requested again from where it stopped, up to
+ *          "retries" times [MANGO_DOWNLOAD_NO_RETRY for none]. Without range support, or if
+ *          the size is unknown, the file is fetched with a single GET.
+ *          Blocks until the download completes or fails. Needs MANGO_OS_ENV__UNIX.
+ *
+ *          With "dl->resume" set the progress of every segment, together with the ETag or
+ *          Last-Modified validator of the file, is kept in the sidecar file "<path>.mango".
+ *          A later call for the same path continues from there, every Range request carries
+ *          an If-Range with the validator. If the file changed on the server the checkpoint
+ *          is dropped and the download starts over. The sidecar is removed on success.
+ *
+ * @retval MANGO_OK     The whole file was written
+ * @retval errorcode    The download failed [for example a segment failed "retries" + 1 times]
+ */
+mangoErr_t          mango_download(mangoDownload_t* dl);
+
+/**
+ * @brief   Creates a response cache of up to "maxBytes" bytes (least recently used responses
+ *          are evicted first). If "dir" is not NULL the responses are stored there, one file
+ *          per response mapped in memory (MANGO_OS_ENV__UNIX only), and the responses of
+ *          previous runs are loaded. They are revalidated before they are used again.
+ *
+ * @retval  NULL on failure
+ */
+mangoCache_t*       mango_cacheCreate(uint32_t maxBytes, char* dir);
+
+/**
+ * @brief   Same as mango_httpRequestProcess(), but GET responses are served from and stored
+ *          to "cache". A fresh response (Cache-Control max-age or Expires) is given to the
+ *          application without contacting the server. A stale one is revalidated with
+ *          If-None-Match/If-Modified-Since, and served from the cache if the server answers
+ *          304 [the headers of the 304 update the stored ones]. Responses with "Cache-Control:
+ *          no-store" or "private", a Vary header or a body bigger than MANGO_CACHE_ENTRY_MAX_SZ
+ *          are not stored. The cache is shared, so a request with an Authorization header is
+ *          always sent to the server and its response is stored only if it is marked public,
+ *          s-maxage or must-revalidate. Other methods are passed through.
+ *          A response served without contacting the server reports no HTTP_STATS.
+ *
+ * @retval  Same as mango_httpRequestProcess(), a response served from the cache returns its
+ *          stored status [MANGO_ERR_HTTP_200]
+ */
+mangoErr_t 			mango_httpRequestProcessCached(mangoHttpClient_t* hc, mangoCache_t* cache, mangoErr_t (*userFunc)(mangoArg_t* mangoArgs, void* userArgs), void* userArgs);
+
+/**
+ * @brief   Copies the counters of the cache.
+ */
+void                mango_cacheStatsGet(mangoCache_t* cache, mangoCacheStats_t* stats);
+
+/**
+ * @brief   Frees the cache. Files of a disk cache are kept for the next run.
+ *          No request may be using the cache.
  */
-void                mango_disconnect(mangoHttpClient_t* hc);
+void                mango_cacheDestroy(mangoCache_t* cache);
 
 
 
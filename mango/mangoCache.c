@@ -0,0 +1,1235 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+/*
+ * Response cache.
+ *
+ * Entries are kept in a LRU list keyed by Host + URI. The lock only covers
+ * the list: a request that uses an entry takes a reference on it, so the
+ * entry may be evicted while it is being delivered and it is freed by the
+ * last user. Stored entries are never modified apart from their freshness.
+ *
+ * Disk entries live in one file each [header, key, response headers, body]
+ * which is mapped read-only. Files are written under a temporary name and
+ * renamed, so a file is either complete or absent. Their freshness is not
+ * stored, entries loaded from disk are revalidated on their first use.
+ *
+ * No system call is made under the spinlock. Evicted entries are collected
+ * while it is held and their files are removed (and their memory freed)
+ * once it is released, see mangoCache_reap(). The renames and removals of a
+ * disk cache are serialized by a mutex, so the file of an evicted entry is
+ * always removed before a new file of the same key takes its name.
+ *
+ * The cache is shared by all the clients: a request with Authorization is
+ * not served from it, and its response is only stored if the server allows
+ * it [public, s-maxage, must-revalidate]. "private" responses are not stored.
+*/
+
+#ifdef MANGO_OS_ENV__UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define MANGO_CACHE_FILE_MAGIC		(0x4D474346)
+#define MANGO_CACHE_FILE_EXT		".mc"
+#define MANGO_CACHE_VALIDATOR_SZ	(128)
+#define MANGO_CACHE_CONTROL_SZ		(256)	/* Longer Cache-Control values get the most restrictive handling */
+#define MANGO_CACHE_FIELD_NAME_SZ	(64)
+
+typedef struct mangoCacheEntry_t mangoCacheEntry_t;
+
+struct mangoCacheEntry_t{
+	mangoCacheEntry_t*	prev;		/* LRU list, most recently used first */
+	mangoCacheEntry_t*	next;
+	uint32_t			refs;		/* Requests using the entry */
+	uint8_t				evicted;	/* Freed when the last reference is dropped */
+	mangoCacheEntry_t*	dead;		/* Next evicted entry to reap */
+
+	char*				key;
+	char*				etag;		/* NULL if the response had none */
+	char*				lastModified;
+
+	char*				headers;	/* '\0' terminated */
+	uint16_t			headersLen;
+	uint16_t			statusCode;
+	uint8_t*			body;
+	uint32_t			bodyLen;
+	uint32_t			size;		/* Bytes accounted against the cache size */
+
+	uint32_t			storedAt;	/* When the response was stored or last revalidated */
+	uint32_t			maxAge;		/* Freshness lifetime [ms], 0 if it has to be revalidated */
+
+	void*				map;		/* Disk entry mapping, NULL for memory entries */
+	uint32_t			mapSz;
+};
+
+struct mangoCache_t{
+	volatile int		lock;
+	uint32_t			maxBytes;
+	char*				dir;		/* NULL for a memory only cache */
+	uint32_t			tmpCnt;		/* Unique temporary file names */
+#ifdef MANGO_OS_ENV__UNIX
+	pthread_mutex_t		fileLock;	/* Renames and removals of the files of a disk cache */
+#endif
+	mangoCacheEntry_t*	head;
+	mangoCacheEntry_t*	tail;
+	mangoCacheStats_t	stats;
+};
+
+/*
+ * Disk entry header
+*/
+typedef struct{
+	uint32_t			magic;
+	uint32_t			bodyLen;
+	uint16_t			keyLen;
+	uint16_t			headersLen;
+	uint16_t			statusCode;
+	uint16_t			reserved;
+}mangoCacheFile_t;
+
+/*
+ * A request going through the cache, the arguments of mangoCache_callback()
+*/
+typedef struct{
+	mangoCacheEntry_t*	entry;		/* Entry being revalidated, NULL if none */
+	mangoErr_t			(*userFunc)(mangoArg_t* mangoArgs, void* userArgs);
+	void*				userArgs;
+
+	uint8_t				notModified;	/* 304 received, the entry is delivered */
+	uint8_t				statsHeld;		/* HTTP_STATS is reported after the entry */
+	uint8_t				freshness;		/* The 304 carried freshness information */
+	uint8_t				store;			/* The response is being captured */
+	uint8_t				authorized;		/* The request carries Authorization */
+	uint32_t			maxAge;
+
+	char*				headers;		/* Captured 200 or 304 headers */
+	uint16_t			headersLen;
+	uint8_t*			body;
+	uint32_t			bodyLen;
+	uint32_t			bodySz;
+}mangoCacheRequest_t;
+
+
+static void mangoCache_acquire(mangoCache_t* cache){
+	while(__sync_lock_test_and_set(&cache->lock, 1)){};
+}
+
+static void mangoCache_release(mangoCache_t* cache){
+	__sync_lock_release(&cache->lock);
+}
+
+
+/* -----------------------------------------------------------------------------------------------------------------
+| HEADER PARSING
+----------------------------------------------------------------------------------------------------------------- */
+
+/*
+* Searches a Cache-Control directive. Returns 1 if found, the value of a
+* "directive=<seconds>" is copied to "value".
+*/
+static int mangoCache_directiveGet(char* list, char* directive, uint32_t* value){
+	uint16_t directivelen;
+	char* end;
+
+	directivelen = strlen(directive);
+
+	while(*list){
+		while(*list == ' ' || *list == '\t' || *list == ','){list++;}
+
+		if(strncasecmp(list, directive, directivelen) == 0){
+			end = list + directivelen;
+			if(*end == '\0' || *end == ',' || *end == ' '){
+				*value = 0;
+				return 1;
+			}
+			if(*end == '='){
+				end++;
+				if(*end == '"'){ end++; }
+				*value = 0;
+				while(*end >= '0' && *end <= '9'){
+					*value = *value > 0x0FFFFFFF ? 0xFFFFFFFF : *value * 10 + (*end - '0');
+					end++;
+				}
+				return 1;
+			}
+		}
+
+		while(*list && *list != ','){list++;}
+	}
+
+	return 0;
+}
+
+/*
+* Converts an IMF-fixdate ["Sun, 06 Nov 1994 08:49:37 GMT"] to seconds since
+* the epoch. Returns 0 if the date is invalid.
+*/
+static uint32_t mangoCache_dateParse(char* date){
+	static const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	unsigned int day, year, hour, minute, second;
+	char month[4];
+	char* ptr;
+	uint32_t m;
+	uint32_t days;
+	uint32_t y;
+
+	if(sscanf(date, "%*[^,], %u %3s %u %u:%u:%u GMT", &day, month, &year, &hour, &minute, &second) != 6){
+		return 0;
+	}
+
+	ptr = strstr(months, month);
+	if(!ptr || strlen(month) != 3 || year < 1970 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60){
+		return 0;
+	}
+	m = (ptr - months) / 3 + 1;
+
+	/* Days from civil date, March based years */
+	y = m <= 2 ? year - 1 : year;
+	days = y * 365 + y / 4 - y / 100 + y / 400 + (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + day - 1 - 719468;
+
+	return days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+/*
+* Freshness lifetime of a response [ms]. Returns 1 if the headers carry
+* freshness information (Cache-Control or Expires), 0 otherwise.
+*/
+static int mangoCache_freshness(char* headers, uint32_t* maxAge){
+	char headerValueBuf[MANGO_CACHE_CONTROL_SZ];
+	mangoErr_t err;
+	uint32_t expires;
+	uint32_t date;
+	uint32_t value;
+
+	*maxAge = 0;
+
+	err = mango_httpHeaderGet(headers, MANGO_HDR__CACHE_CONTROL, headerValueBuf, sizeof(headerValueBuf));
+	if(err == MANGO_ERR_TEMPBUFSMALL){
+		/* Directives that cannot be read, revalidate on every use */
+		return 1;
+	}
+	if(err == MANGO_OK){
+		if(mangoCache_directiveGet(headerValueBuf, "no-cache", &value) || mangoCache_directiveGet(headerValueBuf, "no-store", &value)){
+			return 1;
+		}
+		/* s-maxage overrides max-age in a shared cache */
+		if(mangoCache_directiveGet(headerValueBuf, "s-maxage", &value) || mangoCache_directiveGet(headerValueBuf, "max-age", &value)){
+			*maxAge = value > 0x7FFFFFFF / 1000 ? 0x7FFFFFFF : value * 1000;
+			return 1;
+		}
+	}
+
+	if(mango_httpHeaderGet(headers, MANGO_HDR__EXPIRES, headerValueBuf, sizeof(headerValueBuf)) == MANGO_OK){
+		/* Both dates are server ones, no clock skew. An invalid date means expired */
+		expires = mangoCache_dateParse(headerValueBuf);
+		if(mango_httpHeaderGet(headers, MANGO_HDR__DATE, headerValueBuf, sizeof(headerValueBuf)) == MANGO_OK){
+			date = mangoCache_dateParse(headerValueBuf);
+			if(expires && date && expires > date){
+				*maxAge = expires - date > 0x7FFFFFFF / 1000 ? 0x7FFFFFFF : (expires - date) * 1000;
+			}
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+* Decides if a 200 response may be stored, and its freshness lifetime.
+* "authorized" is set if the request carried Authorization.
+*/
+static int mangoCache_storable(char* headers, uint8_t authorized, uint32_t* maxAge){
+	char headerValueBuf[MANGO_CACHE_CONTROL_SZ];
+	mangoErr_t err;
+	uint32_t value;
+
+	err = mango_httpHeaderGet(headers, MANGO_HDR__CACHE_CONTROL, headerValueBuf, sizeof(headerValueBuf));
+	if(err == MANGO_ERR_TEMPBUFSMALL){
+		/* It may say no-store or private */
+		return 0;
+	}
+
+	if(err == MANGO_OK &&
+	   (mangoCache_directiveGet(headerValueBuf, "no-store", &value) || mangoCache_directiveGet(headerValueBuf, "private", &value))){
+		return 0;
+	}
+
+	/* Authenticated responses are shared only if the server says so [RFC 7234 3.2] */
+	if(authorized &&
+	   (err != MANGO_OK ||
+	    (!mangoCache_directiveGet(headerValueBuf, "public", &value) &&
+	     !mangoCache_directiveGet(headerValueBuf, "s-maxage", &value) &&
+	     !mangoCache_directiveGet(headerValueBuf, "must-revalidate", &value)))){
+		return 0;
+	}
+
+	/* Variants are not kept apart, they are not stored at all */
+	if(mango_httpHeaderGet(headers, MANGO_HDR__VARY, NULL, 0) != MANGO_ERR){
+		return 0;
+	}
+
+	if(mango_httpHeaderGet(headers, MANGO_HDR__CONTENT_LENGTH, headerValueBuf, sizeof(headerValueBuf)) == MANGO_OK &&
+	   (mangoHelper_decstr2dec(headerValueBuf, &value) || value > MANGO_CACHE_ENTRY_MAX_SZ)){
+		return 0;
+	}
+
+	mangoCache_freshness(headers, maxAge);
+
+	/* Without freshness or a validator the response cannot be reused */
+	return *maxAge ||
+	       mango_httpHeaderGet(headers, MANGO_HDR__ETAG, NULL, 0) != MANGO_ERR ||
+	       mango_httpHeaderGet(headers, MANGO_HDR__LAST_MODIFIED, NULL, 0) != MANGO_ERR;
+}
+
+/*
+* Copies the name of the header field starting at "line" to "name".
+* Returns 0 if the line is not a field or the name does not fit.
+*/
+static int mangoCache_fieldName(char* line, char* name, uint16_t namelen){
+	uint16_t len;
+
+	for(len = 0; line[len] != ':'; len++){
+		if(line[len] == '\r' || line[len] == '\0' || len + 1 >= namelen){
+			return 0;
+		}
+	}
+
+	memcpy(name, line, len);
+	name[len] = '\0';
+
+	/* No trailing spaces, mangoHelper_httpHeaderGet() skips them */
+	while(len && name[len - 1] == ' '){ name[--len] = '\0'; }
+
+	return len != 0;
+}
+
+/*
+* Fields a 304 does not update, they describe the connection or the framing
+* of the 304 itself.
+*/
+static int mangoCache_fieldKept(char* name){
+	return strcasecmp(name, MANGO_HDR__CONTENT_LENGTH) == 0 ||
+	       strcasecmp(name, MANGO_HDR__TRANSFER_ENCODING) == 0 ||
+	       strcasecmp(name, MANGO_HDR__CONNECTION) == 0 ||
+	       strcasecmp(name, "Keep-Alive") == 0;
+}
+
+/*
+* Headers of a stored response updated with the ones of a 304 [RFC 7234 4.3.4]:
+* the fields the 304 carries replace the stored ones of the same name.
+* The block ends like the ones the state machine delivers, its last CRLF
+* trimmed to "\0\n". Returns it to be freed by the caller, NULL on failure.
+*/
+static char* mangoCache_headersMerge(char* stored, char* update){
+	char name[MANGO_CACHE_FIELD_NAME_SZ];
+	char* merged;
+	char* line;
+	char* end;
+	char* ptr;
+
+	merged = mangoPort_malloc(strlen(stored) + strlen(update) + 3);
+	if(!merged){
+		return NULL;
+	}
+
+	/* Status line */
+	end = strstr(stored, "\r\n");
+	if(!end){
+		mangoPort_free(merged);
+		return NULL;
+	}
+	memcpy(merged, stored, end + 2 - stored);
+	ptr = merged + (end + 2 - stored);
+
+	/* Stored fields the 304 does not replace */
+	for(line = end + 2; (end = strstr(line, "\r\n")) != NULL && end != line; line = end + 2){
+		if(mangoCache_fieldName(line, name, sizeof(name)) && !mangoCache_fieldKept(name) &&
+		   mangoHelper_httpHeaderGet(update, name, NULL, 0) >= 0){
+			continue;
+		}
+		memcpy(ptr, line, end + 2 - line);
+		ptr += end + 2 - line;
+	}
+
+	/* Fields of the 304 */
+	line = strstr(update, "\r\n");
+	for(line = line ? line + 2 : ""; (end = strstr(line, "\r\n")) != NULL && end != line; line = end + 2){
+		if(!mangoCache_fieldName(line, name, sizeof(name)) || mangoCache_fieldKept(name)){
+			continue;
+		}
+		memcpy(ptr, line, end + 2 - line);
+		ptr += end + 2 - line;
+	}
+
+	memcpy(ptr, "\0\n", 3);
+
+	return merged;
+}
+
+
+/* -----------------------------------------------------------------------------------------------------------------
+| ENTRIES
+----------------------------------------------------------------------------------------------------------------- */
+
+/*
+* Allocates an entry with its key and validators. Memory entries get
+* "dataSz" more bytes for their headers and body.
+*/
+static mangoCacheEntry_t* mangoCache_entryNew(char* key, char* headers, uint32_t dataSz){
+	char etag[MANGO_CACHE_VALIDATOR_SZ];
+	char lastModified[MANGO_CACHE_VALIDATOR_SZ];
+	mangoCacheEntry_t* entry;
+	uint32_t sz;
+	char* ptr;
+
+	/* Weak ETags are fine for If-None-Match. Validators that do not fit are dropped */
+	if(mango_httpHeaderGet(headers, MANGO_HDR__ETAG, etag, sizeof(etag)) != MANGO_OK){
+		etag[0] = '\0';
+	}
+	if(mango_httpHeaderGet(headers, MANGO_HDR__LAST_MODIFIED, lastModified, sizeof(lastModified)) != MANGO_OK){
+		lastModified[0] = '\0';
+	}
+
+	sz = sizeof(mangoCacheEntry_t) + strlen(key) + 1 + strlen(etag) + 1 + strlen(lastModified) + 1;
+
+	entry = mangoPort_malloc(sz + dataSz);
+	if(!entry){
+		return NULL;
+	}
+
+	memset(entry, 0, sizeof(mangoCacheEntry_t));
+
+	ptr = (char*) (entry + 1);
+	entry->key = strcpy(ptr, key);
+	ptr += strlen(key) + 1;
+	entry->etag = etag[0] ? strcpy(ptr, etag) : NULL;
+	ptr += strlen(etag) + 1;
+	entry->lastModified = lastModified[0] ? strcpy(ptr, lastModified) : NULL;
+	ptr += strlen(lastModified) + 1;
+
+	if(dataSz){
+		entry->headers = ptr;
+		entry->body = (uint8_t*) ptr + strlen(headers) + 1;
+	}
+
+	return entry;
+}
+
+static void mangoCache_entryFree(mangoCacheEntry_t* entry){
+#ifdef MANGO_OS_ENV__UNIX
+	if(entry->map){
+		munmap(entry->map, entry->mapSz);
+	}
+#endif
+	mangoPort_free(entry);
+}
+
+#ifdef MANGO_OS_ENV__UNIX
+/*
+* Path of the file of a disk entry, a 64 bit FNV-1a hash of its key
+*/
+static char* mangoCache_path(mangoCache_t* cache, char* key, char* suffix){
+	uint64_t hash;
+	char* path;
+
+	hash = 0xCBF29CE484222325ULL;
+	while(*key){
+		hash ^= (uint8_t) *key++;
+		hash *= 0x100000001B3ULL;
+	}
+
+	path = mangoPort_malloc(strlen(cache->dir) + 1 + 16 + strlen(suffix) + 1);
+	if(path){
+		sprintf(path, "%s/%08x%08x%s", cache->dir, (uint32_t) (hash >> 32), (uint32_t) hash, suffix);
+	}
+
+	return path;
+}
+#endif
+
+/*
+* Removes an entry from the cache and adds it to the "dead" list, which
+* holds a reference on it until mangoCache_reap(). Must be called with the
+* cache lock held.
+*/
+static void mangoCache_evict(mangoCache_t* cache, mangoCacheEntry_t* entry, mangoCacheEntry_t** dead){
+	if(entry->prev){ entry->prev->next = entry->next; }else{ cache->head = entry->next; }
+	if(entry->next){ entry->next->prev = entry->prev; }else{ cache->tail = entry->prev; }
+
+	cache->stats.bytes -= entry->size;
+	cache->stats.entries--;
+	cache->stats.evicted++;
+
+	entry->evicted = 1;
+	entry->refs++;
+	entry->dead = *dead;
+	*dead = entry;
+}
+
+/*
+* Links an entry as the most recently used one, evicting others to make
+* room for it. Must be called with the cache lock held.
+*/
+static void mangoCache_link(mangoCache_t* cache, mangoCacheEntry_t* entry, mangoCacheEntry_t** dead){
+	mangoCacheEntry_t* old;
+
+	for(old = cache->head; old; old = old->next){
+		if(strcmp(old->key, entry->key) == 0){
+			mangoCache_evict(cache, old, dead);
+			break;
+		}
+	}
+
+	while(cache->tail && cache->stats.bytes + entry->size > cache->maxBytes){
+		mangoCache_evict(cache, cache->tail, dead);
+	}
+
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if(cache->head){ cache->head->prev = entry; }else{ cache->tail = entry; }
+	cache->head = entry;
+
+	cache->stats.bytes += entry->size;
+	cache->stats.entries++;
+}
+
+/*
+* Returns the entry of a key with a reference taken, NULL if not cached
+*/
+static mangoCacheEntry_t* mangoCache_lookup(mangoCache_t* cache, char* key){
+	mangoCacheEntry_t* entry;
+
+	mangoCache_acquire(cache);
+
+	for(entry = cache->head; entry; entry = entry->next){
+		if(strcmp(entry->key, key) == 0){
+			break;
+		}
+	}
+
+	if(entry){
+		entry->refs++;
+
+		/* Most recently used */
+		if(entry->prev){
+			entry->prev->next = entry->next;
+			if(entry->next){ entry->next->prev = entry->prev; }else{ cache->tail = entry->prev; }
+			entry->prev = NULL;
+			entry->next = cache->head;
+			cache->head->prev = entry;
+			cache->head = entry;
+		}
+	}
+
+	mangoCache_release(cache);
+
+	return entry;
+}
+
+static void mangoCache_unref(mangoCache_t* cache, mangoCacheEntry_t* entry){
+	uint8_t last;
+
+	mangoCache_acquire(cache);
+	entry->refs--;
+	last = entry->evicted && !entry->refs;
+	mangoCache_release(cache);
+
+	if(last){
+		mangoCache_entryFree(entry);
+	}
+}
+
+/*
+* Returns 1 if the entry can be delivered without revalidation. Its freshness
+* is updated by other requests, so it is read under the lock.
+*/
+static uint8_t mangoCache_fresh(mangoCache_t* cache, mangoCacheEntry_t* entry){
+	uint32_t storedAt;
+	uint32_t maxAge;
+
+	mangoCache_acquire(cache);
+	storedAt = entry->storedAt;
+	maxAge = entry->maxAge;
+	mangoCache_release(cache);
+
+	return maxAge && mangoHelper_elapsedTime(storedAt) < maxAge;
+}
+
+/*
+* The file operations of a disk cache, no-ops for a memory cache
+*/
+static void mangoCache_fileLock(mangoCache_t* cache){
+#ifdef MANGO_OS_ENV__UNIX
+	if(cache->dir){
+		pthread_mutex_lock(&cache->fileLock);
+	}
+#endif
+}
+
+static void mangoCache_fileUnlock(mangoCache_t* cache){
+#ifdef MANGO_OS_ENV__UNIX
+	if(cache->dir){
+		pthread_mutex_unlock(&cache->fileLock);
+	}
+#endif
+}
+
+/*
+* Removes the files of the evicted entries and drops the references taken by
+* mangoCache_evict(). Called without the cache lock, but with the file lock
+* held for a disk cache.
+*/
+static void mangoCache_reap(mangoCache_t* cache, mangoCacheEntry_t* dead){
+	mangoCacheEntry_t* entry;
+#ifdef MANGO_OS_ENV__UNIX
+	char* path;
+#endif
+
+	while(dead){
+		entry = dead;
+		dead = entry->dead;
+
+#ifdef MANGO_OS_ENV__UNIX
+		if(entry->map){
+			path = mangoCache_path(cache, entry->key, MANGO_CACHE_FILE_EXT);
+			if(path){
+				unlink(path);
+				mangoPort_free(path);
+			}
+		}
+#endif
+
+		mangoCache_unref(cache, entry);
+	}
+}
+
+/*
+* Stores a captured response
+*/
+static void mangoCache_store(mangoCache_t* cache, char* key, mangoCacheRequest_t* req){
+	mangoCacheEntry_t* entry;
+	mangoCacheEntry_t* dead;
+	uint32_t dataSz;
+#ifdef MANGO_OS_ENV__UNIX
+	mangoCacheFile_t file;
+	char* path;
+	char* tmpPath;
+	char suffix[24];
+	uint8_t* map;
+	int fd;
+#endif
+
+	dataSz = cache->dir ? 0 : req->headersLen + 1 + req->bodyLen;
+
+	entry = mangoCache_entryNew(key, req->headers, dataSz);
+	if(!entry){
+		return;
+	}
+
+	entry->headersLen = req->headersLen;
+	entry->statusCode = MANGO_ERR_HTTP_200;
+	entry->bodyLen = req->bodyLen;
+	entry->size = req->headersLen + req->bodyLen;
+	entry->storedAt = mangoPort_timeNow();
+	entry->maxAge = req->maxAge;
+
+	if(entry->size > cache->maxBytes){
+		mangoPort_free(entry);
+		return;
+	}
+
+	dead = NULL;
+
+	if(!cache->dir){
+		memcpy(entry->headers, req->headers, req->headersLen + 1);
+		memcpy(entry->body, req->body, req->bodyLen);
+
+		mangoCache_acquire(cache);
+		mangoCache_link(cache, entry, &dead);
+		cache->stats.stored++;
+		mangoCache_release(cache);
+
+		mangoCache_reap(cache, dead);
+		return;
+	}
+
+#ifdef MANGO_OS_ENV__UNIX
+	memset(&file, 0, sizeof(file));
+	file.magic = MANGO_CACHE_FILE_MAGIC;
+	file.bodyLen = req->bodyLen;
+	file.keyLen = strlen(key);
+	file.headersLen = req->headersLen;
+	file.statusCode = MANGO_ERR_HTTP_200;
+
+	entry->mapSz = sizeof(file) + file.keyLen + 1 + file.headersLen + 1 + file.bodyLen;
+
+	sprintf(suffix, ".%u.tmp", __sync_fetch_and_add(&cache->tmpCnt, 1));
+	path = mangoCache_path(cache, key, MANGO_CACHE_FILE_EXT);
+	tmpPath = mangoCache_path(cache, key, suffix);
+	map = MAP_FAILED;
+	fd = -1;
+
+	if(path && tmpPath){
+		fd = open(tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	}
+
+	if(fd >= 0 && ftruncate(fd, entry->mapSz) == 0){
+		map = mmap(NULL, entry->mapSz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+
+	if(map != MAP_FAILED){
+		memcpy(map, &file, sizeof(file));
+		memcpy(map + sizeof(file), key, file.keyLen + 1);
+		memcpy(map + sizeof(file) + file.keyLen + 1, req->headers, file.headersLen + 1);
+		memcpy(map + sizeof(file) + file.keyLen + 1 + file.headersLen + 1, req->body, file.bodyLen);
+		mprotect(map, entry->mapSz, PROT_READ);
+
+		entry->map = map;
+		entry->headers = (char*) map + sizeof(file) + file.keyLen + 1;
+		entry->body = map + sizeof(file) + file.keyLen + 1 + file.headersLen + 1;
+
+		mangoCache_fileLock(cache);
+
+		/* The previous file of the key is removed before it is replaced */
+		mangoCache_acquire(cache);
+		mangoCache_link(cache, entry, &dead);
+		mangoCache_release(cache);
+		mangoCache_reap(cache, dead);
+
+		dead = NULL;
+		if(rename(tmpPath, path) == 0){
+			mangoCache_acquire(cache);
+			cache->stats.stored++;
+			mangoCache_release(cache);
+		}else{
+			mangoCache_acquire(cache);
+			if(!entry->evicted){
+				mangoCache_evict(cache, entry, &dead);
+			}
+			mangoCache_release(cache);
+			mangoCache_reap(cache, dead);
+			entry = NULL;
+		}
+
+		mangoCache_fileUnlock(cache);
+	}else{
+		mangoPort_free(entry);
+		entry = NULL;
+	}
+
+	if(!entry && tmpPath){
+		unlink(tmpPath);
+	}
+
+	if(fd >= 0){ close(fd); }
+	if(path){ mangoPort_free(path); }
+	if(tmpPath){ mangoPort_free(tmpPath); }
+#else
+	mangoPort_free(entry);
+#endif
+}
+
+/*
+* Applies a 304 to the revalidated entry. Stored entries are not modified
+* apart from their freshness, so the entry is replaced by one with the
+* updated headers. "req->entry" then refers to the replacement.
+*/
+static void mangoCache_update(mangoCache_t* cache, char* key, mangoCacheRequest_t* req){
+	mangoCacheRequest_t updated;
+	mangoCacheEntry_t* entry;
+	mangoCacheEntry_t* dead;
+	char* merged;
+
+	mangoCache_acquire(cache);
+	if(req->freshness){
+		req->entry->maxAge = req->maxAge;
+	}
+	req->entry->storedAt = mangoPort_timeNow();
+	mangoCache_release(cache);
+
+	merged = req->headers ? mangoCache_headersMerge(req->entry->headers, req->headers) : NULL;
+	if(!merged){
+		return;
+	}
+
+	memset(&updated, 0, sizeof(updated));
+	updated.headers = merged;
+	updated.headersLen = strlen(merged) + 2;
+	updated.body = req->entry->body;
+	updated.bodyLen = req->entry->bodyLen;
+
+	if(updated.headersLen >= MANGO_WORKING_BUFFER_SZ){
+		/* Does not fit in the working buffer, the stored headers are kept */
+	}else if(mangoCache_storable(merged, 0, &updated.maxAge)){
+		mangoCache_store(cache, key, &updated);
+
+		entry = mangoCache_lookup(cache, key);
+		if(entry){
+			mangoCache_unref(cache, req->entry);
+			req->entry = entry;
+		}
+	}else{
+		/* The 304 forbids storing the response, it is delivered once more */
+		dead = NULL;
+		mangoCache_fileLock(cache);
+		mangoCache_acquire(cache);
+		if(!req->entry->evicted){
+			mangoCache_evict(cache, req->entry, &dead);
+		}
+		mangoCache_release(cache);
+		mangoCache_reap(cache, dead);
+		mangoCache_fileUnlock(cache);
+	}
+
+	mangoPort_free(merged);
+}
+
+#ifdef MANGO_OS_ENV__UNIX
+/*
+* Loads the entries stored by a previous run
+*/
+static void mangoCache_load(mangoCache_t* cache){
+	mangoCacheFile_t* file;
+	mangoCacheEntry_t* entry;
+	mangoCacheEntry_t* dead;
+	struct dirent* dirEntry;
+	struct stat st;
+	char* path;
+	uint8_t* map;
+	uint16_t namelen;
+	DIR* dir;
+	int fd;
+
+	dir = opendir(cache->dir);
+	if(!dir){
+		return;
+	}
+
+	while((dirEntry = readdir(dir)) != NULL){
+		namelen = strlen(dirEntry->d_name);
+		if(namelen < 4){
+			continue;
+		}
+
+		path = mangoPort_malloc(strlen(cache->dir) + 1 + namelen + 1);
+		if(!path){
+			break;
+		}
+		sprintf(path, "%s/%s", cache->dir, dirEntry->d_name);
+
+		if(strcmp(&dirEntry->d_name[namelen - 4], ".tmp") == 0){
+			/* Left over by an interrupted store */
+			unlink(path);
+			mangoPort_free(path);
+			continue;
+		}
+
+		if(strcmp(&dirEntry->d_name[namelen - strlen(MANGO_CACHE_FILE_EXT)], MANGO_CACHE_FILE_EXT) != 0){
+			mangoPort_free(path);
+			continue;
+		}
+
+		map = MAP_FAILED;
+		fd = open(path, O_RDONLY);
+		if(fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(mangoCacheFile_t)){
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		}
+		if(fd >= 0){
+			close(fd);
+		}
+
+		entry = NULL;
+		if(map != MAP_FAILED){
+			file = (mangoCacheFile_t*) map;
+			if(file->magic == MANGO_CACHE_FILE_MAGIC &&
+			   file->headersLen < MANGO_WORKING_BUFFER_SZ &&
+			   file->bodyLen <= MANGO_CACHE_ENTRY_MAX_SZ &&
+			   st.st_size == (off_t) (sizeof(*file) + file->keyLen + 1 + file->headersLen + 1 + file->bodyLen) &&
+			   map[sizeof(*file) + file->keyLen] == '\0' &&
+			   map[sizeof(*file) + file->keyLen + 1 + file->headersLen] == '\0'){
+
+				entry = mangoCache_entryNew((char*) map + sizeof(*file), (char*) map + sizeof(*file) + file->keyLen + 1, 0);
+			}
+
+			if(entry){
+				entry->map = map;
+				entry->mapSz = st.st_size;
+				entry->headers = (char*) map + sizeof(*file) + file->keyLen + 1;
+				entry->headersLen = file->headersLen;
+				entry->statusCode = file->statusCode;
+				entry->body = map + sizeof(*file) + file->keyLen + 1 + file->headersLen + 1;
+				entry->bodyLen = file->bodyLen;
+				entry->size = file->headersLen + file->bodyLen;
+
+				/* The age is unknown, revalidate on first use */
+				entry->maxAge = 0;
+
+				/* The cache is not shared yet, no lock is needed */
+				dead = NULL;
+				mangoCache_link(cache, entry, &dead);
+				mangoCache_reap(cache, dead);
+			}else{
+				munmap(map, st.st_size);
+				unlink(path);
+			}
+		}
+
+		mangoPort_free(path);
+	}
+
+	closedir(dir);
+
+	/* Entries that did not fit are not evictions */
+	cache->stats.evicted = 0;
+}
+#endif
+
+
+/* -----------------------------------------------------------------------------------------------------------------
+| REQUESTS
+----------------------------------------------------------------------------------------------------------------- */
+
+/*
+* Gives a cached response to the application, the same way a received one
+* is given: headers first, then the body in working buffer sized pieces.
+*/
+static mangoErr_t mangoCache_deliver(mangoHttpClient_t* hc, mangoCacheEntry_t* entry, mangoErr_t (*userFunc)(mangoArg_t* mangoArgs, void* userArgs), void* userArgs){
+	mangoArg_t funcArgs;
+	mangoErr_t err;
+	uint32_t offset;
+	uint32_t sz;
+
+	err = (mangoErr_t) entry->statusCode;
+
+	memset(&funcArgs, 0, sizeof(funcArgs));
+
+	memcpy(hc->workingBuffer, entry->headers, entry->headersLen + 1);
+	funcArgs.buf = MANGO_WB_PTR(hc);
+	funcArgs.buflen = entry->headersLen;
+	funcArgs.statusCode = entry->statusCode;
+	funcArgs.argType = MANGO_ARG_TYPE_HTTP_RESP_RECEIVED;
+	userFunc(&funcArgs, userArgs);
+
+	for(offset = 0; offset < entry->bodyLen; offset += sz){
+		sz = entry->bodyLen - offset > MANGO_WB_TOT_SZ(hc) ? MANGO_WB_TOT_SZ(hc) : entry->bodyLen - offset;
+		memcpy(hc->workingBuffer, &entry->body[offset], sz);
+		hc->workingBuffer[sz] = '\0';
+
+		funcArgs.buf = MANGO_WB_PTR(hc);
+		funcArgs.buflen = sz;
+		funcArgs.argType = MANGO_ARG_TYPE_HTTP_DATA_RECEIVED;
+		if(userFunc(&funcArgs, userArgs) != MANGO_OK){
+			err = MANGO_ERR_APPABORTED;
+			break;
+		}
+	}
+
+	hc->workingBufferIndexLeft = 0;
+	hc->workingBufferIndexRight = 0;
+
+	return err;
+}
+
+/*
+* Sits between the state machine and the application: captures storable
+* responses and hides a 304, the cached response is delivered instead.
+*/
+static mangoErr_t mangoCache_callback(mangoArg_t* mangoArgs, void* userArgs){
+	mangoCacheRequest_t* req = (mangoCacheRequest_t*) userArgs;
+	uint8_t* body;
+
+	switch(mangoArgs->argType){
+		case MANGO_ARG_TYPE_HTTP_RESP_RECEIVED:
+		{
+			if(mangoArgs->statusCode == MANGO_ERR_HTTP_304 && req->entry){
+				req->notModified = 1;
+				req->freshness = mangoCache_freshness((char*) mangoArgs->buf, &req->maxAge);
+			}else if(mangoArgs->statusCode != MANGO_ERR_HTTP_200 || req->headers || !mangoCache_storable((char*) mangoArgs->buf, req->authorized, &req->maxAge)){
+				break;
+			}
+
+			/* Kept to be stored, or merged into the entry of a 304 */
+			if(!req->headers){
+				req->headers = mangoPort_malloc(mangoArgs->buflen + 1);
+				if(req->headers){
+					memcpy(req->headers, mangoArgs->buf, mangoArgs->buflen);
+					req->headers[mangoArgs->buflen] = '\0';
+					req->headersLen = mangoArgs->buflen;
+					req->store = !req->notModified;
+				}
+			}
+
+			if(req->notModified){
+				return MANGO_OK;
+			}
+			break;
+		}
+		case MANGO_ARG_TYPE_HTTP_DATA_RECEIVED:
+		{
+			if(!req->store){
+				break;
+			}
+
+			if(req->bodyLen + mangoArgs->buflen > MANGO_CACHE_ENTRY_MAX_SZ){
+				req->store = 0;
+				break;
+			}
+
+			if(req->bodyLen + mangoArgs->buflen > req->bodySz){
+				req->bodySz = req->bodySz ? req->bodySz * 2 : 4096;
+				while(req->bodySz < req->bodyLen + mangoArgs->buflen){ req->bodySz *= 2; }
+				if(req->bodySz > MANGO_CACHE_ENTRY_MAX_SZ){ req->bodySz = MANGO_CACHE_ENTRY_MAX_SZ; }
+
+				body = mangoPort_malloc(req->bodySz);
+				if(!body){
+					req->store = 0;
+					break;
+				}
+				if(req->body){
+					memcpy(body, req->body, req->bodyLen);
+					mangoPort_free(req->body);
+				}
+				req->body = body;
+			}
+
+			memcpy(&req->body[req->bodyLen], mangoArgs->buf, mangoArgs->buflen);
+			req->bodyLen += mangoArgs->buflen;
+			break;
+		}
+		case MANGO_ARG_TYPE_HTTP_STATS:
+		{
+			if(req->notModified){
+				req->statsHeld = 1;
+				return MANGO_OK;
+			}
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+
+	return req->userFunc(mangoArgs, req->userArgs);
+}
+
+
+mangoCache_t* mango_cacheCreate(uint32_t maxBytes, char* dir){
+	mangoCache_t* cache;
+
+	MANGO_ENSURE_RET(maxBytes, NULL, ("?") );
+
+#ifndef MANGO_OS_ENV__UNIX
+	if(dir){
+		return NULL;
+	}
+#endif
+
+	cache = mangoPort_malloc(sizeof(mangoCache_t) + (dir ? strlen(dir) + 1 : 0));
+	if(!cache){
+		return NULL;
+	}
+
+	memset(cache, 0, sizeof(mangoCache_t));
+	cache->maxBytes = maxBytes;
+
+#ifdef MANGO_OS_ENV__UNIX
+	if(dir){
+		cache->dir = strcpy((char*) (cache + 1), dir);
+		pthread_mutex_init(&cache->fileLock, NULL);
+		mkdir(dir, 0755);
+		mangoCache_load(cache);
+	}
+#endif
+
+	return cache;
+}
+
+mangoErr_t mango_httpRequestProcessCached(mangoHttpClient_t* hc, mangoCache_t* cache, mangoErr_t (*userFunc)(mangoArg_t* mangoArgs, void* userArgs), void* userArgs){
+	mangoCacheRequest_t req;
+	mangoArg_t funcArgs;
+	mangoErr_t err;
+	char headerValueBuf[MANGO_CACHE_CONTROL_SZ];
+	char host[256];
+	uint8_t conditional;
+	uint8_t authorized;
+	uint8_t noCache;
+	uint32_t value;
+	uint16_t urilen;
+	char* uri;
+	char* key;
+
+	MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+
+	if(!cache || !userFunc || hc->httpMethod != MANGO_HTTP_METHOD_GET){
+		return mango_httpRequestProcess(hc, userFunc, userArgs);
+	}
+
+	if(!mangoSM_TRYLOCK(hc)){
+		return MANGO_ERR_BUSY;
+	}
+
+	MANGO_WB_NULLTERMINATE();
+
+	/* The request decides if the cache may be used */
+	noCache = 0;
+	err = mango_httpHeaderGet((char*) MANGO_WB_PTR(hc), MANGO_HDR__CACHE_CONTROL, headerValueBuf, sizeof(headerValueBuf));
+	if(err == MANGO_ERR_TEMPBUFSMALL || (err == MANGO_OK && mangoCache_directiveGet(headerValueBuf, "no-store", &value))){
+		mangoSM_UNLOCK(hc);
+		return mango_httpRequestProcess(hc, userFunc, userArgs);
+	}
+	if(err == MANGO_OK){
+		noCache = mangoCache_directiveGet(headerValueBuf, "no-cache", &value);
+	}
+
+	/* Shared responses are not reused for a request with credentials */
+	authorized = mango_httpHeaderGet((char*) MANGO_WB_PTR(hc), MANGO_HDR__AUTHORIZATION, NULL, 0) != MANGO_ERR;
+
+	/* Key: Host + URI ["GET <URI> HTTP/1.1"] */
+	if(mango_httpHeaderGet((char*) MANGO_WB_PTR(hc), MANGO_HDR__HOST, host, sizeof(host)) != MANGO_OK){
+		host[0] = '\0';
+	}
+
+	uri = (char*) MANGO_WB_PTR(hc) + strlen("GET ");
+	urilen = strchr(uri, ' ') ? strchr(uri, ' ') - uri : 0;
+
+	key = urilen ? mangoPort_malloc(strlen(host) + urilen + 1) : NULL;
+	if(!key){
+		mangoSM_UNLOCK(hc);
+		return mango_httpRequestProcess(hc, userFunc, userArgs);
+	}
+	strcpy(key, host);
+	memcpy(key + strlen(host), uri, urilen);
+	key[strlen(host) + urilen] = '\0';
+
+	memset(&req, 0, sizeof(req));
+	req.userFunc = userFunc;
+	req.userArgs = userArgs;
+	req.authorized = authorized;
+	req.entry = authorized ? NULL : mangoCache_lookup(cache, key);
+
+	if(req.entry && !noCache && mangoCache_fresh(cache, req.entry)){
+		/* Fresh */
+		err = mangoCache_deliver(hc, req.entry, userFunc, userArgs);
+		__sync_fetch_and_add(&cache->stats.hits, 1);
+
+		mangoSM_UNLOCK(hc);
+		mangoCache_unref(cache, req.entry);
+		mangoPort_free(key);
+		return err;
+	}
+
+	mangoSM_UNLOCK(hc);
+
+	/* Stale, ask the server if it changed. One validator that fits is enough */
+	conditional = 0;
+	if(req.entry && req.entry->etag && mango_httpHeaderSet(hc, MANGO_HDR__IF_NONE_MATCH, req.entry->etag) == MANGO_OK){
+		conditional = 1;
+	}
+	if(req.entry && req.entry->lastModified && mango_httpHeaderSet(hc, MANGO_HDR__IF_MODIFIED_SINCE, req.entry->lastModified) == MANGO_OK){
+		conditional = 1;
+	}
+	if(req.entry && !conditional){
+		mangoCache_unref(cache, req.entry);
+		req.entry = NULL;
+	}
+
+	err = mango_httpRequestProcess(hc, mangoCache_callback, &req);
+
+	if(req.notModified && err == MANGO_ERR_HTTP_304){
+		mangoCache_update(cache, key, &req);
+
+		err = MANGO_ERR_BUSY;
+		if(mangoSM_TRYLOCK(hc)){
+			err = mangoCache_deliver(hc, req.entry, userFunc, userArgs);
+
+			if(req.statsHeld){
+				memset(&funcArgs, 0, sizeof(funcArgs));
+				funcArgs.argType = MANGO_ARG_TYPE_HTTP_STATS;
+				funcArgs.statusCode = req.entry->statusCode;
+				funcArgs.stats = &hc->stats;
+				userFunc(&funcArgs, userArgs);
+			}
+
+			mangoSM_UNLOCK(hc);
+		}
+
+		__sync_fetch_and_add(&cache->stats.revalidated, 1);
+	}else{
+		if(req.store && err == MANGO_ERR_HTTP_200){
+			mangoCache_store(cache, key, &req);
+		}
+
+		__sync_fetch_and_add(&cache->stats.misses, 1);
+	}
+
+	if(req.entry){
+		mangoCache_unref(cache, req.entry);
+	}
+	if(req.headers){
+		mangoPort_free(req.headers);
+	}
+	if(req.body){
+		mangoPort_free(req.body);
+	}
+	mangoPort_free(key);
+
+	return err;
+}
+
+void mango_cacheStatsGet(mangoCache_t* cache, mangoCacheStats_t* stats){
+	MANGO_ENSURE_VOID(cache && stats, ("?") );
+
+	mangoCache_acquire(cache);
+	*stats = cache->stats;
+	mangoCache_release(cache);
+}
+
+void mango_cacheDestroy(mangoCache_t* cache){
+	mangoCacheEntry_t* entry;
+
+	if(!cache){
+		return;
+	}
+
+	while(cache->head){
+		entry = cache->head;
+		cache->head = entry->next;
+		mangoCache_entryFree(entry);
+	}
+
+#ifdef MANGO_OS_ENV__UNIX
+	if(cache->dir){
+		pthread_mutex_destroy(&cache->fileLock);
+	}
+#endif
+
+	mangoPort_free(cache);
+}
@@ -59,6 +59,14 @@
 */
 #define MANGO_HTTP_RESPONSE_TIMEOUT_MS      (10000)
 
+/*
+* Defines how long (in miliseconds) a request with an "Expect: 100-continue"
+* header waits for the server's "100 Continue". Servers that do not support
+* expectations never send it, so when the timeout expires the body is sent
+* anyway (mango_httpRequestProcess() returns MANGO_ERR_HTTP_100).
+*/
+#define MANGO_HTTP_CONTINUE_TIMEOUT_MS      (1000)
+
 /*
 * Defines the maximum period of time that mango is going to wait until the
 * connection with the remote server has been established. If the timeout
@@ -74,6 +82,133 @@
 */
 #define MANGO_SOCKET_WRITE_TIMEOUT_MS       (10000)
 
+/*
+* Maximum number of buffers handed to one writev() call. A request body
+* sent with mango_httpDataSendv() is written with a single system call when
+* it has up to this many pieces (two less for chunked requests, where the
+* chunk size line and the trailing CRLF take a slot each). At least 3.
+*/
+#define MANGO_SOCKET_IOV_MAX                (16)
+
+
+/*
+* Defines the maximum period of time (in miliseconds) that mango is going to wait
+* until the TLS handshake with the remote server has been completed.
+*/
+#define MANGO_TLS_HANDSHAKE_TIMEOUT_MS      (10000)
+
+/*
+* Defines the number of TLS sessions that are kept for resumption. Every
+* entry corresponds to a "serverName:serverPort" pair, so reconnecting to
+* a recently visited server resumes the previous session instead of doing
+* a full handshake. When the cache is full the least recently used entry
+* is replaced.
+*/
+#define MANGO_TLS_SESSION_CACHE_SZ          (8)
+
+
+/*
+* Defines the number of entries of the per client state machine trace ring.
+* Every event handled by the state machine is recorded (timestamp, state,
+* event, bytes of the last socket operation, exit error) overwriting the
+* oldest entry, so the recent history of a stuck or failed connection can be
+* inspected with mango_traceGet() / mango_traceDump() without enabling the
+* debug messages. Must be a power of 2, set it to 0 to disable tracing.
+*/
+#define MANGO_TRACE_RING_SZ                 (32)
+
+/*
+* Set to 1 to dump the trace ring of a client every time an API call
+* returns a MANGO_ERR_xxx error code.
+*/
+#define MANGO_TRACE_DUMP_ON_ERROR           (0)
+
+
+/*
+* Default websocket keepalive [miliseconds], see mango_wsKeepaliveSet().
+* While polling, a ping is sent every MANGO_WS_PING_INTERVAL_MS and the
+* connection is aborted when nothing (data, pongs) was received for
+* MANGO_WS_IDLE_TIMEOUT_MS. 0 disables them.
+*/
+#define MANGO_WS_PING_INTERVAL_MS           (0)
+#define MANGO_WS_IDLE_TIMEOUT_MS            (0)
+
+
+/*
+* Maximum length of the websocket subprotocol selected by the server
+* (Sec-WebSocket-Protocol), including the null terminator.
+*/
+#define MANGO_WS_PROTOCOL_SZ                (32)
+
+
+/*
+* Defines the size (in frames, power of 2) of the per client outbound websocket
+* queue. mango_wsFrameSend() may be called from any thread: when another thread
+* is running the client (for example it is blocked in mango_wsPoll()) the frame
+* is copied to this queue and sent by that thread. If the queue is full
+* mango_wsFrameSend() fails with MANGO_ERR_QUEUEFULL. Set it to 0 to drop the
+* queue, in which case a client must only be used by one thread at a time.
+*/
+#define MANGO_WS_TX_QUEUE_SZ                (16)
+
+/*
+* How long mango_disconnect() waits for a thread that is still flushing the
+* websocket queue of the client before failing with MANGO_ERR_BUSY.
+*/
+#define MANGO_DISCONNECT_WAIT_MS            (1000)
+
+/*
+* Queued frames are sent as soon as they are queued: a thread blocked in
+* mango_wsPoll() is woken up through mangoPort_wakeupSignal(). On ports
+* without a wakeup primitive the poll instead checks the queue every
+* MANGO_WS_POLL_SLICE_MS miliseconds.
+*/
+#define MANGO_WS_POLL_SLICE_MS              (10)
+
+/*
+* Defaults of the segmented download engine [mango_download()]: the file is
+* fetched in MANGO_DOWNLOAD_SEGMENT_SZ bytes Range requests spread over
+* MANGO_DOWNLOAD_CONNECTIONS parallel connections. A failed segment is
+* requested again (from where it stopped) up to MANGO_DOWNLOAD_RETRIES times.
+*/
+#define MANGO_DOWNLOAD_CONNECTIONS          (4)
+#define MANGO_DOWNLOAD_SEGMENT_SZ           (1024 * 1024)
+#define MANGO_DOWNLOAD_RETRIES              (3)
+
+/*
+* Resumable downloads: the checkpoint is kept next to the file, in
+* "<path>MANGO_DOWNLOAD_SIDECAR_EXT". MANGO_DOWNLOAD_VALIDATOR_SZ bounds the
+* ETag/Last-Modified value that is stored, a longer one disables resuming.
+*/
+#define MANGO_DOWNLOAD_SIDECAR_EXT          ".mango"
+#define MANGO_DOWNLOAD_VALIDATOR_SZ         (128)
+
+/*
+* Largest header of a multipart/form-data part [mango_httpMultipartSet()]:
+* the boundary, Content-Disposition (with the field name and filename) and
+* Content-Type lines.
+*/
+#define MANGO_MULTIPART_HEAD_SZ             (256)
+
+/*
+* Longest Location header that can be followed [mango_httpRedirectSet()],
+* redirects to longer ones are returned to the application.
+*/
+#define MANGO_REDIRECT_LOCATION_SZ          (512)
+
+/*
+* Largest response body kept by the response cache [mango_cacheCreate()],
+* bigger responses are delivered but not stored.
+*/
+#define MANGO_CACHE_ENTRY_MAX_SZ            (256 * 1024)
+
+/*
+* Set to 1 to keep process wide metrics (connections, requests, bytes,
+* timeouts, errors and latency histograms) for all the clients. They are
+* exported in the Prometheus text format with mango_metricsExport().
+*/
+#define MANGO_METRICS_ENABLED               (1)
+
 
 /*
 * Define the OS enviroment
@@ -87,4 +222,12 @@
 #define MANGO_IP_ENV__UNIX
 //#define MANGO_IP_ENV__LWIP
 
+/*
+* Define the TLS enviroment. Leave both undefined to build mango without
+* HTTPS support. The makefile defines one of them when it is invoked with
+* MANGO_TLS=openssl or MANGO_TLS=mbedtls.
+*/
+//#define MANGO_TLS_ENV__OPENSSL
+//#define MANGO_TLS_ENV__MBEDTLS
+
 #endif
@@ -61,7 +61,7 @@ mangoErr_t mangoIDP_raw(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, vo
 		*completed = 1;
 	}
 	
-	MANGO_DBG(MANGO_DBG_LEVEL_DP, ("IDP %u/%u received!\r\n", args->fileSzProcessed, args->fileSz) );
+	MANGO_DBG(MANGO_DBG_LEVEL_DP, ("IDP %llu/%llu received!\r\n", (unsigned long long) args->fileSzProcessed, (unsigned long long) args->fileSz) );
 	 
     /*
     *   Pass the data to application layer
@@ -109,15 +109,21 @@ mangoErr_t mangoIDP_raw(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, vo
  *	chunk-data     = chunk-size(OCTET)
  *	trailer        = *(entity-header CRLF)
  *	------------------------------------------------------------------
+ *
+ * The decoder works byte by byte and keeps its position (and the partial chunk
+ * size) in "args", so chunk-size lines, extensions and CRLFs may be split at any
+ * point between two calls. Only the chunk data and trailer lines are passed to
+ * the application as views of the buffer: a trailer line [MANGO_ARG_TYPE_HTTP_RESP_RECEIVED,
+ * statusCode 0] is given once it is complete.
 */
 mangoErr_t mangoIDP_chunked(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, void* vargs, uint32_t* processed, uint8_t* completed){
 	mangoIDPArgsChunked_t* args = (mangoIDPArgsChunked_t*) vargs;
-	uint8_t* buf0;
-	uint8_t sz;
 	uint32_t maxReadSz;
+	uint16_t linelen;
 	mangoArg_t funcArgs;
     mangoErr_t err;
 	uint8_t oldByte;
+	uint8_t digit;
     
     *completed = 0;
     *processed = 0;
@@ -127,87 +133,104 @@ mangoErr_t mangoIDP_chunked(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen
 #define RETURN()						if(*completed){return MANGO_OK;}else{if(*processed){return MANGO_OK;}else{return MANGO_ERR_MOREDATANEEDED;}}
 #define MOVETO(newState, processSz)		args->state = (newState); *processed += (processSz); buf += (processSz); buflen -= (processSz); break;	
 
+#define STATE_SIZE						1	/* Chunk size digits */
+#define STATE_DATA						2	/* Chunk data */
+#define STATE_DATA_CR					3	/* CRLF after the chunk data */
+#define STATE_TRAILER					4	/* Start of a trailer line, or the final CRLF */
+#define STATE_SIZE_EXT					5	/* Rest of the chunk size line [extensions, whitespace, CR] */
+#define STATE_DATA_LF					6
+#define STATE_TRAILER_LF				7	/* LF of the final CRLF */
+
 	while(1){
 		if(!buflen){ RETURN(); }
-		buf0 = buf;
 		switch(args->state){
-			case 1: /* Chunk size */
+			case STATE_SIZE:
 			{
-				while(*buf != '\n' && *buf){ buf++; }
-				
-				if(!*buf){ RETURN(); }
-
-				if(mangoHelper_hexstr2dec((char*)buf0, &args->chunkSz)){
+				if(*buf >= '0' && *buf <= '9'){
+					digit = *buf - '0';
+				}else if((*buf | 0x20) >= 'a' && (*buf | 0x20) <= 'f'){
+					digit = (*buf | 0x20) - 'a' + 10;
+				}else if(args->digits && (*buf == ';' || *buf == ' ' || *buf == '\t' || *buf == '\r')){
+					MOVETO(STATE_SIZE_EXT, 1);
+				}else if(args->digits && *buf == '\n'){
+					args->chunkSzProcessed = 0;
+					MOVETO(args->chunkSz ? STATE_DATA : STATE_TRAILER, 1);
+				}else{
 					/* Fatal error [chunk size parsing error] */
 					return MANGO_ERR_DATAPROCESSING;
 				}
 				
-				args->chunkSzProcessed = 0;
-
-				sz = ++buf - buf0;
+				if(args->chunkSz > 0x0FFFFFFF){
+					/* Fatal error [chunk size overflow] */
+					return MANGO_ERR_DATAPROCESSING;
+				}
 				
-				buf -= sz; /* buf is already increased, so we have to decrease it */
+				args->chunkSz = (args->chunkSz << 4) | digit;
+				args->digits++;
+				MOVETO(STATE_SIZE, 1);
+			}
+			case STATE_SIZE_EXT:
+			{
+				/* Chunk extensions are ignored */
+				linelen = 0;
+				while(linelen < buflen && buf[linelen] != '\n'){ linelen++; }
 				
-				if(args->chunkSz){
-					MOVETO(2, sz);
-				}else{
-					MOVETO(4, sz);
+				if(linelen == buflen){
+					MOVETO(STATE_SIZE_EXT, linelen);
 				}
+				
+				args->chunkSzProcessed = 0;
+				MOVETO(args->chunkSz ? STATE_DATA : STATE_TRAILER, linelen + 1);
 			}
-			case 2:
+			case STATE_DATA:
 			{
 				maxReadSz = buflen > args->chunkSz - args->chunkSzProcessed ? args->chunkSz - args->chunkSzProcessed : buflen;
 				
-				if(maxReadSz){
-					/*
-					*  Pass the data to application layer
-					*/
-					funcArgs.buf = buf;
-					funcArgs.buflen = maxReadSz;
-					funcArgs.argType = MANGO_ARG_TYPE_HTTP_DATA_RECEIVED;
+				/*
+				*  Pass the data to application layer
+				*/
+				funcArgs.buf = buf;
+				funcArgs.buflen = maxReadSz;
+				funcArgs.argType = MANGO_ARG_TYPE_HTTP_DATA_RECEIVED;
 
-                    oldByte = funcArgs.buf[funcArgs.buflen];
-                    funcArgs.buf[funcArgs.buflen] = '\0';
-                    
-                    err = hc->userFunc(&funcArgs, hc->userArgs);
-                    
-                    funcArgs.buf[funcArgs.buflen] = oldByte;
-                    
-					if(err != MANGO_OK){
-						/* Application wants to abort */
-						return MANGO_ERR_APPABORTED;
-					}
+				oldByte = funcArgs.buf[funcArgs.buflen];
+				funcArgs.buf[funcArgs.buflen] = '\0';
+				
+				err = hc->userFunc(&funcArgs, hc->userArgs);
+				
+				funcArgs.buf[funcArgs.buflen] = oldByte;
+				
+				if(err != MANGO_OK){
+					/* Application wants to abort */
+					return MANGO_ERR_APPABORTED;
+				}
 
-					args->chunkSzProcessed += maxReadSz;
-					if(args->chunkSz == args->chunkSzProcessed){ 
-						MOVETO(3, maxReadSz); 
-					}else{
-						/* Same sate */
-						MOVETO(2, maxReadSz); 
-					}
+				args->chunkSzProcessed += maxReadSz;
+				if(args->chunkSz == args->chunkSzProcessed){ 
+					MOVETO(STATE_DATA_CR, maxReadSz); 
+				}else{
+					/* Same sate */
+					MOVETO(STATE_DATA, maxReadSz); 
 				}
-				
-				/* Never reach here */
-				MANGO_ENSURE(0, ("?") );
-				return MANGO_ERR_DATAPROCESSING;
 			};	
-			case 3:
+			case STATE_DATA_CR:
+			case STATE_DATA_LF:
 			{
-				if(buflen < 2){ 
-					RETURN(); 
-				}
-				
-				if(buf[0] == '\r' && buf[1] == '\n'){
-					MOVETO(1, 2);
+				if(args->state == STATE_DATA_CR && *buf == '\r'){
+					MOVETO(STATE_DATA_LF, 1);
+				}else if(*buf == '\n'){
+					args->chunkSz = 0;
+					args->digits = 0;
+					MOVETO(STATE_SIZE, 1);
 				}else{
 					/* Fatal error [expect CRLF] */
 					return MANGO_ERR_DATAPROCESSING;
 				}
 			}	
-			case 4:
+			case STATE_TRAILER:
 			{
 				/*
-				*	RFC 2616: Trailing headers are acceptable:
+				*	RFC 7230: Trailing headers are acceptable:
 				*	4\r\n
 				*	Test\r\n 
 				*	0\r\n 
@@ -215,40 +238,64 @@ mangoErr_t mangoIDP_chunked(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen
 				*	Evil-header: foobar\r\n
 				*	\r\n
 				*/
+				if(*buf == '\r'){
+					MOVETO(STATE_TRAILER_LF, 1);
+				}else if(*buf == '\n'){
+					/* Completed */
+					*processed += 1;
+					*completed = 1;
+					return MANGO_OK;
+				}
+				
+				/* A trailer line, it is passed to the application when complete */
+				linelen = 0;
+				while(linelen < buflen && buf[linelen] != '\n'){ linelen++; }
 				
-				if(buflen < 2){ 
-					RETURN(); 
+				if(linelen == buflen){
+					/* Resume at the start of the line when more data arrive */
+					RETURN();
 				}
 				
-				if(buflen == 2 && buf[0] == '\r' && buf[1] == '\n'){
-					/* Completed, no extra HTTP headers */
-					*completed = 1;
-					return MANGO_OK;
-				}else if(buflen > 3 && buf[buflen - 4] == '\r' && buf[buflen - 3] == '\n' && buf[buflen - 2] == '\r' && buf[buflen - 1] == '\n'){
-					/*
-					* Completed, extra HTTP headers found.
-					* Pass the HTTP headers to the application
-					*/
-					funcArgs.buf = buf;
-					funcArgs.buflen = buflen;
-					funcArgs.statusCode = 0;
-					funcArgs.argType = MANGO_ARG_TYPE_HTTP_RESP_RECEIVED;
-					hc->userFunc(&funcArgs, hc->userArgs);
-					
-					*completed = 1;
-					return MANGO_OK;
-				}else{
-					RETURN(); 
+				funcArgs.buf = buf;
+				funcArgs.buflen = linelen + 1;
+				funcArgs.statusCode = 0;
+				funcArgs.argType = MANGO_ARG_TYPE_HTTP_RESP_RECEIVED;
+				hc->userFunc(&funcArgs, hc->userArgs);
+				
+				MOVETO(STATE_TRAILER, linelen + 1);
+			}
+			case STATE_TRAILER_LF:
+			{
+				if(*buf != '\n'){
+					/* Fatal error [expect CRLF] */
+					return MANGO_ERR_DATAPROCESSING;
 				}
+				
+				/* Completed */
+				*processed += 1;
+				*completed = 1;
+				return MANGO_OK;
+			}
+			default:
+			{
+				MANGO_ENSURE_RET(0, MANGO_ERR_INTERNAL, ("?") );
+				return MANGO_ERR_DATAPROCESSING;
 			}
 		}; // switch()
 	}; // while(1)
 	
 #undef RETURN
 #undef MOVETO
+#undef STATE_SIZE
+#undef STATE_DATA
+#undef STATE_DATA_CR
+#undef STATE_TRAILER
+#undef STATE_SIZE_EXT
+#undef STATE_DATA_LF
+#undef STATE_TRAILER_LF
 
 	/* Never reach here */
-	MANGO_ENSURE(0, ("?") );
+	MANGO_ENSURE_RET(0, MANGO_ERR_INTERNAL, ("?") );
 	
 	return MANGO_ERR_DATAPROCESSING;
 }
@@ -256,11 +303,14 @@ mangoErr_t mangoIDP_chunked(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen
 /*
  * Pass-through output data processor for non-chunked input data
 */
-mangoErr_t mangoODP_raw(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, void* vargs, uint32_t* processed, uint8_t* completed){
+mangoErr_t mangoODP_raw(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, void* vargs, uint64_t* processed, uint8_t* completed){
     mangoODPArgsRaw_t* args = (mangoODPArgsRaw_t*) vargs;
-    int retval;
+    uint64_t buflen;
+    int64_t retval;
 	
-    MANGO_DBG(MANGO_DBG_LEVEL_DP, ("ODP [HTTP, RAW] %u bytes:\r\n", buflen) );
+    buflen = mangoHelper_iovecLen(iov, iovcnt);
+    
+    MANGO_DBG(MANGO_DBG_LEVEL_DP, ("ODP [HTTP, RAW] %llu bytes:\r\n", (unsigned long long) buflen) );
     
     *completed = 0;
     *processed = 0;
@@ -270,7 +320,7 @@ mangoErr_t mangoODP_raw(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, vo
         /* Application sent all data */
         MANGO_DBG(MANGO_DBG_LEVEL_DP, ("Alla data sent indication\r\n") );
         
-        if(args->fileSzProcessed + buflen > args->fileSz){
+        if(args->fileSzProcessed < args->fileSz){
             /* Application sent less data than expected */
             MANGO_DBG(MANGO_DBG_LEVEL_DP, ("Content-Length was wrong: More data expected\r\n") );
             return MANGO_ERR_CONTENTLENGTH;
@@ -286,11 +336,14 @@ mangoErr_t mangoODP_raw(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, vo
 		return MANGO_ERR_CONTENTLENGTH;
 	}
 	
-	
-	//retval = mangoPort_write(hc->socketfd, buf, buflen, MANGO_SOCKET_WRITE_TIMEOUT_MS);
-    retval = mangoSocket_write(hc, buf, buflen, MANGO_SOCKET_WRITE_TIMEOUT_MS);
+    retval = mangoSocket_writev(hc, iov, iovcnt, hc->odpNonBlocking ? 0 : MANGO_SOCKET_WRITE_TIMEOUT_MS);
     
-	if(retval == buflen){
+	if(retval >= 0 && hc->odpNonBlocking){
+		/* Only what the socket took, the application offers the rest again */
+		*processed = retval;
+		args->fileSzProcessed += retval;
+		return MANGO_OK;
+	}else if(retval >= 0 && (uint64_t) retval == buflen){
 		*processed = buflen;
 		args->fileSzProcessed += buflen;
 		return MANGO_OK;
@@ -300,17 +353,130 @@ mangoErr_t mangoODP_raw(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, vo
 }
 
 /*
- * Output data processor for chunked output data
+ * Writes the application buffers as chunks, every MANGO_SOCKET_IOV_MAX - 2 of
+ * them become one chunk, written together with its size line and trailing CRLF.
 */
-mangoErr_t mangoODP_chunked(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, void* vargs, uint32_t* processed, uint8_t* completed){
+static mangoErr_t mangoODP_chunksWrite(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, uint64_t* processed){
+    mangoIovec_t vec[MANGO_SOCKET_IOV_MAX];
+    char chunkSzLine[16 /* Strlen for chunk size in Hex */ + 2 /* CRLF before data */ + 1];
+    uint64_t chunkSz;
+	uint16_t chunkLen;
+    uint16_t veccnt;
+    int64_t retval;
+    
+	while(iovcnt){
+		veccnt = iovcnt > MANGO_SOCKET_IOV_MAX - 2 ? MANGO_SOCKET_IOV_MAX - 2 : iovcnt;
+		
+		chunkSz = mangoHelper_iovecLen(iov, veccnt);
+		if(chunkSz){
+			/* Hex chunk size + CRLF, the data and the CRLF after them */
+			chunkLen = snprintf(chunkSzLine, sizeof(chunkSzLine), "%llX\r\n", (unsigned long long) chunkSz);
+			
+			vec[0].buf = (uint8_t*) chunkSzLine;
+			vec[0].buflen = chunkLen;
+			memcpy(&vec[1], iov, veccnt * sizeof(mangoIovec_t));
+			vec[veccnt + 1].buf = (uint8_t*) "\r\n";
+			vec[veccnt + 1].buflen = 2;
+			
+			retval = mangoSocket_writev(hc, vec, veccnt + 2, MANGO_SOCKET_WRITE_TIMEOUT_MS);
+			if(retval >= 0 && (uint64_t) retval == chunkLen + chunkSz + 2){
+				*processed += chunkSz;
+			}else{
+				return MANGO_ERR_WRITETIMEOUT;
+			}
+		}
+		
+		iov += veccnt;
+		iovcnt -= veccnt;
+	}
+	
+	return MANGO_OK;
+}
+
+/*
+ * Continues the pending chunk [args->chunkHeadLen != 0] with the data of "iov",
+ * up to the bytes the chunk still needs. "data" is set to the data bytes written.
+ * A "timeout" of 0 writes only what the socket takes now, else the write must
+ * complete.
+*/
+static mangoErr_t mangoODP_chunkContinue(mangoHttpClient_t* hc, mangoODPArgsChunked_t* args, mangoIovec_t* iov, uint16_t iovcnt, uint32_t timeout, uint64_t* data){
+    mangoIovec_t vec[MANGO_SOCKET_IOV_MAX];
+    uint64_t dataLen;
+    uint64_t written;
+    uint64_t len;
+    int64_t retval;
+    uint16_t veccnt;
+    
+    veccnt = 0;
+    *data = 0;
+    
+    if(args->chunkHeadSent < args->chunkHeadLen){
+        vec[veccnt].buf = (uint8_t*) &args->chunkHead[args->chunkHeadSent];
+        vec[veccnt].buflen = args->chunkHeadLen - args->chunkHeadSent;
+        veccnt++;
+    }
+    
+    /* Room is kept for the CRLF */
+    dataLen = 0;
+    for(; iovcnt && dataLen < args->chunkLeft && veccnt < MANGO_SOCKET_IOV_MAX - 1; iov++, iovcnt--){
+        len = iov->buflen < args->chunkLeft - dataLen ? iov->buflen : args->chunkLeft - dataLen;
+        if(len){
+            vec[veccnt].buf = iov->buf;
+            vec[veccnt].buflen = len;
+            veccnt++;
+            dataLen += len;
+        }
+    }
+    
+    if(dataLen == args->chunkLeft){
+        vec[veccnt].buf = (uint8_t*) &"\r\n"[args->chunkTailSent];
+        vec[veccnt].buflen = 2 - args->chunkTailSent;
+        veccnt++;
+    }
+    
+    retval = mangoSocket_writev(hc, vec, veccnt, timeout);
+    if(retval < 0 || (timeout && (uint64_t) retval != mangoHelper_iovecLen(vec, veccnt))){
+        return MANGO_ERR_WRITETIMEOUT;
+    }
+    
+    /* The written bytes go to the size line, the data and the CRLF, in this order */
+    written = retval;
+    
+    len = args->chunkHeadLen - args->chunkHeadSent;
+    len = written < len ? written : len;
+    args->chunkHeadSent += len;
+    written -= len;
+    
+    *data = written < dataLen ? written : dataLen;
+    args->chunkLeft -= *data;
+    written -= *data;
+    
+    args->chunkTailSent += written;
+    if(args->chunkTailSent == 2){
+        /* Chunk complete */
+        args->chunkHeadLen = 0;
+    }
+    
+    return MANGO_OK;
+}
+
+/*
+ * Output data processor for chunked output data. A non-blocking write
+ * [hc->odpNonBlocking] frames the buffers as one chunk and writes what the socket
+ * takes, the rest of the chunk is continued by the next body piece.
+*/
+mangoErr_t mangoODP_chunked(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, void* vargs, uint64_t* processed, uint8_t* completed){
     mangoODPArgsChunked_t* args = (mangoODPArgsChunked_t*) vargs;
-    uint8_t extraChunkSz;
+    mangoIovec_t first;
+    uint64_t buflen;
+    uint64_t skip;
 	uint16_t chunkLen;
-	uint16_t sendSz;
-	int sent;
-    int retval;
+    int64_t retval;
+    mangoErr_t err;
+    
+    buflen = mangoHelper_iovecLen(iov, iovcnt);
     
-    MANGO_DBG(MANGO_DBG_LEVEL_DP, ("ODP [HTTP, CHUNKED] %u bytes\r\n", buflen) );
+    MANGO_DBG(MANGO_DBG_LEVEL_DP, ("ODP [HTTP, CHUNKED] %llu bytes\r\n", (unsigned long long) buflen) );
     
     *completed = 0;
 	*processed = 0;
@@ -319,6 +485,18 @@ mangoErr_t mangoODP_chunked(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen
         /* This is the last chunk, application sent all data */
         MANGO_DBG(MANGO_DBG_LEVEL_DP, ("All data sent indication\r\n") );
         
+		if(args->chunkHeadLen){
+			/* The data of the pending chunk were announced, only its framing may be left */
+			if(args->chunkLeft){
+				return MANGO_ERR_DATAPROCESSING;
+			}
+			
+			err = mangoODP_chunkContinue(hc, args, NULL, 0, MANGO_SOCKET_WRITE_TIMEOUT_MS, processed);
+			if(err != MANGO_OK){
+				return err;
+			}
+		}
+		
 		chunkLen = strlen("0\r\n\r\n");
 		
 		if(chunkLen > args->workingBufferSz){
@@ -336,69 +514,72 @@ mangoErr_t mangoODP_chunked(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen
 			return MANGO_ERR_WRITETIMEOUT;
 		}
 
-	}else{
-		extraChunkSz = (8 /* Strlen for chunk size in Hex */) + (2 /* CRLF before data */);
-		extraChunkSz += (2 /* CRLF after data */) + (1 /* string termination */);
+	}
+	
+	if(args->chunkHeadLen){
+		err = mangoODP_chunkContinue(hc, args, iov, iovcnt, hc->odpNonBlocking ? 0 : MANGO_SOCKET_WRITE_TIMEOUT_MS, processed);
+		if(err != MANGO_OK || hc->odpNonBlocking || args->chunkHeadLen){
+			/* One chunk per non-blocking write, or all the data went to the pending chunk */
+			return err;
+		}
 		
-		if(extraChunkSz >= args->workingBufferSz){
-			return MANGO_ERR_WORKBUFSMALL;
+		/* The rest of the data make new chunks */
+		skip = *processed;
+		while(iovcnt && skip >= iov->buflen){
+			skip -= iov->buflen;
+			iov++;
+			iovcnt--;
 		}
 		
-		sent = 0;
-		while(sent < buflen){
-			sendSz = (buflen - sent > args->workingBufferSz - extraChunkSz) ? args->workingBufferSz - extraChunkSz : buflen - sent;
-			
-			/* Hex chunk size */
-			mangoHelper_dec2hexstr(sendSz, (char*) args->workingBuffer);
-			chunkLen = strlen((char*)args->workingBuffer);
-			
-            //MANGO_DBG(MANGO_DBG_LEVEL_DP, ("Chunk size @HEX = '%s'\r\n", args->workingBuffer) );
-            
-			/* CRLF */
-			memcpy(&args->workingBuffer[chunkLen], "\r\n", strlen("\r\n"));		
-			chunkLen += 2;
-			
-			/* Data */
-			memcpy(&args->workingBuffer[chunkLen], &buf[sent], sendSz); 		
-			chunkLen += sendSz; 
-			
-			/* CRLF */
-			memcpy(&args->workingBuffer[chunkLen], "\r\n", strlen("\r\n"));		
-			chunkLen += 2;
-			
-            args->workingBuffer[chunkLen] = '\0';
-            
-            //MANGO_DBG(MANGO_DBG_LEVEL_DP, ("Sending '%s', len = %u\r\n", args->workingBuffer, chunkLen) );
-            
-			/* Send the chunk */
-			//retval = mangoPort_write(hc->socketfd, args->workingBuffer, chunkLen, MANGO_SOCKET_WRITE_TIMEOUT_MS);
-            retval = mangoSocket_write(hc, args->workingBuffer, chunkLen, MANGO_SOCKET_WRITE_TIMEOUT_MS);
-			if(retval == chunkLen){
-				*processed += sendSz;
-				sent += sendSz;
-			}else{
-				return MANGO_ERR_WRITETIMEOUT;
+		if(skip){
+			first.buf = iov->buf + skip;
+			first.buflen = iov->buflen - skip;
+			err = mangoODP_chunksWrite(hc, &first, 1, processed);
+			if(err != MANGO_OK){
+				return err;
 			}
+			iov++;
+			iovcnt--;
+		}
+	}else if(hc->odpNonBlocking){
+		if(iovcnt > MANGO_SOCKET_IOV_MAX - 2){
+			iovcnt = MANGO_SOCKET_IOV_MAX - 2;
+			buflen = mangoHelper_iovecLen(iov, iovcnt);
 		}
 		
-		return MANGO_OK;
+		args->chunkHeadLen = snprintf(args->chunkHead, sizeof(args->chunkHead), "%llX\r\n", (unsigned long long) buflen);
+		args->chunkHeadSent = 0;
+		args->chunkTailSent = 0;
+		args->chunkLeft = buflen;
+		
+		err = mangoODP_chunkContinue(hc, args, iov, iovcnt, 0, processed);
+		if(err == MANGO_OK && !args->chunkHeadSent){
+			/* Nothing was written, the next piece is framed on its own */
+			args->chunkHeadLen = 0;
+		}
+		
+		return err;
 	}
+	
+	return mangoODP_chunksWrite(hc, iov, iovcnt, processed);
 }
 
 /*
  * Output data processor for websocket output data
 */
-mangoErr_t mangoODP_websocket(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, void* vargs, uint32_t* processed, uint8_t* completed){
+mangoErr_t mangoODP_websocket(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, void* vargs, uint64_t* processed, uint8_t* completed){
     mangoWSFrameSendArgs_t* WSFrameSendArgs = (mangoWSFrameSendArgs_t*) vargs;
+    uint64_t buflen;
     mangoErr_t err;
 	
+    buflen = mangoHelper_iovecLen(iov, iovcnt);
     
-    MANGO_DBG(MANGO_DBG_LEVEL_DP, ("ODP [WEBSOCKET] %u bytes:\r\n", buflen) );
+    MANGO_DBG(MANGO_DBG_LEVEL_DP, ("ODP [WEBSOCKET] %llu bytes:\r\n", (unsigned long long) buflen) );
     
     *completed = 0;
     *processed = 0;
     
-	err =  mangoWS_frameSend(hc->socketfd, WSFrameSendArgs->buf, WSFrameSendArgs->buflen, WSFrameSendArgs->type);
+	err =  mangoWS_frameSend(hc, WSFrameSendArgs->buf, WSFrameSendArgs->buflen, WSFrameSendArgs->type);
 	if(err != MANGO_OK){
 		return MANGO_ERR_DATAPROCESSING;
 	}else{
@@ -416,7 +597,6 @@ mangoErr_t mangoIDP_websocket(mangoHttpClient_t* hc, uint8_t* buf, uint16_t bufl
     int forever = 1;
     uint16_t maxReadSz;
     mangoArg_t funcArgs;
-    uint8_t oldByte;
     
     MANGO_DBG(MANGO_DBG_LEVEL_DP, ("IDP [WEBSOCKET] %u bytes:\r\n", buflen) );
     
@@ -483,7 +663,7 @@ mangoErr_t mangoIDP_websocket(mangoHttpClient_t* hc, uint8_t* buf, uint16_t bufl
 				}
 				
 				/* Never reach here */
-				MANGO_ENSURE(0, ("?") );
+				MANGO_ENSURE_RET(0, MANGO_ERR_INTERNAL, ("?") );
 				return MANGO_ERR_DATAPROCESSING;
             }
             case 2:
@@ -503,27 +683,55 @@ mangoErr_t mangoIDP_websocket(mangoHttpClient_t* hc, uint8_t* buf, uint16_t bufl
 					maxReadSz = buflen >= args->frameSz - args->frameSzProcessed ? args->frameSz - args->frameSzProcessed : buflen;
 				}
 				
+                /*
+                * The application is given a view of the frame straight from the working
+                * buffer. It is valid until the callback returns unless it is pinned
+                * with mango_wsViewPin().
+                */
+                memset(&funcArgs, 0, sizeof(funcArgs));
+                funcArgs.buf = buf;
+                funcArgs.buflen = maxReadSz;
+                funcArgs.opcode = FRAME_OPCODE;
+                funcArgs.fin = FRAME_FIN && (args->frameSzProcessed + maxReadSz == args->frameSz);
+                
                 if(FRAME_OPCODE & 0x08){ /* Control frame */
+                    if(args->frameSz > 125 || !FRAME_FIN){
+                        /* Control frames are never fragmented and fit in the working buffer */
+                        MANGO_DBG(MANGO_DBG_LEVEL_DP, ("!!!!!! Invalid control frame received, aborting..\r\n") );
+                        return MANGO_ERR_DATAPROCESSING;
+                    }
+                    
                     switch(FRAME_OPCODE){
                         case MANGO_WS_FRAME_TYPE_CLOSE:
                         {
-                            funcArgs.buf = NULL;
-                            funcArgs.buflen = 0;
+                            /* Status code followed by the reason */
+                            if(maxReadSz >= 2){
+                                funcArgs.closeCode = (buf[0] << 8) | buf[1];
+                                funcArgs.buf = buf + 2;
+                                funcArgs.buflen = maxReadSz - 2;
+                            }
                             funcArgs.argType = MANGO_ARG_TYPE_WEBSOCKET_CLOSE;
                             hc->userFunc(&funcArgs, hc->userArgs);
                             
-                            mangoWS_close(hc->socketfd);
+                            mangoWS_close(hc);
                             return MANGO_ERR_WEBSOCKETCLOSED;
                             break;
                         }
                         case MANGO_WS_FRAME_TYPE_PING:
                         {
-                            funcArgs.buf = NULL;
-                            funcArgs.buflen = 0;
                             funcArgs.argType = MANGO_ARG_TYPE_WEBSOCKET_PING;
                             hc->userFunc(&funcArgs, hc->userArgs);
                             
-                            mangoWS_pong(hc->socketfd);
+                            mangoWS_pong(hc, buf, maxReadSz);
+                            break;
+                        }
+                        case MANGO_WS_FRAME_TYPE_PONG:
+                        {
+                            /* Answer to a keepalive ping */
+                            mangoWS_pongReceived(hc, buf, maxReadSz);
+                            
+                            funcArgs.argType = MANGO_ARG_TYPE_WEBSOCKET_PONG;
+                            hc->userFunc(&funcArgs, hc->userArgs);
                             break;
                         }
                         default:
@@ -535,22 +743,16 @@ mangoErr_t mangoIDP_websocket(mangoHttpClient_t* hc, uint8_t* buf, uint16_t bufl
                     };
                 }else{ /* Non-control frame */
                     
-                    /*
-                    * Pass the data to the application layer
-                    * TODO: Null terminate this?
-                    */
-                    funcArgs.buf = buf;
-                    funcArgs.buflen = maxReadSz;
+                    if(FRAME_OPCODE != MANGO_WS_FRAME_TYPE_CONT){
+                        args->opcode = FRAME_OPCODE;
+                    }
+                    
+                    /* Pass the data to the application layer, they are not null terminated */
+                    funcArgs.opcode = args->opcode;
                     funcArgs.argType = MANGO_ARG_TYPE_WEBSOCKET_DATA_RECEIVED;
                     funcArgs.frameID = args->frameID;
                     
-                    oldByte = funcArgs.buf[funcArgs.buflen];
-                    funcArgs.buf[funcArgs.buflen] = '\0';
-                    
                     hc->userFunc(&funcArgs, hc->userArgs);
-                    
-                    funcArgs.buf[funcArgs.buflen] = oldByte;
-                    
                 }
                 
 				args->frameSzProcessed  += maxReadSz;
@@ -588,7 +790,7 @@ mangoErr_t mangoIDP_websocket(mangoHttpClient_t* hc, uint8_t* buf, uint16_t bufl
 #undef FRAME_PAYLOADLEN
     
 	/* Never reach here */
-	MANGO_ENSURE(0, ("?") );
+	MANGO_ENSURE_RET(0, MANGO_ERR_INTERNAL, ("?") );
 	
 	return MANGO_ERR_DATAPROCESSING;
 }
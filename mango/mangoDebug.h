@@ -36,7 +36,31 @@
 #define MANGO_DBG_LEVEL_PORT        MANGO_DBG_OFF
 
 
+/*
+*   Set to 1 for production builds. A failed MANGO_ENSURE_xxx() check is then
+*   counted (mango_ensureFailures()) and turned into an error instead of
+*   halting: the client moves to the aborted state and the API call returns
+*   MANGO_ERR_INTERNAL. When 0 a failed check halts, so it can be inspected
+*   with a debugger.
+*/
+#ifndef MANGO_ENSURE_RECOVERABLE
+#define MANGO_ENSURE_RECOVERABLE    (0)
+#endif
+
+
 #define MANGO_DBG(level, msg)       if(level & MANGO_DBG_ON){ MANGO_PRINTF(msg); };
 #define MANGO_ENSURE(cond, msg)     if(!(cond)){MANGO_PRINTF( ("[MANGO ENSURE] %s(), line %d\r\n", __func__, __LINE__) ); MANGO_PRINTF(msg); while(1){};}
 
+#if MANGO_ENSURE_RECOVERABLE
+    /* State machine context: the state machine aborts the client as soon as the state returns */
+    #define MANGO_ENSURE_SM(cond, hc, msg)      if(!(cond)){mangoDebug_ensureFailed(__func__, __LINE__); MANGO_PRINTF(msg); hc->smFaulted = 1; return;}
+    /* Any other context: return the specified error value to the caller */
+    #define MANGO_ENSURE_RET(cond, ret, msg)    if(!(cond)){mangoDebug_ensureFailed(__func__, __LINE__); MANGO_PRINTF(msg); return ret;}
+    #define MANGO_ENSURE_VOID(cond, msg)        if(!(cond)){mangoDebug_ensureFailed(__func__, __LINE__); MANGO_PRINTF(msg); return;}
+#else
+    #define MANGO_ENSURE_SM(cond, hc, msg)      MANGO_ENSURE(cond, msg)
+    #define MANGO_ENSURE_RET(cond, ret, msg)    MANGO_ENSURE(cond, msg)
+    #define MANGO_ENSURE_VOID(cond, msg)        MANGO_ENSURE(cond, msg)
+#endif
+
 #endif
@@ -0,0 +1,588 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+/*
+ * Segmented download engine.
+ *
+ * Every worker thread owns a client and takes the next segment from a shared
+ * counter until none is left, so a fast connection simply fetches more
+ * segments. The received data are written straight from the working buffer
+ * at their file offset (pwrite), the workers never share a file position.
+ *
+ * Resumable downloads keep a checkpoint in a sidecar file: a header that
+ * identifies the file (size, segmentation and validator) followed by the
+ * bytes written for every segment. A worker stores the progress of its
+ * segment when it completes or fails, into the segment's own slot, so the
+ * sidecar needs no locking either. At most the segments in progress when
+ * the process dies are fetched again.
+*/
+
+#ifdef MANGO_OS_ENV__UNIX
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* "MGD2", 64-bit sizes and progress slots. Older checkpoints start over */
+#define MANGO_DOWNLOAD_CHECKPOINT_MAGIC		(0x4D474432)
+
+typedef struct{
+	uint32_t			magic;
+	uint32_t			segmentSz;
+	uint64_t			fileSz;
+	uint32_t			segmentsCnt;
+	char				validator[MANGO_DOWNLOAD_VALIDATOR_SZ];
+}mangoDownloadCheckpoint_t;
+
+typedef struct{
+	mangoDownload_t*	dl;
+	int					fd;
+	uint32_t			segmentSz;
+	uint32_t			segmentsCnt;
+	uint32_t			segmentNext;	/* Next segment to fetch, shared by the workers */
+	uint8_t				failed;			/* A segment failed for good, the workers stop */
+	uint8_t				stale;			/* The file changed on the server */
+	mangoErr_t			err;
+	
+	/* Resumable downloads */
+	int					sidecarFd;		/* -1 if the download is not resumable */
+	uint64_t*			progress;		/* Bytes written per segment */
+	char*				validator;		/* ETag or Last-Modified, sent with If-Range */
+}mangoDownloadJob_t;
+
+/*
+ * HEAD response
+*/
+typedef struct{
+	uint64_t			len;
+	uint8_t				ranged;
+	char				validator[MANGO_DOWNLOAD_VALIDATOR_SZ];
+}mangoDownloadHead_t;
+
+/*
+ * A request in progress, the callback arguments
+*/
+typedef struct{
+	mangoDownloadJob_t*	job;
+	uint64_t			offset;		/* File offset of the segment */
+	uint64_t			len;		/* Segment length, MANGO_FILE_SZ_INFINITE if unknown */
+	uint64_t			written;	/* Bytes of the segment already in the file */
+	uint8_t				ranged;		/* Range request, a 206 is expected */
+	uint8_t				fatal;		/* Retrying will not help */
+	mangoErr_t			err;
+}mangoDownloadSegment_t;
+
+
+static mangoHttpClient_t* mangoDownload_connect(mangoDownload_t* dl){
+	if(dl->tls){
+		return mango_tlsConnect(dl->serverIP, dl->serverPort, dl->serverName);
+	}
+
+	return mango_connect(dl->serverIP, dl->serverPort);
+}
+
+static mangoErr_t mangoDownload_request(mangoHttpClient_t* hc, mangoDownload_t* dl, mangoHttpMethod_e method, char* range, char* ifRange, mangoErr_t (*userFunc)(mangoArg_t* mangoArgs, void* userArgs), void* userArgs){
+	mangoErr_t err;
+
+	err = mango_httpRequestNew(hc, dl->URI, method);
+	if(err == MANGO_OK){
+		err = mango_httpHeaderSet(hc, MANGO_HDR__HOST, dl->serverName ? dl->serverName : dl->serverIP);
+	}
+	if(err == MANGO_OK && range){
+		err = mango_httpHeaderSet(hc, MANGO_HDR__RANGE, range);
+	}
+	if(err == MANGO_OK && range && ifRange){
+		err = mango_httpHeaderSet(hc, MANGO_HDR__IF_RANGE, ifRange);
+	}
+	if(err == MANGO_OK){
+		err = mango_httpRequestProcess(hc, userFunc, userArgs);
+	}
+
+	return err;
+}
+
+/*
+* HEAD response: size, range support and validator
+*/
+static mangoErr_t mangoDownload_headCallback(mangoArg_t* mangoArgs, void* userArgs){
+	mangoDownloadHead_t* head = (mangoDownloadHead_t*) userArgs;
+	char headerValueBuf[32];
+
+	if(mangoArgs->argType != MANGO_ARG_TYPE_HTTP_RESP_RECEIVED || mangoArgs->statusCode != MANGO_ERR_HTTP_200){
+		return MANGO_OK;
+	}
+
+	if(mango_httpHeaderGet((char*) mangoArgs->buf, MANGO_HDR__CONTENT_LENGTH, headerValueBuf, sizeof(headerValueBuf)) == MANGO_OK){
+		if(mangoHelper_decstr2dec64(headerValueBuf, &head->len)){
+			head->len = MANGO_FILE_SZ_INFINITE;
+		}
+	}
+
+	if(mango_httpHeaderGet((char*) mangoArgs->buf, MANGO_HDR__ACCEPT_RANGES, headerValueBuf, sizeof(headerValueBuf)) == MANGO_OK){
+		head->ranged = mangoHelper_httpTokenFind(headerValueBuf, "bytes");
+	}
+
+	/* If-Range needs a strong ETag, a weak one falls back to Last-Modified */
+	if(mango_httpHeaderGet((char*) mangoArgs->buf, MANGO_HDR__ETAG, head->validator, sizeof(head->validator)) != MANGO_OK ||
+	   strncmp(head->validator, "W/", 2) == 0){
+		if(mango_httpHeaderGet((char*) mangoArgs->buf, MANGO_HDR__LAST_MODIFIED, head->validator, sizeof(head->validator)) != MANGO_OK){
+			head->validator[0] = '\0';
+		}
+	}
+
+	return MANGO_OK;
+}
+
+/*
+* Segment response: checks that the server sent what was asked and writes
+* the data at their offset
+*/
+static mangoErr_t mangoDownload_segmentCallback(mangoArg_t* mangoArgs, void* userArgs){
+	mangoDownloadSegment_t* segment = (mangoDownloadSegment_t*) userArgs;
+	char headerValueBuf[64];
+	uint64_t start;
+	char* ptr;
+	int retval;
+
+	switch(mangoArgs->argType){
+		case MANGO_ARG_TYPE_HTTP_RESP_RECEIVED:
+		{
+			if(mangoArgs->statusCode < MANGO_ERR_HTTP_200){
+				/* Interim response or trailer */
+				break;
+			}
+
+			if(segment->ranged && mangoArgs->statusCode == MANGO_ERR_HTTP_200){
+				/* The server ignored the range, with If-Range the file has changed */
+				if(segment->job->validator){
+					segment->job->stale = 1;
+				}
+				segment->err = MANGO_ERR_RESPFORMAT;
+				segment->fatal = 1;
+				return MANGO_ERR;
+			}
+
+			if(mangoArgs->statusCode != (segment->ranged ? MANGO_ERR_HTTP_206 : MANGO_ERR_HTTP_200)){
+				segment->err = (mangoErr_t) mangoArgs->statusCode;
+				segment->fatal = mangoArgs->statusCode < MANGO_ERR_HTTP_500;
+				return MANGO_ERR;
+			}
+
+			if(segment->ranged){
+				/* "Content-Range: bytes <start>-<end>/<size>" */
+				if(mango_httpHeaderGet((char*) mangoArgs->buf, MANGO_HDR__CONTENT_RANGE, headerValueBuf, sizeof(headerValueBuf)) != MANGO_OK ||
+				   strncasecmp(headerValueBuf, "bytes ", 6) != 0){
+					segment->err = MANGO_ERR_RESPFORMAT;
+					segment->fatal = 1;
+					return MANGO_ERR;
+				}
+
+				ptr = strchr(headerValueBuf, '-');
+				if(ptr){
+					*ptr = '\0';
+				}
+				if(!ptr || mangoHelper_decstr2dec64(&headerValueBuf[6], &start) || start != segment->offset + segment->written){
+					segment->err = MANGO_ERR_RESPFORMAT;
+					segment->fatal = 1;
+					return MANGO_ERR;
+				}
+			}
+			break;
+		}
+		case MANGO_ARG_TYPE_HTTP_DATA_RECEIVED:
+		{
+			if(segment->len != MANGO_FILE_SZ_INFINITE && mangoArgs->buflen > segment->len - segment->written){
+				segment->err = MANGO_ERR_RESPFORMAT;
+				segment->fatal = 1;
+				return MANGO_ERR;
+			}
+
+			while(mangoArgs->buflen){
+				retval = pwrite(segment->job->fd, mangoArgs->buf, mangoArgs->buflen, (off_t) segment->offset + segment->written);
+				if(retval <= 0){
+					segment->err = MANGO_ERR;
+					segment->fatal = 1;
+					return MANGO_ERR;
+				}
+
+				mangoArgs->buf += retval;
+				mangoArgs->buflen -= retval;
+				segment->written += retval;
+				__atomic_add_fetch(&segment->job->dl->bytes, retval, __ATOMIC_RELAXED);
+			}
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+
+	return MANGO_OK;
+}
+
+/*
+* Fetches one segment, resuming it on a new request when the previous one failed.
+* "connected" is set once the worker had a connection, later ones are reconnects.
+*/
+static mangoErr_t mangoDownload_segment(mangoDownloadJob_t* job, mangoHttpClient_t** hc, mangoDownloadSegment_t* segment, uint8_t* connected){
+	mangoDownload_t* dl = job->dl;
+	char range[48];
+	mangoErr_t err;
+	uint8_t attempts;
+	uint8_t attempt;
+
+	attempts = dl->retries == MANGO_DOWNLOAD_NO_RETRY ? 1 : dl->retries + 1;
+
+	err = MANGO_ERR;
+	for(attempt = 0; attempt < attempts; attempt++){
+		if(attempt){
+			__atomic_add_fetch(&dl->segmentsRetried, 1, __ATOMIC_RELAXED);
+		}
+
+		if(!*hc){
+			*hc = mangoDownload_connect(dl);
+			if(!*hc){
+				err = MANGO_ERR_CONNECTION;
+				continue;
+			}
+			
+			if(*connected){
+				MANGO_METRICS( mangoMetrics_reconnect() );
+			}
+			*connected = 1;
+		}
+
+		segment->err = MANGO_OK;
+		if(segment->ranged){
+			sprintf(range, "bytes=%llu-%llu", (unsigned long long) (segment->offset + segment->written), (unsigned long long) (segment->offset + segment->len - 1));
+		}else if(segment->written){
+			/* A single unranged request starts over, its bytes are received again */
+			__atomic_sub_fetch(&dl->bytes, segment->written, __ATOMIC_RELAXED);
+			segment->written = 0;
+		}
+
+		err = mangoDownload_request(*hc, dl, MANGO_HTTP_METHOD_GET, segment->ranged ? range : NULL, job->validator, mangoDownload_segmentCallback, segment);
+		if(segment->err != MANGO_OK){
+			err = segment->err;
+		}
+
+		if(!mango_httpConnectionReusable(*hc)){
+			mango_disconnect(*hc);
+			*hc = NULL;
+		}
+
+		if(err == (segment->ranged ? MANGO_ERR_HTTP_206 : MANGO_ERR_HTTP_200) &&
+		   (segment->len == MANGO_FILE_SZ_INFINITE || segment->written == segment->len)){
+			return MANGO_OK;
+		}
+
+		if(segment->fatal || __atomic_load_n(&job->failed, __ATOMIC_RELAXED)){
+			break;
+		}
+	}
+
+	return err == MANGO_OK ? MANGO_ERR : err;
+}
+
+static void* mangoDownload_worker(void* args){
+	mangoDownloadJob_t* job = (mangoDownloadJob_t*) args;
+	mangoDownloadSegment_t segment;
+	mangoHttpClient_t* hc;
+	uint32_t index;
+	uint8_t connected;
+	mangoErr_t err;
+
+	hc = NULL;
+	connected = 0;
+	while(!__atomic_load_n(&job->failed, __ATOMIC_RELAXED)){
+		index = __atomic_fetch_add(&job->segmentNext, 1, __ATOMIC_RELAXED);
+		if(index >= job->segmentsCnt){
+			break;
+		}
+
+		memset(&segment, 0, sizeof(segment));
+		segment.job = job;
+		if(job->segmentsCnt == 1 && job->segmentSz == MANGO_FILE_SZ_INFINITE){
+			/* Single request for the whole file */
+			segment.len = job->dl->fileSz ? job->dl->fileSz : MANGO_FILE_SZ_INFINITE;
+		}else{
+			segment.offset = (uint64_t) index * job->segmentSz;
+			segment.len = job->dl->fileSz - segment.offset < job->segmentSz ? job->dl->fileSz - segment.offset : job->segmentSz;
+			segment.ranged = 1;
+		}
+
+		if(job->progress){
+			segment.written = job->progress[index];
+			if(segment.written == segment.len){
+				/* Completed by a previous call */
+				continue;
+			}
+		}
+
+		err = mangoDownload_segment(job, &hc, &segment, &connected);
+
+		if(job->progress && segment.written != job->progress[index]){
+			job->progress[index] = segment.written;
+			if(pwrite(job->sidecarFd, &segment.written, sizeof(uint64_t), sizeof(mangoDownloadCheckpoint_t) + (off_t) index * sizeof(uint64_t)) != sizeof(uint64_t)){
+				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Checkpoint of segment %u not stored\r\n", index) );
+			}
+		}
+
+		if(err != MANGO_OK){
+			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Segment %u failed [%d]\r\n", index, err) );
+			job->err = err;
+			__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	if(hc){
+		mango_disconnect(hc);
+	}
+
+	return NULL;
+}
+
+/*
+* Loads the checkpoint of a previous call, if it belongs to the same file, or
+* starts a new one. Returns 1 if the data file is to be continued.
+*/
+static uint8_t mangoDownload_checkpointLoad(mangoDownloadJob_t* job, mangoDownloadCheckpoint_t* checkpoint){
+	mangoDownloadCheckpoint_t stored;
+	struct stat st;
+	uint64_t bytes;
+	uint32_t i;
+	int datafd;
+
+	if(read(job->sidecarFd, &stored, sizeof(stored)) == sizeof(stored) &&
+	   memcmp(&stored, checkpoint, sizeof(stored)) == 0 &&
+	   read(job->sidecarFd, job->progress, job->segmentsCnt * sizeof(uint64_t)) == (ssize_t) (job->segmentsCnt * sizeof(uint64_t))){
+
+		/* The data file has to be there, with its full size */
+		datafd = open(job->dl->path, O_RDONLY);
+		if(datafd >= 0){
+			if(fstat(datafd, &st) == 0 && (uint64_t) st.st_size == job->dl->fileSz){
+				bytes = 0;
+				for(i = 0; i < job->segmentsCnt; i++){
+					if(job->progress[i] > job->segmentSz || job->progress[i] > job->dl->fileSz - (uint64_t) i * job->segmentSz){
+						break;
+					}
+					bytes += job->progress[i];
+				}
+
+				if(i == job->segmentsCnt){
+					close(datafd);
+					job->dl->bytesResumed = bytes;
+					return 1;
+				}
+			}
+			close(datafd);
+		}
+	}
+
+	/* Start over */
+	memset(job->progress, 0, job->segmentsCnt * sizeof(uint64_t));
+	if(ftruncate(job->sidecarFd, 0) < 0 ||
+	   pwrite(job->sidecarFd, checkpoint, sizeof(*checkpoint), 0) != sizeof(*checkpoint) ||
+	   pwrite(job->sidecarFd, job->progress, job->segmentsCnt * sizeof(uint64_t), sizeof(*checkpoint)) != (ssize_t) (job->segmentsCnt * sizeof(uint64_t))){
+		/* Not resumable */
+		close(job->sidecarFd);
+		job->sidecarFd = -1;
+	}
+
+	return 0;
+}
+
+
+mangoErr_t mango_download(mangoDownload_t* dl){
+	mangoDownloadCheckpoint_t checkpoint;
+	mangoDownloadHead_t head;
+	mangoDownloadJob_t job;
+	mangoHttpClient_t* hc;
+	pthread_t* threads;
+	char* sidecarPath;
+	uint16_t threadsCnt;
+	uint16_t i;
+	uint8_t resumed;
+	mangoErr_t err;
+
+	MANGO_ENSURE_RET(dl && dl->URI && dl->path, MANGO_ERR, ("?") );
+
+	if(!dl->connections){ dl->connections = MANGO_DOWNLOAD_CONNECTIONS; }
+	if(!dl->segmentSz){ dl->segmentSz = MANGO_DOWNLOAD_SEGMENT_SZ; }
+	if(!dl->retries){ dl->retries = MANGO_DOWNLOAD_RETRIES; }
+
+	dl->bytes = 0;
+	dl->bytesResumed = 0;
+	dl->segmentsRetried = 0;
+
+	memset(&job, 0, sizeof(job));
+	job.dl = dl;
+	job.err = MANGO_OK;
+	job.fd = -1;
+	job.sidecarFd = -1;
+
+	/* Size, range support and validator */
+	memset(&head, 0, sizeof(head));
+	head.len = dl->fileSz ? dl->fileSz : MANGO_FILE_SZ_INFINITE;
+	head.ranged = 0;
+
+	hc = mangoDownload_connect(dl);
+	if(!hc){
+		return MANGO_ERR_CONNECTION;
+	}
+
+	err = mangoDownload_request(hc, dl, MANGO_HTTP_METHOD_HEAD, NULL, NULL, mangoDownload_headCallback, &head);
+	mango_disconnect(hc);
+	if(err != MANGO_ERR_HTTP_200){
+		return err;
+	}
+
+	if(head.len == MANGO_FILE_SZ_INFINITE){
+		dl->fileSz = 0;
+	}else{
+		dl->fileSz = head.len;
+	}
+
+	if(head.ranged && dl->fileSz){
+		job.segmentSz = dl->segmentSz;
+		job.segmentsCnt = (dl->fileSz + dl->segmentSz - 1) / dl->segmentSz;
+	}else{
+		job.segmentSz = MANGO_FILE_SZ_INFINITE;
+		job.segmentsCnt = 1;
+	}
+
+	sidecarPath = NULL;
+	if(dl->resume){
+		sidecarPath = mangoPort_malloc(strlen(dl->path) + strlen(MANGO_DOWNLOAD_SIDECAR_EXT) + 1);
+		if(!sidecarPath){
+			return MANGO_ERR;
+		}
+		strcpy(sidecarPath, dl->path);
+		strcat(sidecarPath, MANGO_DOWNLOAD_SIDECAR_EXT);
+	}
+
+	/* Only ranged downloads of a file with a validator can be continued */
+	resumed = 0;
+	if(sidecarPath && job.segmentSz != MANGO_FILE_SZ_INFINITE && head.validator[0]){
+		memset(&checkpoint, 0, sizeof(checkpoint));
+		checkpoint.magic = MANGO_DOWNLOAD_CHECKPOINT_MAGIC;
+		checkpoint.fileSz = dl->fileSz;
+		checkpoint.segmentSz = job.segmentSz;
+		checkpoint.segmentsCnt = job.segmentsCnt;
+		strcpy(checkpoint.validator, head.validator);
+
+		job.progress = mangoPort_malloc(job.segmentsCnt * sizeof(uint64_t));
+		job.sidecarFd = open(sidecarPath, O_RDWR | O_CREAT, 0644);
+		if(job.progress && job.sidecarFd >= 0){
+			resumed = mangoDownload_checkpointLoad(&job, &checkpoint);
+		}
+
+		if(job.progress && job.sidecarFd >= 0){
+			job.validator = head.validator;
+		}else{
+			if(job.sidecarFd >= 0){
+				close(job.sidecarFd);
+				job.sidecarFd = -1;
+			}
+			if(job.progress){
+				mangoPort_free(job.progress);
+				job.progress = NULL;
+			}
+		}
+	}
+
+	job.fd = open(dl->path, resumed ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(job.fd < 0){
+		err = MANGO_ERR;
+		goto exit;
+	}
+
+	/* Reserve the whole file, segments complete in any order */
+	if(!resumed && dl->fileSz && ftruncate(job.fd, dl->fileSz) < 0){
+		err = MANGO_ERR;
+		goto exit;
+	}
+
+	threadsCnt = job.segmentsCnt < dl->connections ? job.segmentsCnt : dl->connections;
+
+	threads = mangoPort_malloc(threadsCnt * sizeof(pthread_t));
+	if(!threads){
+		err = MANGO_ERR;
+		goto exit;
+	}
+
+	for(i = 0; i < threadsCnt; i++){
+		if(pthread_create(&threads[i], NULL, mangoDownload_worker, &job) != 0){
+			job.err = MANGO_ERR;
+			__atomic_store_n(&job.failed, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+
+	while(i--){
+		pthread_join(threads[i], NULL);
+	}
+
+	mangoPort_free(threads);
+
+	err = job.failed ? job.err : MANGO_OK;
+
+exit:
+
+	if(job.fd >= 0){
+		close(job.fd);
+	}
+
+	if(job.sidecarFd >= 0){
+		close(job.sidecarFd);
+	}
+
+	/* A checkpoint is only kept for a download that may be continued */
+	if(sidecarPath && (err == MANGO_OK || job.stale || job.sidecarFd < 0)){
+		unlink(sidecarPath);
+	}
+
+	if(sidecarPath){
+		mangoPort_free(sidecarPath);
+	}
+
+	if(job.progress){
+		mangoPort_free(job.progress);
+	}
+
+	return err;
+}
+
+#else
+
+mangoErr_t mango_download(mangoDownload_t* dl){
+	(void) dl;
+	return MANGO_ERR;
+}
+
+#endif
@@ -290,25 +290,38 @@ int mangoHelper_hexstr2dec(char* hexstr, uint32_t* dec){
  * @return  0 on success, < 0 on error
  */
 int mangoHelper_decstr2dec(char* decstr, uint32_t* dec){
+	uint64_t value;
+	
+	if(mangoHelper_decstr2dec64(decstr, &value) || value > 0xFFFFFFFF){
+		/* Not a 32-bit integer */
+		*dec = 0;
+		return -1;
+	}
+	
+	*dec = (uint32_t) value;
+	return 0;
+}
+
+/**
+ * @brief   Converts a DEC string to a 64-bit DEC integer [Content-Length of request bodies]
+ * @return  0 on success, < 0 on error
+ */
+int mangoHelper_decstr2dec64(char* decstr, uint64_t* dec){
 	uint8_t i;
 	*dec = 0;
 	
 	i = 0;
 	while(*decstr > 47 && *decstr < 58){
 		/* 0 -> 9 */
-		*dec += (*decstr - 48);
-		
-		decstr++;
-		if(*decstr > 47 && *decstr < 58){
-			*dec *= 10;
-		}
-		
-		/* TODO: fix the check below */
-		if(++i == 11) {
-			/* Not a 32-bit integer */
+		if(*dec > (0xFFFFFFFFFFFFFFFFULL - (*decstr - 48)) / 10){
+			/* Not a 64-bit integer */
 			*dec = 0;
 			return -1;
 		}
+		*dec = *dec * 10 + (*decstr - 48);
+		
+		decstr++;
+		i++;
 	}
 
 	if(!i) {
@@ -322,6 +335,126 @@ int mangoHelper_decstr2dec(char* decstr, uint32_t* dec){
 
 
 
+/**
+ * @brief   Checks if "token" is an element of a comma separated header
+ *          value (for example "keep-alive, Upgrade"), case insensitive.
+ *
+ * @retval  1   if the token was found
+ * @retval  0   if the token was not found
+ */
+int mangoHelper_httpTokenFind(char* list, char* token){
+    uint16_t    tokenlen;
+    uint16_t    len;
+    
+    tokenlen = strlen(token);
+    
+    while(*list){
+        while(*list == ' ' || *list == '\t' || *list == ','){list++;}
+        
+        len = 0;
+        while(list[len] && list[len] != ','){len++;}
+        
+        /* Trailing spaces and parameters [";q=.."] are not part of the token */
+        while(len && (list[len - 1] == ' ' || list[len - 1] == '\t')){len--;}
+        
+        if(len >= tokenlen && strncasecmp(list, token, tokenlen) == 0 && 
+           (len == tokenlen || list[tokenlen] == ';' || list[tokenlen] == ' ')){
+            return 1;
+        }
+        
+        while(*list && *list != ','){list++;}
+    }
+    
+    return 0;
+}
+
+
+/**
+ * @brief   Reads the Content-Length of a header block [RFC 7230, 3.3.2]. Every instance of
+ *          the header is checked, and a value may be a comma separated list (as left by a
+ *          proxy that merged repeated fields), as long as all the lengths are identical.
+ *          Only digits (and optional white space around them) are allowed.
+ *
+ * @retval  1   Content-Length found and valid, stored to "length"
+ * @retval  0   No Content-Length
+ * @retval  -1  Differing lengths, trailing garbage, or a length that is not a 64-bit integer
+ */
+int mangoHelper_httpContentLength(char* headers, uint64_t* length){
+    uint64_t    value;
+    uint8_t     found;
+    uint8_t     digits;
+    char*       strPtr;
+    
+    found = 0;
+    *length = 0;
+    
+    strPtr = headers;
+    while((strPtr = strstr(strPtr, "\r\n")) != NULL){
+        strPtr += 2;
+        if(strncasecmp(strPtr, MANGO_HDR__CONTENT_LENGTH, strlen(MANGO_HDR__CONTENT_LENGTH)) != 0){
+            continue;
+        }
+        
+        strPtr += strlen(MANGO_HDR__CONTENT_LENGTH);
+        while(*strPtr == ' ' || *strPtr == '\t'){strPtr++;}
+        if(*strPtr != ':'){
+            /* Another header starting with the same name */
+            continue;
+        }
+        strPtr++;
+        
+        /* Every element of the list */
+        while(1){
+            while(*strPtr == ' ' || *strPtr == '\t'){strPtr++;}
+            
+            value = 0;
+            digits = 0;
+            while(*strPtr >= '0' && *strPtr <= '9'){
+                if(value > (0xFFFFFFFFFFFFFFFFULL - (*strPtr - '0')) / 10){
+                    return -1;
+                }
+                value = value * 10 + (*strPtr - '0');
+                strPtr++;
+                digits++;
+            }
+            
+            if(!digits || (found && value != *length)){
+                return -1;
+            }
+            found = 1;
+            *length = value;
+            
+            while(*strPtr == ' ' || *strPtr == '\t'){strPtr++;}
+            if(*strPtr == ','){
+                strPtr++;
+            }else if(*strPtr == '\r' || *strPtr == '\0'){
+                break;
+            }else{
+                return -1;
+            }
+        }
+    }
+    
+    return found;
+}
+
+
+/**
+ * @brief   Returns the total length of the buffers of an iovec array
+ */
+uint64_t mangoHelper_iovecLen(mangoIovec_t* iov, uint16_t iovcnt){
+    uint64_t len;
+    
+    len = 0;
+    while(iovcnt--){
+        len += iov->buflen;
+        iov++;
+    }
+    
+    return len;
+}
+
+
 uint32_t mangoHelper_elapsedTime(uint32_t starttime){
     uint32_t now;
     
@@ -329,3 +462,18 @@ uint32_t mangoHelper_elapsedTime(uint32_t starttime){
     
     return (now >= starttime) ? now - starttime : now + (0xffffffff - starttime);
 }
+
+
+static uint32_t mangoDebug_ensureFailedCnt;
+
+/**
+ * @brief   Called when a MANGO_ENSURE_xxx() check fails in recoverable mode
+ */
+void mangoDebug_ensureFailed(const char* func, int line){
+    __atomic_fetch_add(&mangoDebug_ensureFailedCnt, 1, __ATOMIC_RELAXED);
+    MANGO_PRINTF( ("[MANGO ENSURE] %s(), line %d\r\n", func, line) );
+}
+
+uint32_t mangoDebug_ensureFailures(void){
+    return __atomic_load_n(&mangoDebug_ensureFailedCnt, __ATOMIC_RELAXED);
+}
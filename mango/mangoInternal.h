@@ -46,6 +46,40 @@
 
 #define MANGO_WB_NULLTERMINATE()    hc->workingBuffer[hc->workingBufferIndexRight]	= '\0';
 
+#define MANGO_POLL_READ             (0x01)
+#define MANGO_POLL_WRITE            (0x02)
+#define MANGO_POLL_WAKEUP           (0x04)
+
+#define MANGO_SOCKET_CLOSED         (-2)    /* mangoPort_read(): orderly shutdown by the peer */
+
+#define MANGO_WS_FRAME_HDR_MAX      (14)    /* Opcode, 64-bit length and masking key */
+
+#if MANGO_TRACE_RING_SZ & (MANGO_TRACE_RING_SZ - 1)
+    #error "MANGO_TRACE_RING_SZ must be a power of 2"
+#endif
+
+#if MANGO_TRACE_RING_SZ > 0
+    #define MANGO_TRACE(event, hc)          mangoTrace_record(event, hc)
+    #define MANGO_TRACE_BYTES(hc, bytes)    hc->traceBytes = bytes
+#else
+    #define MANGO_TRACE(event, hc)
+    #define MANGO_TRACE_BYTES(hc, bytes)
+#endif
+
+#if MANGO_WS_TX_QUEUE_SZ & (MANGO_WS_TX_QUEUE_SZ - 1)
+    #error "MANGO_WS_TX_QUEUE_SZ must be a power of 2"
+#endif
+
+#if MANGO_METRICS_ENABLED
+    #define MANGO_METRICS(call)             call
+#else
+    #define MANGO_METRICS(call)
+#endif
+
+#if defined(MANGO_TLS_ENV__OPENSSL) || defined(MANGO_TLS_ENV__MBEDTLS)
+    #define MANGO_TLS_ENABLED
+#endif
+
 /* **********************************************************************************************************************
 * Port layer function declarations
 *************************************************************************************************************************/
@@ -54,9 +88,23 @@ void*       mangoPort_malloc(uint32_t sz);
 void        mangoPort_free(void* ptr);
 int         mangoPort_read(int socketfd, uint8_t* data, uint16_t datalen, uint32_t timeout);
 int         mangoPort_write(int socketfd, uint8_t* data, uint16_t datalen, uint32_t timeout);
+int64_t     mangoPort_writev(int socketfd, mangoIovec_t* iov, uint16_t iovcnt, uint32_t timeout);
+int64_t     mangoPort_sendfile(int socketfd, int fd, uint64_t len, uint32_t timeout);
+int         mangoPort_fileRead(int fd, uint8_t* data, uint16_t datalen);
+int64_t     mangoPort_fileRemaining(int fd);
 void        mangoPort_disconnect(int socketfd);
 int         mangoPort_connect(char* serverIP, uint16_t serverPort, uint32_t timeout);
+int         mangoPort_resolve(char* host, char* ip, uint16_t iplen);
+int         mangoPort_poll(int socketfd, uint8_t events, uint32_t timeout);
+int32_t     mangoPort_writeSpace(int socketfd);
+int         mangoPort_wakeupCreate(void);
+void        mangoPort_wakeupSignal(int wakeupfd);
+void        mangoPort_wakeupClear(int wakeupfd);
+void        mangoPort_wakeupDestroy(int wakeupfd);
+int         mangoPort_pollWakeup(int socketfd, int wakeupfd, uint32_t timeout);
 uint32_t    mangoPort_timeNow(void);
+uint32_t    mangoPort_timeNowUs(void);
+int         mangoPort_random(uint8_t* buf, uint32_t buflen);
 void        mangoPort_sleep(uint32_t ms);
 
 /* **********************************************************************************************************************
@@ -64,37 +112,124 @@ void        mangoPort_sleep(uint32_t ms);
 *************************************************************************************************************************/
 int         mangoHelper_httpReponseVerify(char* response);
 int         mangoHelper_httpHeaderGet(char* response, char* headerName, char* headerValue, uint16_t headerValueLen);
+int         mangoHelper_httpTokenFind(char* list, char* token);
+int         mangoHelper_httpContentLength(char* headers, uint64_t* length);
 uint32_t    mangoHelper_elapsedTime(uint32_t starttime);
 void        mangoHelper_dec2hexstr(uint32_t dec, char hexbuf[9]);
 int         mangoHelper_hexstr2dec(char* hexstr, uint32_t* dec);
 int         mangoHelper_decstr2dec(char* decstr, uint32_t* dec);
+int         mangoHelper_decstr2dec64(char* decstr, uint64_t* dec);
 void        mangoHelper_dec2decstr(uint32_t dec, char decbuf[11]);
+uint64_t    mangoHelper_iovecLen(mangoIovec_t* iov, uint16_t iovcnt);
+
+/* **********************************************************************************************************************
+* Debug function declarations
+*************************************************************************************************************************/
+void        mangoDebug_ensureFailed(const char* func, int line);
+uint32_t    mangoDebug_ensureFailures(void);
 
 /* **********************************************************************************************************************
 * Crypto function declarations
 *************************************************************************************************************************/
 int 		mangoCrypto_base64Encode(const void* data_buf, size_t dataLength, char* result, size_t resultSize);
+void 		mangoCrypto_sha1(const void* data_buf, size_t dataLength, uint8_t digest[20]);
 
 /* **********************************************************************************************************************
 * Websocket function declarations
 *************************************************************************************************************************/
-mangoErr_t  mangoWS_close(int socketfd);
-mangoErr_t  mangoWS_pong(int socketfd);
-mangoErr_t  mangoWS_frameSend(int socketfd, uint8_t* buf, uint32_t buflen, mangoWsFrameType_t type);
+mangoErr_t  mangoWS_close(mangoHttpClient_t* hc);
+mangoErr_t  mangoWS_acceptCompute(char* key, char accept[29]);
+void        mangoWS_maskSeed(mangoHttpClient_t* hc);
+uint32_t    mangoWS_maskNext(mangoHttpClient_t* hc);
+mangoErr_t  mangoWS_handshakeVerify(mangoHttpClient_t* hc);
+mangoErr_t  mangoWS_pong(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen);
+void        mangoWS_pongReceived(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen);
+void        mangoWS_keepaliveStart(mangoHttpClient_t* hc);
+mangoErr_t  mangoWS_keepalive(mangoHttpClient_t* hc, uint32_t* next);
+mangoErr_t  mangoWS_timers(mangoHttpClient_t* hc, uint32_t* next);
+mangoErr_t  mangoWS_frameSendBatch(mangoHttpClient_t* hc, mangoWsFrame_t* frames, uint16_t framesCnt);
+mangoErr_t  mangoWS_coalesceSet(mangoHttpClient_t* hc, uint32_t bufSz, uint32_t flushDelay);
+mangoErr_t  mangoWS_coalesceFlush(mangoHttpClient_t* hc);
+mangoErr_t  mangoWS_coalesceTimer(mangoHttpClient_t* hc, uint32_t* next);
+void        mangoWS_coalesceFree(mangoHttpClient_t* hc);
+mangoErr_t  mangoWS_frameSend(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen, mangoWsFrameType_t type);
+void        mangoWS_queueInit(mangoHttpClient_t* hc);
+mangoErr_t  mangoWS_queuePush(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen, mangoWsFrameType_t type);
+uint8_t     mangoWS_queuePop(mangoHttpClient_t* hc, mangoWSQueueSlot_t* frame);
+uint8_t     mangoWS_queuePending(mangoHttpClient_t* hc);
+void        mangoWS_queueFlush(mangoHttpClient_t* hc);
+mangoErr_t  mangoWS_queueError(mangoHttpClient_t* hc);
+void        mangoWS_queueFree(mangoHttpClient_t* hc);
+void        mangoWS_queueWakeup(mangoHttpClient_t* hc);
+
+/* **********************************************************************************************************************
+* TLS function declarations
+*************************************************************************************************************************/
+mangoErr_t  mangoTLS_init(char* caFile);
+void*       mangoTLS_connect(int socketfd, char* serverName, uint16_t serverPort, uint32_t timeout);
+int         mangoTLS_read(void* tls, uint8_t* data, uint16_t datalen, uint32_t timeout);
+int         mangoTLS_write(void* tls, uint8_t* data, uint16_t datalen, uint32_t timeout);
+void        mangoTLS_disconnect(void* tls);
+uint8_t     mangoTLS_sessionResumed(void* tls);
+uint32_t    mangoTLS_pending(void* tls);
+void        mangoTLS_sessionCacheFlush(void);
+
+/* **********************************************************************************************************************
+* Loopback transport function declarations
+*************************************************************************************************************************/
+int         mangoLoopback_read(void* transportArgs, uint8_t* data, uint16_t datalen, uint32_t timeout);
+int         mangoLoopback_write(void* transportArgs, uint8_t* data, uint16_t datalen, uint32_t timeout);
+void        mangoLoopback_disconnect(void* transportArgs);
 
 /* **********************************************************************************************************************
 * Working buffer function declarations
 *************************************************************************************************************************/
 void        mangoWB_shrink(mangoHttpClient_t* hc);
 
+/* **********************************************************************************************************************
+* Trace function declarations
+*************************************************************************************************************************/
+void        mangoTrace_record(mangoEvent_e event, mangoHttpClient_t* hc);
+
+/* **********************************************************************************************************************
+* Metrics function declarations
+*************************************************************************************************************************/
+void        mangoMetrics_connect(uint32_t durationUs, uint8_t failed);
+void        mangoMetrics_disconnect(void);
+void        mangoMetrics_reconnect(void);
+void        mangoMetrics_request(uint32_t durationUs, uint16_t statusCode);
+void        mangoMetrics_rxBytes(uint64_t bytes);
+void        mangoMetrics_txBytes(uint64_t bytes);
+void        mangoMetrics_timeout(void);
+void        mangoMetrics_error(mangoErr_t err);
+
+/* **********************************************************************************************************************
+* Stats function declarations
+*************************************************************************************************************************/
+void        mangoStats_start(mangoHttpClient_t* hc);
+void        mangoStats_report(mangoHttpClient_t* hc);
+
+/* **********************************************************************************************************************
+* Redirect function declarations
+*************************************************************************************************************************/
+void        mangoRedirect_start(mangoHttpClient_t* hc);
+void        mangoRedirect_check(mangoHttpClient_t* hc);
+mangoErr_t  mangoRedirect_follow(mangoHttpClient_t* hc, mangoErr_t err);
+void        mangoRedirect_free(mangoHttpClient_t* hc);
+
 /* **********************************************************************************************************************
 * State machine function declarations
 *************************************************************************************************************************/
 mangoErr_t  mangoSM_INIT(mangoHttpClient_t* hc);
-mangoErr_t  mangoSM_PROCESS(mangoHttpClient_t* hc, mangoEvent_e event);
+void        mangoSM_REINIT(mangoHttpClient_t* hc);
+mangoErr_t  mangoSM_PROCESS(mangoHttpClient_t* hc, mangoEvent_e event, void* apiCallArgs);
 void        mangoSM_EXITERR(mangoErr_t err, mangoHttpClient_t* hc);
 void        mangoSM_THROW(mangoEvent_e event, mangoHttpClient_t* hc);
 void        mangoSM_SUBSCRIBE(mangoEvent_e event, mangoHttpClient_t* hc);
+mangoErr_t  mangoSM_FAULT(mangoHttpClient_t* hc);
+mangoErr_t  mangoSM_RUN(mangoHttpClient_t* hc, mangoEvent_e event);
+uint8_t     mangoSM_TRYLOCK(mangoHttpClient_t* hc);
+void        mangoSM_UNLOCK(mangoHttpClient_t* hc);
 
 void        mangoSM__ABORTED(mangoEvent_e event, mangoHttpClient_t* hc);
 void        mangoSM__DISCONNECTED(mangoEvent_e event, mangoHttpClient_t* hc);
@@ -121,14 +256,17 @@ mangoErr_t  mangoIDP_websocket(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buf
 /* **********************************************************************************************************************
 * Output data processor (ODP) function declarations
 *************************************************************************************************************************/
-mangoErr_t  mangoODP_raw(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, void* vargs, uint32_t* processed, uint8_t* completed);
-mangoErr_t  mangoODP_chunked(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, void* vargs, uint32_t* processed, uint8_t* completed);
+mangoErr_t  mangoODP_raw(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, void* vargs, uint64_t* processed, uint8_t* completed);
+mangoErr_t  mangoODP_chunked(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, void* vargs, uint64_t* processed, uint8_t* completed);
+mangoErr_t  mangoODP_multipart(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, void* vargs, uint64_t* processed, uint8_t* completed);
 
 /* **********************************************************************************************************************
 * Socket IO hook function declarations
 *************************************************************************************************************************/
 int         mangoSocket_read(mangoHttpClient_t* hc, uint8_t* data, uint16_t datalen, uint32_t timeout);
 int         mangoSocket_write(mangoHttpClient_t* hc, uint8_t* data, uint16_t datalen, uint32_t timeout);
+int64_t     mangoSocket_writev(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, uint32_t timeout);
+int64_t     mangoSocket_sendfile(mangoHttpClient_t* hc, int fd, uint64_t len, uint32_t timeout);
 
 
 
@@ -0,0 +1,132 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+/*
+ * In-memory loopback transport.
+ *
+ * The "server" is a script of canned byte streams (steps). A step is released
+ * when the client writes to the transport and it is then delivered to the
+ * client in fragments of at most "fragmentSz" bytes, every "delay" miliseconds.
+ * A single read never crosses the boundary of a step, so a client that has
+ * to act between two server messages (Expect: 100-continue, websocket echo..)
+ * gets them one by one.
+*/
+
+void mango_loopbackInit(mangoLoopback_t* loopback, mangoLoopbackStep_t* steps, uint16_t stepsCnt, uint16_t fragmentSz, uint32_t delay, uint8_t closeOnEnd){
+    MANGO_ENSURE_VOID(loopback, ("?") );
+
+    memset(loopback, 0, sizeof(mangoLoopback_t));
+
+    loopback->steps         = steps;
+    loopback->stepsCnt      = stepsCnt;
+    loopback->fragmentSz    = fragmentSz;
+    loopback->delay         = delay;
+    loopback->closeOnEnd    = closeOnEnd;
+}
+
+int mangoLoopback_read(void* transportArgs, uint8_t* data, uint16_t datalen, uint32_t timeout){
+    mangoLoopback_t* loopback = (mangoLoopback_t*) transportArgs;
+    mangoLoopbackStep_t* step;
+    uint32_t elapsed;
+    uint32_t sz;
+
+    if(!loopback->stepReleased){
+        if(loopback->step >= loopback->stepsCnt && loopback->closeOnEnd){
+            return MANGO_SOCKET_CLOSED;
+        }
+
+        /* Nothing is going to arrive until the client writes */
+        mangoPort_sleep(timeout);
+        return 0;
+    }
+
+    if(loopback->delay){
+        elapsed = mangoHelper_elapsedTime(loopback->fragmentTimestamp);
+        if(elapsed < loopback->delay){
+            if(loopback->delay - elapsed > timeout){
+                mangoPort_sleep(timeout);
+                return 0;
+            }
+            mangoPort_sleep(loopback->delay - elapsed);
+        }
+    }
+
+    step = &loopback->steps[loopback->step];
+
+    sz = step->datalen - loopback->stepIndex;
+    if(loopback->fragmentSz && sz > loopback->fragmentSz){
+        sz = loopback->fragmentSz;
+    }
+    if(sz > datalen){
+        sz = datalen;
+    }
+
+    memcpy(data, &step->data[loopback->stepIndex], sz);
+
+    loopback->stepIndex         += sz;
+    loopback->rxBytes           += sz;
+    loopback->fragmentTimestamp  = mangoPort_timeNow();
+
+    if(loopback->stepIndex == step->datalen){
+        /* Step replayed, the next one waits for the client */
+        loopback->step++;
+        loopback->stepIndex     = 0;
+        loopback->stepReleased  = 0;
+    }
+
+    return sz;
+}
+
+int mangoLoopback_write(void* transportArgs, uint8_t* data, uint16_t datalen, uint32_t timeout){
+    mangoLoopback_t* loopback = (mangoLoopback_t*) transportArgs;
+
+    (void) data;
+    (void) timeout;
+
+    if(!loopback->stepReleased){
+        if(loopback->step >= loopback->stepsCnt){
+            if(loopback->closeOnEnd){
+                return -1;
+            }
+
+            /* Replay the script again */
+            loopback->step = 0;
+        }
+
+        if(loopback->stepsCnt){
+            loopback->stepIndex         = 0;
+            loopback->stepReleased      = 1;
+            loopback->fragmentTimestamp = mangoPort_timeNow();
+        }
+    }
+
+    loopback->txBytes += datalen;
+
+    return datalen;
+}
+
+void mangoLoopback_disconnect(void* transportArgs){
+    (void) transportArgs;
+}
@@ -0,0 +1,282 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+/*
+ * Process wide metrics registry, shared by all the clients.
+ *
+ * Counters are updated with relaxed atomic additions so clients running in
+ * different threads never contend on a lock. Latencies are recorded in
+ * log-linear histograms (HDR style): every power of two microseconds is
+ * split in 4 linear sub-buckets, so a value is placed with at most 25%
+ * relative error using a single count-leading-zeros.
+*/
+
+#if MANGO_METRICS_ENABLED
+
+/*
+* 4 linear buckets for [0, 3] us, then 4 sub-buckets for every power of two
+* up to 2^26 us (~67 seconds). Bigger values only show up in "+Inf".
+*/
+#define MANGO_METRICS_HIST_SUB_BITS     (2)
+#define MANGO_METRICS_HIST_SUB_CNT      (1 << MANGO_METRICS_HIST_SUB_BITS)
+#define MANGO_METRICS_HIST_MAX_EXP      (26)
+#define MANGO_METRICS_HIST_BUCKETS      (MANGO_METRICS_HIST_SUB_CNT + (MANGO_METRICS_HIST_MAX_EXP - MANGO_METRICS_HIST_SUB_BITS + 1) * MANGO_METRICS_HIST_SUB_CNT)
+
+/*
+* Error codes are counted by value, bigger values are counted as MANGO_ERR
+*/
+#define MANGO_METRICS_ERR_CNT           (MANGO_ERR_HTTP_100)
+
+#define MANGO_METRICS_ADD(var, val)     __atomic_fetch_add(&(var), (val), __ATOMIC_RELAXED)
+#define MANGO_METRICS_GET(var)          __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+typedef struct{
+    uint64_t    buckets[MANGO_METRICS_HIST_BUCKETS + 1]; /* Last one is the overflow bucket */
+    uint64_t    sum;    /* [microseconds] */
+}mangoMetricsHist_t;
+
+typedef struct{
+    uint64_t            connections;
+    uint64_t            connectFailures;
+    uint64_t            disconnects;
+    uint64_t            reconnects;
+    uint64_t            requests;
+    uint64_t            responses[6];   /* By status class, 0 for requests without a response */
+    uint64_t            rxBytes;
+    uint64_t            txBytes;
+    uint64_t            timeouts;
+    uint64_t            errors[MANGO_METRICS_ERR_CNT];
+
+    mangoMetricsHist_t  connectDuration;
+    mangoMetricsHist_t  requestDuration;
+}mangoMetrics_t;
+
+static mangoMetrics_t mangoMetrics;
+
+static const char* mangoMetrics_errNames[] = {
+    "MANGO_OK",
+    "MANGO_ERR",
+    "MANGO_ERR_CONNECTION",
+    "MANGO_ERR_ABORTED",
+    "MANGO_ERR_APICALLNOTSUPPORTED",
+    "MANGO_ERR_INVALIDREQHEADERS",
+    "MANGO_ERR_RESPTIMEOUT",
+    "MANGO_ERR_RESPFORMAT",
+    "MANGO_ERR_DATAPROCESSING",
+    "MANGO_ERR_WORKBUFSMALL",
+    "MANGO_ERR_CONTENTLENGTH",
+    "MANGO_ERR_WRITETIMEOUT",
+    "MANGO_ERR_TEMPBUFSMALL",
+    "MANGO_ERR_APPABORTED",
+    "MANGO_ERR_MOREDATANEEDED",
+    "MANGO_ERR_WEBSOCKETCLOSED",
+    "MANGO_ERR_INTERNAL",
+    "MANGO_ERR_BUSY",
+    "MANGO_ERR_QUEUEFULL",
+    "MANGO_ERR_WSHANDSHAKE",
+    "MANGO_ERR_WSIDLETIMEOUT",
+    "MANGO_ERR_WSPINNED",
+};
+
+
+static uint32_t mangoMetrics_histBucket(uint32_t value){
+    uint32_t exponent;
+    uint32_t index;
+
+    if(value < MANGO_METRICS_HIST_SUB_CNT){
+        return value;
+    }
+
+    exponent = 31 - __builtin_clz(value);
+    if(exponent > MANGO_METRICS_HIST_MAX_EXP){
+        return MANGO_METRICS_HIST_BUCKETS;
+    }
+
+    index  = MANGO_METRICS_HIST_SUB_CNT + (exponent - MANGO_METRICS_HIST_SUB_BITS) * MANGO_METRICS_HIST_SUB_CNT;
+    index += (value >> (exponent - MANGO_METRICS_HIST_SUB_BITS)) & (MANGO_METRICS_HIST_SUB_CNT - 1);
+
+    return index;
+}
+
+/*
+* Largest value [microseconds] that falls into the specified bucket
+*/
+static uint32_t mangoMetrics_histBucketMax(uint32_t index){
+    uint32_t exponent;
+    uint32_t sub;
+
+    if(index < MANGO_METRICS_HIST_SUB_CNT){
+        return index;
+    }
+
+    exponent = (index - MANGO_METRICS_HIST_SUB_CNT) / MANGO_METRICS_HIST_SUB_CNT + MANGO_METRICS_HIST_SUB_BITS;
+    sub      = (index - MANGO_METRICS_HIST_SUB_CNT) % MANGO_METRICS_HIST_SUB_CNT;
+
+    return ((MANGO_METRICS_HIST_SUB_CNT + sub + 1) << (exponent - MANGO_METRICS_HIST_SUB_BITS)) - 1;
+}
+
+static void mangoMetrics_histRecord(mangoMetricsHist_t* hist, uint32_t value){
+    MANGO_METRICS_ADD(hist->buckets[mangoMetrics_histBucket(value)], 1);
+    MANGO_METRICS_ADD(hist->sum, value);
+}
+
+
+void mangoMetrics_connect(uint32_t durationUs, uint8_t failed){
+    if(failed){
+        MANGO_METRICS_ADD(mangoMetrics.connectFailures, 1);
+    }else{
+        MANGO_METRICS_ADD(mangoMetrics.connections, 1);
+        mangoMetrics_histRecord(&mangoMetrics.connectDuration, durationUs);
+    }
+}
+
+void mangoMetrics_disconnect(void){
+    MANGO_METRICS_ADD(mangoMetrics.disconnects, 1);
+}
+
+void mangoMetrics_reconnect(void){
+    MANGO_METRICS_ADD(mangoMetrics.reconnects, 1);
+}
+
+void mangoMetrics_request(uint32_t durationUs, uint16_t statusCode){
+    MANGO_METRICS_ADD(mangoMetrics.requests, 1);
+    MANGO_METRICS_ADD(mangoMetrics.responses[(statusCode >= 100 && statusCode <= 599) ? statusCode / 100 : 0], 1);
+    mangoMetrics_histRecord(&mangoMetrics.requestDuration, durationUs);
+}
+
+void mangoMetrics_rxBytes(uint64_t bytes){
+    MANGO_METRICS_ADD(mangoMetrics.rxBytes, bytes);
+}
+
+void mangoMetrics_txBytes(uint64_t bytes){
+    MANGO_METRICS_ADD(mangoMetrics.txBytes, bytes);
+}
+
+void mangoMetrics_timeout(void){
+    MANGO_METRICS_ADD(mangoMetrics.timeouts, 1);
+}
+
+void mangoMetrics_error(mangoErr_t err){
+    MANGO_METRICS_ADD(mangoMetrics.errors[(uint32_t) err < MANGO_METRICS_ERR_CNT ? err : MANGO_ERR], 1);
+}
+
+
+/*
+* Appends formatted text to the export buffer. On overflow "*len" is set
+* past "buflen" and nothing else is written.
+*/
+#define MANGO_METRICS_PRINT(...) \
+    do{ \
+        if(*len < buflen){ \
+            *len += snprintf(&buf[*len], buflen - *len, __VA_ARGS__); \
+        } \
+    }while(0)
+
+static void mangoMetrics_exportCounter(char* buf, uint32_t buflen, uint32_t* len, char* name, char* help, uint64_t value){
+    MANGO_METRICS_PRINT("# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, (unsigned long long) value);
+}
+
+static void mangoMetrics_exportHist(char* buf, uint32_t buflen, uint32_t* len, char* name, char* help, mangoMetricsHist_t* hist){
+    uint64_t cumulative;
+    uint32_t bucketMax;
+    uint32_t i;
+
+    MANGO_METRICS_PRINT("# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+    cumulative = 0;
+    for(i = 0; i < MANGO_METRICS_HIST_BUCKETS; i++){
+        cumulative += MANGO_METRICS_GET(hist->buckets[i]);
+        bucketMax = mangoMetrics_histBucketMax(i);
+        MANGO_METRICS_PRINT("%s_bucket{le=\"%u.%06u\"} %llu\n", name, bucketMax / 1000000, bucketMax % 1000000, (unsigned long long) cumulative);
+    }
+    cumulative += MANGO_METRICS_GET(hist->buckets[MANGO_METRICS_HIST_BUCKETS]);
+
+    MANGO_METRICS_PRINT("%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) cumulative);
+    MANGO_METRICS_PRINT("%s_sum %.6f\n", name, MANGO_METRICS_GET(hist->sum) / 1000000.0);
+    MANGO_METRICS_PRINT("%s_count %llu\n", name, (unsigned long long) cumulative);
+}
+
+#endif
+
+
+int mango_metricsExport(char* buf, uint32_t buflen){
+#if MANGO_METRICS_ENABLED
+    static const char* classes[] = {"none", "1xx", "2xx", "3xx", "4xx", "5xx"};
+    uint32_t length = 0;
+    uint32_t* len = &length;
+    uint64_t value;
+    uint32_t i;
+
+    MANGO_ENSURE_RET(buf, -1, ("?") );
+
+    mangoMetrics_exportCounter(buf, buflen, len, "mango_connections_total", "Connections established.", MANGO_METRICS_GET(mangoMetrics.connections));
+    mangoMetrics_exportCounter(buf, buflen, len, "mango_connect_failures_total", "Connection attempts that failed.", MANGO_METRICS_GET(mangoMetrics.connectFailures));
+    mangoMetrics_exportCounter(buf, buflen, len, "mango_disconnects_total", "Connections closed.", MANGO_METRICS_GET(mangoMetrics.disconnects));
+    mangoMetrics_exportCounter(buf, buflen, len, "mango_reconnects_total", "Connections established again for an existing client (redirects, retries).", MANGO_METRICS_GET(mangoMetrics.reconnects));
+    mangoMetrics_exportCounter(buf, buflen, len, "mango_requests_total", "HTTP requests processed.", MANGO_METRICS_GET(mangoMetrics.requests));
+
+    MANGO_METRICS_PRINT("# HELP mango_responses_total HTTP requests by response status class.\n# TYPE mango_responses_total counter\n");
+    for(i = 0; i < sizeof(classes) / sizeof(classes[0]); i++){
+        MANGO_METRICS_PRINT("mango_responses_total{class=\"%s\"} %llu\n", classes[i], (unsigned long long) MANGO_METRICS_GET(mangoMetrics.responses[i]));
+    }
+
+    mangoMetrics_exportCounter(buf, buflen, len, "mango_rx_bytes_total", "Bytes received.", MANGO_METRICS_GET(mangoMetrics.rxBytes));
+    mangoMetrics_exportCounter(buf, buflen, len, "mango_tx_bytes_total", "Bytes sent.", MANGO_METRICS_GET(mangoMetrics.txBytes));
+    mangoMetrics_exportCounter(buf, buflen, len, "mango_timeouts_total", "State machine timeouts.", MANGO_METRICS_GET(mangoMetrics.timeouts));
+    mangoMetrics_exportCounter(buf, buflen, len, "mango_ensure_failures_total", "Internal consistency checks that failed.", mangoDebug_ensureFailures());
+
+    MANGO_METRICS_PRINT("# HELP mango_errors_total API calls that returned an error, by error code.\n# TYPE mango_errors_total counter\n");
+    for(i = MANGO_ERR; i < MANGO_METRICS_ERR_CNT; i++){
+        value = MANGO_METRICS_GET(mangoMetrics.errors[i]);
+        if(!value){
+            continue;
+        }
+        if(i < sizeof(mangoMetrics_errNames) / sizeof(mangoMetrics_errNames[0])){
+            MANGO_METRICS_PRINT("mango_errors_total{code=\"%s\"} %llu\n", mangoMetrics_errNames[i], (unsigned long long) value);
+        }else{
+            MANGO_METRICS_PRINT("mango_errors_total{code=\"%u\"} %llu\n", i, (unsigned long long) value);
+        }
+    }
+
+    mangoMetrics_exportHist(buf, buflen, len, "mango_connect_duration_seconds", "Duration of the TCP connection establishment.", &mangoMetrics.connectDuration);
+    mangoMetrics_exportHist(buf, buflen, len, "mango_request_duration_seconds", "Duration of the HTTP requests, from mango_httpRequestProcess() until completion or failure.", &mangoMetrics.requestDuration);
+
+    if(length >= buflen){
+        return -1;
+    }
+
+    return length;
+#else
+    (void) buf;
+    (void) buflen;
+    return -1;
+#endif
+}
+
+void mango_metricsReset(void){
+#if MANGO_METRICS_ENABLED
+    memset(&mangoMetrics, 0, sizeof(mangoMetrics));
+#endif
+}
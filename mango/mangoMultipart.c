@@ -0,0 +1,281 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+/*
+ * multipart/form-data request bodies [RFC 7578].
+ *
+ * mango_httpMultipartSet() adds the Content-Type header of the request and,
+ * when the length of every part is known, its Content-Length, else the body
+ * is sent chunked. Once the request headers are sent the multipart ODP is
+ * attached on top of the raw/chunked one and it streams all the parts when
+ * the application ends the body. A memory part is written together with its
+ * header, a file part is sent straight from the file [sendfile()].
+*/
+
+/*
+ * Builds the header of part "index" (preceded by the CRLF that ends the
+ * previous part), or the closing delimiter when "index" is "partsCnt".
+ * Returns its length, 0 if it does not fit in "buf".
+ */
+static uint16_t mangoMultipart_headBuild(mangoODPArgsMultipart_t* args, uint16_t index, char* buf, uint16_t bufSz){
+	mangoMultipartPart_t* part;
+	int len;
+	
+	if(index == args->partsCnt){
+		len = snprintf(buf, bufSz, "\r\n--%s--\r\n", args->boundary);
+	}else{
+		part = &args->parts[index];
+		len = snprintf(buf, bufSz, "%s--%s\r\nContent-Disposition: form-data; name=\"%s\"%s%s%s\r\n%s%s%s\r\n",
+		               index ? "\r\n" : "", args->boundary, part->name, 
+		               part->filename ? "; filename=\"" : "", part->filename ? part->filename : "", part->filename ? "\"" : "",
+		               part->contentType ? MANGO_HDR__CONTENT_TYPE ": " : "", part->contentType ? part->contentType : "", part->contentType ? "\r\n" : "");
+	}
+	
+	return (len < 0 || len >= bufSz) ? 0 : len;
+}
+
+/*
+ * Returns the data length of a part, < 0 if it is not known
+ */
+static int64_t mangoMultipart_partLen(mangoMultipartPart_t* part){
+	if(part->buf || part->len){
+		return part->len;
+	}
+	
+	return mangoPort_fileRemaining(part->fd);
+}
+
+/*
+ * Checks that a header parameter can be sent as a quoted string
+ */
+static uint8_t mangoMultipart_paramValid(char* param){
+	return strcspn(param, "\"\r\n") == strlen(param);
+}
+
+/*
+ * Sends the data of a file part through the framing ODP
+ */
+static mangoErr_t mangoMultipart_fileSend(mangoHttpClient_t* hc, mangoODPArgsMultipart_t* args, mangoMultipartPart_t* part, uint64_t* processed){
+	mangoODPArgsRaw_t* raw;
+	mangoIovec_t vec;
+	char chunkSzLine[16 + 2 + 1];
+	uint64_t sent;
+	uint8_t completed;
+	int64_t len;
+	mangoErr_t err;
+	int n;
+	
+	*processed = 0;
+	raw = (mangoODPArgsRaw_t*) args->odpArgs;
+	
+	len = mangoMultipart_partLen(part);
+	if(len < 0){
+		/* Unknown length, the body is chunked: the file is read through the WB */
+		while((n = mangoPort_fileRead(part->fd, hc->workingBuffer, MANGO_WORKING_BUFFER_SZ)) > 0){
+			vec.buf = hc->workingBuffer;
+			vec.buflen = n;
+			err = args->odp(hc, &vec, 1, args->odpArgs, &sent, &completed);
+			if(err != MANGO_OK){
+				return err;
+			}
+			*processed += sent;
+		}
+		
+		return n < 0 ? MANGO_ERR_DATAPROCESSING : MANGO_OK;
+	}
+	
+	if(len == 0){
+		return MANGO_OK;
+	}
+	
+	if(args->odp == mangoODP_chunked){
+		/* The file is one chunk */
+		n = snprintf(chunkSzLine, sizeof(chunkSzLine), "%llX\r\n", (unsigned long long) len);
+		if(mangoSocket_write(hc, (uint8_t*) chunkSzLine, n, MANGO_SOCKET_WRITE_TIMEOUT_MS) != n){
+			return MANGO_ERR_WRITETIMEOUT;
+		}
+	}else{
+		if(raw->fileSzProcessed + len > raw->fileSz){
+			/* The file grew since mango_httpMultipartSet() */
+			return MANGO_ERR_CONTENTLENGTH;
+		}
+	}
+	
+	if(mangoSocket_sendfile(hc, part->fd, len, MANGO_SOCKET_WRITE_TIMEOUT_MS) != len){
+		return MANGO_ERR_WRITETIMEOUT;
+	}
+	
+	if(args->odp == mangoODP_chunked){
+		if(mangoSocket_write(hc, (uint8_t*) "\r\n", 2, MANGO_SOCKET_WRITE_TIMEOUT_MS) != 2){
+			return MANGO_ERR_WRITETIMEOUT;
+		}
+	}else{
+		raw->fileSzProcessed += len;
+	}
+	
+	*processed = len;
+	
+	return MANGO_OK;
+}
+
+/*
+ * Output data processor for multipart/form-data bodies. The application only
+ * ends the body, all the data come from the parts.
+*/
+mangoErr_t mangoODP_multipart(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, void* vargs, uint64_t* processed, uint8_t* completed){
+	mangoODPArgsMultipart_t* args = (mangoODPArgsMultipart_t*) vargs;
+	mangoMultipartPart_t* part;
+	mangoIovec_t vec[2];
+	char head[MANGO_MULTIPART_HEAD_SZ];
+	uint64_t sent;
+	uint16_t i;
+	mangoErr_t err;
+	
+	MANGO_DBG(MANGO_DBG_LEVEL_DP, ("ODP [HTTP, MULTIPART] %u parts\r\n", args->partsCnt) );
+	
+	*completed = 0;
+	*processed = 0;
+	
+	if(mangoHelper_iovecLen(iov, iovcnt)){
+		/* The body is made of the parts only */
+		return MANGO_ERR_DATAPROCESSING;
+	}
+	
+	for(i = 0; i <= args->partsCnt; i++){
+		vec[0].buf = (uint8_t*) head;
+		vec[0].buflen = mangoMultipart_headBuild(args, i, head, sizeof(head));
+		if(!vec[0].buflen){
+			return MANGO_ERR_TEMPBUFSMALL;
+		}
+		
+		part = i < args->partsCnt ? &args->parts[i] : NULL;
+		if(part && part->buf){
+			vec[1].buf = part->buf;
+			vec[1].buflen = part->len;
+		}
+		
+		err = args->odp(hc, vec, (part && part->buf) ? 2 : 1, args->odpArgs, &sent, completed);
+		if(err != MANGO_OK){
+			return err;
+		}
+		*processed += sent;
+		
+		if(part && !part->buf){
+			err = mangoMultipart_fileSend(hc, args, part, &sent);
+			if(err != MANGO_OK){
+				return err;
+			}
+			*processed += sent;
+		}
+	}
+	
+	/* End of the body */
+	return args->odp(hc, NULL, 0, args->odpArgs, &sent, completed);
+}
+
+
+mangoErr_t mango_httpMultipartSet(mangoHttpClient_t* hc, mangoMultipartPart_t* parts, uint16_t partsCnt){
+	mangoODPArgsMultipart_t* args;
+	char head[MANGO_MULTIPART_HEAD_SZ];
+	char value[sizeof(args->boundary) + 32];
+	uint8_t nonce[16];
+	uint64_t total;
+	uint16_t headlen;
+	uint8_t known;
+	int64_t len;
+	mangoErr_t err;
+	uint16_t i;
+	
+	MANGO_ENSURE_RET(hc, MANGO_ERR, ("?") );
+	MANGO_ENSURE_RET(parts && partsCnt, MANGO_ERR, ("?") );
+	MANGO_ENSURE_RET(hc->workingBufferIndexRight > 2, MANGO_ERR, ("?") );
+	
+	for(i = 0; i < partsCnt; i++){
+		if(!parts[i].name || !mangoMultipart_paramValid(parts[i].name) ||
+		   (parts[i].filename && !mangoMultipart_paramValid(parts[i].filename)) ||
+		   (parts[i].contentType && strcspn(parts[i].contentType, "\r\n") != strlen(parts[i].contentType)) ||
+		   (!parts[i].buf && parts[i].fd < 0)){
+			return MANGO_ERR;
+		}
+	}
+	
+	args = &hc->ODPArgsMultipart;
+	args->parts = parts;
+	args->partsCnt = partsCnt;
+	
+	if(mangoPort_random(nonce, sizeof(nonce)) < 0){
+		goto handleError;
+	}
+	strcpy(args->boundary, "mango-");
+	for(i = 0; i < sizeof(nonce); i++){
+		args->boundary[6 + 2 * i]		= "0123456789abcdef"[nonce[i] >> 4];
+		args->boundary[6 + 2 * i + 1]	= "0123456789abcdef"[nonce[i] & 0x0F];
+	}
+	args->boundary[6 + 2 * sizeof(nonce)] = '\0';
+	
+	/* 
+	* Body length: the headers, the data and the closing delimiter
+	*/
+	total = 0;
+	known = 1;
+	for(i = 0; i <= partsCnt; i++){
+		headlen = mangoMultipart_headBuild(args, i, head, sizeof(head));
+		if(!headlen){
+			goto handleError;
+		}
+		total += headlen;
+		
+		if(i < partsCnt){
+			len = mangoMultipart_partLen(&parts[i]);
+			if(len < 0){
+				known = 0;
+			}else{
+				total += len;
+			}
+		}
+	}
+	
+	snprintf(value, sizeof(value), "multipart/form-data; boundary=%s", args->boundary);
+	err = mango_httpHeaderSet(hc, MANGO_HDR__CONTENT_TYPE, value);
+	if(err != MANGO_OK){
+		goto handleError;
+	}
+	
+	if(known){
+		snprintf(value, sizeof(value), "%llu", (unsigned long long) total);
+		err = mango_httpHeaderSet(hc, MANGO_HDR__CONTENT_LENGTH, value);
+	}else{
+		err = mango_httpHeaderSet(hc, MANGO_HDR__TRANSFER_ENCODING, "chunked");
+	}
+	if(err != MANGO_OK){
+		goto handleError;
+	}
+	
+	return MANGO_OK;
+	
+	handleError:
+		args->parts = NULL;
+		return MANGO_ERR;
+}
@@ -37,13 +37,23 @@
     #include <string.h>
     #include <sys/types.h>
     #include <sys/socket.h>
+    #include <sys/uio.h>
     #include <netinet/in.h>
     #include <netdb.h> 
 
     #include <sys/time.h>
+    #include <time.h>
     #include <sys/stat.h>
     #include <fcntl.h>
     #include <errno.h>
+    #include <poll.h>
+    #ifdef __linux__
+        #include <sys/eventfd.h>
+        #include <sys/random.h>
+        #include <sys/sendfile.h>
+        #include <sys/ioctl.h>
+        #include <linux/sockios.h>
+    #endif
 #endif
 
 #ifdef MANGO_IP_ENV__LWIP
@@ -68,6 +78,68 @@ uint32_t mangoPort_timeNow(){
 #endif
 }
 
+/**
+ * @brief   Get the current timestamp in microseconds. Only used for measuring
+ *          durations, so wrapping around is fine.
+ */
+uint32_t mangoPort_timeNowUs(){
+    
+#ifdef MANGO_OS_ENV__UNIX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return  (ts.tv_sec) * 1000000 + (ts.tv_nsec) / 1000;
+#endif
+    
+#ifdef MANGO_OS_ENV__CHIBIOS
+    return chTimeNow() * (1000000 / CH_FREQUENCY);
+#endif
+}
+
+/**
+ * @brief   Fill "buf" with "buflen" random bytes, used for the websocket
+ *          handshake key. Ports should use a hardware RNG when available.
+ *
+ * @retval  0       Success
+ * @retval  < 0     No entropy source is available
+ */
+int mangoPort_random(uint8_t* buf, uint32_t buflen){
+#ifdef MANGO_OS_ENV__UNIX
+    ssize_t retval;
+    int fd;
+    
+#ifdef __linux__
+    retval = getrandom(buf, buflen, 0);
+    if(retval == (ssize_t) buflen){
+        return 0;
+    }
+#endif
+    
+    fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return -1;
+    }
+    retval = read(fd, buf, buflen);
+    close(fd);
+    
+    return retval == (ssize_t) buflen ? 0 : -1;
+#endif
+    
+#ifdef MANGO_OS_ENV__CHIBIOS
+    /* No entropy source, replace with the hardware RNG of the target */
+    static uint32_t state;
+    uint32_t i;
+    
+    state ^= chTimeNow();
+    for(i = 0; i < buflen; i++){
+        state = state * 1664525 + 1013904223;
+        buf[i] = state >> 24;
+    }
+    
+    return 0;
+#endif
+}
+
 /**
  * @brief   Sleep for the specified number of miliseconds
  */
@@ -116,12 +188,16 @@ void mangoPort_free(void* ptr){
  *          only defines the mamixum number of bytes that should be read.
  *
  * @retval  >= 0    The number of bytes read. 0 means timeout happend and no bytes were read.
- * @retval  < 0     Indicates connection error. In this case the function should return
- *                  even if the timeout has not been expired. mango will return with an error.
+ * @retval  MANGO_SOCKET_CLOSED  The peer closed the connection (orderly shutdown). mango
+ *                  returns with an error, unless the response body is delimited by the
+ *                  connection close.
+ * @retval  < 0     Indicates connection error [reset, ..]. In both cases the function should
+ *                  return even if the timeout has not been expired.
  */
 int mangoPort_read(int socketfd, uint8_t* data, uint16_t datalen, uint32_t timeout){
     uint32_t received;
     uint32_t start;
+    uint32_t elapsed;
     int socketerror;
     int retval;
 	
@@ -149,16 +225,24 @@ int mangoPort_read(int socketfd, uint8_t* data, uint16_t datalen, uint32_t timeo
             MANGO_DBG(MANGO_DBG_LEVEL_PORT, ("!!!!!!! READ SOCKET ERROR %d\r\n", socketerror) );
             
             if(socketerror == EWOULDBLOCK || socketerror == EAGAIN){
-                mangoPort_sleep(64);
+                /* Block until the socket is ready (or the timeout expires) */
+                elapsed = mangoHelper_elapsedTime(start);
+                if(mangoPort_poll(socketfd, MANGO_POLL_READ, elapsed < timeout ? timeout - elapsed : 0) < 0){
+                    return -1;
+                }
             }else{
                 return -1;
             }
+        }else if(retval == 0){
+            /* Orderly shutdown by the peer */
+            MANGO_DBG(MANGO_DBG_LEVEL_PORT, ("!!!!!!! CONNECTION CLOSED BY PEER\r\n") );
+            return MANGO_SOCKET_CLOSED;
         }else{
             received += retval;
             return received;
         }
         
-        if(mangoHelper_elapsedTime(start) > timeout){
+        if(mangoHelper_elapsedTime(start) >= timeout){
             return received;
         }
 	}
@@ -185,6 +269,7 @@ int mangoPort_read(int socketfd, uint8_t* data, uint16_t datalen, uint32_t timeo
 int mangoPort_write(int socketfd, uint8_t* data, uint16_t datalen, uint32_t timeout){
     uint32_t sent;
     uint32_t start;
+    uint32_t elapsed;
     int socketerror;
     int retval;
     
@@ -210,7 +295,11 @@ int mangoPort_write(int socketfd, uint8_t* data, uint16_t datalen, uint32_t time
             MANGO_DBG(MANGO_DBG_LEVEL_PORT, ("!!!!!!! WRITE SOCKET ERROR %d\r\n", socketerror) );
             
             if(socketerror == EWOULDBLOCK || socketerror == EAGAIN){
-                mangoPort_sleep(64);
+                /* Block until the socket is ready (or the timeout expires) */
+                elapsed = mangoHelper_elapsedTime(start);
+                if(mangoPort_poll(socketfd, MANGO_POLL_WRITE, elapsed < timeout ? timeout - elapsed : 0) < 0){
+                    return -1;
+                }
             }else{
                 return -1;
             }
@@ -218,7 +307,7 @@ int mangoPort_write(int socketfd, uint8_t* data, uint16_t datalen, uint32_t time
             sent += retval;
         }
         
-        if(mangoHelper_elapsedTime(start) > timeout){
+        if(mangoHelper_elapsedTime(start) >= timeout){
             return sent;
         }
     };
@@ -226,6 +315,397 @@ int mangoPort_write(int socketfd, uint8_t* data, uint16_t datalen, uint32_t time
     return sent;
 }
 
+/**
+ * @brief   Same as mangoPort_write() for the "iovcnt" buffers of "iov", in order. Up to
+ *          MANGO_SOCKET_IOV_MAX buffers are written with a single writev() call. As the
+ *          buffers may be large the "timeout" is counted from the last progress.
+ *
+ * @retval  >= 0    The number of bytes sent. If this number is not equal to the total
+ *                  length of the buffers mango will consider the connection closed.
+ * @retval  < 0     Indicates connection error.
+ */
+int64_t mangoPort_writev(int socketfd, mangoIovec_t* iov, uint16_t iovcnt, uint32_t timeout){
+    struct iovec vec[MANGO_SOCKET_IOV_MAX];
+    uint64_t offset;
+    uint64_t len;
+    int64_t sent;
+    uint32_t start;
+    uint32_t elapsed;
+    uint16_t veccnt;
+    int socketerror;
+    ssize_t retval;
+    
+    sent = 0;
+    offset = 0; /* Bytes of iov[0] already sent */
+    start = mangoPort_timeNow();
+    while(1){
+        while(iovcnt && iov->buflen == offset){
+            iov++;
+            iovcnt--;
+            offset = 0;
+        }
+        
+        if(!iovcnt){
+            break;
+        }
+        
+        for(veccnt = 0; veccnt < iovcnt && veccnt < MANGO_SOCKET_IOV_MAX; veccnt++){
+            len = iov[veccnt].buflen - (veccnt ? 0 : offset);
+            vec[veccnt].iov_base = iov[veccnt].buf + (veccnt ? 0 : offset);
+            /* Keep the total below SSIZE_MAX, the rest is sent by the next call */
+            vec[veccnt].iov_len = len > 0x40000000 ? 0x40000000 : len;
+        }
+        
+        MANGO_DBG(MANGO_DBG_LEVEL_PORT, ("Trying to write %u buffers\r\n", veccnt) );
+        
+        retval = writev(socketfd, vec, veccnt);
+        if(retval < 0){
+#ifdef MANGO_IP_ENV__UNIX
+            socketerror = errno;
+#endif
+            
+#ifdef MANGO_IP_ENV__LWIP
+            socklen_t socketerrorlen;
+            socketerrorlen = sizeof(socketerror);
+            getsockopt(socketfd, SOL_SOCKET, SO_ERROR, &socketerror, (socklen_t *) &socketerrorlen);
+#endif
+            
+            MANGO_DBG(MANGO_DBG_LEVEL_PORT, ("!!!!!!! WRITEV SOCKET ERROR %d\r\n", socketerror) );
+            
+            if(socketerror == EWOULDBLOCK || socketerror == EAGAIN){
+                /* Block until the socket is ready (or the timeout expires) */
+                elapsed = mangoHelper_elapsedTime(start);
+                if(mangoPort_poll(socketfd, MANGO_POLL_WRITE, elapsed < timeout ? timeout - elapsed : 0) < 0){
+                    return -1;
+                }
+            }else{
+                return -1;
+            }
+        }else{
+            sent += retval;
+            start = mangoPort_timeNow();
+            
+            /* Skip the buffers that were completely sent */
+            while(retval && (uint64_t) retval >= iov->buflen - offset){
+                retval -= iov->buflen - offset;
+                iov++;
+                iovcnt--;
+                offset = 0;
+            }
+            offset += retval;
+        }
+        
+        if(mangoHelper_elapsedTime(start) >= timeout){
+            return sent;
+        }
+    }
+    
+    return sent;
+}
+
+/**
+ * @brief   Same as mangoPort_write() for the next "len" bytes of file "fd", read from
+ *          its current offset. The data are copied in the kernel [sendfile()] when
+ *          it is possible. The "timeout" is counted from the last progress.
+ *
+ * @retval  >= 0    The number of bytes sent. It is less than "len" if the timeout expired
+ *                  or the end of the file was reached.
+ * @retval  < 0     Indicates connection or file error.
+ */
+int64_t mangoPort_sendfile(int socketfd, int fd, uint64_t len, uint32_t timeout){
+    uint64_t sent;
+    uint32_t start;
+    uint32_t elapsed;
+    
+    sent = 0;
+    start = mangoPort_timeNow();
+    while(sent < len){
+#if defined(MANGO_IP_ENV__UNIX) && defined(__linux__)
+        ssize_t retval;
+        
+        retval = sendfile(socketfd, fd, NULL, len - sent > 0x40000000 ? 0x40000000 : len - sent);
+        if(retval < 0){
+            if(errno == EWOULDBLOCK || errno == EAGAIN){
+                /* Block until the socket is ready (or the timeout expires) */
+                elapsed = mangoHelper_elapsedTime(start);
+                if(mangoPort_poll(socketfd, MANGO_POLL_WRITE, elapsed < timeout ? timeout - elapsed : 0) < 0){
+                    return -1;
+                }
+            }else{
+                return -1;
+            }
+        }else if(retval == 0){
+            /* End of file */
+            return sent;
+        }else{
+            sent += retval;
+            start = mangoPort_timeNow();
+        }
+#else
+        uint8_t buf[512];
+        int retval;
+        
+        retval = mangoPort_fileRead(fd, buf, len - sent > sizeof(buf) ? sizeof(buf) : len - sent);
+        if(retval <= 0){
+            return retval < 0 ? -1 : sent;
+        }
+        
+        elapsed = mangoHelper_elapsedTime(start);
+        if(mangoPort_write(socketfd, buf, retval, elapsed < timeout ? timeout - elapsed : 1) != retval){
+            return -1;
+        }
+        sent += retval;
+        start = mangoPort_timeNow();
+#endif
+        
+        if(mangoHelper_elapsedTime(start) >= timeout){
+            return sent;
+        }
+    }
+    
+    return sent;
+}
+
+/**
+ * @brief   Reads up to "datalen" bytes from file "fd"
+ *
+ * @retval  > 0     The number of bytes read
+ * @retval  0       End of file
+ * @retval  < 0     File error, or files are not supported
+ */
+int mangoPort_fileRead(int fd, uint8_t* data, uint16_t datalen){
+#ifdef MANGO_OS_ENV__UNIX
+    int retval;
+    
+    do{
+        retval = read(fd, data, datalen);
+    }while(retval < 0 && errno == EINTR);
+    
+    return retval;
+#else
+    (void) fd; (void) data; (void) datalen;
+    return -1;
+#endif
+}
+
+/**
+ * @brief   Returns the number of bytes from the current offset of file "fd" to its end
+ *
+ * @retval  >= 0    The number of bytes
+ * @retval  < 0     Not known (for example "fd" is a pipe)
+ */
+int64_t mangoPort_fileRemaining(int fd){
+#ifdef MANGO_OS_ENV__UNIX
+    struct stat st;
+    off_t offset;
+    
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)){
+        return -1;
+    }
+    
+    offset = lseek(fd, 0, SEEK_CUR);
+    if(offset < 0 || offset > st.st_size){
+        return -1;
+    }
+    
+    return st.st_size - offset;
+#else
+    (void) fd;
+    return -1;
+#endif
+}
+
+/**
+ * @brief   Wait until the specified socket becomes readable and/or writable
+ *          ("events" is a mask of MANGO_POLL_READ / MANGO_POLL_WRITE) or until
+ *          the "timeout" [miliseconds] expires.
+ *
+ * @retval  > 0     The socket is ready for at least one of the requested events
+ * @retval  0       Timeout expired
+ * @retval  < 0     Connection error
+ */
+int mangoPort_poll(int socketfd, uint8_t events, uint32_t timeout){
+    int retval;
+    
+#ifdef MANGO_IP_ENV__UNIX
+    struct pollfd pfd;
+    
+    pfd.fd      = socketfd;
+    pfd.events  = 0;
+    pfd.revents = 0;
+    if(events & MANGO_POLL_READ){ pfd.events |= POLLIN; }
+    if(events & MANGO_POLL_WRITE){ pfd.events |= POLLOUT; }
+    
+    do{
+        retval = poll(&pfd, 1, timeout);
+    }while(retval < 0 && errno == EINTR);
+    
+    if(retval > 0 && (pfd.revents & (POLLERR | POLLNVAL))){
+        return -1;
+    }
+#endif
+    
+#ifdef MANGO_IP_ENV__LWIP
+    fd_set rfds;
+    fd_set wfds;
+    struct timeval tv;
+    
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    if(events & MANGO_POLL_READ){ FD_SET(socketfd, &rfds); }
+    if(events & MANGO_POLL_WRITE){ FD_SET(socketfd, &wfds); }
+    
+    tv.tv_sec  = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    
+    retval = select(socketfd + 1, &rfds, &wfds, NULL, &tv);
+#endif
+    
+    return retval;
+}
+
+/**
+ * @brief   Estimates how many bytes can be written to the specified socket
+ *          without blocking.
+ *
+ * @retval  > 0     The estimation, at least MANGO_WORKING_BUFFER_SZ
+ * @retval  0       The socket is not writable
+ * @retval  < 0     Connection error
+ */
+int32_t mangoPort_writeSpace(int socketfd){
+    int32_t space;
+    int retval;
+    
+    retval = mangoPort_poll(socketfd, MANGO_POLL_WRITE, 0);
+    if(retval <= 0){
+        return retval;
+    }
+    
+    space = MANGO_WORKING_BUFFER_SZ;
+    
+#if defined(MANGO_IP_ENV__UNIX) && defined(__linux__)
+    int sndbuf;
+    int outq;
+    socklen_t optlen;
+    
+    optlen = sizeof(sndbuf);
+    if(getsockopt(socketfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) == 0 && ioctl(socketfd, SIOCOUTQ, &outq) == 0){
+        /* Half of SO_SNDBUF is for the kernel bookkeeping */
+        if(sndbuf / 2 - outq > space){
+            space = sndbuf / 2 - outq;
+        }
+    }
+#endif
+    
+    return space;
+}
+
+/**
+ * @brief   Create a wakeup object, used by other threads to interrupt a
+ *          mangoPort_pollWakeup() call.
+ *
+ * @retval  >= 0    The wakeup object ID
+ * @retval  < 0     Not supported, mango is going to poll in short slices
+ *                  [MANGO_WS_POLL_SLICE_MS] instead.
+ */
+int mangoPort_wakeupCreate(void){
+#if defined(MANGO_IP_ENV__UNIX) && defined(__linux__)
+    return eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    return -1;
+#endif
+}
+
+/**
+ * @brief   Signal the wakeup object. May be called from any thread.
+ */
+void mangoPort_wakeupSignal(int wakeupfd){
+#if defined(MANGO_IP_ENV__UNIX) && defined(__linux__)
+    uint64_t one = 1;
+    
+    if(write(wakeupfd, &one, sizeof(one)) < 0){
+        /* Counter saturated, it is signaled anyway */
+    }
+#else
+    (void) wakeupfd;
+#endif
+}
+
+/**
+ * @brief   Clear a signaled wakeup object
+ */
+void mangoPort_wakeupClear(int wakeupfd){
+#if defined(MANGO_IP_ENV__UNIX) && defined(__linux__)
+    uint64_t cnt;
+    
+    if(read(wakeupfd, &cnt, sizeof(cnt)) < 0){
+        /* Was not signaled */
+    }
+#else
+    (void) wakeupfd;
+#endif
+}
+
+/**
+ * @brief   Release the wakeup object
+ */
+void mangoPort_wakeupDestroy(int wakeupfd){
+#if defined(MANGO_IP_ENV__UNIX) && defined(__linux__)
+    close(wakeupfd);
+#else
+    (void) wakeupfd;
+#endif
+}
+
+/**
+ * @brief   Wait until the specified socket becomes readable, the wakeup
+ *          object is signaled or the "timeout" [miliseconds] expires.
+ *          "wakeupfd" may be < 0, in which case only the socket is polled.
+ *
+ * @retval  > 0     Mask of MANGO_POLL_READ / MANGO_POLL_WAKEUP
+ * @retval  0       Timeout expired
+ * @retval  < 0     Connection error
+ */
+int mangoPort_pollWakeup(int socketfd, int wakeupfd, uint32_t timeout){
+#ifdef MANGO_IP_ENV__UNIX
+    struct pollfd pfd[2];
+    int retval;
+    
+    pfd[0].fd      = socketfd;
+    pfd[0].events  = POLLIN;
+    pfd[0].revents = 0;
+    pfd[1].fd      = wakeupfd;
+    pfd[1].events  = POLLIN;
+    pfd[1].revents = 0;
+    
+    do{
+        retval = poll(pfd, wakeupfd < 0 ? 1 : 2, timeout);
+    }while(retval < 0 && errno == EINTR);
+    
+    if(retval <= 0){
+        return retval;
+    }
+    
+    retval = 0;
+    if(pfd[0].revents & (POLLERR | POLLNVAL)){
+        return -1;
+    }
+    if(pfd[0].revents & (POLLIN | POLLHUP)){
+        retval |= MANGO_POLL_READ;
+    }
+    if(wakeupfd >= 0 && (pfd[1].revents & POLLIN)){
+        retval |= MANGO_POLL_WAKEUP;
+    }
+    
+    return retval;
+#else
+    (void) wakeupfd;
+    
+    return mangoPort_poll(socketfd, MANGO_POLL_READ, timeout) > 0 ? MANGO_POLL_READ : 0;
+#endif
+}
+
+
 /**
  * @brief   Close the connection with the specific socket ID
  */
@@ -234,6 +714,36 @@ void mangoPort_disconnect(int socketfd){
 }
 
 
+/**
+ * @brief   Resolves "host" [a name or a dotted IPv4 address] to a dotted IPv4
+ *          address in "ip" [at least 16 bytes].
+ *
+ * @retval  0       Resolved
+ * @retval  < 0     The host could not be resolved
+ */
+int mangoPort_resolve(char* host, char* ip, uint16_t iplen){
+    struct addrinfo hints;
+    struct addrinfo* res;
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    
+    if(getaddrinfo(host, NULL, &hints, &res) != 0){
+        return -1;
+    }
+    
+    if(!inet_ntop(AF_INET, &((struct sockaddr_in*) res->ai_addr)->sin_addr, ip, iplen)){
+        freeaddrinfo(res);
+        return -1;
+    }
+    
+    freeaddrinfo(res);
+    
+    return 0;
+}
+
+
 /**
  * @brief   Connect to the specified IP address and port. Wait until at least 
  *          for at most "timeout" [miliseconds] until the connection is established,
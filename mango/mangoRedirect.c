@@ -0,0 +1,555 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+/*
+ * Redirect following.
+ *
+ * The request headers are kept when the request starts. When the response
+ * is a redirect that can be followed, the state machine hands it (and its
+ * body) to a sink instead of the application, and once it is complete the
+ * kept request is rewritten for the new location and executed again. The
+ * connection is reused when the location has the same origin and the
+ * server kept it open, otherwise the client is connected again in place.
+ *
+ * Methods are rewritten as user agents do [RFC 7231, 6.4]: 303 turns any
+ * method but HEAD into GET, 301/302 turn POST into GET, 307/308 keep the
+ * method. The request body is not kept, so a redirect that would have to
+ * send it again is returned to the application.
+*/
+
+/*
+ * Where a location points to
+*/
+typedef struct{
+	char				host[256];
+	uint16_t			port;
+	uint8_t				tls;
+	uint8_t				sameOrigin;		/* Same scheme, host and port as the current request */
+	char				path[MANGO_REDIRECT_LOCATION_SZ];
+}mangoRedirectTarget_t;
+
+
+static mangoErr_t mangoRedirect_sink(mangoArg_t* mangoArgs, void* userArgs){
+	(void) mangoArgs;
+	(void) userArgs;
+	return MANGO_OK;
+}
+
+/*
+* Removes the "." and ".." segments of the path of "uri" [RFC 3986, 5.2.4],
+* the query is kept as is
+*/
+static void mangoRedirect_dotSegmentsRemove(char* uri){
+	char query[MANGO_REDIRECT_LOCATION_SZ];
+	char* in;
+	char* out;
+
+	in = uri + strcspn(uri, "?");
+	strcpy(query, in);
+	*in = '\0';
+
+	/* The output never grows past the input, so it is built in place */
+	in = uri;
+	out = uri;
+	while(*in){
+		if(strncmp(in, "../", 3) == 0){
+			in += 3;
+		}else if(strncmp(in, "./", 2) == 0 || strncmp(in, "/./", 3) == 0){
+			in += 2;
+		}else if(strcmp(in, "/.") == 0){
+			*out++ = '/';
+			break;
+		}else if(strncmp(in, "/../", 4) == 0 || strcmp(in, "/..") == 0){
+			/* Drop the last output segment */
+			in += 3;
+			while(out > uri && *--out != '/'){}
+			if(!*in){
+				*out++ = '/';
+			}
+		}else if(strcmp(in, ".") == 0 || strcmp(in, "..") == 0){
+			break;
+		}else{
+			/* Move the first segment [with its leading '/'] to the output */
+			do{
+				*out++ = *in++;
+			}while(*in && *in != '/');
+		}
+	}
+
+	if(out == uri){
+		*out++ = '/';
+	}
+	*out = '\0';
+
+	strcat(uri, query);
+}
+
+/*
+* Resolves "location" against the current request [RFC 3986, 5.2]
+*/
+static int mangoRedirect_targetGet(mangoHttpClient_t* hc, char* location, mangoRedirectTarget_t* target){
+	char originHost[256];
+	uint16_t originPort;
+	uint8_t originTls;
+	uint32_t port;
+	uint16_t len;
+	char* colon;
+	char* uri;
+	char* ptr;
+
+	/* Current origin, from the Host header and the connection */
+	originTls = hc->tls != NULL;
+	if(mangoHelper_httpHeaderGet(hc->redirectRequest, MANGO_HDR__HOST, originHost, sizeof(originHost)) <= 0){
+		strcpy(originHost, hc->serverIP);
+	}
+
+	originPort = hc->serverPort ? hc->serverPort : (originTls ? 443 : 80);
+	colon = strchr(originHost, ':');
+	if(colon){
+		*colon = '\0';
+		if(!mangoHelper_decstr2dec(colon + 1, &port) && port && port <= 0xFFFF){
+			originPort = port;
+		}
+	}
+
+	if(strncasecmp(location, "http://", 7) == 0){
+		target->tls = 0;
+		ptr = location + 7;
+	}else if(strncasecmp(location, "https://", 8) == 0){
+		target->tls = 1;
+		ptr = location + 8;
+	}else if(strncmp(location, "//", 2) == 0){
+		target->tls = originTls;
+		ptr = location + 2;
+	}else{
+		ptr = NULL;
+	}
+
+	if(ptr){
+		/* Absolute location */
+		len = strcspn(ptr, "/?#");
+		if(!len || len >= sizeof(target->host)){
+			return -1;
+		}
+
+		memcpy(target->host, ptr, len);
+		target->host[len] = '\0';
+		ptr += len;
+
+		target->port = target->tls ? 443 : 80;
+		colon = strchr(target->host, ':');
+		if(colon){
+			*colon = '\0';
+			if(mangoHelper_decstr2dec(colon + 1, &port) || !port || port > 0xFFFF){
+				return -1;
+			}
+			target->port = port;
+		}
+
+		if(*ptr == '/'){
+			target->path[0] = '\0';
+		}else{
+			strcpy(target->path, "/");
+		}
+		if(strlen(target->path) + strlen(ptr) >= sizeof(target->path)){
+			return -1;
+		}
+		strcat(target->path, ptr);
+	}else{
+		/* Relative location, on the current origin */
+		strcpy(target->host, originHost);
+		target->port = originPort;
+		target->tls = originTls;
+
+		if(location[0] == '/'){
+			target->path[0] = '\0';
+		}else{
+			/* Current URI ["GET <URI> HTTP/1.1"] */
+			uri = strchr(hc->redirectRequest, ' ');
+			if(!uri){
+				return -1;
+			}
+			uri++;
+			
+			if(location[0] == '\0' || location[0] == '#'){
+				/* Same URI [the fragment is dropped below] */
+				len = strcspn(uri, " ");
+			}else if(location[0] == '?'){
+				/* Same path, new query */
+				len = strcspn(uri, " ?");
+			}else{
+				/* Merged with the directory of the current path */
+				len = strcspn(uri, " ?");
+				while(len && uri[len - 1] != '/'){len--;}
+			}
+			
+			if(!len || len >= sizeof(target->path)){
+				return -1;
+			}
+			memcpy(target->path, uri, len);
+			target->path[len] = '\0';
+		}
+
+		if(strlen(target->path) + strlen(location) >= sizeof(target->path)){
+			return -1;
+		}
+		strcat(target->path, location);
+	}
+
+	/* The fragment is not sent */
+	ptr = strchr(target->path, '#');
+	if(ptr){
+		*ptr = '\0';
+	}
+
+	for(ptr = target->path; *ptr; ptr++){
+		if(*ptr <= ' '){
+			return -1;
+		}
+	}
+
+	mangoRedirect_dotSegmentsRemove(target->path);
+
+	target->sameOrigin = target->tls == originTls && target->port == originPort && strcasecmp(target->host, originHost) == 0;
+
+	return 0;
+}
+
+/*
+* Method of the redirected request, NULL if it cannot be redirected.
+* "dropBody" is set when the request becomes a GET.
+*/
+static char* mangoRedirect_method(mangoHttpClient_t* hc, uint16_t statusCode, char method[16], uint8_t* dropBody){
+	uint16_t len;
+	uint8_t hasBody;
+
+	len = strcspn(hc->redirectRequest, " ");
+	if(!len || len >= 16){
+		return NULL;
+	}
+	memcpy(method, hc->redirectRequest, len);
+	method[len] = '\0';
+
+	*dropBody = 0;
+	if((statusCode == MANGO_ERR_HTTP_303 && strcmp(method, "HEAD") != 0) ||
+	   ((statusCode == MANGO_ERR_HTTP_301 || statusCode == MANGO_ERR_HTTP_302) && strcmp(method, "POST") == 0)){
+		*dropBody = 1;
+		return strcpy(method, "GET");
+	}
+
+	hasBody = mangoHelper_httpHeaderGet(hc->redirectRequest, MANGO_HDR__CONTENT_LENGTH, NULL, 0) >= 0 ||
+	          mangoHelper_httpHeaderGet(hc->redirectRequest, MANGO_HDR__TRANSFER_ENCODING, NULL, 0) >= 0;
+
+	return hasBody ? NULL : method;
+}
+
+/*
+* Rewrites the kept request for the target. Returns its length, 0 if it
+* does not fit in "buf".
+*/
+static uint16_t mangoRedirect_requestBuild(mangoHttpClient_t* hc, mangoRedirectTarget_t* target, char* method, uint8_t dropBody, char* buf, uint16_t bufSz){
+	static char* bodyHeaders[] = {MANGO_HDR__CONTENT_LENGTH, MANGO_HDR__TRANSFER_ENCODING, MANGO_HDR__EXPECT, "Content-Type", NULL};
+	static char* credentialHeaders[] = {MANGO_HDR__AUTHORIZATION, "Cookie", NULL};
+	char host[sizeof(target->host) + 8];
+	uint32_t len;
+	uint16_t linelen;
+	uint8_t skip;
+	char* line;
+	char* end;
+	uint8_t i;
+
+	len = snprintf(buf, bufSz, "%s %s HTTP/1.1\r\n", method, target->path);
+	if(len >= bufSz){
+		return 0;
+	}
+
+	/* Host first, the original value is kept on the same origin */
+	if(mangoHelper_httpHeaderGet(hc->redirectRequest, MANGO_HDR__HOST, host, sizeof(host)) > 0){
+		if(!target->sameOrigin){
+			if(target->port == (target->tls ? 443 : 80)){
+				strcpy(host, target->host);
+			}else{
+				sprintf(host, "%s:%u", target->host, target->port);
+			}
+		}
+
+		len += snprintf(&buf[len], bufSz - len, "%s: %s\r\n", MANGO_HDR__HOST, host);
+		if(len >= bufSz){
+			return 0;
+		}
+	}
+
+	line = strstr(hc->redirectRequest, "\r\n");
+	while(line){
+		line += 2;
+		end = strstr(line, "\r\n");
+		if(!end || end == line){
+			break;
+		}
+		linelen = end - line;
+
+		skip = strncasecmp(line, MANGO_HDR__HOST ":", strlen(MANGO_HDR__HOST ":")) == 0;
+		for(i = 0; dropBody && bodyHeaders[i] && !skip; i++){
+			skip = strncasecmp(line, bodyHeaders[i], strlen(bodyHeaders[i])) == 0 && line[strlen(bodyHeaders[i])] == ':';
+		}
+		/* Credentials are not given to another origin */
+		for(i = 0; !target->sameOrigin && credentialHeaders[i] && !skip; i++){
+			skip = strncasecmp(line, credentialHeaders[i], strlen(credentialHeaders[i])) == 0 && line[strlen(credentialHeaders[i])] == ':';
+		}
+
+		if(!skip){
+			if(len + linelen + 2 >= bufSz){
+				return 0;
+			}
+			memcpy(&buf[len], line, linelen + 2);
+			len += linelen + 2;
+		}
+
+		line = end;
+	}
+
+	if(len + 2 >= bufSz){
+		return 0;
+	}
+	memcpy(&buf[len], "\r\n", 3);
+
+	return len + 2;
+}
+
+/*
+* Connects the client again, to another endpoint
+*/
+static mangoErr_t mangoRedirect_reconnect(mangoHttpClient_t* hc, char* serverIP, uint16_t serverPort, uint8_t tls, char* serverName){
+#ifdef MANGO_TLS_ENABLED
+	if(hc->tls){
+		mangoTLS_disconnect(hc->tls);
+		hc->tls = NULL;
+	}
+#else
+	(void) serverName;
+	if(tls){
+		return MANGO_ERR_CONNECTION;
+	}
+#endif
+
+	mangoPort_disconnect(hc->socketfd);
+	MANGO_METRICS( mangoMetrics_disconnect() );
+
+	hc->stats.connectStart = mangoPort_timeNowUs();
+
+	hc->socketfd = mangoPort_connect(serverIP, serverPort, MANGO_SOCKET_CONNECT_TIMEOUT_MS);
+	if(hc->socketfd < 0){
+		MANGO_METRICS( mangoMetrics_connect(0, 1) );
+		return MANGO_ERR_CONNECTION;
+	}
+
+	MANGO_METRICS( mangoMetrics_connect(mangoPort_timeNowUs() - hc->stats.connectStart, 0) );
+	MANGO_METRICS( mangoMetrics_reconnect() );
+
+	if(serverIP != hc->serverIP){
+		strcpy(hc->serverIP, serverIP);
+	}
+	hc->serverPort = serverPort;
+
+#ifdef MANGO_TLS_ENABLED
+	if(tls){
+		hc->tls = mangoTLS_connect(hc->socketfd, serverName, serverPort, MANGO_TLS_HANDSHAKE_TIMEOUT_MS);
+		if(!hc->tls){
+			return MANGO_ERR_CONNECTION;
+		}
+	}
+#endif
+
+	hc->stats.connectEnd = mangoPort_timeNowUs();
+
+	mangoSM_REINIT(hc);
+
+	return MANGO_OK;
+}
+
+
+/*
+* Keeps the headers of a new request
+*/
+void mangoRedirect_start(mangoHttpClient_t* hc){
+	hc->redirectHops = 0;
+	hc->redirectFollow = 0;
+
+	if(hc->redirectRequest){
+		mangoPort_free(hc->redirectRequest);
+	}
+
+	hc->redirectRequest = mangoPort_malloc(hc->workingBufferIndexRight + 1);
+	if(hc->redirectRequest){
+		memcpy(hc->redirectRequest, hc->workingBuffer, hc->workingBufferIndexRight);
+		hc->redirectRequest[hc->workingBufferIndexRight] = '\0';
+	}
+}
+
+/*
+* Called with the response headers in the working buffer, before they are
+* given to the application. A redirect that can be followed is diverted to
+* the sink.
+*/
+void mangoRedirect_check(mangoHttpClient_t* hc){
+	char location[MANGO_REDIRECT_LOCATION_SZ];
+	mangoRedirectTarget_t target;
+	uint8_t dropBody;
+	char method[16];
+
+	switch(hc->httpResponseStatusCode){
+		case MANGO_ERR_HTTP_301:
+		case MANGO_ERR_HTTP_302:
+		case MANGO_ERR_HTTP_303:
+		case MANGO_ERR_HTTP_307:
+		case MANGO_ERR_HTTP_308:
+			break;
+		default:
+			return;
+	}
+
+	if(!hc->redirectRequest || hc->redirectHops >= hc->redirectMax){
+		return;
+	}
+
+	if(mangoHelper_httpHeaderGet((char*) MANGO_WB_PTR(hc), MANGO_HDR__LOCATION, location, sizeof(location)) <= 0 ||
+	   mangoRedirect_targetGet(hc, location, &target) != 0 ||
+	   !mangoRedirect_method(hc, hc->httpResponseStatusCode, method, &dropBody)){
+		return;
+	}
+
+	/* User transports cannot be connected elsewhere */
+	if(!target.sameOrigin && hc->transport){
+		return;
+	}
+
+#ifndef MANGO_TLS_ENABLED
+	if(target.tls){
+		return;
+	}
+#endif
+
+	strcpy(hc->redirectLocation, location);
+
+	hc->redirectFollow = 1;
+	hc->redirectUserFunc = hc->userFunc;
+	hc->userFunc = mangoRedirect_sink;
+}
+
+/*
+* Called when the state machine returns with a redirect diverted to the
+* sink. Follows it, and the ones after it, returning the final result.
+*/
+mangoErr_t mangoRedirect_follow(mangoHttpClient_t* hc, mangoErr_t err){
+	mangoRedirectTarget_t target;
+	mangoArg_t funcArgs;
+	char serverIP[16];
+	char* request;
+	uint16_t requestlen;
+	uint8_t dropBody;
+	char method[16];
+
+	while(hc->redirectFollow){
+		hc->redirectFollow = 0;
+		hc->userFunc = hc->redirectUserFunc;
+
+		if(err != (mangoErr_t) hc->httpResponseStatusCode){
+			/* The redirect was not received completely */
+			return err;
+		}
+
+		if(mangoRedirect_targetGet(hc, hc->redirectLocation, &target) != 0 ||
+		   !mangoRedirect_method(hc, hc->httpResponseStatusCode, method, &dropBody)){
+			return err;
+		}
+
+		request = mangoPort_malloc(MANGO_WORKING_BUFFER_SZ);
+		if(!request){
+			return err;
+		}
+
+		requestlen = mangoRedirect_requestBuild(hc, &target, method, dropBody, request, MANGO_WORKING_BUFFER_SZ);
+		if(!requestlen){
+			mangoPort_free(request);
+			return err;
+		}
+
+		if(!target.sameOrigin || !mango_httpConnectionReusable(hc)){
+			if(hc->transport){
+				mangoPort_free(request);
+				return err;
+			}
+
+			if(target.sameOrigin){
+				strcpy(serverIP, hc->serverIP);
+			}else if(mangoPort_resolve(target.host, serverIP, sizeof(serverIP)) < 0){
+				mangoPort_free(request);
+				return MANGO_ERR_CONNECTION;
+			}
+
+			err = mangoRedirect_reconnect(hc, serverIP, target.port, target.tls, target.host);
+			if(err != MANGO_OK){
+				mangoPort_free(request);
+				return err;
+			}
+		}
+
+		MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Redirect %u to %s\r\n", hc->httpResponseStatusCode, hc->redirectLocation) );
+
+		hc->redirectHops++;
+
+		mangoPort_free(hc->redirectRequest);
+		hc->redirectRequest = request;
+
+		if(dropBody){
+			hc->httpMethod = MANGO_HTTP_METHOD_GET;
+		}
+
+		memcpy(hc->workingBuffer, request, requestlen + 1);
+		hc->workingBufferIndexLeft = 0;
+		hc->workingBufferIndexRight = requestlen;
+
+		memset(&funcArgs, 0, sizeof(funcArgs));
+		funcArgs.buf = MANGO_WB_PTR(hc);
+		funcArgs.buflen = MANGO_WB_USED_SZ(hc);
+		funcArgs.argType = MANGO_ARG_TYPE_HTTP_REQUEST_READY;
+		hc->userFunc(&funcArgs, hc->userArgs);
+
+		mangoStats_start(hc);
+
+		hc->smAPICallArgs = NULL;
+
+		err = mangoSM_RUN(hc, EVENT_APICALL_httpRequestProcess);
+	}
+
+	return err;
+}
+
+void mangoRedirect_free(mangoHttpClient_t* hc){
+	if(hc->redirectRequest){
+		mangoPort_free(hc->redirectRequest);
+		hc->redirectRequest = NULL;
+	}
+}
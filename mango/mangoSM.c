@@ -25,7 +25,7 @@
 
 
 #define mangoSM_ENTER(state, hc)  \
-    MANGO_ENSURE(hc->curState != state, ("?") ); \
+    MANGO_ENSURE_SM(hc->curState != state, hc, ("?") ); \
     hc->nxtState = state; \
     return;
 
@@ -38,12 +38,89 @@ mangoErr_t mangoSM_INIT(mangoHttpClient_t* hc){
 	hc->smTimeout		= MANGO_TIMEOUT_INFINITE;
 	hc->smEntryTimestamp= mangoPort_timeNow();
 	
+#if MANGO_WS_TX_QUEUE_SZ > 0
+	mangoWS_queueInit(hc);
+#endif
+	
+	mangoWS_maskSeed(hc);
+	
+	hc->wsPingInterval = MANGO_WS_PING_INTERVAL_MS;
+	hc->wsIdleTimeout = MANGO_WS_IDLE_TIMEOUT_MS;
+	
     mangoSM_THROW(EVENT_ENTRY, hc);
     
     return MANGO_OK;
 }
 
-mangoErr_t mangoSM_PROCESS(mangoHttpClient_t* hc, mangoEvent_e event){
+/*
+* Restarts the state machine of a client which was connected again
+*/
+void mangoSM_REINIT(mangoHttpClient_t* hc){
+	hc->curState = mangoSM__HTTP_CONNECTED;
+	hc->nxtState = mangoSM__HTTP_CONNECTED;
+	
+	hc->subscribedEvent = EVENT_NONE;
+	hc->smTimeout		= MANGO_TIMEOUT_INFINITE;
+	hc->smEntryTimestamp= mangoPort_timeNow();
+	hc->httpConnClose	= 0;
+	
+	mangoSM_THROW(EVENT_ENTRY, hc);
+}
+
+mangoErr_t mangoSM_PROCESS(mangoHttpClient_t* hc, mangoEvent_e event, void* apiCallArgs){
+    mangoErr_t err;
+    
+    if(!mangoSM_TRYLOCK(hc)){
+        /* Another thread is running the client */
+        return MANGO_ERR_BUSY;
+    }
+    
+#if MANGO_WS_TX_QUEUE_SZ > 0
+    /* A frame queued by another thread failed since the last websocket call */
+    if(event == EVENT_APICALL_wsPoll || event == EVENT_APICALL_wsFrameSend){
+        err = mangoWS_queueError(hc);
+        if(err != MANGO_OK){
+            mangoSM_UNLOCK(hc);
+            return err;
+        }
+    }
+#endif
+    
+    hc->smAPICallArgs = apiCallArgs;
+    
+    err = mangoSM_RUN(hc, event);
+    
+    mangoSM_UNLOCK(hc);
+    
+    return err;
+}
+
+/*
+* A client is run by one thread at a time, the lock owner. Only
+* mango_wsFrameSend() is allowed to find the lock taken, in which
+* case the frame is queued and sent by the owner.
+*/
+uint8_t mangoSM_TRYLOCK(mangoHttpClient_t* hc){
+    return !__atomic_test_and_set(&hc->smLock, __ATOMIC_ACQUIRE);
+}
+
+void mangoSM_UNLOCK(mangoHttpClient_t* hc){
+    __atomic_clear(&hc->smLock, __ATOMIC_RELEASE);
+    
+#if MANGO_WS_TX_QUEUE_SZ > 0
+    /* 
+    * Frames queued by other threads while we were owning the client.
+    * A producer which pushes after this check is going to find the
+    * lock free and flush them itself.
+    */
+    while(mangoWS_queuePending(hc) && mangoSM_TRYLOCK(hc)){
+        mangoWS_queueFlush(hc);
+        __atomic_clear(&hc->smLock, __ATOMIC_RELEASE);
+    }
+#endif
+}
+
+mangoErr_t mangoSM_RUN(mangoHttpClient_t* hc, mangoEvent_e event){
     uint32_t elapsedTime;
     uint8_t forever = 1;
 
@@ -68,6 +145,7 @@ mangoErr_t mangoSM_PROCESS(mangoHttpClient_t* hc, mangoEvent_e event){
 		if(hc->smTimeout != MANGO_TIMEOUT_INFINITE){
 			elapsedTime = mangoHelper_elapsedTime(hc->smEntryTimestamp);
 			if(elapsedTime >= hc->smTimeout){
+				MANGO_METRICS( mangoMetrics_timeout() );
 				mangoSM_THROW(EVENT_TIMEOUT, hc);
 			}else{
 				hc->smEventTimeout = hc->smTimeout - elapsedTime;
@@ -91,11 +169,18 @@ mangoErr_t mangoSM_PROCESS(mangoHttpClient_t* hc, mangoEvent_e event){
                 forever = 0;
                 break;
             default:
-                MANGO_ENSURE(0, ("?") );
+                MANGO_ENSURE_RET(0, mangoSM_FAULT(hc), ("?") );
                 break;
         }
     }
     
+    if(hc->smExitError != MANGO_OK && (hc->smExitError < MANGO_ERR_HTTP_100 || hc->smExitError > MANGO_ERR_HTTP_599)){
+        MANGO_METRICS( mangoMetrics_error(hc->smExitError) );
+#if MANGO_TRACE_RING_SZ > 0 && MANGO_TRACE_DUMP_ON_ERROR
+        mango_traceDump(hc);
+#endif
+    }
+    
     return hc->smExitError;
 }
 
@@ -114,22 +199,46 @@ void mangoSM_SUBSCRIBE(mangoEvent_e event, mangoHttpClient_t* hc){
             hc->subscribedEvent = event;
             break;
         default:
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
             break;
     }
 }
 
 void mangoSM_THROW(mangoEvent_e event, mangoHttpClient_t* hc){
     hc->curState(event, hc);
-    while(hc->nxtState != hc->curState){
+    MANGO_TRACE(event, hc);
+    while(hc->nxtState != hc->curState && !hc->smFaulted){
         hc->curState        = hc->nxtState;
         hc->subscribedEvent = EVENT_NONE;
 		hc->smTimeout		= MANGO_TIMEOUT_INFINITE;
 		hc->smEntryTimestamp= mangoPort_timeNow();
         hc->curState(EVENT_ENTRY, hc);
+        MANGO_TRACE(EVENT_ENTRY, hc);
+    }
+    
+    if(hc->smFaulted){
+        mangoSM_FAULT(hc);
     }
 }
 
+/*
+* Aborts the client after a failed MANGO_ENSURE_xxx() check. Whatever the
+* failing state did (transitions, subscriptions, exit error) is discarded.
+*/
+mangoErr_t mangoSM_FAULT(mangoHttpClient_t* hc){
+    hc->smFaulted       = 0;
+    hc->curState        = mangoSM__ABORTED;
+    hc->nxtState        = mangoSM__ABORTED;
+    hc->subscribedEvent = EVENT_NONE;
+    hc->smTimeout       = MANGO_TIMEOUT_INFINITE;
+    
+    mangoSM_EXITERR(MANGO_ERR_INTERNAL, hc);
+    mangoStats_report(hc);
+    MANGO_TRACE(EVENT_ENTRY, hc);
+    
+    return MANGO_ERR_INTERNAL;
+}
+
 
 void mangoSM_TIMEOUT(uint32_t timeout, mangoHttpClient_t* hc){
 	hc->smEntryTimestamp = mangoPort_timeNow();
@@ -148,6 +257,7 @@ void mangoSM__ABORTED(mangoEvent_e event, mangoHttpClient_t* hc){
             /*
             * State machine is going to exit as we do not subsribe to any events
             */
+			mangoStats_report(hc);
 			break;
         case EVENT_APICALL_httpRequestProcess:
 		case EVENT_APICALL_httpDataSend:
@@ -160,7 +270,7 @@ void mangoSM__ABORTED(mangoEvent_e event, mangoHttpClient_t* hc){
             mangoSM_EXITERR(MANGO_ERR_ABORTED, hc);
 			break;
 		default:
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;	
 	}
 }
@@ -173,6 +283,7 @@ void mangoSM__DISCONNECTED(mangoEvent_e event, mangoHttpClient_t* hc){
             /*
             * State machine is going to exit as we do not subsribe to any event
             */
+			mangoStats_report(hc);
 			break;
         case EVENT_APICALL_httpRequestProcess:
 		case EVENT_APICALL_httpDataSend:
@@ -185,7 +296,7 @@ void mangoSM__DISCONNECTED(mangoEvent_e event, mangoHttpClient_t* hc){
             mangoSM_EXITERR(MANGO_ERR_CONNECTION, hc);
 			break;
 		default:
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;	
 	}
 }
@@ -202,15 +313,23 @@ void mangoSM__HTTP_CONNECTED(mangoEvent_e event, mangoHttpClient_t* hc){
             hc->workingBufferIndexLeft = 0;
             hc->workingBufferIndexRight = 0;
 			
-			hc->stats.time = mangoHelper_elapsedTime(hc->stats.time);
+			if(hc->statsPending){
+				hc->stats.bodyComplete = mangoPort_timeNowUs();
+				mangoStats_report(hc);
+			}
 			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("-----------------------------------\r\n") );
-			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("| Tx   = %u bytes\r\n", hc->stats.txBytes) );
-			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("| Rx   = %u bytes\r\n", hc->stats.rxBytes) );
+			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("| Tx   = %llu bytes\r\n", (unsigned long long) hc->stats.txBytes) );
+			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("| Rx   = %llu bytes\r\n", (unsigned long long) hc->stats.rxBytes) );
 			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("| Time = %u ms\r\n", hc->stats.time) );
 			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("-----------------------------------\r\n") );
 			
 			break;
         case EVENT_APICALL_httpRequestProcess:
+			if(hc->httpConnClose){
+				/* The server closed [or is closing] the connection after the last response */
+				mangoSM_EXITERR(MANGO_ERR_CONNECTION, hc);
+				mangoSM_ENTER(mangoSM__DISCONNECTED, hc);
+			}
             mangoSM_ENTER(mangoSM__HTTP_SENDING_HEADERS, hc);
 			break;
 		case EVENT_APICALL_httpDataSend:
@@ -224,7 +343,7 @@ void mangoSM__HTTP_CONNECTED(mangoEvent_e event, mangoHttpClient_t* hc){
 			mangoSM_EXITERR(MANGO_ERR_APICALLNOTSUPPORTED, hc);
 			break;
         default:
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;	
 	}
 }
@@ -238,8 +357,8 @@ void mangoSM__HTTP_SENDING_HEADERS(mangoEvent_e event, mangoHttpClient_t* hc){
 	switch(event){
 		case EVENT_ENTRY:
         {
-            MANGO_ENSURE(hc->workingBufferIndexLeft == 0, ("?") );
-            MANGO_ENSURE(hc->workingBufferIndexRight > 0, ("?") );
+            MANGO_ENSURE_SM(hc->workingBufferIndexLeft == 0, hc, ("?") );
+            MANGO_ENSURE_SM(hc->workingBufferIndexRight > 0, hc, ("?") );
             
             mangoSM_SUBSCRIBE(EVENT_WRITE, hc);
             
@@ -261,9 +380,10 @@ void mangoSM__HTTP_SENDING_HEADERS(mangoEvent_e event, mangoHttpClient_t* hc){
             }else{
                 hc->workingBufferIndexLeft += retval;
                 
-                MANGO_ENSURE(hc->workingBufferIndexLeft <= hc->workingBufferIndexRight, ("?") );
+                MANGO_ENSURE_SM(hc->workingBufferIndexLeft <= hc->workingBufferIndexRight, hc, ("?") );
                 
                 if(hc->workingBufferIndexLeft == hc->workingBufferIndexRight){
+                   hc->stats.headersSent = mangoPort_timeNowUs();
                    mangoSM_SUBSCRIBE(EVENT_PROCESS, hc);
                    return;
                 }
@@ -275,102 +395,104 @@ void mangoSM__HTTP_SENDING_HEADERS(mangoEvent_e event, mangoHttpClient_t* hc){
 			/* 
             * HTTP request headers sent, inspect user's request to get the next state.
 			* The HTTP request is stored into the WB at range [0, hc->workingBufferIndexLeft - 1]
+			* The request headers decide if a body follows, whatever the method is.
             */
-			switch(hc->httpMethod){
-				case MANGO_HTTP_METHOD_HEAD:
-				case MANGO_HTTP_METHOD_GET:
-				{
+			hc->outputDataProcessor = NULL;
+			hc->dataProcessorArgs = NULL;
+			hc->httpExpectPending = 0;
+			
+			/* 
+			* Check if MANGO_HDR__CONTENT_LENGTH header is used and if so assign the RAW ODP
+			*/
+			retval = mangoHelper_httpHeaderGet((char*)MANGO_WB_PTR(hc), MANGO_HDR__CONTENT_LENGTH, headerValueBuf, sizeof(headerValueBuf));
+			if(retval < 0){
+			}else{
+				/* Request body with known length */
+				hc->outputDataProcessor = mangoODP_raw;
+				if(mangoHelper_decstr2dec64(headerValueBuf, &hc->ODPArgsRaw.fileSz)){
+					mangoSM_EXITERR(MANGO_ERR_INVALIDREQHEADERS, hc);
+					mangoSM_ENTER(mangoSM__ABORTED, hc);
+				}
+				
+				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Attaching Raw ODP\r\n") );
+				
+				hc->ODPArgsRaw.fileSzProcessed = 0;
+				hc->dataProcessorArgs = &hc->ODPArgsRaw;
+				
+				if(hc->ODPArgsRaw.fileSz == 0){
 					mangoSM_ENTER(mangoSM__HTTP_RECVING_HEADERS, hc);
-					
-					break;
 				}
-				case MANGO_HTTP_METHOD_PUT:
-				case MANGO_HTTP_METHOD_POST:
-				{	
-					hc->outputDataProcessor = NULL;
-					hc->dataProcessorArgs = NULL;
-					
-					/* 
-					* Check if MANGO_HDR__CONTENT_LENGTH header is used and if so assign the RAW ODP
-					*/
-					retval = mangoHelper_httpHeaderGet((char*)MANGO_WB_PTR(hc), MANGO_HDR__CONTENT_LENGTH, headerValueBuf, sizeof(headerValueBuf));
-					if(retval < 0){
-					}else{
-						/* Normal PUT/POST */
-						hc->outputDataProcessor = mangoODP_raw;
-                        if(mangoHelper_decstr2dec(headerValueBuf, &hc->ODPArgsRaw.fileSz)){
-                            mangoSM_EXITERR(MANGO_ERR_INVALIDREQHEADERS, hc);
-							mangoSM_ENTER(mangoSM__ABORTED, hc);
-                        }
-                        
-                        MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Attaching Raw ODP\r\n") );
-                        
-						hc->ODPArgsRaw.fileSzProcessed = 0;
-						hc->dataProcessorArgs = &hc->ODPArgsRaw;
-						
-						if(hc->ODPArgsRaw.fileSz == 0){
-							mangoSM_ENTER(mangoSM__HTTP_RECVING_HEADERS, hc);
-						}
-					}
-					
-					/* 
-					* Check if MANGO_HDR__TRANSFER_ENCODING header is used and if so assign the CHUNKED ODP
-					*
-					* Messages MUST NOT include both a Content-Length header field and a non-identity transfer-coding. 
-					* If the message does include a non-identity transfer-coding, the Content-Length MUST be ignored.
-					*/
-					retval = mangoHelper_httpHeaderGet((char*)MANGO_WB_PTR(hc), MANGO_HDR__TRANSFER_ENCODING, NULL, 0);
-					if(retval < 0){
-					}else{
-						/* Chunked PUT/POST */
-						if(hc->outputDataProcessor){
-							/* User has provided both "Content-Length" & "Transfer-Encoding" HTTP Headers */
-							mangoSM_EXITERR(MANGO_ERR_INVALIDREQHEADERS, hc);
-							mangoSM_ENTER(mangoSM__ABORTED, hc);
-						}
-						
-                        MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Attaching Chunked ODP\r\n") );
-                        
-						hc->outputDataProcessor = mangoODP_chunked;
-						hc->ODPArgsChunked.workingBuffer = MANGO_WB_PTR(hc);
-						hc->ODPArgsChunked.workingBufferSz = MANGO_WB_TOT_SZ(hc);
-						hc->dataProcessorArgs = &hc->ODPArgsChunked;
-					}
-					
-					/* 
-					* Verify that request's headers resulted to one ODP
-					*/
-					if(!hc->outputDataProcessor){
-						/* HTTP request has not the "Content-Length" or the "Transfer-Encoding" HTTP Header */
-						mangoSM_EXITERR(MANGO_ERR_INVALIDREQHEADERS, hc);
-						mangoSM_ENTER(mangoSM__ABORTED, hc);
-					}
-					
-					/* 
-					* Check if MANGO_HDR__EXPECT header is used and if so move to the mangoSM__HTTP_RECVING_HEADERS state
-					*/
-					retval = mangoHelper_httpHeaderGet((char*)MANGO_WB_PTR(hc), MANGO_HDR__EXPECT, NULL, 0);
-					if(retval < 0){
-						/* Not used. Set a virtual  MANGO_ERR_HTTP_100 so user can handle it the same way that expect-100 is handled */
-						mangoSM_EXITERR(MANGO_ERR_HTTP_100, hc);
-						mangoSM_ENTER(mangoSM__HTTP_SENDING_DATA, hc);
-					}else{
-						/* Used */
-						mangoSM_ENTER(mangoSM__HTTP_RECVING_HEADERS, hc);
-					}
-					
-					break;
+			}
+			
+			/* 
+			* Check if MANGO_HDR__TRANSFER_ENCODING header is used and if so assign the CHUNKED ODP
+			*
+			* Messages MUST NOT include both a Content-Length header field and a non-identity transfer-coding. 
+			* If the message does include a non-identity transfer-coding, the Content-Length MUST be ignored.
+			*/
+			retval = mangoHelper_httpHeaderGet((char*)MANGO_WB_PTR(hc), MANGO_HDR__TRANSFER_ENCODING, NULL, 0);
+			if(retval < 0){
+			}else{
+				/* Chunked request body */
+				if(hc->outputDataProcessor){
+					/* User has provided both "Content-Length" & "Transfer-Encoding" HTTP Headers */
+					mangoSM_EXITERR(MANGO_ERR_INVALIDREQHEADERS, hc);
+					mangoSM_ENTER(mangoSM__ABORTED, hc);
 				}
-				default:
-				{
-					MANGO_ENSURE(0, ("?") );
-					break;
+				
+				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Attaching Chunked ODP\r\n") );
+				
+				hc->outputDataProcessor = mangoODP_chunked;
+				hc->ODPArgsChunked.workingBuffer = MANGO_WB_PTR(hc);
+				hc->ODPArgsChunked.workingBufferSz = MANGO_WB_TOT_SZ(hc);
+				hc->ODPArgsChunked.chunkHeadLen = 0;
+				hc->dataProcessorArgs = &hc->ODPArgsChunked;
+			}
+			
+			/* 
+			* Without an ODP the request has no body. POST and PUT always have one.
+			*/
+			if(!hc->outputDataProcessor){
+				if(hc->httpMethod == MANGO_HTTP_METHOD_POST || 
+				   hc->httpMethod == MANGO_HTTP_METHOD_POST_CHUNKED || 
+				   hc->httpMethod == MANGO_HTTP_METHOD_PUT){
+					/* HTTP request has not the "Content-Length" or the "Transfer-Encoding" HTTP Header */
+					mangoSM_EXITERR(MANGO_ERR_INVALIDREQHEADERS, hc);
+					mangoSM_ENTER(mangoSM__ABORTED, hc);
 				}
+				
+				mangoSM_ENTER(mangoSM__HTTP_RECVING_HEADERS, hc);
+			}
+			
+			/* 
+			* Multipart bodies [mango_httpMultipartSet()] are encoded on top of the framing ODP
+			*/
+			if(hc->ODPArgsMultipart.parts){
+				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Attaching Multipart ODP\r\n") );
+				
+				hc->ODPArgsMultipart.odp = hc->outputDataProcessor;
+				hc->ODPArgsMultipart.odpArgs = hc->dataProcessorArgs;
+				hc->outputDataProcessor = mangoODP_multipart;
+				hc->dataProcessorArgs = &hc->ODPArgsMultipart;
+			}
+			
+			/* 
+			* Check if MANGO_HDR__EXPECT header is used and if so move to the mangoSM__HTTP_RECVING_HEADERS state
+			*/
+			retval = mangoHelper_httpHeaderGet((char*)MANGO_WB_PTR(hc), MANGO_HDR__EXPECT, NULL, 0);
+			if(retval < 0){
+				/* Not used. Set a virtual  MANGO_ERR_HTTP_100 so user can handle it the same way that expect-100 is handled */
+				mangoSM_EXITERR(MANGO_ERR_HTTP_100, hc);
+				mangoSM_ENTER(mangoSM__HTTP_SENDING_DATA, hc);
+			}else{
+				/* Used, the body waits for "100 Continue" [or a final status that rejects it] */
+				hc->httpExpectPending = 1;
+				mangoSM_ENTER(mangoSM__HTTP_RECVING_HEADERS, hc);
 			}
 		}
         default:
         {
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;
         }
 	}
@@ -378,9 +500,61 @@ void mangoSM__HTTP_SENDING_HEADERS(mangoEvent_e event, mangoHttpClient_t* hc){
 
 
 
+/*
+* Checks if a complete response is at the start of the working buffer,
+* same return values as mangoHelper_httpReponseVerify().
+*/
+static int mangoSM_httpResponseParse(mangoHttpClient_t* hc){
+	int retval;
+	
+	retval = mangoHelper_httpReponseVerify((char*) hc->workingBuffer);
+	if(retval > 0){
+		hc->httpResponseStatusCode = retval;
+		hc->stats.headersParsed = mangoPort_timeNowUs();
+		
+		/* 
+		* NOTE: Update the left index of the working buffer to be ready to enter
+		* other states that are not aware that we have trimmed 2 bytes
+		* from the working buffer (last CRLF). For this reason we will not be
+		* able to use the MANGO_WB_xxx during the EVENT_PROCESS event.
+		*/
+		hc->workingBufferIndexLeft = strlen((char*) hc->workingBuffer) + 2;
+	}
+	
+	return retval;
+}
+
+/*
+* HTTP/1.1 connections persist unless "Connection: close" is given, HTTP/1.0
+* ones (and anything else, like ICY) only with "Connection: keep-alive".
+*/
+static uint8_t mangoSM_httpPersistent(mangoHttpClient_t* hc){
+	char headerValueBuf[32];
+	int retval;
+	
+	retval = mangoHelper_httpHeaderGet((char*) MANGO_WB_PTR(hc), MANGO_HDR__CONNECTION, headerValueBuf, sizeof(headerValueBuf));
+	if(retval == 0){
+		/* Too long to check, don't risk reusing it */
+		return 0;
+	}
+	
+	if(retval > 0 && mangoHelper_httpTokenFind(headerValueBuf, "close")){
+		return 0;
+	}
+	
+	if(memcmp(MANGO_WB_PTR(hc), "HTTP/1.1", 8) != 0){
+		return retval > 0 && mangoHelper_httpTokenFind(headerValueBuf, "keep-alive");
+	}
+	
+	return 1;
+}
+
 void mangoSM__HTTP_RECVING_HEADERS(mangoEvent_e event, mangoHttpClient_t* hc){
 	char headerValueBuf[32];
+	char* coding;
+	uint64_t contentLength;
 	mangoArg_t funcArgs;
+	mangoErr_t err;
 	int retval;
 	
     MANGO_DBG(MANGO_DBG_LEVEL_SM, ("STATE %s, EVENT %u\r\n", __func__, event) );
@@ -388,7 +562,8 @@ void mangoSM__HTTP_RECVING_HEADERS(mangoEvent_e event, mangoHttpClient_t* hc){
 	switch(event){
 		case EVENT_ENTRY:
         {
-			mangoSM_TIMEOUT(MANGO_HTTP_RESPONSE_TIMEOUT_MS, hc);
+			/* Servers that ignore "Expect: 100-continue" never answer before the body arrives */
+			mangoSM_TIMEOUT(hc->httpExpectPending ? MANGO_HTTP_CONTINUE_TIMEOUT_MS : MANGO_HTTP_RESPONSE_TIMEOUT_MS, hc);
             mangoSM_SUBSCRIBE(EVENT_READ, hc);
             hc->workingBufferIndexLeft  = 0;
             hc->workingBufferIndexRight = 0;
@@ -403,10 +578,14 @@ void mangoSM__HTTP_RECVING_HEADERS(mangoEvent_e event, mangoHttpClient_t* hc){
                 mangoSM_ENTER(mangoSM__DISCONNECTED, hc);
             }else if(retval == 0){
 			}else{
+                if(!hc->stats.firstByte){
+                    hc->stats.firstByte = mangoPort_timeNowUs();
+                }
+                
                 hc->workingBufferIndexRight += retval;
                 MANGO_WB_NULLTERMINATE();
                 
-                retval = mangoHelper_httpReponseVerify((char*) hc->workingBuffer);
+                retval = mangoSM_httpResponseParse(hc);
                 if(retval < 0){
                     /* Malformed/not supported HTTP Response format */
                     mangoSM_EXITERR(MANGO_ERR_RESPFORMAT, hc);
@@ -418,18 +597,13 @@ void mangoSM__HTTP_RECVING_HEADERS(mangoEvent_e event, mangoHttpClient_t* hc){
                         mangoSM_EXITERR(MANGO_ERR_WORKBUFSMALL, hc);
                         mangoSM_ENTER(mangoSM__ABORTED, hc);
                     }
+                    
+                    if(hc->httpExpectPending){
+                        /* The server is answering, give it the full response timeout */
+                        mangoSM_TIMEOUT(MANGO_HTTP_RESPONSE_TIMEOUT_MS, hc);
+                    }
                 }else{
 					/* The whole HTTP response received */
-					hc->httpResponseStatusCode = retval;
-					
-					/* 
-					* NOTE: Update the left index of the working buffer to be ready to enter
-					* other states that are not aware that we have trimmed 2 bytes
-					* from the working buffer (last CRLF). For this reason we will not be
-					* able to use the MANGO_WB_xxx during the EVENT_PROCESS event.
-					*/
-					hc->workingBufferIndexLeft = strlen((char*) hc->workingBuffer) + 2;
-					 
 					mangoSM_SUBSCRIBE(EVENT_PROCESS, hc);
 					return;
 				}
@@ -440,134 +614,182 @@ void mangoSM__HTTP_RECVING_HEADERS(mangoEvent_e event, mangoHttpClient_t* hc){
 		case EVENT_PROCESS:
 		{
 			/*
-			*	Pass the HTTP response to the application
+			*	Pass the HTTP response to the application, unless it is a
+			*	redirect that is going to be followed
 			*/
+			if(hc->redirectMax){
+				mangoRedirect_check(hc);
+			}
+			
 			funcArgs.buf = MANGO_WB_PTR(hc);
 			funcArgs.buflen = hc->workingBufferIndexLeft;
 			funcArgs.statusCode = hc->httpResponseStatusCode;
 			funcArgs.argType = MANGO_ARG_TYPE_HTTP_RESP_RECEIVED;
 			hc->userFunc(&funcArgs, hc->userArgs);
 
-			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("CONTENT LENGTH SEARCH\r\n") );
+			/* 
+			* Special case: Websockets [They have no content-length] 
+			*/
+			if(hc->httpResponseStatusCode == MANGO_ERR_HTTP_101){
+				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("SWITCHING TO WEB SOCKETS!\r\n") );
+				
+				err = mangoWS_handshakeVerify(hc);
+				if(err != MANGO_OK){
+					mangoSM_EXITERR(err, hc);
+					mangoSM_ENTER(mangoSM__ABORTED, hc);
+				}
+				
+				mangoWS_keepaliveStart(hc);
+				
+				hc->inputDataProcessor = mangoIDP_websocket;
+				hc->IDPArgsWebsocket.state = 1;
+                hc->IDPArgsWebsocket.frameID = 0;
+				hc->dataProcessorArgs = &hc->IDPArgsWebsocket;
+
+                mangoSM_EXITERR(MANGO_ERR_HTTP_101, hc);
+				mangoSM_ENTER(mangoSM__WS_CONNECTED, hc);
+			}
+			
+			/* 
+			* Special case: Received "Expect: 100-continue" for a request with a body and expectation
+			*/
+			if(hc->httpResponseStatusCode == MANGO_ERR_HTTP_100 && hc->httpExpectPending){
+				hc->httpExpectPending = 0;
+				mangoSM_EXITERR(MANGO_ERR_HTTP_100, hc);
+				mangoSM_ENTER(mangoSM__HTTP_SENDING_DATA, hc);
+			}
 			
 			/*
-			* Locate Content-Length
+			* Any other 1xx [or a 100 that arrived after the continue timeout]
+			* is an interim response, the final one follows on the same
+			* connection [and may already be buffered]
 			*/
-			retval = mangoHelper_httpHeaderGet((char*) MANGO_WB_PTR(hc), MANGO_HDR__CONTENT_LENGTH, headerValueBuf, sizeof(headerValueBuf));
-			if(retval < 0){
-				/* Content-Length not found */
-				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("CONTENT LENGTH NOT FOUND!\r\n") );
-			}else if(retval == 0){
-				/* Content-Length found, but buffer size is not enough to get the length */
-                MANGO_DBG(MANGO_DBG_LEVEL_SM, ("CONTENT LENGTH TOO BIG!\r\n") );
-				mangoSM_EXITERR(MANGO_ERR_TEMPBUFSMALL, hc);
-				mangoSM_ENTER(mangoSM__ABORTED, hc);
-			}else{
-				/* HTTP response with CONTENT-LENGTH */
-                
-                MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Content-Length is %s bytes\r\n", headerValueBuf) );
-                
-				if(hc->httpMethod != MANGO_HTTP_METHOD_HEAD){
-					hc->inputDataProcessor = mangoIDP_raw;
-                    if(mangoHelper_decstr2dec(headerValueBuf, &hc->IDPArgsRaw.fileSz)){
-                        MANGO_DBG(MANGO_DBG_LEVEL_SM, ("CONTENT LENGTH ERROR!\r\n") );
-                        mangoSM_EXITERR(MANGO_ERR_RESPFORMAT, hc);
-                        mangoSM_ENTER(mangoSM__ABORTED, hc);
-                    }
-                    
-                    MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Content-Length is %u bytes\r\n", hc->IDPArgsRaw.fileSz) );
-                    
-					hc->IDPArgsRaw.fileSzProcessed = 0;
-					hc->dataProcessorArgs = &hc->IDPArgsRaw;
-					mangoSM_ENTER(mangoSM__HTTP_RECVING_DATA, hc);
+			if(hc->httpResponseStatusCode < MANGO_ERR_HTTP_200){
+				mangoWB_shrink(hc);
+				
+				retval = mangoSM_httpResponseParse(hc);
+				if(retval < 0){
+					mangoSM_EXITERR(MANGO_ERR_RESPFORMAT, hc);
+					mangoSM_ENTER(mangoSM__ABORTED, hc);
+				}else if(retval == 0){
+					mangoSM_SUBSCRIBE(EVENT_READ, hc);
 				}else{
-					/* HTTP request completed */
-					mangoSM_EXITERR(hc->httpResponseStatusCode, hc);
-					mangoSM_ENTER(mangoSM__HTTP_CONNECTED, hc);
+					mangoSM_SUBSCRIBE(EVENT_PROCESS, hc);
 				}
+				return;
 			}
 			
 			/*
-			* Content-Length not found, maybe this is a CHUNKED transfer-coding ?
+			* Will the server keep the connection open after this response? [RFC 7230, 6.3]
 			*/
-			retval = mangoHelper_httpHeaderGet((char*) MANGO_WB_PTR(hc), MANGO_HDR__TRANSFER_ENCODING, headerValueBuf, sizeof(headerValueBuf));
-			if(retval < 0){
-				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("NOT A CHUNKED RESPONSE!\r\n") );
-			}else if(retval == 0){
-				mangoSM_EXITERR(MANGO_ERR_TEMPBUFSMALL, hc);
-				mangoSM_ENTER(mangoSM__ABORTED, hc);
-				break;
-			}else{
-				/* CHUNKED HTTP response */
-				
-				/*
-				* TODO: verify it is indeed chunked encoding..
-				*/
-				
-				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("This is a CHUNKED RESPONSE!\r\n") );
-
-				if(hc->httpMethod != MANGO_HTTP_METHOD_HEAD){
-					hc->inputDataProcessor = mangoIDP_chunked;
-					hc->IDPArgsChunked.state 			= 1;
-					hc->IDPArgsChunked.chunkSz 			= 0;
-					hc->IDPArgsChunked.chunkSzProcessed	= 0;
-					hc->dataProcessorArgs = &hc->IDPArgsChunked;
-					mangoSM_ENTER(mangoSM__HTTP_RECVING_DATA, hc);
+			hc->httpConnClose = !mangoSM_httpPersistent(hc);
+			
+			/*
+			* A final status [417, 413, 401, ..] instead of "100 Continue": the
+			* request body is not sent. A chunked body is terminated right away so
+			* the connection stays in sync. With a Content-Length the server may
+			* still wait for the announced bytes, so the connection is not reused.
+			*/
+			if(hc->httpExpectPending){
+				hc->httpExpectPending = 0;
+				if(hc->outputDataProcessor == mangoODP_chunked || 
+				  (hc->outputDataProcessor == mangoODP_multipart && hc->ODPArgsMultipart.odp == mangoODP_chunked)){
+					if(mangoSocket_write(hc, (uint8_t*) "0\r\n\r\n", 5, MANGO_SOCKET_WRITE_TIMEOUT_MS) != 5){
+						hc->httpConnClose = 1;
+					}
 				}else{
-					/* HTTP request completed */
-					mangoSM_EXITERR(hc->httpResponseStatusCode, hc);
-					mangoSM_ENTER(mangoSM__HTTP_CONNECTED, hc);
+					hc->httpConnClose = 1;
 				}
 			}
 			
 			/*
-			* According to RFC HTTP Responses with the status codes below should not have a HTTP Body:
-			*	1xx: 100 Continue and 101 Switching Protocols 
-			*	204: No Content
-			*	205: Reset Content
-			*	304: 304 Not Modified
+			* Message body length [RFC 7230, 3.3.3]
+			*
+			* Responses to HEAD requests and 204 No Content / 304 Not Modified
+			* responses never have a body, whatever their headers say.
 			*/
+			if(hc->httpMethod == MANGO_HTTP_METHOD_HEAD || 
+			   hc->httpResponseStatusCode == MANGO_ERR_HTTP_204 || 
+			   hc->httpResponseStatusCode == MANGO_ERR_HTTP_304){
+				/* HTTP request completed */
+				mangoSM_EXITERR(hc->httpResponseStatusCode, hc);
+				mangoSM_ENTER(mangoSM__HTTP_CONNECTED, hc);
+			}
 			
-			/* 
-			* Special case: Shoutcast [ICY 200 responses have no content-length] 
+			/*
+			* Transfer-Encoding overrides Content-Length. If chunked is not the
+			* final coding the body ends when the server closes the connection.
 			*/
-			if(hc->httpResponseStatusCode == MANGO_ERR_HTTP_200 && memcmp(MANGO_WB_PTR(hc), "ICY ", 4) == 0){
-				hc->inputDataProcessor = mangoIDP_raw;
-				hc->IDPArgsRaw.fileSz = MANGO_FILE_SZ_INFINITE;
-				hc->IDPArgsRaw.fileSzProcessed = 0;
-				hc->dataProcessorArgs = &hc->IDPArgsRaw;
-				mangoSM_ENTER(mangoSM__HTTP_RECVING_DATA, hc);
+			retval = mangoHelper_httpHeaderGet((char*) MANGO_WB_PTR(hc), MANGO_HDR__TRANSFER_ENCODING, headerValueBuf, sizeof(headerValueBuf));
+			if(retval == 0){
+				mangoSM_EXITERR(MANGO_ERR_TEMPBUFSMALL, hc);
+				mangoSM_ENTER(mangoSM__ABORTED, hc);
 			}
 			
-			/* 
-			* Special case: Websockets [They have no content-length] 
-			*/
-			if(hc->httpResponseStatusCode == MANGO_ERR_HTTP_101){
-				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("SWITCHING TO WEB SOCKETS!\r\n") );
+			/* Only the last coding matters, "chunked, gzip" is not chunked framing */
+			coding = NULL;
+			if(retval > 0){
+				coding = strrchr(headerValueBuf, ',');
+				coding = coding ? coding + 1 : headerValueBuf;
 				
-				hc->inputDataProcessor = mangoIDP_websocket;
-				hc->IDPArgsWebsocket.state = 1;
-                hc->IDPArgsWebsocket.frameID = 0;
-				hc->dataProcessorArgs = &hc->IDPArgsWebsocket;
-
-                mangoSM_EXITERR(MANGO_ERR_HTTP_101, hc);
-				mangoSM_ENTER(mangoSM__WS_CONNECTED, hc);
+				/* Both framings: possibly a smuggling attempt, never reuse the connection */
+				if(mangoHelper_httpHeaderGet((char*) MANGO_WB_PTR(hc), MANGO_HDR__CONTENT_LENGTH, NULL, 0) >= 0){
+					hc->httpConnClose = 1;
+				}
 			}
 			
-			/* 
-			* Special case: Received "Expect: 100-continue" for a POST/PUT request with expectation
-			*/
-			if(hc->httpResponseStatusCode == MANGO_ERR_HTTP_100 && (hc->httpMethod == MANGO_HTTP_METHOD_POST || hc->httpMethod == MANGO_HTTP_METHOD_PUT)){
-				mangoSM_EXITERR(MANGO_ERR_HTTP_100, hc);
-				mangoSM_ENTER(mangoSM__HTTP_SENDING_DATA, hc);
+			if(coding && mangoHelper_httpTokenFind(coding, "chunked")){
+				/* CHUNKED HTTP response */
+				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("This is a CHUNKED RESPONSE!\r\n") );
+
+				hc->inputDataProcessor = mangoIDP_chunked;
+				hc->IDPArgsChunked.state 			= 1;
+				hc->IDPArgsChunked.chunkSz 			= 0;
+				hc->IDPArgsChunked.chunkSzProcessed	= 0;
+				hc->IDPArgsChunked.digits			= 0;
+				hc->dataProcessorArgs = &hc->IDPArgsChunked;
+				mangoSM_ENTER(mangoSM__HTTP_RECVING_DATA, hc);
+			}else if(retval < 0){
+				MANGO_DBG(MANGO_DBG_LEVEL_SM, ("NOT A CHUNKED RESPONSE!\r\n") );
+				
+				/*
+				* Locate Content-Length. Every instance must carry the same
+				* length [RFC 7230, 3.3.3 #4], anything else cannot be framed.
+				*/
+				retval = mangoHelper_httpContentLength((char*) MANGO_WB_PTR(hc), &contentLength);
+				if(retval == 0){
+					/* Content-Length not found */
+					MANGO_DBG(MANGO_DBG_LEVEL_SM, ("CONTENT LENGTH NOT FOUND!\r\n") );
+				}else{
+					if(retval < 0 || contentLength == MANGO_FILE_SZ_INFINITE){
+						MANGO_DBG(MANGO_DBG_LEVEL_SM, ("CONTENT LENGTH ERROR!\r\n") );
+						hc->httpConnClose = 1;
+						mangoSM_EXITERR(MANGO_ERR_RESPFORMAT, hc);
+						mangoSM_ENTER(mangoSM__ABORTED, hc);
+					}
+					
+					/* HTTP response with CONTENT-LENGTH */
+					hc->inputDataProcessor = mangoIDP_raw;
+					hc->IDPArgsRaw.fileSz = contentLength;
+					
+					MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Content-Length is %llu bytes\r\n", (unsigned long long) hc->IDPArgsRaw.fileSz) );
+					
+					hc->IDPArgsRaw.fileSzProcessed = 0;
+					hc->dataProcessorArgs = &hc->IDPArgsRaw;
+					mangoSM_ENTER(mangoSM__HTTP_RECVING_DATA, hc);
+				}
 			}
 			
-			/* 
-			* Special case: Unknown case, we are going to suppose it provided a content-length: 0 header
-			* and let the IDP to handle it as such
+			/*
+			* No length at all [or a non chunked Transfer-Encoding]: the body is
+			* whatever arrives until the server closes the connection. Shoutcast's
+			* "ICY 200" responses end up here too.
 			*/
+			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("READING UNTIL CLOSE!\r\n") );
+			
+			hc->httpConnClose = 1;
 			hc->inputDataProcessor = mangoIDP_raw;
-			hc->IDPArgsRaw.fileSz = 0;
+			hc->IDPArgsRaw.fileSz = MANGO_FILE_SZ_INFINITE;
 			hc->IDPArgsRaw.fileSzProcessed = 0;
 			hc->dataProcessorArgs = &hc->IDPArgsRaw;
 			mangoSM_ENTER(mangoSM__HTTP_RECVING_DATA, hc);
@@ -576,13 +798,20 @@ void mangoSM__HTTP_RECVING_HEADERS(mangoEvent_e event, mangoHttpClient_t* hc){
         }
 		case EVENT_TIMEOUT:
         {
+			if(hc->httpExpectPending){
+				/* No "100 Continue" in time, send the body anyway [RFC 7231, 5.1.1] */
+				hc->httpExpectPending = 0;
+				mangoSM_EXITERR(MANGO_ERR_HTTP_100, hc);
+				mangoSM_ENTER(mangoSM__HTTP_SENDING_DATA, hc);
+			}
+			
 			mangoSM_EXITERR(MANGO_ERR_RESPTIMEOUT, hc);
 			mangoSM_ENTER(mangoSM__ABORTED, hc);
 			break;
         }
         default:
 		{
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;
 		}
 	}
@@ -618,6 +847,12 @@ void mangoSM__HTTP_RECVING_DATA(mangoEvent_e event, mangoHttpClient_t* hc){
             /* Ask new data from the socket */
             retval = mangoSocket_read(hc, MANGO_WB_FREE_PTR(hc), MANGO_WB_FREE_SZ(hc), hc->smEventTimeout); 
             if(retval < 0){
+                if(retval == MANGO_SOCKET_CLOSED && hc->inputDataProcessor == mangoIDP_raw && hc->IDPArgsRaw.fileSz == MANGO_FILE_SZ_INFINITE){
+                    /* The body was delimited by the connection close [a reset means it was truncated] */
+                    mangoSM_EXITERR(hc->httpResponseStatusCode, hc);
+                    mangoSM_ENTER(mangoSM__HTTP_CONNECTED, hc);
+                }
+                
                 /* Connection error */
                 mangoSM_EXITERR(MANGO_ERR_CONNECTION, hc);
                 mangoSM_ENTER(mangoSM__DISCONNECTED, hc);
@@ -628,7 +863,7 @@ void mangoSM__HTTP_RECVING_DATA(mangoEvent_e event, mangoHttpClient_t* hc){
                 hc->workingBufferIndexRight += retval;
                 MANGO_WB_NULLTERMINATE();
 				
-                MANGO_ENSURE(hc->workingBufferIndexRight <= MANGO_WB_TOT_SZ(hc), ("?") );
+                MANGO_ENSURE_SM(hc->workingBufferIndexRight <= MANGO_WB_TOT_SZ(hc), hc, ("?") );
                 
 				/* Reset timeout */
 				mangoSM_TIMEOUT(MANGO_HTTP_RESPONSE_TIMEOUT_MS, hc);
@@ -704,7 +939,7 @@ void mangoSM__HTTP_RECVING_DATA(mangoEvent_e event, mangoHttpClient_t* hc){
         }
 		default:
         {
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;
         }
 	}
@@ -734,7 +969,7 @@ void mangoSM__HTTP_SENDING_DATA(mangoEvent_e event, mangoHttpClient_t* hc){
             mangoSM_EXITERR(MANGO_ERR_APICALLNOTSUPPORTED, hc);
 			break;
         default:
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;	
 	}
 	
@@ -742,7 +977,7 @@ void mangoSM__HTTP_SENDING_DATA(mangoEvent_e event, mangoHttpClient_t* hc){
 
 
 void mangoSM__HTTP_SENDING_PACKET(mangoEvent_e event, mangoHttpClient_t* hc){
-	uint32_t processed;
+	uint64_t processed;
     mangoErr_t err;
 
     MANGO_DBG(MANGO_DBG_LEVEL_SM, ("STATE %s, EVENT %u\r\n", __func__, event) );
@@ -760,7 +995,10 @@ void mangoSM__HTTP_SENDING_PACKET(mangoEvent_e event, mangoHttpClient_t* hc){
 			
 			mangoHTTPDataSendArgs_t* HTTPDataSendArgs = (mangoHTTPDataSendArgs_t*) hc->smAPICallArgs;
             
-			err = hc->outputDataProcessor(hc, HTTPDataSendArgs->buf, HTTPDataSendArgs->buflen, hc->dataProcessorArgs, &processed, &hc->dataProcessorCompleted);
+			hc->odpNonBlocking = HTTPDataSendArgs->nonBlocking;
+			err = hc->outputDataProcessor(hc, HTTPDataSendArgs->iov, HTTPDataSendArgs->iovcnt, hc->dataProcessorArgs, &processed, &hc->dataProcessorCompleted);
+			hc->odpNonBlocking = 0;
+			HTTPDataSendArgs->sent = processed;
 			if(err != MANGO_OK){
 				mangoSM_EXITERR(err, hc);
 				mangoSM_ENTER(mangoSM__ABORTED, hc);
@@ -783,7 +1021,7 @@ void mangoSM__HTTP_SENDING_PACKET(mangoEvent_e event, mangoHttpClient_t* hc){
         }
         default:
         {
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;
         }
 	};
@@ -806,6 +1044,8 @@ void mangoSM__WS_CONNECTED(mangoEvent_e event, mangoHttpClient_t* hc){
 			*/
             mangoWB_shrink(hc);
 			
+			mangoStats_report(hc);
+			
 			break;
         case EVENT_APICALL_httpRequestProcess:
 		case EVENT_APICALL_httpDataSend:
@@ -825,14 +1065,21 @@ void mangoSM__WS_CONNECTED(mangoEvent_e event, mangoHttpClient_t* hc){
 			mangoSM_ENTER(mangoSM__WS_CLOSING, hc);
 			break;
         default:
-            MANGO_ENSURE(0 , ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;	
 	}
 }
 
 
 void mangoSM__WS_POLLING(mangoEvent_e event, mangoHttpClient_t* hc){
+#if MANGO_WS_TX_QUEUE_SZ > 0
+    mangoWSQueueSlot_t frame;
+    uint32_t timeout;
+#endif
+    mangoWSPollArgs_t* WSPollArgs = (mangoWSPollArgs_t*) hc->smAPICallArgs;
     uint32_t processed;
+    uint32_t elapsed;
+    uint32_t next;
     mangoErr_t err;
     int retval;
     
@@ -841,9 +1088,22 @@ void mangoSM__WS_POLLING(mangoEvent_e event, mangoHttpClient_t* hc){
 	switch(event){
 		case EVENT_ENTRY:
         {
-			mangoWSPollArgs_t* WSPollArgs = (mangoWSPollArgs_t*) hc->smAPICallArgs;
-
-			mangoSM_TIMEOUT(WSPollArgs->timeout, hc); 
+			/* Send any due keepalive ping / coalesced frames, the state timeout also covers the next ones */
+			err = mangoWS_timers(hc, &next);
+			if(err != MANGO_OK){
+				mangoSM_EXITERR(err, hc);
+				mangoSM_ENTER(mangoSM__ABORTED, hc);
+			}
+			
+			hc->wsPollStart = mangoPort_timeNow();
+			mangoSM_TIMEOUT(next < WSPollArgs->timeout ? next : WSPollArgs->timeout, hc); 
+			
+#if MANGO_WS_TX_QUEUE_SZ > 0
+			if(hc->wsWakeupfd < 0 && !hc->transport){
+				/* Let the producers wake us up while polling */
+				__atomic_store_n(&hc->wsWakeupfd, mangoPort_wakeupCreate(), __ATOMIC_RELEASE);
+			}
+#endif
 			
 			mangoSM_SUBSCRIBE(EVENT_PROCESS, hc);
 		}
@@ -856,7 +1116,12 @@ void mangoSM__WS_POLLING(mangoEvent_e event, mangoHttpClient_t* hc){
                     case MANGO_ERR_MOREDATANEEDED:
                     {
                         /* The processor needs more data to continue.. */
-                        if(MANGO_WB_FREE_SZ(hc) == 0){
+                        mangoWB_shrink(hc);
+                        if(MANGO_WB_FREE_SZ(hc) == 0 && hc->workingBufferIndexLeft > 0){
+                            /* ..but pinned views take the space, the application has to release them */
+                            mangoSM_EXITERR(MANGO_ERR_WSPINNED, hc);
+                            mangoSM_ENTER(mangoSM__WS_CONNECTED, hc);
+                        }else if(MANGO_WB_FREE_SZ(hc) == 0){
                             /* ..but we have no space anyway */
                             mangoSM_EXITERR(MANGO_ERR_WORKBUFSMALL, hc);
                             mangoSM_ENTER(mangoSM__ABORTED, hc);
@@ -905,6 +1170,45 @@ void mangoSM__WS_POLLING(mangoEvent_e event, mangoHttpClient_t* hc){
         }
         case EVENT_READ:
         {
+#if MANGO_WS_TX_QUEUE_SZ > 0
+            /* Frames queued by other threads while we are polling */
+            while(mangoWS_queuePop(hc, &frame)){
+                err = mangoWS_frameSend(hc, frame.buf, frame.buflen, frame.type);
+                mangoPort_free(frame.buf);
+                if(err != MANGO_OK){
+                    mangoSM_EXITERR(MANGO_ERR_CONNECTION, hc);
+                    mangoSM_ENTER(mangoSM__ABORTED, hc);
+                }
+            }
+            
+            /*
+            * Wait for either new data or new queued frames, unless
+            * decrypted data are already waiting in the TLS layer
+            */
+            if(!hc->transport
+#ifdef MANGO_TLS_ENABLED
+               && !(hc->tls && mangoTLS_pending(hc->tls))
+#endif
+            ){
+                timeout = hc->smEventTimeout;
+                if(hc->wsWakeupfd < 0 && timeout > MANGO_WS_POLL_SLICE_MS){
+                    timeout = MANGO_WS_POLL_SLICE_MS;
+                }
+                
+                retval = mangoPort_pollWakeup(hc->socketfd, hc->wsWakeupfd, timeout);
+                if(retval < 0){
+                    mangoSM_EXITERR(MANGO_ERR_CONNECTION, hc);
+                    mangoSM_ENTER(mangoSM__DISCONNECTED, hc);
+                }
+                if(retval & MANGO_POLL_WAKEUP){
+                    mangoPort_wakeupClear(hc->wsWakeupfd);
+                }
+                if(!(retval & MANGO_POLL_READ)){
+                    /* Woken up (send the queued frames) or nothing yet */
+                    break;
+                }
+            }
+#endif
             
             /* Ask new data from the socket */
             retval = mangoSocket_read(hc, MANGO_WB_FREE_PTR(hc), MANGO_WB_FREE_SZ(hc), hc->smEventTimeout); 
@@ -917,9 +1221,10 @@ void mangoSM__WS_POLLING(mangoEvent_e event, mangoHttpClient_t* hc){
             }else{
                 /* New data received */
                 hc->workingBufferIndexRight += retval;
+                hc->wsLastRx = mangoPort_timeNow();
                 MANGO_WB_NULLTERMINATE();
 				
-                MANGO_ENSURE(hc->workingBufferIndexRight <= MANGO_WB_TOT_SZ(hc), ("?") );
+                MANGO_ENSURE_SM(hc->workingBufferIndexRight <= MANGO_WB_TOT_SZ(hc), hc, ("?") );
                 
                 /* Process the data */
                 mangoSM_SUBSCRIBE(EVENT_PROCESS, hc);
@@ -931,12 +1236,26 @@ void mangoSM__WS_POLLING(mangoEvent_e event, mangoHttpClient_t* hc){
         case EVENT_TIMEOUT:
         {
             MANGO_DBG(MANGO_DBG_LEVEL_SM, ("EVENT TIMEOUT !!!!!!!\r\n") );
-			mangoSM_ENTER(mangoSM__WS_CONNECTED, hc);
+            
+            /* Either a keepalive / flush event or the end of the poll */
+            err = mangoWS_timers(hc, &next);
+            if(err != MANGO_OK){
+                mangoSM_EXITERR(err, hc);
+                mangoSM_ENTER(mangoSM__ABORTED, hc);
+            }
+            
+            elapsed = mangoHelper_elapsedTime(hc->wsPollStart);
+            if(elapsed >= WSPollArgs->timeout){
+                mangoSM_ENTER(mangoSM__WS_CONNECTED, hc);
+            }
+            
+            /* Keep polling, the subscribed event is kept */
+            mangoSM_TIMEOUT(next < WSPollArgs->timeout - elapsed ? next : WSPollArgs->timeout - elapsed, hc);
 			break;
         }
         default:
         {
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;
         }
 	};
@@ -960,8 +1279,13 @@ void mangoSM__WS_SENDING_FRAME(mangoEvent_e event, mangoHttpClient_t* hc){
 			
 			mangoWSFrameSendArgs_t* WSFrameSendArgs = (mangoWSFrameSendArgs_t*) hc->smAPICallArgs;
 
-			err =  mangoWS_frameSend(hc->socketfd, WSFrameSendArgs->buf, WSFrameSendArgs->buflen, WSFrameSendArgs->type);
+			if(WSFrameSendArgs->batch){
+				err = mangoWS_frameSendBatch(hc, WSFrameSendArgs->frames, WSFrameSendArgs->framesCnt);
+			}else{
+				err = mangoWS_frameSend(hc, WSFrameSendArgs->buf, WSFrameSendArgs->buflen, WSFrameSendArgs->type);
+			}
 			if(err != MANGO_OK){
+				mangoSM_EXITERR(MANGO_ERR_CONNECTION, hc);
 				mangoSM_ENTER(mangoSM__ABORTED, hc);
 			}else{
 				mangoSM_ENTER(mangoSM__WS_CONNECTED, hc);
@@ -977,7 +1301,7 @@ void mangoSM__WS_SENDING_FRAME(mangoEvent_e event, mangoHttpClient_t* hc){
         }
         default:
         {
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;
         }
 	};
@@ -999,7 +1323,7 @@ void mangoSM__WS_CLOSING(mangoEvent_e event, mangoHttpClient_t* hc){
         {
             MANGO_DBG(MANGO_DBG_LEVEL_SM, ("EVENT EVENT_APICALL_wsClose !!!!!!!\r\n") );
 			
-			err =  mangoWS_close(hc->socketfd);
+			err =  mangoWS_close(hc);
 			if(err != MANGO_OK){
 				mangoSM_ENTER(mangoSM__ABORTED, hc);
 			}else{
@@ -1016,7 +1340,7 @@ void mangoSM__WS_CLOSING(mangoEvent_e event, mangoHttpClient_t* hc){
         }
         default:
         {
-            MANGO_ENSURE(0, ("?") );
+            MANGO_ENSURE_SM(0, hc, ("?") );
 			break;
         }
 	};
@@ -1027,25 +1351,34 @@ void mangoSM__WS_CLOSING(mangoEvent_e event, mangoHttpClient_t* hc){
 ----------------------------------------------------------------------------------------------------------------- */
 
 void mangoWB_shrink(mangoHttpClient_t* hc){
+    uint16_t base;
     
     /* The last byte of working buffer is used for string termination */
-    MANGO_ENSURE(hc->workingBufferIndexRight <= MANGO_WB_TOT_SZ(hc), ("?") );
-    MANGO_ENSURE(hc->workingBufferIndexLeft <= hc->workingBufferIndexRight, ("?") );
+    MANGO_ENSURE_SM(hc->workingBufferIndexRight <= MANGO_WB_TOT_SZ(hc), hc, ("?") );
+    MANGO_ENSURE_SM(hc->workingBufferIndexLeft <= hc->workingBufferIndexRight, hc, ("?") );
+    
+    /* Websocket views pinned by the application are not moved */
+    base = 0;
+    if(__atomic_load_n(&hc->wsPinCnt, __ATOMIC_ACQUIRE)){
+        base = hc->wsPinEnd;
+    }else{
+        hc->wsPinEnd = 0;
+    }
     
-    if(hc->workingBufferIndexLeft == 0){
+    if(hc->workingBufferIndexLeft <= base){
         /* Cannot shrink */
     }else{
         if(hc->workingBufferIndexLeft == hc->workingBufferIndexRight){
-            hc->workingBufferIndexLeft  = 0;
-            hc->workingBufferIndexRight = 0;
+            hc->workingBufferIndexLeft  = base;
+            hc->workingBufferIndexRight = base;
         }else{
-            uint16_t index = 0;
+            uint16_t index = base;
             
             while(hc->workingBufferIndexLeft < hc->workingBufferIndexRight){
                 hc->workingBuffer[index++] = hc->workingBuffer[hc->workingBufferIndexLeft++];
             };
             
-            hc->workingBufferIndexLeft  = 0;
+            hc->workingBufferIndexLeft  = base;
             hc->workingBufferIndexRight = index;
         }
     }
@@ -1054,6 +1387,50 @@ void mangoWB_shrink(mangoHttpClient_t* hc){
 }
 
 
+/*
+* Starts the stats of a new request
+*/
+void mangoStats_start(mangoHttpClient_t* hc){
+	hc->stats.rxBytes       = 0;
+	hc->stats.txBytes       = 0;
+	hc->stats.time          = 0;
+	hc->stats.headersSent   = 0;
+	hc->stats.firstByte     = 0;
+	hc->stats.headersParsed = 0;
+	hc->stats.bodyComplete  = 0;
+	hc->stats.requestStart  = mangoPort_timeNowUs();
+	hc->statsPending        = 1;
+}
+
+/*
+* Reports the stats of the request in progress (if any) to the application
+*/
+void mangoStats_report(mangoHttpClient_t* hc){
+	mangoArg_t funcArgs;
+	uint32_t elapsedUs;
+	
+	if(!hc->statsPending){
+		return;
+	}
+	
+	hc->statsPending = 0;
+	elapsedUs = mangoPort_timeNowUs() - hc->stats.requestStart;
+	hc->stats.time = elapsedUs / 1000;
+	
+	MANGO_METRICS( mangoMetrics_request(elapsedUs, hc->stats.headersParsed ? hc->httpResponseStatusCode : 0) );
+	
+	if(!hc->userFunc){
+		return;
+	}
+	
+	memset(&funcArgs, 0, sizeof(funcArgs));
+	funcArgs.argType = MANGO_ARG_TYPE_HTTP_STATS;
+	funcArgs.statusCode = hc->httpResponseStatusCode;
+	funcArgs.stats = &hc->stats;
+	hc->userFunc(&funcArgs, hc->userArgs);
+}
+
+
 /* -----------------------------------------------------------------------------------------------------------------
 | HELP FUNCTIONS
 ----------------------------------------------------------------------------------------------------------------- */
@@ -1063,11 +1440,23 @@ int mangoSocket_read(mangoHttpClient_t* hc, uint8_t* data, uint16_t datalen, uin
     
     if(!timeout) {timeout = 1;}
     
-    retval = mangoPort_read(hc->socketfd, data, datalen, timeout);
+    if(hc->transport){
+        retval = hc->transport->read(hc->transportArgs, data, datalen, timeout);
+    }else
+#ifdef MANGO_TLS_ENABLED
+    if(hc->tls){
+        retval = mangoTLS_read(hc->tls, data, datalen, timeout);
+    }else
+#endif
+    {
+        retval = mangoPort_read(hc->socketfd, data, datalen, timeout);
+    }
+    MANGO_TRACE_BYTES(hc, retval);
     if(retval <= 0){
         
     }else{
 		hc->stats.rxBytes += retval;
+		MANGO_METRICS( mangoMetrics_rxBytes(retval) );
     }
 	
 	return retval;
@@ -1079,11 +1468,121 @@ int mangoSocket_write(mangoHttpClient_t* hc, uint8_t* data, uint16_t datalen, ui
     
     if(!timeout) {timeout = 1;}
     
-    retval = mangoPort_write(hc->socketfd, data, datalen, timeout);
+    if(hc->transport){
+        retval = hc->transport->write(hc->transportArgs, data, datalen, timeout);
+    }else
+#ifdef MANGO_TLS_ENABLED
+    if(hc->tls){
+        retval = mangoTLS_write(hc->tls, data, datalen, timeout);
+    }else
+#endif
+    {
+        retval = mangoPort_write(hc->socketfd, data, datalen, timeout);
+    }
+    MANGO_TRACE_BYTES(hc, retval);
+    if(retval <= 0){
+        
+    }else{
+		hc->stats.txBytes += retval;
+		MANGO_METRICS( mangoMetrics_txBytes(retval) );
+    }
+    
+    return retval;
+}
+
+
+/*
+ * A "timeout" of 0 writes only what the socket takes right now [mango_httpDataSendNB()].
+ * Transports and TLS have no such mode, they wait for the shortest timeout instead.
+ */
+int64_t mangoSocket_writev(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, uint32_t timeout){
+    int64_t retval;
+    uint64_t offset;
+    uint16_t len;
+    int sent;
+    
+    if(hc->transport
+#ifdef MANGO_TLS_ENABLED
+       || hc->tls
+#endif
+    ){
+        /* Transports and TLS write one buffer at a time */
+        retval = 0;
+        for(; iovcnt; iov++, iovcnt--){
+            for(offset = 0; offset < iov->buflen; offset += sent){
+                len = iov->buflen - offset > 0x8000 ? 0x8000 : iov->buflen - offset;
+                sent = mangoSocket_write(hc, iov->buf + offset, len, timeout);
+                if(sent < 0){
+                    return sent;
+                }
+                retval += sent;
+                if(sent != len){
+                    return retval;
+                }
+            }
+        }
+        return retval;
+    }
+    
+    retval = mangoPort_writev(hc->socketfd, iov, iovcnt, timeout);
+    MANGO_TRACE_BYTES(hc, (int32_t) retval);
+    if(retval <= 0){
+        
+    }else{
+		hc->stats.txBytes += retval;
+		MANGO_METRICS( mangoMetrics_txBytes(retval) );
+    }
+    
+    return retval;
+}
+
+
+/*
+ * Sends "len" bytes of file "fd". Transports and TLS read the file through the
+ * working buffer, so it must not hold anything [true while a body is sent].
+ */
+int64_t mangoSocket_sendfile(mangoHttpClient_t* hc, int fd, uint64_t len, uint32_t timeout){
+    int64_t retval;
+    uint16_t readlen;
+    int sent;
+    int n;
+    
+    if(!timeout) {timeout = 1;}
+    
+    if(hc->transport
+#ifdef MANGO_TLS_ENABLED
+       || hc->tls
+#endif
+    ){
+        retval = 0;
+        while((uint64_t) retval < len){
+            readlen = len - retval > MANGO_WORKING_BUFFER_SZ ? MANGO_WORKING_BUFFER_SZ : len - retval;
+            n = mangoPort_fileRead(fd, hc->workingBuffer, readlen);
+            if(n < 0){
+                return n;
+            }else if(n == 0){
+                /* End of file */
+                break;
+            }
+            sent = mangoSocket_write(hc, hc->workingBuffer, n, timeout);
+            if(sent < 0){
+                return sent;
+            }
+            retval += sent;
+            if(sent != n){
+                break;
+            }
+        }
+        return retval;
+    }
+    
+    retval = mangoPort_sendfile(hc->socketfd, fd, len, timeout);
+    MANGO_TRACE_BYTES(hc, (int32_t) retval);
     if(retval <= 0){
         
     }else{
 		hc->stats.txBytes += retval;
+		MANGO_METRICS( mangoMetrics_txBytes(retval) );
     }
     
     return retval;
@@ -0,0 +1,665 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+#ifdef MANGO_TLS_ENABLED
+
+#ifdef MANGO_TLS_ENV__OPENSSL
+    #include <openssl/ssl.h>
+    #include <openssl/err.h>
+    #include <openssl/x509v3.h>
+#endif
+
+#ifdef MANGO_TLS_ENV__MBEDTLS
+    #include "mbedtls/version.h"
+    #include "mbedtls/ssl.h"
+    #include "mbedtls/net_sockets.h"
+    #include "mbedtls/entropy.h"
+    #include "mbedtls/ctr_drbg.h"
+    #include "mbedtls/x509_crt.h"
+#endif
+
+#define MANGO_TLS_SESSION_KEY_SZ    (64)
+
+/*
+ * Library initialization states
+*/
+#define MANGO_TLS_STATE_NONE        (0)
+#define MANGO_TLS_STATE_BUSY        (1) /* Being initialized by another thread */
+#define MANGO_TLS_STATE_READY       (2)
+#define MANGO_TLS_STATE_FAILED      (3) /* mango_tlsInit() failed, there is no fallback to the default trust store */
+
+/*
+ * One resumable session per "serverName:serverPort"
+*/
+typedef struct{
+    char        key[MANGO_TLS_SESSION_KEY_SZ];
+    uint32_t    lastUsed;
+#ifdef MANGO_TLS_ENV__OPENSSL
+    SSL_SESSION* session;
+#endif
+#ifdef MANGO_TLS_ENV__MBEDTLS
+    uint8_t     valid;
+    mbedtls_ssl_session session;
+#endif
+}mangoTLSSession_t;
+
+typedef struct{
+    int         socketfd;
+    char        key[MANGO_TLS_SESSION_KEY_SZ];
+    uint8_t     resumed;
+#ifdef MANGO_TLS_ENV__OPENSSL
+    SSL*        ssl;
+#endif
+#ifdef MANGO_TLS_ENV__MBEDTLS
+    mbedtls_ssl_context ssl;
+    mbedtls_net_context net;
+#endif
+}mangoTLS_t;
+
+static int                  mangoTLS_state;
+static volatile int         mangoTLS_cacheLock;
+static mangoTLSSession_t    mangoTLS_cache[MANGO_TLS_SESSION_CACHE_SZ];
+
+#ifdef MANGO_TLS_ENV__OPENSSL
+static SSL_CTX*             mangoTLS_ctx;
+#endif
+
+#ifdef MANGO_TLS_ENV__MBEDTLS
+static mbedtls_entropy_context  mangoTLS_entropy;
+static mbedtls_ctr_drbg_context mangoTLS_ctrDrbg;
+static mbedtls_ssl_config       mangoTLS_conf;
+static mbedtls_x509_crt         mangoTLS_caChain;
+#endif
+
+/*
+ * The session cache is shared by all the clients, it is only touched
+ * during handshakes so a spinlock is more than enough.
+*/
+static void mangoTLS_cacheAcquire(void){
+    while(__sync_lock_test_and_set(&mangoTLS_cacheLock, 1)){};
+}
+
+static void mangoTLS_cacheRelease(void){
+    __sync_lock_release(&mangoTLS_cacheLock);
+}
+
+/*
+ * Returns the cache entry of the specified key, or the entry that should be
+ * replaced if the key is not cached. Must be called with the cache lock held.
+*/
+static mangoTLSSession_t* mangoTLS_cacheSlot(char* key){
+    mangoTLSSession_t* slot;
+    uint32_t i;
+
+    slot = &mangoTLS_cache[0];
+    for(i = 0; i < MANGO_TLS_SESSION_CACHE_SZ; i++){
+        if(strcmp(mangoTLS_cache[i].key, key) == 0){
+            return &mangoTLS_cache[i];
+        }
+        if(mangoTLS_cache[i].key[0] == '\0'){
+            /* Prefer an empty slot over the LRU one */
+            if(slot->key[0] != '\0'){ slot = &mangoTLS_cache[i]; }
+        }else if(slot->key[0] != '\0' && mangoHelper_elapsedTime(mangoTLS_cache[i].lastUsed) > mangoHelper_elapsedTime(slot->lastUsed)){
+            slot = &mangoTLS_cache[i];
+        }
+    }
+
+    return slot;
+}
+
+static void mangoTLS_cacheSlotClear(mangoTLSSession_t* slot){
+#ifdef MANGO_TLS_ENV__OPENSSL
+    if(slot->session){
+        SSL_SESSION_free(slot->session);
+        slot->session = NULL;
+    }
+#endif
+#ifdef MANGO_TLS_ENV__MBEDTLS
+    if(slot->valid){
+        mbedtls_ssl_session_free(&slot->session);
+        slot->valid = 0;
+    }
+#endif
+    slot->key[0] = '\0';
+}
+
+
+#ifdef MANGO_TLS_ENV__MBEDTLS
+/*
+ * Returns 1 if both sessions carry the same (non empty) session ID. The ID
+ * is only reachable through the public API from mbedTLS 3.2 on (2.x still
+ * exposes the fields), 3.0 and 3.1 never report a resumption.
+*/
+static uint8_t mangoTLS_sessionIdEqual(const mbedtls_ssl_session* a, const mbedtls_ssl_session* b){
+#if MBEDTLS_VERSION_NUMBER >= 0x03020000
+    size_t len;
+
+    len = mbedtls_ssl_session_get_id_len(a);
+    return (len && len == mbedtls_ssl_session_get_id_len(b) && memcmp(mbedtls_ssl_session_get_id(a), mbedtls_ssl_session_get_id(b), len) == 0) ? 1 : 0;
+#elif MBEDTLS_VERSION_NUMBER < 0x03000000
+    return (a->id_len && a->id_len == b->id_len && memcmp(a->id, b->id, a->id_len) == 0) ? 1 : 0;
+#else
+    (void) a;
+    (void) b;
+    return 0;
+#endif
+}
+#endif
+
+#ifdef MANGO_TLS_ENV__OPENSSL
+/*
+ * OpenSSL reports new sessions through this callback. With TLSv1.3 the session
+ * tickets arrive after the handshake, so the cache can't be updated from
+ * mangoTLS_connect() only.
+*/
+static int mangoTLS_newSessionCb(SSL* ssl, SSL_SESSION* session){
+    mangoTLS_t* tls = (mangoTLS_t*) SSL_get_app_data(ssl);
+    mangoTLSSession_t* slot;
+
+    if(!tls){
+        return 0;
+    }
+
+    mangoTLS_cacheAcquire();
+    slot = mangoTLS_cacheSlot(tls->key);
+    mangoTLS_cacheSlotClear(slot);
+    strcpy(slot->key, tls->key);
+    slot->session  = session;
+    slot->lastUsed = mangoPort_timeNow();
+    mangoTLS_cacheRelease();
+
+    /* We keep the reference */
+    return 1;
+}
+#endif
+
+/*
+ * Sets up the library state, on failure everything allocated so far is released.
+*/
+static mangoErr_t mangoTLS_setup(char* caFile){
+
+#ifdef MANGO_TLS_ENV__OPENSSL
+    mangoTLS_ctx = SSL_CTX_new(TLS_client_method());
+    if(!mangoTLS_ctx){
+        return MANGO_ERR;
+    }
+
+    SSL_CTX_set_min_proto_version(mangoTLS_ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(mangoTLS_ctx, SSL_VERIFY_PEER, NULL);
+
+    if(caFile){
+        if(SSL_CTX_load_verify_locations(mangoTLS_ctx, caFile, NULL) != 1){
+            SSL_CTX_free(mangoTLS_ctx);
+            mangoTLS_ctx = NULL;
+            return MANGO_ERR;
+        }
+    }else{
+        SSL_CTX_set_default_verify_paths(mangoTLS_ctx);
+    }
+
+    SSL_CTX_set_session_cache_mode(mangoTLS_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(mangoTLS_ctx, mangoTLS_newSessionCb);
+#endif
+
+#ifdef MANGO_TLS_ENV__MBEDTLS
+    mbedtls_entropy_init(&mangoTLS_entropy);
+    mbedtls_ctr_drbg_init(&mangoTLS_ctrDrbg);
+    mbedtls_ssl_config_init(&mangoTLS_conf);
+    mbedtls_x509_crt_init(&mangoTLS_caChain);
+
+    if(mbedtls_ctr_drbg_seed(&mangoTLS_ctrDrbg, mbedtls_entropy_func, &mangoTLS_entropy, (const unsigned char*) "mango", 5) != 0){
+        goto handleError;
+    }
+
+    if(caFile){
+        if(mbedtls_x509_crt_parse_file(&mangoTLS_caChain, caFile) != 0){
+            goto handleError;
+        }
+    }else{
+        if(mbedtls_x509_crt_parse_path(&mangoTLS_caChain, "/etc/ssl/certs") < 0){
+            goto handleError;
+        }
+    }
+
+    if(mbedtls_ssl_config_defaults(&mangoTLS_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0){
+        goto handleError;
+    }
+
+    mbedtls_ssl_conf_authmode(&mangoTLS_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&mangoTLS_conf, &mangoTLS_caChain, NULL);
+    mbedtls_ssl_conf_rng(&mangoTLS_conf, mbedtls_ctr_drbg_random, &mangoTLS_ctrDrbg);
+#endif
+
+    return MANGO_OK;
+
+#ifdef MANGO_TLS_ENV__MBEDTLS
+handleError:
+    mbedtls_x509_crt_free(&mangoTLS_caChain);
+    mbedtls_ssl_config_free(&mangoTLS_conf);
+    mbedtls_ctr_drbg_free(&mangoTLS_ctrDrbg);
+    mbedtls_entropy_free(&mangoTLS_entropy);
+    return MANGO_ERR;
+#endif
+}
+
+/*
+ * Runs mangoTLS_setup() once, concurrent callers wait for its result. Only an
+ * "explicit" call [mango_tlsInit()] may retry after a failed initialization,
+ * a lazy one must not silently fall back to the default trust store.
+*/
+static mangoErr_t mangoTLS_initOnce(char* caFile, uint8_t explicit){
+    mangoErr_t err;
+    int state;
+
+    while(1){
+        state = __atomic_load_n(&mangoTLS_state, __ATOMIC_ACQUIRE);
+        if(state == MANGO_TLS_STATE_READY){
+            return MANGO_OK;
+        }
+        if(state == MANGO_TLS_STATE_FAILED && !explicit){
+            return MANGO_ERR;
+        }
+        if(state == MANGO_TLS_STATE_BUSY){
+            mangoPort_sleep(1);
+            continue;
+        }
+        if(__atomic_compare_exchange_n(&mangoTLS_state, &state, MANGO_TLS_STATE_BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)){
+            break;
+        }
+    }
+
+    err = mangoTLS_setup(caFile);
+
+    __atomic_store_n(&mangoTLS_state, err == MANGO_OK ? MANGO_TLS_STATE_READY : MANGO_TLS_STATE_FAILED, __ATOMIC_RELEASE);
+
+    return err;
+}
+
+/**
+ * @brief   Initializes the TLS library. "caFile" is a PEM file with the trusted
+ *          certificates, if NULL the system default trust store is used.
+ *          Thread safe, only the first successful call has an effect.
+ */
+mangoErr_t mangoTLS_init(char* caFile){
+    return mangoTLS_initOnce(caFile, 1);
+}
+
+/**
+ * @brief   Performs the TLS handshake over the (already connected) socket.
+ *          A cached session for "serverName:serverPort" is offered to the server
+ *          so the handshake can be abbreviated.
+ *
+ * @retval  The TLS context or NULL if the handshake failed
+ */
+void* mangoTLS_connect(int socketfd, char* serverName, uint16_t serverPort, uint32_t timeout){
+    mangoTLSSession_t* slot;
+    mangoTLS_t* tls;
+    char portStr[11];
+    uint32_t start;
+    uint32_t elapsed;
+    uint8_t events;
+    int retval;
+#ifdef MANGO_TLS_ENV__MBEDTLS
+    mbedtls_ssl_session session;
+#endif
+
+    /* Lazy initialization unless mango_tlsInit() was called [or failed] */
+    if(mangoTLS_initOnce(NULL, 0) != MANGO_OK){
+        return NULL;
+    }
+
+    mangoHelper_dec2decstr(serverPort, portStr);
+    if(strlen(serverName) + 1 + strlen(portStr) + 1 > MANGO_TLS_SESSION_KEY_SZ){
+        return NULL;
+    }
+
+    tls = mangoPort_malloc(sizeof(mangoTLS_t));
+    if(!tls){
+        return NULL;
+    }
+    memset(tls, 0, sizeof(mangoTLS_t));
+
+    tls->socketfd = socketfd;
+    strcpy(tls->key, serverName);
+    strcat(tls->key, ":");
+    strcat(tls->key, portStr);
+
+#ifdef MANGO_TLS_ENV__OPENSSL
+    tls->ssl = SSL_new(mangoTLS_ctx);
+    if(!tls->ssl){
+        goto handleError;
+    }
+
+    SSL_set_app_data(tls->ssl, tls);
+    SSL_set_fd(tls->ssl, socketfd);
+    SSL_set_tlsext_host_name(tls->ssl, serverName);
+
+    /* Hostname or IP address verification */
+    if(!X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(tls->ssl), serverName)){
+        SSL_set1_host(tls->ssl, serverName);
+    }
+
+    mangoTLS_cacheAcquire();
+    slot = mangoTLS_cacheSlot(tls->key);
+    if(slot->session && strcmp(slot->key, tls->key) == 0){
+        SSL_set_session(tls->ssl, slot->session);
+        slot->lastUsed = mangoPort_timeNow();
+    }
+    mangoTLS_cacheRelease();
+
+    start = mangoPort_timeNow();
+    while(1){
+        retval = SSL_connect(tls->ssl);
+        if(retval == 1){
+            break;
+        }
+
+        switch(SSL_get_error(tls->ssl, retval)){
+            case SSL_ERROR_WANT_READ:
+                events = MANGO_POLL_READ;
+                break;
+            case SSL_ERROR_WANT_WRITE:
+                events = MANGO_POLL_WRITE;
+                break;
+            default:
+                MANGO_DBG(MANGO_DBG_LEVEL_PORT, ("TLS handshake failed: %s\r\n", ERR_error_string(ERR_get_error(), NULL)) );
+                goto handleError;
+        }
+
+        elapsed = mangoHelper_elapsedTime(start);
+        if(elapsed >= timeout || mangoPort_poll(socketfd, events, timeout - elapsed) < 0){
+            goto handleError;
+        }
+    }
+
+    tls->resumed = SSL_session_reused(tls->ssl) ? 1 : 0;
+#endif
+
+#ifdef MANGO_TLS_ENV__MBEDTLS
+    mbedtls_ssl_init(&tls->ssl);
+    mbedtls_net_init(&tls->net);
+    tls->net.fd = socketfd;
+
+    if(mbedtls_ssl_setup(&tls->ssl, &mangoTLS_conf) != 0){
+        goto handleError;
+    }
+
+    if(mbedtls_ssl_set_hostname(&tls->ssl, serverName) != 0){
+        goto handleError;
+    }
+
+    mbedtls_ssl_set_bio(&tls->ssl, &tls->net, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+    mangoTLS_cacheAcquire();
+    slot = mangoTLS_cacheSlot(tls->key);
+    if(slot->valid && strcmp(slot->key, tls->key) == 0){
+        mbedtls_ssl_set_session(&tls->ssl, &slot->session);
+        slot->lastUsed = mangoPort_timeNow();
+    }
+    mangoTLS_cacheRelease();
+
+    start = mangoPort_timeNow();
+    while(1){
+        retval = mbedtls_ssl_handshake(&tls->ssl);
+        if(retval == 0){
+            break;
+        }
+
+        if(retval == MBEDTLS_ERR_SSL_WANT_READ){
+            events = MANGO_POLL_READ;
+        }else if(retval == MBEDTLS_ERR_SSL_WANT_WRITE){
+            events = MANGO_POLL_WRITE;
+        }else{
+            MANGO_DBG(MANGO_DBG_LEVEL_PORT, ("TLS handshake failed: -0x%x\r\n", -retval) );
+            goto handleError;
+        }
+
+        elapsed = mangoHelper_elapsedTime(start);
+        if(elapsed >= timeout || mangoPort_poll(socketfd, events, timeout - elapsed) < 0){
+            goto handleError;
+        }
+    }
+
+    /*
+    * Store the negotiated session. The server resumed our session if it
+    * echoed back the session ID that we offered.
+    */
+    mbedtls_ssl_session_init(&session);
+    if(mbedtls_ssl_get_session(&tls->ssl, &session) == 0){
+        mangoTLS_cacheAcquire();
+        slot = mangoTLS_cacheSlot(tls->key);
+        if(slot->valid && strcmp(slot->key, tls->key) == 0){
+            tls->resumed = mangoTLS_sessionIdEqual(&slot->session, &session);
+        }
+        mangoTLS_cacheSlotClear(slot);
+        /* The slot takes over the session and the buffers it owns */
+        slot->session = session;
+        strcpy(slot->key, tls->key);
+        slot->valid = 1;
+        slot->lastUsed = mangoPort_timeNow();
+        mangoTLS_cacheRelease();
+    }else{
+        mbedtls_ssl_session_free(&session);
+    }
+#endif
+
+    MANGO_DBG(MANGO_DBG_LEVEL_PORT, ("TLS handshake with %s completed [%s]\r\n", tls->key, tls->resumed ? "resumed" : "full") );
+
+    return tls;
+
+handleError:
+    mangoTLS_disconnect(tls);
+    return NULL;
+}
+
+/**
+ * @brief   Same semantics as mangoPort_read(), over the TLS session.
+ */
+int mangoTLS_read(void* vtls, uint8_t* data, uint16_t datalen, uint32_t timeout){
+    mangoTLS_t* tls = (mangoTLS_t*) vtls;
+    uint32_t start;
+    uint32_t elapsed;
+    uint8_t events;
+    int retval;
+
+    start = mangoPort_timeNow();
+    while(1){
+#ifdef MANGO_TLS_ENV__OPENSSL
+        retval = SSL_read(tls->ssl, data, datalen);
+        if(retval > 0){
+            return retval;
+        }
+
+        switch(SSL_get_error(tls->ssl, retval)){
+            case SSL_ERROR_WANT_READ:
+                events = MANGO_POLL_READ;
+                break;
+            case SSL_ERROR_WANT_WRITE:
+                events = MANGO_POLL_WRITE;
+                break;
+            case SSL_ERROR_ZERO_RETURN:
+                /* close_notify, a TCP close without it is a (possibly truncating) error */
+                return MANGO_SOCKET_CLOSED;
+            default:
+                /* Connection closed or TLS error */
+                return -1;
+        }
+#endif
+
+#ifdef MANGO_TLS_ENV__MBEDTLS
+        retval = mbedtls_ssl_read(&tls->ssl, data, datalen);
+        if(retval > 0){
+            return retval;
+        }
+
+        if(retval == MBEDTLS_ERR_SSL_WANT_READ){
+            events = MANGO_POLL_READ;
+        }else if(retval == MBEDTLS_ERR_SSL_WANT_WRITE){
+            events = MANGO_POLL_WRITE;
+        }else if(retval == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY){
+            /* close_notify, a TCP close without it is a (possibly truncating) error */
+            return MANGO_SOCKET_CLOSED;
+        }else{
+            /* Connection closed or TLS error */
+            return -1;
+        }
+#endif
+
+        elapsed = mangoHelper_elapsedTime(start);
+        if(elapsed >= timeout){
+            return 0;
+        }
+
+        if(mangoPort_poll(tls->socketfd, events, timeout - elapsed) < 0){
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief   Same semantics as mangoPort_write(), over the TLS session.
+ */
+int mangoTLS_write(void* vtls, uint8_t* data, uint16_t datalen, uint32_t timeout){
+    mangoTLS_t* tls = (mangoTLS_t*) vtls;
+    uint32_t start;
+    uint32_t elapsed;
+    uint32_t sent;
+    uint8_t events;
+    int retval;
+
+    sent = 0;
+    start = mangoPort_timeNow();
+    while(sent < datalen){
+#ifdef MANGO_TLS_ENV__OPENSSL
+        /* A retried SSL_write() must use the same arguments */
+        retval = SSL_write(tls->ssl, &data[sent], datalen - sent);
+        if(retval > 0){
+            sent += retval;
+            continue;
+        }
+
+        switch(SSL_get_error(tls->ssl, retval)){
+            case SSL_ERROR_WANT_READ:
+                events = MANGO_POLL_READ;
+                break;
+            case SSL_ERROR_WANT_WRITE:
+                events = MANGO_POLL_WRITE;
+                break;
+            default:
+                return -1;
+        }
+#endif
+
+#ifdef MANGO_TLS_ENV__MBEDTLS
+        retval = mbedtls_ssl_write(&tls->ssl, &data[sent], datalen - sent);
+        if(retval > 0){
+            sent += retval;
+            continue;
+        }
+
+        if(retval == MBEDTLS_ERR_SSL_WANT_READ){
+            events = MANGO_POLL_READ;
+        }else if(retval == MBEDTLS_ERR_SSL_WANT_WRITE){
+            events = MANGO_POLL_WRITE;
+        }else{
+            return -1;
+        }
+#endif
+
+        elapsed = mangoHelper_elapsedTime(start);
+        if(elapsed >= timeout){
+            return sent;
+        }
+
+        if(mangoPort_poll(tls->socketfd, events, timeout - elapsed) < 0){
+            return -1;
+        }
+    }
+
+    return sent;
+}
+
+/**
+ * @brief   Sends a close notification (best effort) and releases the TLS context.
+ *          The socket itself is closed by the caller.
+ */
+void mangoTLS_disconnect(void* vtls){
+    mangoTLS_t* tls = (mangoTLS_t*) vtls;
+
+#ifdef MANGO_TLS_ENV__OPENSSL
+    if(tls->ssl){
+        SSL_set_app_data(tls->ssl, NULL);
+        SSL_shutdown(tls->ssl);
+        SSL_free(tls->ssl);
+    }
+#endif
+
+#ifdef MANGO_TLS_ENV__MBEDTLS
+    mbedtls_ssl_close_notify(&tls->ssl);
+    mbedtls_ssl_free(&tls->ssl);
+#endif
+
+    mangoPort_free(tls);
+}
+
+/**
+ * @brief   Returns 1 if the handshake resumed a cached session
+ */
+uint8_t mangoTLS_sessionResumed(void* vtls){
+    mangoTLS_t* tls = (mangoTLS_t*) vtls;
+
+    return tls->resumed;
+}
+
+/**
+ * @brief   Returns the number of decrypted bytes which can be read without
+ *          touching the socket
+ */
+uint32_t mangoTLS_pending(void* vtls){
+    mangoTLS_t* tls = (mangoTLS_t*) vtls;
+
+#ifdef MANGO_TLS_ENV__OPENSSL
+    return SSL_pending(tls->ssl);
+#endif
+
+#ifdef MANGO_TLS_ENV__MBEDTLS
+    return mbedtls_ssl_get_bytes_avail(&tls->ssl);
+#endif
+}
+
+/**
+ * @brief   Drops all the cached sessions, forcing full handshakes
+ */
+void mangoTLS_sessionCacheFlush(void){
+    uint32_t i;
+
+    mangoTLS_cacheAcquire();
+    for(i = 0; i < MANGO_TLS_SESSION_CACHE_SZ; i++){
+        mangoTLS_cacheSlotClear(&mangoTLS_cache[i]);
+    }
+    mangoTLS_cacheRelease();
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * mango HTTP client
+ *
+ * Copyright (C) 2015,  Nikos Poulokefalos
+ *
+ * This file is part of mango HTTP client.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * npoulokefalos@gmail.com
+*/
+
+#include "mango.h"
+
+/*
+ * State machine trace ring.
+ *
+ * Every client owns its ring and only the thread driving the client writes
+ * to it, so recording an event is a few stores without any locking. Readers
+ * on other threads [mango_traceGet()] are kept consistent by a sequence
+ * counter that is odd while an entry is being written.
+*/
+
+#if MANGO_TRACE_RING_SZ > 0
+
+typedef struct{
+	void		(*state)(mangoEvent_e event, mangoHttpClient_t* hc);
+	char*		name;
+}mangoTraceStateName_t;
+
+static const mangoTraceStateName_t mangoTrace_stateNames[] = {
+	{mangoSM__ABORTED,				"ABORTED"},
+	{mangoSM__DISCONNECTED,			"DISCONNECTED"},
+	{mangoSM__HTTP_CONNECTED,		"HTTP_CONNECTED"},
+	{mangoSM__HTTP_SENDING_HEADERS,	"HTTP_SENDING_HEADERS"},
+	{mangoSM__HTTP_RECVING_HEADERS,	"HTTP_RECVING_HEADERS"},
+	{mangoSM__HTTP_RECVING_DATA,	"HTTP_RECVING_DATA"},
+	{mangoSM__HTTP_SENDING_DATA,	"HTTP_SENDING_DATA"},
+	{mangoSM__HTTP_SENDING_PACKET,	"HTTP_SENDING_PACKET"},
+	{mangoSM__WS_CONNECTED,			"WS_CONNECTED"},
+	{mangoSM__WS_POLLING,			"WS_POLLING"},
+	{mangoSM__WS_SENDING_FRAME,		"WS_SENDING_FRAME"},
+	{mangoSM__WS_CLOSING,			"WS_CLOSING"},
+};
+
+static const char* mangoTrace_eventNames[] = {
+	"NONE",
+	"ENTRY",
+	"PROCESS",
+	"READ",
+	"WRITE",
+	"TIMEOUT",
+	"httpRequestProcess",
+	"httpDataSend",
+	"wsPoll",
+	"wsFrameSend",
+	"wsClose",
+};
+
+static const char* mangoTrace_stateName(void (*state)(mangoEvent_e event, mangoHttpClient_t* hc)){
+	uint8_t i;
+
+	for(i = 0; i < sizeof(mangoTrace_stateNames) / sizeof(mangoTrace_stateNames[0]); i++){
+		if(mangoTrace_stateNames[i].state == state){
+			return mangoTrace_stateNames[i].name;
+		}
+	}
+
+	return "?";
+}
+
+void mangoTrace_record(mangoEvent_e event, mangoHttpClient_t* hc){
+	mangoTraceEntry_t* entry;
+
+	__atomic_store_n(&hc->traceSeq, hc->traceSeq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	entry = &hc->trace[hc->traceIndex & (MANGO_TRACE_RING_SZ - 1)];
+
+	/* State entries immediately follow the event that caused them, they share its time */
+	if(event != EVENT_ENTRY || !hc->traceIndex){
+		hc->traceTimestamp = mangoPort_timeNowUs();
+	}
+
+	entry->timestamp	= hc->traceTimestamp;
+	entry->state		= hc->curState;
+	entry->bytes		= hc->traceBytes;
+	entry->err			= hc->smExitError;
+	entry->event		= event;
+
+	hc->traceIndex++;
+
+	__atomic_store_n(&hc->traceSeq, hc->traceSeq + 1, __ATOMIC_RELEASE);
+}
+
+#endif
+
+
+uint16_t mango_traceGet(mangoHttpClient_t* hc, mangoTraceEntry_t* entries, uint16_t maxEntries){
+#if MANGO_TRACE_RING_SZ > 0
+	uint32_t first;
+	uint32_t cnt;
+	uint32_t seq;
+	uint32_t i;
+
+	MANGO_ENSURE_RET(hc, 0, ("?") );
+
+	do{
+		seq = __atomic_load_n(&hc->traceSeq, __ATOMIC_ACQUIRE);
+		if(seq & 1){
+			/* An entry is being written */
+			continue;
+		}
+
+		cnt = hc->traceIndex > MANGO_TRACE_RING_SZ ? MANGO_TRACE_RING_SZ : hc->traceIndex;
+		if(cnt > maxEntries){
+			cnt = maxEntries;
+		}
+
+		first = hc->traceIndex - cnt;
+		for(i = 0; i < cnt; i++){
+			entries[i] = hc->trace[(first + i) & (MANGO_TRACE_RING_SZ - 1)];
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	}while((seq & 1) || __atomic_load_n(&hc->traceSeq, __ATOMIC_RELAXED) != seq);
+
+	return cnt;
+#else
+	(void) hc;
+	(void) entries;
+	(void) maxEntries;
+	return 0;
+#endif
+}
+
+void mango_traceDump(mangoHttpClient_t* hc){
+#if MANGO_TRACE_RING_SZ > 0
+	mangoTraceEntry_t entries[MANGO_TRACE_RING_SZ];
+	uint16_t cnt;
+	uint16_t i;
+
+	cnt = mango_traceGet(hc, entries, MANGO_TRACE_RING_SZ);
+
+	MANGO_PRINTF( ("[MANGO TRACE] %u events, last %u:\r\n", hc->traceIndex, cnt) );
+	for(i = 0; i < cnt; i++){
+		MANGO_PRINTF( ("[MANGO TRACE] %10u us  %-20s  %-18s  bytes %-6d  err %u\r\n",
+			entries[i].timestamp,
+			mangoTrace_stateName(entries[i].state),
+			entries[i].event < sizeof(mangoTrace_eventNames) / sizeof(mangoTrace_eventNames[0]) ? mangoTrace_eventNames[entries[i].event] : "?",
+			entries[i].bytes,
+			entries[i].err) );
+	}
+#else
+	(void) hc;
+#endif
+}
@@ -41,6 +41,35 @@ typedef enum{
 	MANGO_WS_FRAME_TYPE_PONG 			= 0x0A,
 }mangoWsFrameType_t;
 
+typedef struct{
+	uint8_t*			buf;
+	uint32_t			buflen;
+	mangoWsFrameType_t	type; /* MANGO_WS_FRAME_TYPE_TEXT or MANGO_WS_FRAME_TYPE_BINARY */
+}mangoWsFrame_t;
+
+/*
+ * A piece of an HTTP request body, see mango_httpDataSendv()
+*/
+typedef struct{
+	uint8_t*			buf;
+	uint64_t			buflen;
+}mangoIovec_t;
+
+/*
+ * A part of a multipart/form-data request body, see mango_httpMultipartSet().
+ * Its data are the "len" bytes of "buf" or, when "buf" is NULL, they are read
+ * from "fd" starting at its current offset: "len" bytes, or up to the end of
+ * the file when "len" is 0.
+*/
+typedef struct{
+	char*				name;			/* Form field name */
+	char*				filename;		/* NULL for plain fields */
+	char*				contentType;	/* NULL to omit the Content-Type of the part */
+	uint8_t*			buf;
+	int					fd;
+	uint64_t			len;
+}mangoMultipartPart_t;
+
 
 typedef enum{
     MANGO_OK = 0,
@@ -64,6 +93,12 @@ typedef enum{
     MANGO_ERR_APPABORTED,               /* Application aborted the connection [for esxample by returning MANGO_ERR from the app callback] */
     MANGO_ERR_MOREDATANEEDED,           /* Data processor needs more data to continue */
     MANGO_ERR_WEBSOCKETCLOSED,          /* For websockets, it indicates that the remote peer sent a close packet and the connection is considered closed */
+    MANGO_ERR_INTERNAL,                 /* An internal consistency check failed [MANGO_ENSURE_RECOVERABLE], the connection was aborted */
+    MANGO_ERR_BUSY,                     /* The client is being used by another thread */
+    MANGO_ERR_QUEUEFULL,                /* The outbound websocket queue is full [MANGO_WS_TX_QUEUE_SZ] */
+    MANGO_ERR_WSHANDSHAKE,              /* The server accepted the websocket upgrade with invalid handshake headers (Accept, Upgrade, Protocol, Extensions) */
+    MANGO_ERR_WSIDLETIMEOUT,            /* Nothing was received from the websocket peer for too long, the connection is considered dead [mango_wsKeepaliveSet()] */
+    MANGO_ERR_WSPINNED,                 /* The working buffer is full of pinned websocket views, release them and poll again [mango_wsViewPin()] */
 	
 	/* 
     * HTTP status codes 
@@ -124,10 +159,12 @@ typedef enum{
     MANGO_ARG_TYPE_HTTP_REQUEST_READY,
     MANGO_ARG_TYPE_HTTP_RESP_RECEIVED,
     MANGO_ARG_TYPE_HTTP_DATA_RECEIVED,
+    MANGO_ARG_TYPE_HTTP_STATS,
     
 	MANGO_ARG_TYPE_WEBSOCKET_DATA_RECEIVED,
     MANGO_ARG_TYPE_WEBSOCKET_CLOSE,
     MANGO_ARG_TYPE_WEBSOCKET_PING,
+    MANGO_ARG_TYPE_WEBSOCKET_PONG,
 }mangoArgType_e;
 
 
@@ -137,15 +174,45 @@ typedef enum{
 	MANGO_HTTP_METHOD_POST,
 	MANGO_HTTP_METHOD_POST_CHUNKED,
 	MANGO_HTTP_METHOD_PUT,
+	MANGO_HTTP_METHOD_DELETE,
+	MANGO_HTTP_METHOD_PATCH,
+	MANGO_HTTP_METHOD_OPTIONS,
+	MANGO_HTTP_METHOD_CUSTOM, /* See mango_httpRequestNewCustom() */
 }mangoHttpMethod_e;
 
 
+/*
+ * Per-request statistics. Timestamps are mangoPort_timeNowUs() values [microseconds]
+ * captured when the request reached the corresponding phase, 0 if it never did.
+ * They wrap every ~71 minutes, so only their (unsigned) differences are meaningful.
+ * The connect timestamps belong to the connection and are kept across requests.
+*/
+typedef struct{
+    uint64_t txBytes;
+    uint64_t rxBytes;
+    uint32_t time;          /* Total duration of the request [miliseconds] */
+    
+    uint32_t connectStart;  /* Connection establishment started */
+    uint32_t connectEnd;    /* Connection (and TLS handshake) established */
+    uint32_t requestStart;  /* mango_httpRequestProcess() called */
+    uint32_t headersSent;   /* Request headers written to the socket */
+    uint32_t firstByte;     /* First byte of the response received */
+    uint32_t headersParsed; /* Response headers received and parsed */
+    uint32_t bodyComplete;  /* Response body received */
+    
+    uint32_t wsRtt;         /* Round trip of the last answered websocket keepalive ping [microseconds], 0 if none */
+}mangoStats_t;
+
 typedef struct{
     mangoArgType_e argType;
     uint8_t* buf;
     uint16_t buflen;
 	uint16_t statusCode; /* App may need this to abort an invalid response with big body for example */
     uint8_t frameID; /* For websockets only. Fragmented frames are given to the app with the same ID, so it can merge them back */
+    uint8_t opcode; /* Websocket frame opcode [mangoWsFrameType_t], fragments of a data frame carry the opcode of the first one */
+    uint8_t fin; /* Websocket only, set on the last piece of the last fragment of a message */
+    uint16_t closeCode; /* MANGO_ARG_TYPE_WEBSOCKET_CLOSE only, 0 if the server sent none. buf/buflen is the reason */
+    mangoStats_t* stats; /* For MANGO_ARG_TYPE_HTTP_STATS only */
 }mangoArg_t;
 
 typedef enum{
@@ -162,21 +229,22 @@ typedef enum{
 	EVENT_APICALL_wsClose,
 }mangoEvent_e;
 
-typedef struct{
-    uint32_t txBytes;
-    uint32_t rxBytes;
-    uint32_t time;
-}mangoStats_t;
-
 typedef struct{
 	uint8_t* buf;
-	uint16_t buflen;
+	uint32_t buflen;
 	mangoWsFrameType_t type;
+	
+	/* mango_wsFrameSendBatch() / mango_wsFlush() */
+	uint8_t batch;
+	mangoWsFrame_t* frames;
+	uint16_t framesCnt;
 }mangoWSFrameSendArgs_t;
 
 typedef struct{
-	uint8_t* buf;
-	uint16_t buflen;
+	mangoIovec_t* iov;
+	uint16_t iovcnt;
+	uint8_t nonBlocking;	/* mango_httpDataSendNB(): write only what the socket takes now */
+	uint64_t sent;			/* Body bytes written */
 }mangoHTTPDataSendArgs_t;
 
 
@@ -184,15 +252,27 @@ typedef struct{
 	uint32_t timeout;
 }mangoWSPollArgs_t;
 
+/*
+ * A slot of the outbound websocket queue. "seq" tells producers and the
+ * consumer who owns the slot (bounded MPMC queue, D. Vyukov).
+*/
+typedef struct{
+	uint32_t				seq;
+	uint8_t*				buf;	/* Copy of the payload */
+	uint32_t				buflen;
+	mangoWsFrameType_t		type;
+}mangoWSQueueSlot_t;
+
 typedef struct{
-    uint32_t fileSz;
-    uint32_t fileSzProcessed;
+    uint64_t fileSz;
+    uint64_t fileSzProcessed;
 }mangoIDPArgsRaw_t;
 
 typedef struct{
 	uint8_t state;
 	uint32_t chunkSz;
 	uint32_t chunkSzProcessed;
+	uint8_t digits; /* Chunk size digits parsed so far */
 }mangoIDPArgsChunked_t;
 
 typedef struct{
@@ -201,26 +281,146 @@ typedef struct{
 	uint32_t frameSz;
 	uint32_t frameSzProcessed;
 	uint8_t frameID;
+	uint8_t opcode; /* Opcode of the data frame being received, continuation frames inherit it */
 }mangoIDPArgsWebsocket_t;
 
+typedef struct mangoHttpClient_t mangoHttpClient_t;
+
 typedef struct{
-    uint32_t fileSz;
-    uint32_t fileSzProcessed;
+    uint64_t fileSz;
+    uint64_t fileSzProcessed;
 }mangoODPArgsRaw_t;
 
 
 typedef struct{
 	uint8_t* workingBuffer;
 	uint16_t workingBufferSz;
+	
+	/* Chunk left unfinished by a non-blocking write, continued by the next body piece */
+	char chunkHead[19];		/* Hex size + CRLF */
+	uint8_t chunkHeadLen;	/* 0 if no chunk is pending */
+	uint8_t chunkHeadSent;
+	uint8_t chunkTailSent;	/* Of the CRLF after the data */
+	uint64_t chunkLeft;		/* Data bytes not sent yet */
 }mangoODPArgsChunked_t;
 
-typedef struct mangoHttpClient_t mangoHttpClient_t;
+typedef struct{
+	mangoMultipartPart_t* parts; /* NULL if the request is not a multipart one */
+	uint16_t partsCnt;
+	char boundary[40];
+	
+	/* ODP of the framing (raw or chunked) the parts are sent through */
+	mangoErr_t (*odp)(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, void* vargs, uint64_t* processed, uint8_t* completed);
+	void* odpArgs;
+}mangoODPArgsMultipart_t;
+
+/*
+ * User provided transport. When set it replaces the socket (and TLS) IO, the
+ * functions have the same semantics as mangoPort_read() / mangoPort_write().
+ * In particular read() returns MANGO_SOCKET_CLOSED when the peer closed the
+ * connection, any other negative value is an error.
+*/
+typedef struct{
+	int						(*read)(void* transportArgs, uint8_t* data, uint16_t datalen, uint32_t timeout);
+	int						(*write)(void* transportArgs, uint8_t* data, uint16_t datalen, uint32_t timeout);
+	void					(*disconnect)(void* transportArgs);
+}mangoTransport_t;
+
+/*
+ * A step of a loopback script: a canned server byte stream which is
+ * replayed after the client has written to the transport.
+*/
+typedef struct{
+	uint8_t*				data;
+	uint32_t				datalen;
+}mangoLoopbackStep_t;
+
+typedef struct{
+	/* Script */
+	mangoLoopbackStep_t*	steps;
+	uint16_t				stepsCnt;
+	uint16_t				fragmentSz;	/* Maximum bytes returned by a single read, 0 for no limit */
+	uint32_t				delay;		/* Delay [miliseconds] before every fragment is delivered */
+	uint8_t					closeOnEnd;	/* Report a closed connection when the script has been replayed */
+	
+	/* Replay state */
+	uint16_t				step;
+	uint32_t				stepIndex;
+	uint8_t					stepReleased;
+	uint32_t				fragmentTimestamp;
+	
+	/* Counters */
+	uint32_t				rxBytes;	/* Bytes delivered to the client */
+	uint32_t				txBytes;	/* Bytes written by the client */
+}mangoLoopback_t;
+
+/*
+ * A segmented download [mango_download()]
+*/
+#define MANGO_DOWNLOAD_NO_RETRY		(0xFF)	/* "retries" value for a single attempt, as 0 selects the default */
+
+typedef struct{
+	/* Source */
+	char*					serverIP;
+	uint16_t				serverPort;
+	uint8_t					tls;		/* Connect with mango_tlsConnect() */
+	char*					serverName;	/* TLS server name and Host header, NULL to use serverIP */
+	char*					URI;
+	
+	/* Destination file, created or overwritten */
+	char*					path;
+	
+	/* 0 selects the defaults [MANGO_DOWNLOAD_xxx] */
+	uint16_t				connections;
+	uint32_t				segmentSz;
+	uint8_t					retries;	/* Extra attempts per segment, MANGO_DOWNLOAD_NO_RETRY for none */
+	uint8_t					resume;		/* Checkpoint to "<path>.mango" and continue from it */
+	
+	/* Set by mango_download() */
+	uint64_t				fileSz;		/* Found with a HEAD request unless given */
+	uint64_t				bytes;		/* Body bytes received and written */
+	uint64_t				bytesResumed;	/* Bytes already in the file from a previous call */
+	uint32_t				segmentsRetried;
+}mangoDownload_t;
+
+/*
+ * Response cache [mango_cacheCreate()], shared by any number of clients
+*/
+typedef struct mangoCache_t mangoCache_t;
+
+typedef struct{
+	uint32_t				hits;			/* Served from the cache without contacting the server */
+	uint32_t				revalidated;	/* Served from the cache after a 304 */
+	uint32_t				misses;			/* Fetched from the server */
+	uint32_t				stored;
+	uint32_t				evicted;
+	uint32_t				entries;		/* Currently cached */
+	uint32_t				bytes;
+}mangoCacheStats_t;
+
+/*
+ * An entry of the state machine trace ring, see MANGO_TRACE_RING_SZ
+*/
+typedef struct{
+	uint32_t				timestamp;	/* mangoPort_timeNowUs() when the event was handled [microseconds] */
+	void					(*state)(mangoEvent_e event, mangoHttpClient_t* hc); /* State that handled the event */
+	int32_t					bytes;		/* Result of the last socket read/write */
+	uint16_t				err;		/* State machine exit error after the event was handled */
+	uint8_t					event;
+}mangoTraceEntry_t;
 
 struct mangoHttpClient_t{
     int                     socketfd;
+    void*                   tls; /* TLS session on top of socketfd, NULL for plaintext connections */
+    char                    serverIP[16]; /* Endpoint of socket connections, used to reconnect */
+    uint16_t                serverPort;
+    mangoTransport_t*       transport; /* User provided transport, NULL for socket connections */
+    void*                   transportArgs;
     mangoHttpMethod_e       httpMethod;
 
 	uint16_t				httpResponseStatusCode;
+	uint8_t					httpConnClose; /* The server closes the connection after the last response, it cannot be reused */
+	uint8_t					httpExpectPending; /* "Expect: 100-continue" sent, the request body waits for the server's answer */
     
     uint8_t                 workingBuffer[MANGO_WORKING_BUFFER_SZ];
     uint16_t                workingBufferIndexLeft;
@@ -231,6 +431,8 @@ struct mangoHttpClient_t{
 	uint32_t				smEventTimeout;
 
 	void*					smAPICallArgs;
+	uint8_t					smFaulted; /* A MANGO_ENSURE_SM() check failed while the current state was executing */
+	uint8_t					smLock; /* Set while a thread is running the state machine */
 
 	uint32_t				smEntryTimestamp;
     mangoEvent_e            subscribedEvent;
@@ -244,20 +446,77 @@ struct mangoHttpClient_t{
     /* Data processors */
     void*                   dataProcessorArgs;
 	uint8_t					dataProcessorCompleted; /* We need this to keep track of the SM between different events */
+	uint8_t					odpNonBlocking; /* The ODP writes only what the socket takes now [mango_httpDataSendNB()] */
     mangoErr_t              (*inputDataProcessor) (mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, void* vargs, uint32_t* processed, uint8_t* completed); // inputDataProcessor
-    mangoErr_t              (*outputDataProcessor)(mangoHttpClient_t* hc, uint8_t* buf, uint16_t buflen, void* vargs, uint32_t* processed, uint8_t* completed);
+    mangoErr_t              (*outputDataProcessor)(mangoHttpClient_t* hc, mangoIovec_t* iov, uint16_t iovcnt, void* vargs, uint64_t* processed, uint8_t* completed);
 
     /* Input Data processor arguments */
     mangoIDPArgsRaw_t       IDPArgsRaw;
     mangoIDPArgsChunked_t   IDPArgsChunked;
 	mangoIDPArgsWebsocket_t IDPArgsWebsocket;
+	
+	/* Websocket keepalive [mango_wsKeepaliveSet()] */
+	uint32_t				wsPingInterval;
+	uint32_t				wsIdleTimeout;
+	uint32_t				wsLastRx;		/* Last time data were received */
+	uint32_t				wsPingLast;		/* Last time a ping was sent */
+	uint32_t				wsPingLastUs;
+	uint32_t				wsPingSeq;		/* Payload of the last ping */
+	uint32_t				wsPollStart;
+	
+	/* Websocket frame coalescing [mango_wsCoalesceSet()] */
+	uint8_t*				wsCoalesceBuf;
+	uint32_t				wsCoalesceSz;
+	uint32_t				wsCoalesceLen;
+	uint32_t				wsCoalesceDelay;
+	uint32_t				wsCoalesceStart;	/* When the first buffered frame was added */
+	
+	/* Websocket masking key generator (xoshiro128++), seeded on connect */
+	uint32_t				wsMaskState[4];
+	
+	/* Websocket handshake */
+	char					wsAccept[29];	/* Expected Sec-WebSocket-Accept, empty if no key was sent */
+	char*					wsProtocols;	/* Subprotocols offered by mango_wsConnect(), NULL for manual upgrades */
+	char					wsProtocol[MANGO_WS_PROTOCOL_SZ]; /* Subprotocol selected by the server */
+	
+	/* Redirect following [mango_httpRedirectSet()] */
+	uint8_t					redirectMax;	/* Redirects followed per request, 0 to return them to the application */
+	uint8_t					redirectHops;	/* Redirects followed by the last request */
+	uint8_t					redirectFollow;	/* The response being received is a redirect about to be followed */
+	char*					redirectRequest;	/* Headers of the request, sent again to the new location */
+	mangoErr_t				(*redirectUserFunc)(mangoArg_t* mangoArgs, void* userArgs);
+	char					redirectLocation[MANGO_REDIRECT_LOCATION_SZ];	/* Last location followed */
+	
+	/* Received frame views kept by the application [mango_wsViewPin()] */
+	uint16_t				wsPinEnd;		/* The working buffer is not reused below this index while pinned */
+	uint16_t				wsPinCnt;		/* Views not released yet */
     
 	/* Output Data processor arguments */
 	mangoODPArgsRaw_t       ODPArgsRaw;
     mangoODPArgsChunked_t   ODPArgsChunked;
+	mangoODPArgsMultipart_t	ODPArgsMultipart;
+	
+#if MANGO_WS_TX_QUEUE_SZ > 0
+	/* Outbound websocket queue, filled by any thread and drained by the lock owner */
+	mangoWSQueueSlot_t		wsTxQueue[MANGO_WS_TX_QUEUE_SZ];
+	uint32_t				wsTxQueueHead;
+	uint32_t				wsTxQueueTail;
+	int						wsWakeupfd;		/* Wakes up a thread blocked in mango_wsPoll(), created on the first poll */
+	mangoErr_t				wsTxError;		/* First failure of a queued frame sent outside mango_wsPoll(), see mangoWS_queueError() */
+#endif
 	
 	/* Stats */
 	mangoStats_t			stats;
+	uint8_t					statsPending; /* A request is in progress and its stats have not been reported yet */
+
+#if MANGO_TRACE_RING_SZ > 0
+	/* Trace */
+	mangoTraceEntry_t		trace[MANGO_TRACE_RING_SZ];
+	uint32_t				traceIndex; /* Number of events recorded so far */
+	uint32_t				traceSeq;	/* Odd while an entry is written, lets other threads copy the ring consistently */
+	uint32_t				traceTimestamp; /* Time of the last recorded event */
+	int32_t					traceBytes; /* Result of the last socket read/write */
+#endif
 };
 
 
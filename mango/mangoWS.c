@@ -23,79 +23,263 @@
 
 #include "mango.h"
 
-mangoErr_t mangoWS_close(int socketfd){
-	return mangoWS_frameSend(socketfd, NULL, 0, MANGO_WS_FRAME_TYPE_CLOSE);
+mangoErr_t mangoWS_close(mangoHttpClient_t* hc){
+	return mangoWS_frameSend(hc, NULL, 0, MANGO_WS_FRAME_TYPE_CLOSE);
 }
 
-mangoErr_t mangoWS_pong(int socketfd){
-	return mangoWS_frameSend(socketfd, NULL, 0, MANGO_WS_FRAME_TYPE_PONG);
+/*
+* The pong carries the payload of the ping it answers [RFC 6455, 5.5.3]
+*/
+mangoErr_t mangoWS_pong(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen){
+	return mangoWS_frameSend(hc, buf, buflen, MANGO_WS_FRAME_TYPE_PONG);
 }
 
-mangoErr_t mangoWS_frameSend(int socketfd, uint8_t* buf, uint32_t buflen, mangoWsFrameType_t type){
-	uint8_t frame0[8];
-	uint8_t buf0[2];
-    uint8_t maskingkey[4];
-    uint32_t i, k;
-    int retval;
-	uint8_t* frame;
-	uint32_t framelen;
+/*
+* Client keepalive, driven by mango_wsPoll(). Our pings carry a 4 byte
+* sequence number, so a pong answering an older ping (or an unsolicited
+* one) does not produce a bogus round trip.
+*/
+void mangoWS_keepaliveStart(mangoHttpClient_t* hc){
+	hc->wsLastRx = mangoPort_timeNow();
+	hc->wsPingLast = hc->wsLastRx;
+	hc->stats.wsRtt = 0;
+}
+
+void mangoWS_pongReceived(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen){
+	uint32_t seq;
+	
+	if(buflen != 4){
+		return;
+	}
 	
+	seq = ((uint32_t) buf[0] << 24) | ((uint32_t) buf[1] << 16) | ((uint32_t) buf[2] << 8) | buf[3];
+	if(seq == hc->wsPingSeq){
+		hc->stats.wsRtt = mangoPort_timeNowUs() - hc->wsPingLastUs;
+	}
+}
 
-	/* 
-	* Randomize masking key 
-	*/
-	maskingkey[0] = mangoPort_timeNow();
-	maskingkey[1] = mangoPort_timeNow() >> 8;
-	maskingkey[2] = maskingkey[0] & maskingkey[1];
-	maskingkey[3] = maskingkey[1] ^ maskingkey[2];	
+/*
+* Sends a ping if one is due and checks for idle timeout. "next" is set
+* to the time until the next keepalive event [miliseconds].
+*/
+mangoErr_t mangoWS_keepalive(mangoHttpClient_t* hc, uint32_t* next){
+	uint8_t payload[4];
+	uint32_t elapsed;
 	
-						 
-    switch(type){
-        case MANGO_WS_FRAME_TYPE_CONT:
-            /* Fragmentation on the Tx path currently not supported */
-            MANGO_ENSURE(0, ("?") );
-            break;
-        case MANGO_WS_FRAME_TYPE_PING:
-            /* Clients are not allowed to ping the server  */
-            MANGO_ENSURE(0, ("?") );
-            break;
-        case MANGO_WS_FRAME_TYPE_PONG:
-			MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: PONG!\r\n"));
-			buflen = 0;
-            break;
-        case MANGO_WS_FRAME_TYPE_CLOSE:
-			MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: CLOSE!\r\n"));
-			buf = buf0;
-			
-			/* Status code 1000, normal closure */
-			buf0[0] = (0x03e8 & 0xff00) >> 8;
-			buf0[1] = (0x03e8 & 0x00ff);
-			
-            buflen = 2;
-            break;
-        case MANGO_WS_FRAME_TYPE_TEXT:
-            MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: TEXT!\r\n"));
-            break;
-        case MANGO_WS_FRAME_TYPE_BINARY:
-            MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: BINARY!\r\n"));
-            break;
-        default:
-            MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: ???\r\n"));
-            break;
-    }
-    
-	/*
-    * Allocate memory for the frame
-    */
-	if((type == MANGO_WS_FRAME_TYPE_PONG) || (type == MANGO_WS_FRAME_TYPE_CLOSE)){
-		frame = frame0;
-	}else{
-		frame = mangoPort_malloc(buflen + 14 /* max frame header size */);
-		if(!frame){
-			return 0;
+	*next = MANGO_TIMEOUT_INFINITE;
+	
+	if(hc->wsIdleTimeout){
+		elapsed = mangoHelper_elapsedTime(hc->wsLastRx);
+		if(elapsed >= hc->wsIdleTimeout){
+			MANGO_DBG(MANGO_DBG_LEVEL_WS, ("Nothing received for %u ms, peer is dead\r\n", elapsed) );
+			return MANGO_ERR_WSIDLETIMEOUT;
 		}
+		*next = hc->wsIdleTimeout - elapsed;
 	}
+	
+	if(hc->wsPingInterval){
+		elapsed = mangoHelper_elapsedTime(hc->wsPingLast);
+		if(elapsed >= hc->wsPingInterval){
+			hc->wsPingSeq++;
+			payload[0] = hc->wsPingSeq >> 24;
+			payload[1] = hc->wsPingSeq >> 16;
+			payload[2] = hc->wsPingSeq >> 8;
+			payload[3] = hc->wsPingSeq;
 			
+			hc->wsPingLast = mangoPort_timeNow();
+			hc->wsPingLastUs = mangoPort_timeNowUs();
+			if(mangoWS_frameSend(hc, payload, sizeof(payload), MANGO_WS_FRAME_TYPE_PING) != MANGO_OK){
+				return MANGO_ERR_CONNECTION;
+			}
+			elapsed = 0;
+		}
+		if(hc->wsPingInterval - elapsed < *next){
+			*next = hc->wsPingInterval - elapsed;
+		}
+	}
+	
+	return MANGO_OK;
+}
+
+/*
+* Masking keys must not be predictable by the server or intermediaries
+* [RFC 6455, 5.3]. Every client runs its own xoshiro128++ generator,
+* seeded once from mangoPort_random(), so sending a frame costs no
+* syscall and no locking.
+*/
+static uint32_t mangoWS_rotl(uint32_t x, uint8_t k){
+	return (x << k) | (x >> (32 - k));
+}
+
+void mangoWS_maskSeed(mangoHttpClient_t* hc){
+	uint32_t seed;
+	uint8_t i;
+	
+	if(mangoPort_random((uint8_t*) hc->wsMaskState, sizeof(hc->wsMaskState)) < 0){
+		/* No entropy source, better than nothing */
+		seed = mangoPort_timeNowUs() ^ (uint32_t) (uintptr_t) hc;
+		for(i = 0; i < 4; i++){
+			seed += 0x9E3779B9;
+			hc->wsMaskState[i] = seed ^ (seed >> 16);
+		}
+	}
+	
+	/* The all zero state is a fixed point */
+	if(!(hc->wsMaskState[0] | hc->wsMaskState[1] | hc->wsMaskState[2] | hc->wsMaskState[3])){
+		hc->wsMaskState[0] = 1;
+	}
+}
+
+uint32_t mangoWS_maskNext(mangoHttpClient_t* hc){
+	uint32_t* s = hc->wsMaskState;
+	uint32_t result;
+	uint32_t t;
+	
+	result = mangoWS_rotl(s[0] + s[3], 7) + s[0];
+	t = s[1] << 9;
+	
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = mangoWS_rotl(s[3], 11);
+	
+	return result;
+}
+
+/*
+* Time driven websocket work while polling: keepalive and coalesced
+* frames. "next" is set to the time until the next event [miliseconds].
+*/
+mangoErr_t mangoWS_timers(mangoHttpClient_t* hc, uint32_t* next){
+	uint32_t nextFlush;
+	mangoErr_t err;
+	
+	err = mangoWS_keepalive(hc, next);
+	if(err != MANGO_OK){
+		return err;
+	}
+	
+	if(mangoWS_coalesceTimer(hc, &nextFlush) != MANGO_OK){
+		return MANGO_ERR_CONNECTION;
+	}
+	
+	if(nextFlush < *next){
+		*next = nextFlush;
+	}
+	
+	return MANGO_OK;
+}
+
+/*
+* Sec-WebSocket-Accept = base64(SHA-1(key + GUID)) [RFC 6455, 4.2.2]
+*/
+mangoErr_t mangoWS_acceptCompute(char* key, char accept[29]){
+	char tmpBuf[64 + 36 + 1];
+	uint8_t digest[20];
+	uint16_t keylen;
+	
+	keylen = strlen(key);
+	if(keylen > 64){
+		return MANGO_ERR_TEMPBUFSMALL;
+	}
+	
+	memcpy(tmpBuf, key, keylen);
+	memcpy(&tmpBuf[keylen], "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36);
+	
+	mangoCrypto_sha1(tmpBuf, keylen + 36, digest);
+	
+	if(mangoCrypto_base64Encode(digest, sizeof(digest), accept, 29) != 28){
+		return MANGO_ERR_TEMPBUFSMALL;
+	}
+	
+	return MANGO_OK;
+}
+
+/*
+* Checks the 101 response against the upgrade request. Called while the
+* response headers are still at the start of the working buffer.
+*/
+mangoErr_t mangoWS_handshakeVerify(mangoHttpClient_t* hc){
+	char headerValueBuf[64];
+	char* response;
+	char* offered;
+	uint16_t len;
+	int retval;
+	
+	response = (char*) MANGO_WB_PTR(hc);
+	hc->wsProtocol[0] = '\0';
+	
+	retval = mangoHelper_httpHeaderGet(response, MANGO_HDR__UPGRADE, headerValueBuf, sizeof(headerValueBuf));
+	if(retval <= 0 || strcasecmp(headerValueBuf, "websocket") != 0){
+		MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Upgrade header missing or invalid\r\n") );
+		return MANGO_ERR_WSHANDSHAKE;
+	}
+	
+	if(hc->wsAccept[0]){
+		retval = mangoHelper_httpHeaderGet(response, MANGO_HDR__WEB_SOCKET_ACCEPT, headerValueBuf, sizeof(headerValueBuf));
+		if(retval <= 0 || strcmp(headerValueBuf, hc->wsAccept) != 0){
+			MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Sec-WebSocket-Accept missing or invalid\r\n") );
+			return MANGO_ERR_WSHANDSHAKE;
+		}
+	}
+	
+	retval = mangoHelper_httpHeaderGet(response, MANGO_HDR__WEB_SOCKET_PROTOCOL, hc->wsProtocol, sizeof(hc->wsProtocol));
+	if(retval == 0){
+		hc->wsProtocol[0] = '\0';
+		return MANGO_ERR_WSHANDSHAKE;
+	}else if(retval < 0){
+		hc->wsProtocol[0] = '\0';
+	}
+	
+	if(!hc->wsProtocols){
+		/* Manual upgrade, the offered subprotocols and extensions are not known */
+		return MANGO_OK;
+	}
+	
+	/* We never offer extensions */
+	if(mangoHelper_httpHeaderGet(response, MANGO_HDR__WEB_SOCKET_EXTENSIONS, headerValueBuf, sizeof(headerValueBuf)) >= 0){
+		MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Unexpected Sec-WebSocket-Extensions\r\n") );
+		return MANGO_ERR_WSHANDSHAKE;
+	}
+	
+	/* The selected subprotocol (if any) must be one of the offered ones */
+	if(hc->wsProtocol[0]){
+		len = strlen(hc->wsProtocol);
+		offered = hc->wsProtocols;
+		while(*offered){
+			while(*offered == ' ' || *offered == ','){offered++;}
+			if(strncmp(offered, hc->wsProtocol, len) == 0 && (offered[len] == '\0' || offered[len] == ',' || offered[len] == ' ')){
+				return MANGO_OK;
+			}
+			while(*offered && *offered != ','){offered++;}
+		}
+		
+		MANGO_DBG(MANGO_DBG_LEVEL_SM, ("Subprotocol '%s' was not offered\r\n", hc->wsProtocol) );
+		return MANGO_ERR_WSHANDSHAKE;
+	}
+	
+	return MANGO_OK;
+}
+
+/*
+* Builds a masked frame into "frame", which must have room for
+* buflen + MANGO_WS_FRAME_HDR_MAX bytes. Returns the frame length.
+*/
+static uint32_t mangoWS_frameBuild(mangoHttpClient_t* hc, uint8_t* frame, uint8_t* buf, uint32_t buflen, mangoWsFrameType_t type){
+    uint8_t maskingkey[4];
+    uint32_t mask32;
+    uint64_t mask64;
+    uint64_t word;
+    uint32_t framelen;
+    uint32_t i, k;
+	
+	/* 
+	* Randomize masking key 
+	*/
+	mask32 = mangoWS_maskNext(hc);
+	memcpy(maskingkey, &mask32, 4);
 	
     /*
     * Build frame's header
@@ -108,11 +292,6 @@ mangoErr_t mangoWS_frameSend(int socketfd, uint8_t* buf, uint32_t buflen, mangoW
         frame[i++] = 0x80 | type;
         /* Payload len */
         frame[i++] = 0x80 | buflen;
-        /* Masking */
-        frame[i++] = maskingkey[0];
-        frame[i++] = maskingkey[1];
-        frame[i++] = maskingkey[2];
-        frame[i++] = maskingkey[3];
     }else if(buflen <= 0xffff) { 
         /* 126 -> 65,535 */
 		/* Opcode */
@@ -122,11 +301,6 @@ mangoErr_t mangoWS_frameSend(int socketfd, uint8_t* buf, uint32_t buflen, mangoW
         frame[i++] = 0x80 |126;
         frame[i++] = (buflen >> 8) & 0xff;
         frame[i++] = (buflen) & 0xff;
-        /* Masking */
-        frame[i++] = maskingkey[0];
-        frame[i++] = maskingkey[1];
-        frame[i++] = maskingkey[2];
-        frame[i++] = maskingkey[3];
     }else{ 
 		/* 65,536 -> 4,294,967,295 */
         /* Opcode */
@@ -142,64 +316,463 @@ mangoErr_t mangoWS_frameSend(int socketfd, uint8_t* buf, uint32_t buflen, mangoW
         frame[i++] = (buflen >> 16) & 0xff;
         frame[i++] = (buflen >> 8) & 0xff;
         frame[i++] = (buflen) & 0xff;
-        /* Masking */
-        frame[i++] = maskingkey[0];
-        frame[i++] = maskingkey[1];
-        frame[i++] = maskingkey[2];
-        frame[i++] = maskingkey[3];
     }
+    
+    /* Masking */
+    frame[i++] = maskingkey[0];
+    frame[i++] = maskingkey[1];
+    frame[i++] = maskingkey[2];
+    frame[i++] = maskingkey[3];
 
 	/*
-    * Mask frame's payload
+    * Mask frame's payload, 8 bytes at a time. The key is kept in memory
+    * order so the same XOR works regardless of the CPU's endianness.
+    * memcpy() is used for the (unaligned) loads/stores and is compiled
+    * to plain moves.
     */
+    mask64 = ((uint64_t) mask32 << 32) | mask32;
 	k = 0;
     while(buflen >= 8){
-        frame[i++] = buf[k++] ^ maskingkey[0]; 
-        frame[i++] = buf[k++] ^ maskingkey[1]; 
-        frame[i++] = buf[k++] ^ maskingkey[2]; 
-        frame[i++] = buf[k++] ^ maskingkey[3]; 
-        frame[i++] = buf[k++] ^ maskingkey[0]; 
-        frame[i++] = buf[k++] ^ maskingkey[1]; 
-        frame[i++] = buf[k++] ^ maskingkey[2];
-        frame[i++] = buf[k++] ^ maskingkey[3];
+        memcpy(&word, &buf[k], 8);
+        word ^= mask64;
+        memcpy(&frame[i], &word, 8);
+        i += 8;
+        k += 8;
         buflen -= 8;
     }
 	
     while(buflen > 0){
-        frame[i++] = buf[k] ^ maskingkey[k % 4]; k++;
+        frame[i++] = buf[k] ^ maskingkey[k & 3]; k++;
         buflen--;
     }
+    
+    return framelen;
+}
+
+/*
+* Writes the whole buffer. It's a do or die here so we give a big enough 
+* timeout. If we don't manage to send everything (but only part of it)
+* we have to abort the websocket connection.
+*/
+static mangoErr_t mangoWS_write(mangoHttpClient_t* hc, uint8_t* data, uint32_t datalen){
+	uint16_t sz;
+	int retval;
+	
+	MANGO_DBG(MANGO_DBG_LEVEL_WS, ("Sending %u websocket bytes..\r\n", datalen));
+	
+	while(datalen){
+		/* mangoSocket_write() takes a 16-bit length, the payload is written in 32K pieces */
+		sz = datalen > 0x8000 ? 0x8000 : datalen;
+		
+		retval = mangoSocket_write(hc, data, sz, MANGO_SOCKET_WRITE_TIMEOUT_MS);
+		
+		MANGO_DBG(MANGO_DBG_LEVEL_WS, ("%d/%d bytes sent..\r\n", retval, sz));
+		
+		if(retval != sz){
+			/* 
+			* Connection closed, or only part of the data was transmitted.
+			* Given the big timeout this is not normal, and the connection
+			* is considered closed. 
+			*/
+			return MANGO_ERR;
+		}
+		
+		data += sz;
+		datalen -= sz;
+	}
+	
+	return MANGO_OK;
+}
+
+mangoErr_t mangoWS_frameSend(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen, mangoWsFrameType_t type){
+	uint8_t frame0[MANGO_WS_FRAME_HDR_MAX + 125];
+	uint8_t buf0[2];
+	uint8_t* frame;
+	uint32_t framelen;
+	mangoErr_t err;
+	
+    switch(type){
+        case MANGO_WS_FRAME_TYPE_CONT:
+            /* Fragmentation on the Tx path currently not supported */
+            MANGO_ENSURE_RET(0, MANGO_ERR_INTERNAL, ("?") );
+            break;
+        case MANGO_WS_FRAME_TYPE_PING:
+			MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: PING!\r\n"));
+			/* Control frames carry at most 125 bytes */
+			MANGO_ENSURE_RET(buflen <= 125, MANGO_ERR_INTERNAL, ("?") );
+            break;
+        case MANGO_WS_FRAME_TYPE_PONG:
+			MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: PONG!\r\n"));
+			MANGO_ENSURE_RET(buflen <= 125, MANGO_ERR_INTERNAL, ("?") );
+            break;
+        case MANGO_WS_FRAME_TYPE_CLOSE:
+			MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: CLOSE!\r\n"));
+			buf = buf0;
+			
+			/* Status code 1000, normal closure */
+			buf0[0] = (0x03e8 & 0xff00) >> 8;
+			buf0[1] = (0x03e8 & 0x00ff);
+			
+            buflen = 2;
+            break;
+        case MANGO_WS_FRAME_TYPE_TEXT:
+            MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: TEXT!\r\n"));
+            break;
+        case MANGO_WS_FRAME_TYPE_BINARY:
+            MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: BINARY!\r\n"));
+            break;
+        default:
+            MANGO_DBG(MANGO_DBG_LEVEL_WS, ("--------------> OPCODE: ???\r\n"));
+            break;
+    }
+    
+    if(hc->wsCoalesceBuf){
+    	if(!(type & 0x08) && buflen + MANGO_WS_FRAME_HDR_MAX <= hc->wsCoalesceSz){
+    		/* Data frame, coalesce it with the previous ones */
+    		if(hc->wsCoalesceLen + buflen + MANGO_WS_FRAME_HDR_MAX > hc->wsCoalesceSz){
+    			err = mangoWS_coalesceFlush(hc);
+    			if(err != MANGO_OK){
+    				return err;
+    			}
+    		}
+    		
+    		if(!hc->wsCoalesceLen){
+    			hc->wsCoalesceStart = mangoPort_timeNow();
+    		}
+    		hc->wsCoalesceLen += mangoWS_frameBuild(hc, &hc->wsCoalesceBuf[hc->wsCoalesceLen], buf, buflen, type);
+    		
+    		if(mangoHelper_elapsedTime(hc->wsCoalesceStart) >= hc->wsCoalesceDelay){
+    			return mangoWS_coalesceFlush(hc);
+    		}
+    		
+    		return MANGO_OK;
+    	}
+    	
+    	/* Control (or too big) frames are sent right away, keeping the order */
+    	err = mangoWS_coalesceFlush(hc);
+    	if(err != MANGO_OK){
+    		return err;
+    	}
+    }
+    
+	/*
+    * Allocate memory for the frame
+    */
+	if(type & 0x08){
+		/* Control frame */
+		frame = frame0;
+	}else{
+		frame = mangoPort_malloc(buflen + MANGO_WS_FRAME_HDR_MAX);
+		if(!frame){
+			return MANGO_ERR;
+		}
+	}
+	
+	framelen = mangoWS_frameBuild(hc, frame, buf, buflen, type);
 
 	/*
 	* Send the frame.
-	* It's a do or die here so we give a big enough timeout. 
-	* If we don't manage to send the whole frame (but only part of it)
-	* we have to abort the websocket connection.
 	*/
-	MANGO_DBG(MANGO_DBG_LEVEL_WS, ("Sending websocket frame with size %u bytes..\r\n", framelen));
-              
-    retval = mangoPort_write(socketfd, frame, framelen, MANGO_SOCKET_WRITE_TIMEOUT_MS);
-
-	MANGO_DBG(MANGO_DBG_LEVEL_WS, ("%d/%d bytes sent..\r\n", retval, framelen));
+    err = mangoWS_write(hc, frame, framelen);
 	
 	if(frame != frame0){
 		mangoPort_free(frame);
 	}
 	
-	if(retval < 0){
-		/* Connection closed */
+	return err;
+}
+
+/*
+* Sends several data frames with a single write
+*/
+mangoErr_t mangoWS_frameSendBatch(mangoHttpClient_t* hc, mangoWsFrame_t* frames, uint16_t framesCnt){
+	uint8_t* batch;
+	uint32_t batchlen;
+	uint32_t sz;
+	uint16_t i;
+	mangoErr_t err;
+	
+	sz = 0;
+	for(i = 0; i < framesCnt; i++){
+		MANGO_ENSURE_RET( (frames[i].type == MANGO_WS_FRAME_TYPE_TEXT) || (frames[i].type == MANGO_WS_FRAME_TYPE_BINARY), MANGO_ERR_INTERNAL, ("?") );
+		sz += frames[i].buflen + MANGO_WS_FRAME_HDR_MAX;
+	}
+	
+	/* Whatever was coalesced goes first */
+	if(hc->wsCoalesceBuf){
+		err = mangoWS_coalesceFlush(hc);
+		if(err != MANGO_OK){
+			return err;
+		}
+	}
+	
+	if(!framesCnt){
+		return MANGO_OK;
+	}
+	
+	batch = mangoPort_malloc(sz);
+	if(!batch){
 		return MANGO_ERR;
-	}else{
-		if(retval == framelen){
-			/* The whole frame was transmitted */
-			return MANGO_OK;
-		}else{
-			/* 
-			* None all part of the frame was transmitted. 
-			* Given the big timeout of mangoWS_frameSend() this is not normal
-			* so we have to abort the connection.
-			*/
+	}
+	
+	batchlen = 0;
+	for(i = 0; i < framesCnt; i++){
+		batchlen += mangoWS_frameBuild(hc, &batch[batchlen], frames[i].buf, frames[i].buflen, frames[i].type);
+	}
+	
+	err = mangoWS_write(hc, batch, batchlen);
+	
+	mangoPort_free(batch);
+	
+	return err;
+}
+
+
+/* -----------------------------------------------------------------------------------------------------------------
+| COALESCING
+----------------------------------------------------------------------------------------------------------------- */
+
+/*
+* When enabled [mango_wsCoalesceSet()] data frames are built into a per
+* client buffer instead of being written one by one. The buffer is
+* written when it is full, when a control frame is sent, and at the
+* latest "wsCoalesceDelay" miliseconds after its first frame (checked
+* on every send and, while polling, by the state timeout).
+*/
+
+mangoErr_t mangoWS_coalesceSet(mangoHttpClient_t* hc, uint32_t bufSz, uint32_t flushDelay){
+	mangoErr_t err;
+	
+	if(hc->wsCoalesceBuf){
+		err = mangoWS_coalesceFlush(hc);
+		if(err != MANGO_OK){
+			return err;
+		}
+		
+		mangoPort_free(hc->wsCoalesceBuf);
+		hc->wsCoalesceBuf = NULL;
+	}
+	
+	if(bufSz){
+		hc->wsCoalesceBuf = mangoPort_malloc(bufSz);
+		if(!hc->wsCoalesceBuf){
 			return MANGO_ERR;
 		}
 	}
+	
+	hc->wsCoalesceSz = bufSz;
+	hc->wsCoalesceLen = 0;
+	hc->wsCoalesceDelay = flushDelay;
+	
+	return MANGO_OK;
+}
+
+mangoErr_t mangoWS_coalesceFlush(mangoHttpClient_t* hc){
+	mangoErr_t err;
+	
+	if(!hc->wsCoalesceLen){
+		return MANGO_OK;
+	}
+	
+	err = mangoWS_write(hc, hc->wsCoalesceBuf, hc->wsCoalesceLen);
+	hc->wsCoalesceLen = 0;
+	
+	return err;
+}
+
+/*
+* Flushes the buffer if its deadline passed, "next" is set to the time
+* until the deadline of what is (still) buffered [miliseconds].
+*/
+mangoErr_t mangoWS_coalesceTimer(mangoHttpClient_t* hc, uint32_t* next){
+	uint32_t elapsed;
+	
+	*next = MANGO_TIMEOUT_INFINITE;
+	
+	if(!hc->wsCoalesceLen){
+		return MANGO_OK;
+	}
+	
+	elapsed = mangoHelper_elapsedTime(hc->wsCoalesceStart);
+	if(elapsed >= hc->wsCoalesceDelay){
+		return mangoWS_coalesceFlush(hc);
+	}
+	
+	*next = hc->wsCoalesceDelay - elapsed;
+	
+	return MANGO_OK;
+}
+
+void mangoWS_coalesceFree(mangoHttpClient_t* hc){
+	if(hc->wsCoalesceBuf){
+		mangoPort_free(hc->wsCoalesceBuf);
+		hc->wsCoalesceBuf = NULL;
+	}
+	hc->wsCoalesceLen = 0;
+}
+
+
+/* -----------------------------------------------------------------------------------------------------------------
+| OUTBOUND QUEUE
+----------------------------------------------------------------------------------------------------------------- */
+
+/*
+* Frames sent with mango_wsFrameSend() while another thread owns the client
+* (see mangoSM_TRYLOCK()) are copied to a bounded lock-free queue. Any thread
+* may push, only the lock owner pops, so the consumer side needs no CAS.
+*/
+
+#if MANGO_WS_TX_QUEUE_SZ > 0
+
+void mangoWS_queueInit(mangoHttpClient_t* hc){
+	uint32_t i;
+	
+	for(i = 0; i < MANGO_WS_TX_QUEUE_SZ; i++){
+		hc->wsTxQueue[i].seq = i;
+	}
+	
+	hc->wsTxQueueHead = 0;
+	hc->wsTxQueueTail = 0;
+	hc->wsWakeupfd = -1;
+	hc->wsTxError = MANGO_OK;
+}
+
+mangoErr_t mangoWS_queuePush(mangoHttpClient_t* hc, uint8_t* buf, uint32_t buflen, mangoWsFrameType_t type){
+	mangoWSQueueSlot_t* slot;
+	uint8_t* copy;
+	uint32_t pos;
+	int32_t diff;
+	
+	copy = mangoPort_malloc(buflen ? buflen : 1);
+	if(!copy){
+		return MANGO_ERR;
+	}
+	memcpy(copy, buf, buflen);
+	
+	pos = __atomic_load_n(&hc->wsTxQueueHead, __ATOMIC_RELAXED);
+	while(1){
+		slot = &hc->wsTxQueue[pos & (MANGO_WS_TX_QUEUE_SZ - 1)];
+		diff = (int32_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if(diff == 0){
+			/* Slot is free, try to claim it */
+			if(__atomic_compare_exchange_n(&hc->wsTxQueueHead, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+				break;
+			}
+		}else if(diff < 0){
+			/* Queue is full */
+			mangoPort_free(copy);
+			return MANGO_ERR_QUEUEFULL;
+		}else{
+			/* Another producer claimed it */
+			pos = __atomic_load_n(&hc->wsTxQueueHead, __ATOMIC_RELAXED);
+		}
+	}
+	
+	slot->buf		= copy;
+	slot->buflen	= buflen;
+	slot->type		= type;
+	
+	/* Publish the frame to the consumer */
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	
+	return MANGO_OK;
 }
+
+uint8_t mangoWS_queuePop(mangoHttpClient_t* hc, mangoWSQueueSlot_t* frame){
+	mangoWSQueueSlot_t* slot;
+	uint32_t pos;
+	
+	pos = hc->wsTxQueueTail;
+	slot = &hc->wsTxQueue[pos & (MANGO_WS_TX_QUEUE_SZ - 1)];
+	
+	if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1){
+		/* Empty */
+		return 0;
+	}
+	
+	frame->buf		= slot->buf;
+	frame->buflen	= slot->buflen;
+	frame->type		= slot->type;
+	
+	/* Give the slot back to the producers */
+	__atomic_store_n(&slot->seq, pos + MANGO_WS_TX_QUEUE_SZ, __ATOMIC_RELEASE);
+	__atomic_store_n(&hc->wsTxQueueTail, pos + 1, __ATOMIC_RELEASE);
+	
+	return 1;
+}
+
+uint8_t mangoWS_queuePending(mangoHttpClient_t* hc){
+	uint32_t pos;
+	
+	pos = __atomic_load_n(&hc->wsTxQueueTail, __ATOMIC_ACQUIRE);
+	
+	return __atomic_load_n(&hc->wsTxQueue[pos & (MANGO_WS_TX_QUEUE_SZ - 1)].seq, __ATOMIC_ACQUIRE) == pos + 1;
+}
+
+/*
+* Sends all the queued frames through the state machine. Must be called by
+* the lock owner while the state machine is idle. Frames fail if the
+* connection is not (or no longer) an open websocket, the first failure is
+* kept for mangoWS_queueError().
+*/
+void mangoWS_queueFlush(mangoHttpClient_t* hc){
+	mangoWSFrameSendArgs_t WSFrameSendArgs;
+	mangoWSQueueSlot_t frame;
+	mangoErr_t err;
+	
+	while(mangoWS_queuePop(hc, &frame)){
+		WSFrameSendArgs.buf		= frame.buf;
+		WSFrameSendArgs.buflen	= frame.buflen;
+		WSFrameSendArgs.type	= frame.type;
+		WSFrameSendArgs.batch	= 0;
+		
+		hc->smAPICallArgs = &WSFrameSendArgs;
+		err = mangoSM_RUN(hc, EVENT_APICALL_wsFrameSend);
+		if(err != MANGO_OK && hc->wsTxError == MANGO_OK){
+			hc->wsTxError = err;
+		}
+		
+		mangoPort_free(frame.buf);
+	}
+}
+
+/*
+* Returns (and clears) the first error of the queued frames sent by
+* mangoWS_queueFlush(), MANGO_OK if none failed. Lock owner only.
+*/
+mangoErr_t mangoWS_queueError(mangoHttpClient_t* hc){
+	mangoErr_t err;
+	
+	err = hc->wsTxError;
+	hc->wsTxError = MANGO_OK;
+	
+	return err;
+}
+
+void mangoWS_queueFree(mangoHttpClient_t* hc){
+	mangoWSQueueSlot_t frame;
+	
+	while(mangoWS_queuePop(hc, &frame)){
+		mangoPort_free(frame.buf);
+	}
+	
+	if(hc->wsWakeupfd >= 0){
+		mangoPort_wakeupDestroy(hc->wsWakeupfd);
+		hc->wsWakeupfd = -1;
+	}
+}
+
+/*
+* Called by a producer after queueing a frame, so that a thread
+* blocked in mango_wsPoll() sends it right away.
+*/
+void mangoWS_queueWakeup(mangoHttpClient_t* hc){
+	int wakeupfd;
+	
+	wakeupfd = __atomic_load_n(&hc->wsWakeupfd, __ATOMIC_ACQUIRE);
+	if(wakeupfd >= 0){
+		mangoPort_wakeupSignal(wakeupfd);
+	}
+}
+
+#endif